@@ -0,0 +1,293 @@
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+#include "Lightning/Benchmarking.h"
+
+using namespace lightning;
+using namespace lightning::benchmarking;
+
+namespace {
+
+void PrintUsage(const char* program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "\n"
+            << "Run the Lightning benchmarks, reporting throughput with 95% confidence intervals and per-call\n"
+            << "latency percentiles.\n"
+            << "  --filter <text>        Only run benchmarks whose name contains the text.\n"
+            << "  --iterations <n>       Calls per repetition, per thread (default 100000).\n"
+            << "  --repetitions <n>      Throughput measurements per benchmark (default 5).\n"
+            << "  --latency-samples <n>  Individually timed calls, per thread (default 50000).\n"
+            << "  --max-threads <n>      Largest thread count for the multi-threaded benchmarks (default 8).\n"
+            << "  --perf                 Read cycles, instructions, and cache misses (Linux).\n"
+            << "  --json <file>          Also write the results as JSON.\n"
+            << "  --figure-dir <dir>     Write throughput vs. threads figure data, for make_figure.py.\n";
+}
+
+auto MakeHeaderFormatter() {
+  return formatting::MakeMsgFormatter("[{}] [{}] [{}] {}",
+                                      formatting::DateTimeAttributeFormatter {},
+                                      formatting::LoggerNameAttributeFormatter {},
+                                      formatting::SeverityAttributeFormatter {},
+                                      formatting::MSG);
+}
+
+//! \brief Collects the results of the benchmarks that pass the filter, printing each as it finishes.
+class Runner {
+public:
+  Runner(Options options, std::string filter)
+      : options_(options)
+      , filter_(std::move(filter)) {}
+
+  template<typename Body_t>
+  void Run(const std::string& name, std::size_t threads, Body_t&& body) {
+    if (name.find(filter_) == std::string::npos) {
+      return;
+    }
+    results_.push_back(benchmarking::Run(name, threads, options_, std::forward<Body_t>(body)));
+    WriteTable(std::cout, {results_.back()});
+  }
+
+  template<typename Body_t>
+  void Run(const std::string& name, Body_t&& body) {
+    Run(name, 1, std::forward<Body_t>(body));
+  }
+
+  NO_DISCARD const std::vector<Result>& GetResults() const { return results_; }
+
+private:
+  Options options_;
+  std::string filter_;
+  std::vector<Result> results_;
+};
+
+void BenchFormatters(Runner& runner) {
+  Record record;
+  record.Attributes().basic_attributes.level = Severity::Info;
+  record.Attributes().basic_attributes.logger_name = "basic_st/backtrace-off";
+  record.Attributes().basic_attributes.time_stamp = time::DateTime::Now();
+  record.Bundle() << "Hello, world!";
+  FormattingSettings settings;
+  memory::MemoryBuffer<char> buffer;
+
+  formatting::RecordFormatter record_formatter;
+  record_formatter.ClearSegments()
+      .AddLiteralSegment("[")
+      .AddAttributeFormatter(std::make_shared<formatting::DateTimeAttributeFormatter>())
+      .AddLiteralSegment("] [")
+      .AddAttributeFormatter(std::make_shared<formatting::LoggerNameAttributeFormatter>())
+      .AddLiteralSegment("] [")
+      .AddAttributeFormatter(std::make_shared<formatting::SeverityAttributeFormatter>())
+      .AddLiteralSegment("] ")
+      .AddMsgSegment();
+  runner.Run("format/RecordFormatter", [&](std::size_t) {
+    buffer.Clear();
+    record_formatter.Format(record, settings, buffer);
+  });
+
+  auto msg_formatter = MakeHeaderFormatter();
+  runner.Run("format/MsgFormatter", [&](std::size_t) {
+    buffer.Clear();
+    msg_formatter->Format(record, settings, buffer);
+  });
+
+  formatting::FormatterBySeverity by_severity;
+  by_severity.SetDefaultFormatter(*MakeHeaderFormatter())
+      .SetFormatterForSeverity(Severity::Info, *formatting::MakeMsgFormatter("{}", formatting::MSG));
+  runner.Run("format/FormatterBySeverity", [&](std::size_t) {
+    buffer.Clear();
+    by_severity.Format(record, settings, buffer);
+  });
+}
+
+void BenchLogging(Runner& runner, std::size_t max_threads) {
+  {
+    auto sink = NewSink<FileSink, UnlockedSink>("logs/benchmark_nonaccepting.log");
+    sink->GetFilter().Accept({Severity::Error});
+    sink->SetFormatter(MakeHeaderFormatter());
+    Logger logger(sink);
+    runner.Run("log/non-accepting",
+               [&](std::size_t i) { LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i; });
+  }
+  {
+    auto sink = NewSink<FileSink, UnlockedSink>("logs/benchmark_st.log");
+    sink->SetFormatter(MakeHeaderFormatter());
+    Logger logger(sink);
+    logger.SetName("benchmark_st");
+    runner.Run("log/file", [&](std::size_t i) { LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i; });
+  }
+  {
+    // Several sinks with different headers, which share the formatted message.
+    Logger logger;
+    logger.SetName("benchmark_three_sinks");
+    for (auto i = 0; i < 3; ++i) {
+      auto sink = NewSink<TrivialDispatchSink, UnlockedSink>();
+      sink->SetFormatter(i == 0 ? MakeHeaderFormatter() : formatting::MakeMsgFormatter("{}", formatting::MSG));
+      logger.GetCore()->AddSink(sink);
+    }
+    runner.Run("log/three sinks", [&](std::size_t i) {
+      LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i << ", value " << 1.2345 << ", and some text";
+    });
+  }
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    // A hot call site that is sampled, so almost every message is suppressed before a record is made.
+    auto sink = NewSink<FileSink, SynchronousSink>("logs/benchmark_sampled.log");
+    sink->SetFormatter(MakeHeaderFormatter());
+    Logger logger(sink);
+    runner.Run("log/file, every 1000th, synchronous sink", threads, [&](std::size_t i) {
+      LOG_EVERY_N_TO(logger, Info, 1000) << "Hello logger: msg number " << i;
+    });
+  }
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    auto sink = NewSink<FileSink, SynchronousSink>("logs/benchmark_mt.log");
+    sink->SetFormatter(MakeHeaderFormatter());
+    Logger logger(sink);
+    logger.SetName("benchmark_mt");
+    runner.Run("log/file, synchronous sink", threads, [&](std::size_t i) {
+      LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i;
+    });
+  }
+  // Every thread logs through one core to a sink that does no I/O, so what is left is contention on the core.
+  // The second benchmark also copies the core's shared pointer per record, like records used to, to show what
+  // the reference count traffic costs as threads are added.
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    Logger logger(NewSink<TrivialDispatchSink, UnlockedSink>());
+    runner.Run("contention/shared core", threads, [&](std::size_t i) {
+      RecordDispatcher(logger.GetCore(), BasicAttributes(Severity::Info)) << "Hello logger: msg number " << i;
+    });
+    runner.Run("contention/shared core, core refcount per record", threads, [&](std::size_t i) {
+      const std::shared_ptr<Core> core = logger.GetCore();
+      RecordDispatcher(core, BasicAttributes(Severity::Info)) << "Hello logger: msg number " << i;
+    });
+  }
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    auto sink = NewSink<FileSink, AsyncSink>("logs/benchmark_mt_async.log");
+    sink->SetFormatter(MakeHeaderFormatter());
+    Logger logger(sink);
+    logger.SetName("benchmark_mt_async");
+    runner.Run("log/file, async sink", threads, [&](std::size_t i) {
+      LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i;
+    });
+    logger.Flush();
+  }
+}
+
+void BenchSegments(Runner& runner) {
+  FormattingSettings settings;
+  formatting::MessageInfo msg_info {};
+  memory::MemoryBuffer<char> buffer;
+
+  Segment<int> int_segment(4869244);
+  runner.Run("segment/int", [&](std::size_t) {
+    buffer.Clear();
+    int_segment.AddToBuffer(settings, msg_info, buffer);
+  });
+  Segment<double> double_segment(1.2345);
+  runner.Run("segment/double", [&](std::size_t) {
+    buffer.Clear();
+    double_segment.AddToBuffer(settings, msg_info, buffer);
+  });
+  runner.Run("segment/FormatTo", [&](std::size_t i) {
+    buffer.Clear();
+    formatting::FormatTo(buffer, settings, "{@GREEN}Value{@RESET} {} of {:L} is {}.", i, 4869244, 1.2345);
+  });
+  runner.Run("segment/FormatTo, compiled", [&](std::size_t i) {
+    buffer.Clear();
+    formatting::FormatTo(buffer, settings, LL_FMT("{@GREEN}Value{@RESET} {} of {:L} is {}."), i, 4869244, 1.2345);
+  });
+}
+
+void BenchDateTime(Runner& runner, std::size_t max_threads) {
+  runner.Run("datetime/DateTime::Now", [](std::size_t) { [[maybe_unused]] auto dt = time::DateTime::Now(); });
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    runner.Run("datetime/TimeSource", threads, [](std::size_t) {
+      [[maybe_unused]] auto dt = time::TimeSource::Global().Now();
+    });
+  }
+
+  RecordAttributes attributes;
+  attributes.basic_attributes.time_stamp = time::DateTime::Now();
+  formatting::DateTimeAttributeFormatter formatter;
+  FormattingSettings settings;
+  memory::MemoryBuffer<char> buffer;
+  runner.Run("datetime/DateTimeAttributeFormatter", [&](std::size_t) {
+    buffer.Clear();
+    formatter.AddToBuffer(attributes, settings, {}, buffer);
+  });
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  std::string filter, json_path, figure_dir;
+  std::size_t max_threads = 8;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next_number = [&]() -> std::size_t { return i + 1 < argc ? std::stoul(argv[++i]) : 0; };
+    if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    }
+    else if (arg == "--iterations") {
+      options.iterations = next_number();
+    }
+    else if (arg == "--repetitions") {
+      options.repetitions = next_number();
+    }
+    else if (arg == "--latency-samples") {
+      options.latency_samples = next_number();
+    }
+    else if (arg == "--max-threads") {
+      max_threads = std::max<std::size_t>(next_number(), 1);
+    }
+    else if (arg == "--perf") {
+      options.perf_counters = true;
+    }
+    else if (arg == "--json" && i + 1 < argc) {
+      json_path = argv[++i];
+    }
+    else if (arg == "--figure-dir" && i + 1 < argc) {
+      figure_dir = argv[++i];
+    }
+    else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (options.perf_counters && !PerfCounters {}.IsAvailable()) {
+    std::cerr << "Hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid).\n";
+    options.perf_counters = false;
+  }
+  // Keep the warm up proportional for short runs.
+  options.warmup_iterations = std::min(options.warmup_iterations, options.iterations);
+
+  std::filesystem::create_directories("logs");
+  Runner runner(options, filter);
+  BenchFormatters(runner);
+  BenchLogging(runner, max_threads);
+  BenchSegments(runner);
+  BenchDateTime(runner, max_threads);
+
+  std::cout << "\n";
+  WriteTable(std::cout, runner.GetResults());
+
+  if (!json_path.empty()) {
+    std::ofstream fout(json_path);
+    WriteJson(fout, runner.GetResults());
+  }
+  if (!figure_dir.empty()) {
+    std::filesystem::create_directories(figure_dir);
+    // Only the logging benchmarks that were run on several thread counts.
+    std::vector<Result> scaling;
+    for (auto& result : runner.GetResults()) {
+      if (result.name.rfind("log/file, ", 0) == 0) {
+        scaling.push_back(result);
+      }
+    }
+    MatplotlibSerializingFigure figure(8, 6, figure_dir);
+    figure.SetTitle("Throughput vs. threads");
+    PlotThroughputVsThreads(figure, scaling);
+    figure.SaveFigure("throughput-vs-threads.png");
+  }
+  return 0;
+}
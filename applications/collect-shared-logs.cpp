@@ -0,0 +1,145 @@
+#include <csignal>
+#include <iostream>
+
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+
+namespace {
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void RequestStop(int) {
+  stop_requested = 1;
+}
+
+void PrintUsage(const char* program) {
+  std::cerr << "Usage: " << program << " <segment name> <output file> [options]\n"
+            << "\n"
+            << "Collect the records that SharedMemorySinks in other processes write to a shared memory\n"
+            << "segment, merging them by time stamp into one file, until interrupted.\n"
+            << "  --rings N        The number of rings in the segment (default: 16).\n"
+            << "  --capacity N     The size of each ring, in bytes (default: 4194304).\n"
+            << "  --compress CODEC Compress the file with gzip, lz4 or zstd, if it was compiled in.\n"
+            << "  --hold-back MS   How long to hold records back for slower producers (default: 10).\n"
+            << "  --remove         Remove the segment's name on exit.\n";
+}
+
+std::optional<Compression> ParseCompression(std::string_view name) {
+  if (name == "gzip") {
+    return Compression::Gzip;
+  }
+  if (name == "lz4") {
+    return Compression::Lz4;
+  }
+  if (name == "zstd") {
+    return Compression::Zstd;
+  }
+  return {};
+}
+
+//! \brief Write what changed about the rings to stderr: new producers, restarts, and dropped records.
+void ReportRings(const std::vector<SharedMemoryCollector::RingStats>& stats,
+                 std::vector<SharedMemoryCollector::RingStats>& reported) {
+  for (std::size_t index = 0; index < stats.size(); ++index) {
+    auto& now = stats[index];
+    auto& before = reported[index];
+    if (now.generation != before.generation && now.owner_pid != 0) {
+      const auto what = before.owner_pid == 0 ? "producer " : "producer restarted as ";
+      std::cerr << "Ring " << index << ": " << what << now.owner_pid << "\n";
+    }
+    if (now.dropped != before.dropped) {
+      std::cerr << "Ring " << index << ": " << now.dropped - before.dropped << " records dropped ("
+                << now.dropped << " in total)\n";
+    }
+    before = now;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* segment_name = nullptr;
+  const char* file_path = nullptr;
+  std::uint32_t ring_count = 16;
+  std::uint64_t ring_capacity = 4 * 1024 * 1024;
+  std::optional<Compression> compression;
+  std::chrono::milliseconds hold_back(10);
+  bool remove = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--rings" && i + 1 < argc) {
+      ring_count = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+    }
+    else if (arg == "--capacity" && i + 1 < argc) {
+      ring_capacity = std::stoull(argv[++i]);
+    }
+    else if (arg == "--compress" && i + 1 < argc) {
+      if (!(compression = ParseCompression(argv[++i]))) {
+        PrintUsage(argv[0]);
+        return 1;
+      }
+    }
+    else if (arg == "--hold-back" && i + 1 < argc) {
+      hold_back = std::chrono::milliseconds(std::stoll(argv[++i]));
+    }
+    else if (arg == "--remove") {
+      remove = true;
+    }
+    else if (!segment_name && !arg.empty() && arg[0] != '-') {
+      segment_name = argv[i];
+    }
+    else if (!file_path && !arg.empty() && arg[0] != '-') {
+      file_path = argv[i];
+    }
+    else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (!segment_name || !file_path) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  std::signal(SIGINT, RequestStop);
+  std::signal(SIGTERM, RequestStop);
+
+  try {
+    SharedMemoryCollector collector(segment_name, ring_count, ring_capacity);
+    std::unique_ptr<SinkBackend> sink;
+    if (compression) {
+      sink = std::make_unique<CompressedFileSink>(file_path, *compression);
+    }
+    else {
+      sink = std::make_unique<FastFileSink>(file_path);
+    }
+
+    memory::MemoryBuffer<char> buffer;
+    const Record record;
+    auto write = [&](std::int64_t, std::string_view text) {
+      buffer.Clear();
+      buffer.Append(text.data(), text.data() + text.size());
+      sink->Dispatch(buffer, record);
+    };
+    std::vector<SharedMemoryCollector::RingStats> reported(ring_count);
+    while (!stop_requested) {
+      if (collector.Poll(write, hold_back) == 0) {
+        sink->Flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      ReportRings(collector.GetRingStats(), reported);
+    }
+    // Nobody is waiting for the records that were held back any more.
+    collector.Poll(write);
+    sink->Flush();
+    ReportRings(collector.GetRingStats(), reported);
+  } catch (const std::exception& ex) {
+    std::cerr << "Error collecting from '" << segment_name << "': " << ex.what() << "\n";
+    return 1;
+  }
+  if (remove) {
+    ipc::Segment::Remove(segment_name);
+  }
+  return 0;
+}
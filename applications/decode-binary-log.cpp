@@ -0,0 +1,76 @@
+#include <iostream>
+
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+
+namespace {
+
+void PrintUsage(const char* program) {
+  std::cerr << "Usage: " << program << " <binary log file> [--style standard|full|message] [--color]\n"
+            << "\n"
+            << "Decode a file written by a BinaryFileSink back into text, writing it to stdout.\n"
+            << "  --style  Which attributes to print with each message (default: standard).\n"
+            << "  --color  Keep ANSI color codes in the messages.\n";
+}
+
+std::unique_ptr<formatting::BaseMessageFormatter> MakeFormatter(std::string_view style) {
+  using namespace formatting;
+  if (style == "standard") {
+    return MakeStandardFormatter();
+  }
+  if (style == "full") {
+    return MakeMsgFormatter("[{}] [{}] [{}] [{}] [{}:{}] {}",
+                            SeverityAttributeFormatter {},
+                            DateTimeAttributeFormatter {},
+                            ThreadAttributeFormatter {},
+                            LoggerNameAttributeFormatter {},
+                            FileNameAttributeFormatter {true},
+                            FileLineAttributeFormatter {},
+                            MSG);
+  }
+  if (style == "message") {
+    return MakeMsgFormatter("{}", MSG);
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* file_path = nullptr;
+  std::string_view style = "standard";
+  FormattingSettings settings;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--style" && i + 1 < argc) {
+      style = argv[++i];
+    }
+    else if (arg == "--color") {
+      settings.has_virtual_terminal_processing = true;
+    }
+    else if (!file_path && !arg.empty() && arg[0] != '-') {
+      file_path = argv[i];
+    }
+    else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  auto formatter = MakeFormatter(style);
+  if (!file_path || !formatter) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  try {
+    BinaryLogReader reader(file_path);
+    reader.DecodeTo(std::cout, *formatter, settings);
+  } catch (const std::exception& ex) {
+    std::cout.flush();
+    std::cerr << "Error decoding '" << file_path << "': " << ex.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <iostream>
+
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+
+namespace {
+
+void PrintUsage(const char* program) {
+  std::cerr << "Usage: " << program << " <binary log file>... [--style standard|full|message] [--color]\n"
+            << "\n"
+            << "Merge files written by BinaryFileSinks, e.g. the files of a ShardedFileSink, into one\n"
+            << "log in time stamp order, writing it as text to stdout.\n"
+            << "  --style  Which attributes to print with each message (default: standard).\n"
+            << "  --color  Keep ANSI color codes in the messages.\n";
+}
+
+std::unique_ptr<formatting::BaseMessageFormatter> MakeFormatter(std::string_view style) {
+  using namespace formatting;
+  if (style == "standard") {
+    return MakeStandardFormatter();
+  }
+  if (style == "full") {
+    return MakeMsgFormatter("[{}] [{}] [{}] [{}] [{}:{}] {}",
+                            SeverityAttributeFormatter {},
+                            DateTimeAttributeFormatter {},
+                            ThreadAttributeFormatter {},
+                            LoggerNameAttributeFormatter {},
+                            FileNameAttributeFormatter {true},
+                            FileLineAttributeFormatter {},
+                            MSG);
+  }
+  if (style == "message") {
+    return MakeMsgFormatter("{}", MSG);
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::string> file_paths;
+  std::string_view style = "standard";
+  FormattingSettings settings;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--style" && i + 1 < argc) {
+      style = argv[++i];
+    }
+    else if (arg == "--color") {
+      settings.has_virtual_terminal_processing = true;
+    }
+    else if (!arg.empty() && arg[0] != '-') {
+      file_paths.emplace_back(arg);
+    }
+    else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  auto formatter = MakeFormatter(style);
+  if (file_paths.empty() || !formatter) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  try {
+    memory::MemoryBuffer<char> buffer;
+    MergeBinaryLogs(file_paths, [&](const Record& record) {
+      buffer.Clear();
+      formatter->Format(record, settings, buffer);
+      std::cout.write(buffer.Data(), static_cast<std::streamsize>(buffer.Size()));
+    });
+  } catch (const std::exception& ex) {
+    std::cout.flush();
+    std::cerr << "Error merging: " << ex.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
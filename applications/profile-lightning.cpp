@@ -54,8 +54,12 @@ void bench_segments(int howmany);
 
 void bench_fmtdatetime(int howmany);
 
+void bench_simd(int howmany);
+
 void bench_mt(int howmany, std::size_t thread_count);
 
+void bench_mt_async(int howmany);
+
 auto main() -> int {
   // Set up global logger.
   Global::GetCore()->AddSink(NewSink<StdoutSink>())
@@ -122,12 +126,24 @@ auto main() -> int {
   bench_fmtdatetime(iters);
   LOG_SEV(Info) << RepeatChar(header_length, '*') << "\n";
 
+  LOG_SEV(Info) << RepeatChar(header_length, '*');
+  LOG_SEV(Info) << "String kernels, 4 KiB strings";
+  LOG_SEV(Info) << RepeatChar(header_length, '*');
+  bench_simd(iters / 10);
+  LOG_SEV(Info) << RepeatChar(header_length, '*') << "\n";
+
   LOG_SEV(Info) << RepeatChar(header_length, '*');
   LOG_SEV(Info) << formatting::Format("Multi threaded ({}) threads): {:L} messages", num_threads, iters);
   LOG_SEV(Info) << RepeatChar(header_length, '*');
   bench_mt(iters, num_threads);
   LOG_SEV(Info) << RepeatChar(header_length, '*') << "\n";
 
+  LOG_SEV(Info) << RepeatChar(header_length, '*');
+  LOG_SEV(Info) << formatting::Format("Multi threaded, synchronous vs. async sink: {:L} messages", iters);
+  LOG_SEV(Info) << RepeatChar(header_length, '*');
+  bench_mt_async(iters);
+  LOG_SEV(Info) << RepeatChar(header_length, '*') << "\n";
+
   return 0;
 }
 
@@ -187,6 +203,52 @@ void bench_st(int howmany) {
                   << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
   }
 
+#if LL_HAS_POSIX
+  {  // Benchmark using MsgFormatter, writing with a FastFileSink
+    ++count;
+    std::string file_name = formatting::Format("logs/lightning_basic_st-{}.log", count);
+    std::filesystem::remove(file_name);
+    auto fs = NewSink<FastFileSink, UnlockedSink>(file_name);
+    Logger logger(fs);
+    logger.SetName("basic_st/backtrace-off");
+    logger.GetCore()->SetSynchronousMode(false); // We do not need synchronous mode.
+    fs->SetFormatter(MakeMsgFormatter("[{}] [{}] [{}] {}",
+                                      formatting::DateTimeAttributeFormatter{},
+                                      formatting::LoggerNameAttributeFormatter{},
+                                      formatting::SeverityAttributeFormatter{},
+                                      formatting::MSG));
+
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i;
+    }
+    logger.Flush();
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    LOG_SEV(Info) << "MsgFormatter, FastFileSink:" << PadUntil(pad_width) << "Elapsed: " << delta_d << " secs "
+                  << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+  }
+
+  {  // Benchmark using MsgFormatter, writing with a MmapRotatingFileSink
+    auto fs = NewSink<MmapRotatingFileSink, UnlockedSink>("logs/lightning_basic_st-mmap");
+    Logger logger(fs);
+    logger.SetName("basic_st/backtrace-off");
+    logger.GetCore()->SetSynchronousMode(false); // We do not need synchronous mode.
+    fs->SetFormatter(MakeMsgFormatter("[{}] [{}] [{}] {}",
+                                      formatting::DateTimeAttributeFormatter{},
+                                      formatting::LoggerNameAttributeFormatter{},
+                                      formatting::SeverityAttributeFormatter{},
+                                      formatting::MSG));
+
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i;
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    LOG_SEV(Info) << "MsgFormatter, MmapRotatingFileSink:" << PadUntil(pad_width) << "Elapsed: " << delta_d
+                  << " secs " << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+  }
+#endif  // LL_HAS_POSIX
+
   {  // Benchmark using FormatterBySeverity
     ++count;
     auto [fs, file_name] = make_sink();
@@ -660,6 +722,28 @@ void bench_st_types(int howmany) {
                   << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
   }
 
+  // Heap allocated segments, with and without the thread's arena.
+  for (auto use_arena : {false, true}) {
+    auto logger = make_logger();
+    logger.GetCore()->SetArenaAllocation(use_arena);
+    auto& arena = memory::ThreadArena::Local();
+    arena.ResetCounters();
+    const std::string long_string = "A string that is too long for the small string optimization";
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      LOG_SEV_TO(logger, Info) << std::string(long_string) << " "
+                               << AnsiColor8Bit(i, formatting::AnsiForegroundColor::Blue) << " 1 " << 2 << " 3 "
+                               << 4 << " 5 " << 6 << " 7 " << 8;
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    LOG_SEV(Info) << (use_arena ? "Allocating segments, arena:" : "Allocating segments, heap:") << PadUntil(pad_width)
+                  << "Elapsed: " << delta_d << " secs "
+                  << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d))
+                  << formatting::Format(" (arena: {:L} B, heap: {:L} B)",
+                                        static_cast<long long>(arena.GetArenaBytes()),
+                                        static_cast<long long>(arena.GetHeapBytes()));
+  }
+
   // Exception
   {
     auto logger = make_logger();
@@ -737,6 +821,47 @@ void bench_nonaccepting(int howmany) {
     LOG_SEV(Info) << "No core:" << PadUntil(pad_width) << "Elapsed: " << delta_d << " secs "
                   << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
   }
+  {
+    // Rejected messages with the core in synchronous mode. The rejection should not touch the core's lock.
+    auto fs = NewSink<FileSink>("logs/lightning_basic_st_nonaccepting_sync.log");
+    fs->GetFilter().Accept({Severity::Error});
+    Logger logger(fs);
+
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i;
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+
+    LOG_SEV(Info) << "Nonaccepting sink, synchronous core:" << PadUntil(pad_width) << "Elapsed: " << delta_d
+                  << " secs " << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+  }
+  for (std::size_t thread_count : std::initializer_list<std::size_t> {2, 4, 8}) {
+    // Contended case: many threads checking the same synchronous core. Each thread rejects howmany messages.
+    auto fs = NewSink<FileSink>("logs/lightning_basic_mt_nonaccepting.log");
+    fs->GetFilter().Accept({Severity::Error});
+    Logger logger(fs);
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    auto start = high_resolution_clock::now();
+    for (std::size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&]() {
+        for (auto i = 0; i < howmany; ++i) {
+          LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << i;
+        }
+      });
+    }
+    for (auto& t: threads) {
+      t.join();
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+
+    const auto total = static_cast<double>(howmany) * static_cast<double>(thread_count);
+    LOG_SEV(Info) << formatting::Format("Nonaccepting sink, {} threads:", thread_count) << PadUntil(pad_width)
+                  << "Elapsed: " << delta_d << " secs "
+                  << formatting::Format("{:L}/sec", static_cast<long long>(total / delta_d));
+  }
 }
 
 void bench_datetime(int howmany) {
@@ -764,6 +889,37 @@ void bench_datetime(int howmany) {
     LOG_SEV(Info) << "Fast datetime generator:" << PadUntil(pad_width) << "Elapsed: " << delta_d << " secs "
                   << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
   }
+  const std::pair<time::ClockSource, std::string_view> clocks[] = {{time::ClockSource::System, "system"},
+                                                                   {time::ClockSource::RealtimeCoarse, "coarse"},
+                                                                   {time::ClockSource::Tsc, "TSC"}};
+  for (auto thread_count : {1u, 4u}) {
+    for (auto [clock, clock_name] : clocks) {
+      if (!time::TimeSource::IsAvailable(clock)) {
+        LOG_SEV(Info) << "Time source, " << clock_name << " clock:" << PadUntil(pad_width) << "Not available";
+        continue;
+      }
+      time::TimeSource source(clock);
+
+      std::vector<std::thread> threads;
+      auto start = high_resolution_clock::now();
+      for (auto t = 0u; t < thread_count; ++t) {
+        threads.emplace_back([&source, howmany] {
+          for (auto i = 0; i < howmany; ++i) {
+            [[maybe_unused]] auto dt = source.Now();
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+
+      const auto total = static_cast<double>(howmany) * thread_count;
+      LOG_SEV(Info) << formatting::Format("Time source, {} clock, {} threads:", clock_name, thread_count)
+                    << PadUntil(pad_width) << "Elapsed: " << delta_d << " secs "
+                    << formatting::Format("{:L}/sec", static_cast<long long>(total / delta_d));
+    }
+  }
   {
     auto start = high_resolution_clock::now();
     for (auto i = 0; i < howmany; ++i) {
@@ -906,6 +1062,32 @@ void bench_segments(int howmany) {
                   << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
   }
 
+  {
+    memory::MemoryBuffer<char> buffer;
+    FormattingSettings settings;
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      buffer.Clear();
+      formatting::FormatTo(buffer, settings, "{@GREEN}Value{@RESET} {} of {:L} is {}.", i, 4869244, 1.2345);
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    LOG_SEV(Info) << "FormatTo:" << PadUntil(pad_width) << "Elapsed: " << delta_d << " secs "
+                  << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+  }
+
+  {
+    memory::MemoryBuffer<char> buffer;
+    FormattingSettings settings;
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      buffer.Clear();
+      formatting::FormatTo(buffer, settings, LL_FMT("{@GREEN}Value{@RESET} {} of {:L} is {}."), i, 4869244, 1.2345);
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    LOG_SEV(Info) << "FormatTo, compiled format string:" << PadUntil(pad_width) << "Elapsed: " << delta_d << " secs "
+                  << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+  }
+
   {
     std::string buffer(7, ' ');
     auto start = high_resolution_clock::now();
@@ -964,6 +1146,119 @@ void bench_fmtdatetime(int howmany) {
     LOG_SEV(Info) << "Lightning FormatDateTo:" << PadUntil(pad_width) << "Elapsed: " << delta_d << " secs "
                   << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
   }
+
+  // The attribute formatter caches the text of the current second, so only the sub-second digits change.
+  const std::pair<formatting::DateTimeLayout, std::string_view> layouts[] = {
+      {formatting::DateTimeLayout::Standard, "standard"},
+      {formatting::DateTimeLayout::Iso8601, "ISO-8601"},
+      {formatting::DateTimeLayout::Milliseconds, "milliseconds"},
+      {formatting::DateTimeLayout::EpochMicroseconds, "epoch micros"}};
+  for (auto [layout, layout_name] : layouts) {
+    formatting::DateTimeAttributeFormatter formatter(layout);
+    RecordAttributes attributes;
+    FormattingSettings settings;
+    memory::MemoryBuffer<char> buffer;
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      buffer.Clear();
+      attributes.basic_attributes.time_stamp = time::AddMicroseconds(x, static_cast<unsigned long long>(i));
+      formatter.AddToBuffer(attributes, settings, {}, buffer);
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    LOG_SEV(Info) << formatting::Format("Cached DateTime formatter, {}:", layout_name)
+                  << PadUntil(pad_width) << "Elapsed: " << delta_d << " secs "
+                  << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+  }
+  {
+    // The same time stamps, without the cache, for comparison.
+    RecordAttributes attributes;
+    memory::MemoryBuffer<char> buffer;
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      buffer.Clear();
+      attributes.basic_attributes.time_stamp = time::AddMicroseconds(x, static_cast<unsigned long long>(i));
+      auto [begin, end] = buffer.Allocate(26);
+      formatting::FormatDateTo(begin, end, *attributes.basic_attributes.time_stamp);
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    LOG_SEV(Info) << "Uncached FormatDateTo, same time stamps:" << PadUntil(pad_width) << "Elapsed: " << delta_d
+                  << " secs " << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+  }
+}
+
+void bench_simd(int howmany) {
+  // A multi-line exception dump, the kind of text that NewLineIndent and {:?} see.
+  std::string text;
+  while (text.size() < 4096) {
+    text += formatting::SetAnsiColorFmt(formatting::AnsiForegroundColor::Yellow)
+            + "    at lightning::Logger::dispatch(lightning::Record&) (Lightning.h:4242), a \"quoted\" value"
+            + formatting::AnsiReset() + "\n";
+  }
+  const auto begin = text.data(), end = text.data() + text.size();
+  auto report = [howmany](std::string_view name, std::string_view isa_name, double delta_d) {
+    LOG_SEV(Info) << formatting::Format("{}, {}:", name, isa_name) << PadUntil(pad_width)
+                  << "Elapsed: " << delta_d << " secs "
+                  << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+  };
+
+  {
+    // The original byte by byte state machine, for comparison.
+    unsigned count = 0;
+    auto start = high_resolution_clock::now();
+    for (auto i = 0; i < howmany; ++i) {
+      bool in_escape = false;
+      for (auto it = begin; it != end; ++it) {
+        in_escape |= *it == '\x1b';
+        count += !in_escape;
+        in_escape &= *it != 'm';
+      }
+    }
+    auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    report("Count non-ANSI characters", count ? "byte by byte" : "", delta_d);
+  }
+
+  const std::pair<simd::Isa, std::string_view> isas[] = {
+      {simd::Isa::Scalar, "scalar"},
+      {simd::Isa::SSE2, "SSE2"},
+      {simd::Isa::AVX2, "AVX2"},
+      {simd::Isa::NEON, "NEON"}};
+  const auto original_isa = simd::GetIsa();
+  for (auto [isa, isa_name] : isas) {
+    if (!simd::IsSupported(isa)) {
+      continue;
+    }
+    simd::SetIsa(isa);
+    {
+      unsigned count = 0;
+      auto start = high_resolution_clock::now();
+      for (auto i = 0; i < howmany; ++i) {
+        count += formatting::CountNonAnsiSequenceCharacters(begin, end);
+      }
+      auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+      report("Count non-ANSI characters", count ? isa_name : "", delta_d);
+    }
+    {
+      std::size_t total = 0;
+      auto start = high_resolution_clock::now();
+      for (auto i = 0; i < howmany; ++i) {
+        // There is no '#' in the text, so the whole string is scanned.
+        total += static_cast<std::size_t>(simd::FindLastByte(begin, end, '#') - begin);
+      }
+      auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+      report("Reverse byte search", total ? isa_name : "", delta_d);
+    }
+    {
+      memory::MemoryBuffer<char> buffer;
+      auto start = high_resolution_clock::now();
+      for (auto i = 0; i < howmany; ++i) {
+        buffer.Clear();
+        formatting::detail::formatDebugString(text, buffer);
+      }
+      auto delta_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+      report("Debug string escaping", isa_name, delta_d);
+    }
+  }
+  simd::SetIsa(original_isa);
 }
 
 void bench_mt(int howmany, std::size_t thread_count) {
@@ -1059,3 +1354,56 @@ void bench_mt(int howmany, std::size_t thread_count) {
                   << " secs " << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
   }
 }
+
+void bench_mt_async(int howmany) {
+  // Run the same workload through a synchronous sink and an async sink. For the async sink, the time at which
+  // the logging threads are done and the time at which the queue has been drained to the file are both
+  // reported, since the first is what the logging threads see, and the second is the sustained throughput.
+  auto run = [howmany](const std::shared_ptr<Sink>& sink, std::size_t thread_count) {
+    Logger logger(sink);
+    logger.GetCore()->SetSynchronousMode(false);
+    sink->SetFormatter(formatting::MakeMsgFormatter("[{}] [{}] {}",
+                                                    formatting::DateTimeAttributeFormatter{},
+                                                    formatting::SeverityAttributeFormatter{},
+                                                    formatting::MSG));
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    auto start = high_resolution_clock::now();
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&]() {
+        for (int j = 0; j < howmany / static_cast<int>(thread_count); ++j) {
+          LOG_SEV_TO(logger, Info) << "Hello logger: msg number " << j;
+        }
+      });
+    }
+    for (auto& t: threads) {
+      t.join();
+    }
+    auto logged_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    logger.Flush();
+    auto drained_d = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    return std::pair{logged_d, drained_d};
+  };
+
+  for (std::size_t thread_count : std::initializer_list<std::size_t> {1, 2, 4, 8, 16, 32}) {
+    {
+      auto sink = SynchronousSink::From<FileSink>("logs/lightning_mt_sync.log");
+      auto [delta_d, _] = run(sink, thread_count);
+      LOG_SEV(Info) << formatting::Format("Synchronous sink, {} threads:", thread_count) << PadUntil(pad_width)
+                    << "Elapsed: " << delta_d << " secs "
+                    << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d));
+    }
+    {
+      auto sink = AsyncSink::From<FileSink>("logs/lightning_mt_async.log");
+      auto [delta_d, drained_d] = run(sink, thread_count);
+      LOG_SEV(Info) << formatting::Format("Async sink, {} threads:", thread_count) << PadUntil(pad_width)
+                    << "Elapsed: " << delta_d << " secs "
+                    << formatting::Format("{:L}/sec", static_cast<int>(howmany / delta_d))
+                    << formatting::Format(" (drained after {} secs, {:L}/sec, {} dropped)",
+                                          drained_d,
+                                          static_cast<int>(howmany / drained_d),
+                                          sink->GetDroppedCount());
+    }
+  }
+}
@@ -0,0 +1,21 @@
+# ---- Optional compression libraries, used by CompressedFileSink ----
+#
+# Each library that is found is linked to the (still header-only) library target, and turns on the matching
+# LL_HAS_* macro. Codecs whose library is not found are simply not available.
+
+function(lightning_find_codec name header library macro)
+  find_path(LIGHTNING_${name}_INCLUDE_DIR ${header})
+  find_library(LIGHTNING_${name}_LIBRARY ${library})
+  if (LIGHTNING_${name}_INCLUDE_DIR AND LIGHTNING_${name}_LIBRARY)
+    target_include_directories(Lightning_Lightning SYSTEM INTERFACE "${LIGHTNING_${name}_INCLUDE_DIR}")
+    target_link_libraries(Lightning_Lightning INTERFACE "${LIGHTNING_${name}_LIBRARY}")
+    target_compile_definitions(Lightning_Lightning INTERFACE ${macro}=1)
+    message(STATUS "Lightning: ${name} compression enabled")
+  else ()
+    message(STATUS "Lightning: ${name} not found, its compression is not available")
+  endif ()
+endfunction()
+
+lightning_find_codec(zlib zlib.h z LL_HAS_ZLIB)
+lightning_find_codec(LZ4 lz4frame.h lz4 LL_HAS_LZ4)
+lightning_find_codec(zstd zstd.h zstd LL_HAS_ZSTD)
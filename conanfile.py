@@ -10,6 +10,9 @@ class LightningProject(ConanFile):
     description = "Lightning logging"
     topics = ("conan", "lightning", "logging")  # Specify relevant topics or keywords
     settings = "os", "compiler", "build_type", "arch"
+    # The codecs that CompressedFileSink can use. The library itself stays header-only without them.
+    options = {"with_zlib": [True, False], "with_lz4": [True, False], "with_zstd": [True, False]}
+    default_options = {"with_zlib": False, "with_lz4": False, "with_zstd": False}
     exports_sources = "include/**", "source/**", "CMakeLists.txt", "cmake/**", "test/**"
 
     generators = "CMakeToolchain", "CMakeDeps", "VirtualRunEnv", "cmake"
@@ -32,5 +35,13 @@ class LightningProject(ConanFile):
     def package_info(self):
         self.cpp_info.libs = ["lightning"]
 
+    def requirements(self):
+        if self.options.with_zlib:
+            self.requires("zlib/1.3")
+        if self.options.with_lz4:
+            self.requires("lz4/1.9.4")
+        if self.options.with_zstd:
+            self.requires("zstd/1.5.5")
+
     def build_requirements(self):
         self.test_requires("gtest/1.11.0")
@@ -0,0 +1,457 @@
+/*
+MIT License
+
+Copyright (c) 2023 Nathaniel Rupprecht
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <numeric>
+
+#include "Lightning/Lightning.h"
+#include "Lightning/Plotting.h"
+
+#if defined(__linux__)
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  define LL_HAS_PERF_EVENTS 1
+#else
+#  define LL_HAS_PERF_EVENTS 0
+#endif  // __linux__
+
+namespace lightning::benchmarking {
+
+//! \brief Settings for running a benchmark.
+struct Options {
+  //! \brief Calls to make before measuring anything, per thread.
+  std::size_t warmup_iterations = 10'000;
+
+  //! \brief Calls per repetition, per thread. Each repetition gives one throughput measurement.
+  std::size_t iterations = 100'000;
+
+  //! \brief How many times to measure the throughput.
+  std::size_t repetitions = 5;
+
+  //! \brief Calls that are timed individually, per thread, to get the latency distribution.
+  std::size_t latency_samples = 50'000;
+
+  //! \brief Whether to read hardware counters (Linux only, and subject to perf_event_paranoid).
+  bool perf_counters = false;
+};
+
+//! \brief Summary of the distribution of per-call latencies, in nanoseconds.
+struct LatencyStats {
+  double min {}, p50 {}, p90 {}, p99 {}, p999 {}, max {}, mean {};
+
+  //! \brief Summarize a set of samples. The samples are sorted in place.
+  static LatencyStats FromSamples(std::vector<double>& samples) {
+    LatencyStats stats;
+    if (samples.empty()) {
+      return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    // Nearest rank percentile.
+    auto percentile = [&samples](double p) {
+      const auto rank = static_cast<std::size_t>(std::ceil(p * static_cast<double>(samples.size())));
+      return samples[std::clamp<std::size_t>(rank, 1, samples.size()) - 1];
+    };
+    stats.min = samples.front();
+    stats.p50 = percentile(0.5);
+    stats.p90 = percentile(0.9);
+    stats.p99 = percentile(0.99);
+    stats.p999 = percentile(0.999);
+    stats.max = samples.back();
+    stats.mean = std::accumulate(samples.begin(), samples.end(), 0.) / static_cast<double>(samples.size());
+    return stats;
+  }
+};
+
+//! \brief Hardware counter values, per call.
+struct CounterValues {
+  double cycles {}, instructions {}, cache_misses {};
+
+  CounterValues& operator+=(const CounterValues& other) {
+    cycles += other.cycles, instructions += other.instructions, cache_misses += other.cache_misses;
+    return *this;
+  }
+};
+
+//! \brief The results of one benchmark.
+struct Result {
+  std::string name;
+  std::size_t threads {1};
+
+  //! \brief The throughput of each repetition, in calls per second, summed over all threads.
+  std::vector<double> rates;
+
+  //! \brief The mean throughput over the repetitions.
+  double mean_rate {};
+
+  //! \brief The half width of the 95% confidence interval of the mean throughput.
+  double rate_ci95 {};
+
+  //! \brief Per-call latency.
+  LatencyStats latency;
+
+  //! \brief Hardware counters, per call, if they were requested and available.
+  std::optional<CounterValues> counters;
+};
+
+//! \brief The two sided 95% critical value of Student's t distribution with dof degrees of freedom.
+inline double StudentT95(std::size_t dof) {
+  static constexpr double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                     2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                     2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  if (dof == 0) {
+    return 0.;
+  }
+  return dof <= std::size(table) ? table[dof - 1] : 1.96;
+}
+
+//! \brief Reads the cycles, instructions, and cache misses of the calling thread, via perf_event_open.
+//!
+//! If the counters can't be opened, e.g. because of perf_event_paranoid or because this is not Linux, the
+//! counters are not available and read as zero.
+class PerfCounters {
+public:
+  PerfCounters() {
+#if LL_HAS_PERF_EVENTS
+    const std::uint64_t configs[] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+    for (auto i = 0u; i < 3; ++i) {
+      perf_event_attr attr {};
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+      attr.disabled = i == 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+      const auto fd =
+          static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], 0));
+      if (fd < 0) {
+        close();
+        return;
+      }
+      fds_[i] = fd;
+    }
+#endif
+  }
+
+  ~PerfCounters() { close(); }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  NO_DISCARD bool IsAvailable() const { return fds_[2] != -1; }
+
+  void Start() {
+#if LL_HAS_PERF_EVENTS
+    if (IsAvailable()) {
+      ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+
+  //! \brief Stop counting, and get the counts since Start, divided by the number of calls.
+  CounterValues Stop(std::size_t calls) {
+    CounterValues values;
+#if LL_HAS_PERF_EVENTS
+    if (IsAvailable()) {
+      ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      struct {
+        std::uint64_t count;
+        std::uint64_t values[3];
+      } group {};
+      if (read(fds_[0], &group, sizeof(group)) == static_cast<ssize_t>(sizeof(group)) && group.count == 3) {
+        const auto n = static_cast<double>(std::max<std::size_t>(calls, 1));
+        values = {static_cast<double>(group.values[0]) / n,
+                  static_cast<double>(group.values[1]) / n,
+                  static_cast<double>(group.values[2]) / n};
+      }
+    }
+#endif
+    return values;
+  }
+
+private:
+  void close() {
+#if LL_HAS_PERF_EVENTS
+    for (auto& fd : fds_) {
+      if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+#endif
+  }
+
+  //! \brief The group leader (cycles), instructions, and cache misses.
+  int fds_[3] = {-1, -1, -1};
+};
+
+namespace detail {
+
+using Clock = std::chrono::steady_clock;
+
+//! \brief Estimate the cost of reading the clock, which is subtracted from individually timed calls.
+inline double clockOverheadNs() {
+  static const double overhead = [] {
+    auto best = std::numeric_limits<double>::max();
+    for (int i = 0; i < 1000; ++i) {
+      const auto start = Clock::now();
+      const auto end = Clock::now();
+      best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    return best;
+  }();
+  return overhead;
+}
+
+//! \brief What each thread measured.
+struct ThreadMeasurement {
+  std::vector<double> latencies;
+  CounterValues counters;
+};
+
+}  // namespace detail
+
+//! \brief Run a benchmark on a number of threads, each thread calling body(i) for i = 0, 1, ...
+//!
+//! The throughput is measured over whole repetitions, without timing individual calls. The latency
+//! distribution comes from a separate phase, where each call is timed on its own (less the cost of reading
+//! the clock).
+template<typename Body_t>
+Result Run(std::string name, std::size_t threads, const Options& options, Body_t&& body) {
+  Result result;
+  result.name = std::move(name);
+  result.threads = std::max<std::size_t>(threads, 1);
+  const auto overhead = detail::clockOverheadNs();
+
+  std::vector<detail::ThreadMeasurement> measurements(result.threads);
+  // Phases: the threads wait for the phase to be released, do the phase, then report that they are done.
+  std::atomic<std::size_t> phase {0}, done {0};
+  auto worker = [&](std::size_t t) {
+    auto wait_for = [&phase](std::size_t p) {
+      while (phase.load(std::memory_order_acquire) < p) {
+        std::this_thread::yield();
+      }
+    };
+    std::size_t i = 0;
+    for (std::size_t w = 0; w < options.warmup_iterations; ++w) {
+      body(i++);
+    }
+    done.fetch_add(1, std::memory_order_acq_rel);
+
+    std::optional<PerfCounters> counters;
+    if (options.perf_counters) {
+      counters.emplace();
+    }
+    for (std::size_t r = 0; r < options.repetitions; ++r) {
+      wait_for(r + 1);
+      if (counters) {
+        counters->Start();
+      }
+      for (std::size_t n = 0; n < options.iterations; ++n) {
+        body(i++);
+      }
+      if (counters) {
+        measurements[t].counters += counters->Stop(options.iterations * options.repetitions);
+      }
+      done.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    wait_for(options.repetitions + 1);
+    auto& latencies = measurements[t].latencies;
+    latencies.reserve(options.latency_samples);
+    for (std::size_t n = 0; n < options.latency_samples; ++n) {
+      const auto start = detail::Clock::now();
+      body(i++);
+      const auto end = detail::Clock::now();
+      latencies.push_back(std::max(0., std::chrono::duration<double, std::nano>(end - start).count() - overhead));
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (std::size_t t = 0; t < result.threads; ++t) {
+    workers.emplace_back(worker, t);
+  }
+  auto wait_done = [&](std::size_t count) {
+    while (done.load(std::memory_order_acquire) < count) {
+      std::this_thread::yield();
+    }
+  };
+  wait_done(result.threads);
+  for (std::size_t r = 0; r < options.repetitions; ++r) {
+    const auto start = detail::Clock::now();
+    phase.store(r + 1, std::memory_order_release);
+    wait_done(result.threads * (r + 2));
+    const auto seconds = std::chrono::duration<double>(detail::Clock::now() - start).count();
+    result.rates.push_back(static_cast<double>(options.iterations * result.threads) / seconds);
+  }
+  phase.store(options.repetitions + 1, std::memory_order_release);
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  // Summarize.
+  const auto n = static_cast<double>(result.rates.size());
+  if (!result.rates.empty()) {
+    result.mean_rate = std::accumulate(result.rates.begin(), result.rates.end(), 0.) / n;
+    double variance = 0;
+    for (auto rate : result.rates) {
+      variance += (rate - result.mean_rate) * (rate - result.mean_rate);
+    }
+    if (1 < result.rates.size()) {
+      variance /= n - 1;
+      result.rate_ci95 = StudentT95(result.rates.size() - 1) * std::sqrt(variance / n);
+    }
+  }
+  std::vector<double> latencies;
+  for (auto& measurement : measurements) {
+    latencies.insert(latencies.end(), measurement.latencies.begin(), measurement.latencies.end());
+  }
+  result.latency = LatencyStats::FromSamples(latencies);
+  if (options.perf_counters && PerfCounters {}.IsAvailable()) {
+    CounterValues total;
+    for (auto& measurement : measurements) {
+      total += measurement.counters;
+    }
+    const auto threads_d = static_cast<double>(result.threads);
+    result.counters = CounterValues {
+        total.cycles / threads_d, total.instructions / threads_d, total.cache_misses / threads_d};
+  }
+  return result;
+}
+
+//! \brief Run a single threaded benchmark.
+template<typename Body_t>
+Result Run(std::string name, const Options& options, Body_t&& body) {
+  return Run(std::move(name), 1, options, std::forward<Body_t>(body));
+}
+
+//! \brief Write a table of results, one result per line.
+inline void WriteTable(std::ostream& out, const std::vector<Result>& results) {
+  std::size_t name_width = 4;
+  for (auto& result : results) {
+    name_width = std::max(name_width, result.name.size());
+  }
+  const auto has_counters = std::any_of(
+      results.begin(), results.end(), [](const Result& result) { return result.counters.has_value(); });
+
+  auto cell = [&out](auto&& value, int width, int precision = 1) {
+    out << std::setw(width) << std::fixed << std::setprecision(precision) << value;
+  };
+  out << std::left << std::setw(static_cast<int>(name_width)) << "Name" << std::right;
+  out << std::setw(8) << "Threads" << std::setw(16) << "Calls/sec" << std::setw(12) << "+/- 95%"
+      << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns" << std::setw(10) << "p99.9 ns" << std::setw(12)
+      << "max ns";
+  if (has_counters) {
+    out << std::setw(10) << "cycles" << std::setw(10) << "instr" << std::setw(10) << "misses";
+  }
+  out << "\n";
+  for (auto& result : results) {
+    out << std::left << std::setw(static_cast<int>(name_width)) << result.name << std::right;
+    cell(result.threads, 8);
+    cell(result.mean_rate, 16, 0);
+    cell(result.rate_ci95, 12, 0);
+    cell(result.latency.p50, 10);
+    cell(result.latency.p99, 10);
+    cell(result.latency.p999, 10);
+    cell(result.latency.max, 12);
+    if (result.counters) {
+      cell(result.counters->cycles, 10);
+      cell(result.counters->instructions, 10);
+      cell(result.counters->cache_misses, 10, 2);
+    }
+    out << "\n";
+  }
+  out.flush();
+}
+
+//! \brief Write results as a JSON array of objects.
+inline void WriteJson(std::ostream& out, const std::vector<Result>& results) {
+  auto quoted = [&out](std::string_view str) {
+    out << '"';
+    for (auto c : str) {
+      if (c == '"' || c == '\\') {
+        out << '\\' << c;
+      }
+      else if (static_cast<unsigned char>(c) < 0x20) {
+        out << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf] << "0123456789abcdef"[c & 0xf];
+      }
+      else {
+        out << c;
+      }
+    }
+    out << '"';
+  };
+  out << std::setprecision(10) << "[\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    auto& result = results[i];
+    out << "  {\"name\": ";
+    quoted(result.name);
+    out << ", \"threads\": " << result.threads << ", \"mean_rate\": " << result.mean_rate
+        << ", \"rate_ci95\": " << result.rate_ci95 << ", \"rates\": [";
+    for (std::size_t r = 0; r < result.rates.size(); ++r) {
+      out << (r ? ", " : "") << result.rates[r];
+    }
+    const auto& latency = result.latency;
+    out << "], \"latency_ns\": {\"min\": " << latency.min << ", \"p50\": " << latency.p50
+        << ", \"p90\": " << latency.p90 << ", \"p99\": " << latency.p99 << ", \"p99.9\": " << latency.p999
+        << ", \"max\": " << latency.max << ", \"mean\": " << latency.mean << "}";
+    if (result.counters) {
+      out << ", \"counters_per_call\": {\"cycles\": " << result.counters->cycles
+          << ", \"instructions\": " << result.counters->instructions
+          << ", \"cache_misses\": " << result.counters->cache_misses << "}";
+    }
+    out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "]\n";
+}
+
+//! \brief Plot throughput against the number of threads, with 95% confidence intervals as error bars, one
+//!        line per benchmark name.
+inline void PlotThroughputVsThreads(Figure& figure, const std::vector<Result>& results) {
+  std::map<std::string, std::vector<const Result*>> by_name;
+  for (auto& result : results) {
+    by_name[result.name].push_back(&result);
+  }
+  figure.SetXLabel("Threads");
+  figure.SetYLabel("Calls/sec");
+  for (auto& [name, series] : by_name) {
+    std::sort(series.begin(), series.end(), [](auto* lhs, auto* rhs) { return lhs->threads < rhs->threads; });
+    std::vector<double> x, y, y_err;
+    for (auto* result : series) {
+      x.push_back(static_cast<double>(result->threads));
+      y.push_back(result->mean_rate);
+      y_err.push_back(result->rate_ci95);
+    }
+    figure.ErrorBars(x, y, y_err, name);
+  }
+}
+
+}  // namespace lightning::benchmarking
@@ -27,30 +27,133 @@ SOFTWARE.
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <charconv>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <csignal>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>  // For std::strlen, std::memcpy, etc.
+#include <ctime>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <numeric>
 #include <optional>
 #include <set>
 #include <shared_mutex>
 #include <sstream>
+#include <stdexcept>
+#include <streambuf>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#  define LL_HAS_POSIX 1
+#  include <cerrno>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <sys/uio.h>
+#  include <unistd.h>
+#else
+#  define LL_HAS_POSIX 0
+#endif  // POSIX
+
+#if defined(__linux__)
+#  include <sys/syscall.h>
+#elif defined(__APPLE__)
+#  include <pthread.h>
+#elif defined(_WIN32)
+// Declared here, so that windows.h does not have to be included.
+extern "C" __declspec(dllimport) unsigned long __stdcall GetCurrentThreadId();
+#endif  // Thread IDs
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  define LL_HAS_TSC 1
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#    include <x86intrin.h>
+#  endif
+#else
+#  define LL_HAS_TSC 0
+#endif  // TSC
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define LL_HAS_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define LL_HAS_SSE2 0
+#endif  // SSE2
+
+// The AVX2 kernels are compiled with target attributes and picked at runtime, so they do not need -mavx2.
+#if LL_HAS_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#  define LL_HAS_AVX2_DISPATCH 1
+#  include <immintrin.h>
+#else
+#  define LL_HAS_AVX2_DISPATCH 0
+#endif  // AVX2
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#  define LL_HAS_NEON 1
+#  include <arm_neon.h>
+#else
+#  define LL_HAS_NEON 0
+#endif  // NEON
+
+// Logging pipeline metrics (see lightning::metrics) are compiled out unless LL_ENABLE_METRICS is 1.
+#ifndef LL_ENABLE_METRICS
+#  define LL_ENABLE_METRICS 0
+#endif  // LL_ENABLE_METRICS
+
+#if LL_ENABLE_METRICS
+#  define LL_METRICS(...) __VA_ARGS__
+#else
+#  define LL_METRICS(...)
+#endif  // LL_ENABLE_METRICS
+
 #ifdef __cpp_lib_span
 #  include <span>
 #endif  // __cpp_lib_span
 
+// The compression libraries that CompressedFileSink can use. The build defines these when it finds them.
+#ifndef LL_HAS_ZLIB
+#  define LL_HAS_ZLIB 0
+#endif  // LL_HAS_ZLIB
+#ifndef LL_HAS_LZ4
+#  define LL_HAS_LZ4 0
+#endif  // LL_HAS_LZ4
+#ifndef LL_HAS_ZSTD
+#  define LL_HAS_ZSTD 0
+#endif  // LL_HAS_ZSTD
+
+#if LL_HAS_ZLIB
+#  include <zlib.h>
+#endif  // LL_HAS_ZLIB
+#if LL_HAS_LZ4
+#  include <lz4frame.h>
+#endif  // LL_HAS_LZ4
+#if LL_HAS_ZSTD
+#  include <zstd.h>
+#endif  // LL_HAS_ZSTD
+
 namespace lightning {
 
 // ==============================================================================
@@ -477,10 +580,54 @@ public:
     this->capacity_ = stack_size_v;
   }
 
+  MemoryBuffer(const MemoryBuffer&) = delete;
+  MemoryBuffer& operator=(const MemoryBuffer&) = delete;
+
+  //! \brief Move a memory buffer. Data in the other buffer's stack storage is copied, heap data is taken over.
+  MemoryBuffer(MemoryBuffer&& other) noexcept
+      : MemoryBuffer() {
+    moveFrom(other);
+  }
+
+  MemoryBuffer& operator=(MemoryBuffer&& other) noexcept {
+    if (this != &other) {
+      deallocate();
+      this->data_ = buffer_;
+      this->capacity_ = stack_size_v;
+      moveFrom(other);
+    }
+    return *this;
+  }
+
   //! \brief Clean up by deallocating any heap memory.
   ~MemoryBuffer() override { deallocate(); }
 
+  //! \brief Clear the buffer and give back any heap memory, going back to the stack storage.
+  void Reset() {
+    deallocate();
+    this->data_ = buffer_;
+    this->capacity_ = stack_size_v;
+    this->size_ = 0;
+    this->normalize();
+  }
+
 private:
+  void moveFrom(MemoryBuffer& other) {
+    if (other.data_ == other.buffer_) {
+      std::copy(other.buffer_, other.buffer_ + other.size_, buffer_);
+    }
+    else {
+      this->data_ = other.data_;
+      this->capacity_ = other.capacity_;
+      other.data_ = other.buffer_;
+      other.capacity_ = stack_size_v;
+    }
+    this->size_ = other.size_;
+    other.size_ = 0;
+    this->normalize();
+    other.normalize();
+  }
+
   void allocate(std::size_t size) override {
     auto trial_capacity = this->capacity_ + this->capacity_ / 2;
     trial_capacity = std::max(size, trial_capacity);
@@ -561,6 +708,336 @@ inline void AppendBuffer(BasicMemoryBuffer<char>& buffer, const char* start, con
   }
 }
 
+//! \brief A stream buffer that appends everything written to it to a memory buffer, so that types which can
+//!        only be written to a std::ostream can be formatted into a buffer without a temporary string.
+//!
+//! \code
+//!   BufferStreambuf streambuf(buffer);
+//!   std::ostream stream(&streambuf);
+//!   stream << object;
+//! \endcode
+class BufferStreambuf final : public std::streambuf {
+public:
+  explicit BufferStreambuf(BasicMemoryBuffer<char>& buffer)
+      : buffer_(buffer) {}
+
+protected:
+  std::streamsize xsputn(const char* str, std::streamsize count) override {
+    buffer_.Append(str, str + count);
+    return count;
+  }
+
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      buffer_.PushBack(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
+
+private:
+  BasicMemoryBuffer<char>& buffer_;
+};
+
+//! \brief A per-thread pool of formatting buffers, which keep the heap memory they grew into from one use to
+//!        the next, so formatting long messages does not allocate and free memory for every record.
+//!
+//! A buffer is borrowed with Acquire, and goes back to the pool, cleared, when the lease is destroyed. Leases
+//! can nest, each one gets its own buffer. A buffer that grew past the high water mark gives its heap memory
+//! back when it is returned, so one huge message does not keep its memory forever.
+class BufferPool {
+public:
+  using Buffer = MemoryBuffer<char>;
+
+  //! \brief A buffer borrowed from the pool.
+  class Lease {
+  public:
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    Lease(Lease&& other) noexcept = default;
+    Lease& operator=(Lease&&) = delete;
+
+    ~Lease() {
+      if (buffer_) {
+        pool_->giveBack(std::move(buffer_));
+      }
+    }
+
+    Buffer& operator*() const { return *buffer_; }
+    Buffer* operator->() const { return buffer_.get(); }
+
+  private:
+    friend class BufferPool;
+
+    Lease(BufferPool& pool, std::unique_ptr<Buffer> buffer)
+        : pool_(&pool)
+        , buffer_(std::move(buffer)) {}
+
+    BufferPool* pool_;
+    std::unique_ptr<Buffer> buffer_;
+  };
+
+  //! \brief Get the calling thread's pool.
+  static BufferPool& Local() {
+    static thread_local BufferPool pool;
+    return pool;
+  }
+
+  //! \brief Borrow an empty buffer.
+  NO_DISCARD Lease Acquire() {
+    if (free_.empty()) {
+      return {*this, std::make_unique<Buffer>()};
+    }
+    auto buffer = std::move(free_.back());
+    free_.pop_back();
+    return {*this, std::move(buffer)};
+  }
+
+  //! \brief Set the capacity, in bytes, above which returned buffers give back their heap memory.
+  void SetHighWaterMark(std::size_t high_water_mark) { high_water_mark_ = high_water_mark; }
+
+  //! \brief Get the capacity, in bytes, above which returned buffers give back their heap memory.
+  NO_DISCARD std::size_t GetHighWaterMark() const { return high_water_mark_; }
+
+  //! \brief Get the number of buffers that are waiting in the pool.
+  NO_DISCARD std::size_t GetNumFree() const { return free_.size(); }
+
+private:
+  void giveBack(std::unique_ptr<Buffer> buffer) {
+    if (high_water_mark_ < buffer->Capacity()) {
+      buffer->Reset();
+    }
+    else {
+      buffer->Clear();
+    }
+    // Only as many buffers as are used at once are ever needed, which is a handful.
+    if (free_.size() < max_free_) {
+      free_.push_back(std::move(buffer));
+    }
+  }
+
+  static constexpr std::size_t max_free_ = 8;
+
+  std::vector<std::unique_ptr<Buffer>> free_;
+  std::size_t high_water_mark_ = 64 * 1024;
+};
+
+//! \brief A per-thread bump allocator for the short-lived memory of records that are being built.
+//!
+//! Memory is only served while an ArenaScope is open on the thread (and no ArenaSuspend is active), and
+//! everything allocated inside a scope is released in bulk when the scope closes, so deallocating from the
+//! arena is a no-op. Blocks are kept after a scope closes, so in the steady state, the arena never touches the
+//! heap. Anything that does not fit in a block, or that is requested while no scope is open, comes from the
+//! heap instead.
+//!
+//! The arena also counts how many bytes it served, and how many bytes arena-aware allocations had to take from
+//! the heap, which can be used to pick a block size.
+class ThreadArena {
+public:
+  //! \brief Position of the arena, used to release everything allocated after a certain point.
+  struct Mark {
+    std::size_t block;
+    std::size_t offset;
+  };
+
+  //! \brief Get the calling thread's arena.
+  static ThreadArena& Local() {
+    static thread_local ThreadArena arena;
+    return arena;
+  }
+
+  //! \brief Try to allocate memory from the arena. Returns null if the memory has to come from the heap.
+  void* Allocate(std::size_t size, std::size_t alignment) {
+    if (depth_ == 0 || suspended_ != 0 || block_size_ < size + alignment) {
+      return nullptr;
+    }
+    while (true) {
+      if (block_ == blocks_.size()) {
+        blocks_.emplace_back(new unsigned char[block_size_]);
+      }
+      const auto base = reinterpret_cast<std::uintptr_t>(blocks_[block_].get());
+      const auto aligned = (base + offset_ + alignment - 1) & ~(alignment - 1);
+      if (aligned + size <= base + block_size_) {
+        offset_ = aligned + size - base;
+        arena_bytes_ += size;
+        return reinterpret_cast<void*>(aligned);
+      }
+      ++block_;
+      offset_ = 0;
+    }
+  }
+
+  //! \brief Check whether a pointer points into one of the arena's blocks.
+  NO_DISCARD bool Owns(const void* ptr) const {
+    const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+    for (auto& block : blocks_) {
+      const auto base = reinterpret_cast<std::uintptr_t>(block.get());
+      if (base <= address && address < base + block_size_) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //! \brief Record that an arena-aware allocation was served by the heap.
+  void NoteHeapAllocation(std::size_t size) { heap_bytes_ += size; }
+
+  //! \brief Check whether the arena currently serves allocations.
+  NO_DISCARD bool IsActive() const { return depth_ != 0 && suspended_ == 0; }
+
+  //! \brief Set the size of the arena's blocks. Can only be done while no scope is open, and releases all
+  //!        blocks.
+  void SetBlockSize(std::size_t block_size) {
+    LL_REQUIRE(depth_ == 0, "cannot change the block size of an arena while a scope is open");
+    LL_REQUIRE(0 < block_size, "the block size of an arena must be positive");
+    blocks_.clear();
+    block_size_ = block_size;
+    block_ = offset_ = 0;
+  }
+
+  //! \brief Get the size of the arena's blocks.
+  NO_DISCARD std::size_t GetBlockSize() const { return block_size_; }
+
+  //! \brief Get the number of blocks that the arena has allocated.
+  NO_DISCARD std::size_t GetBlockCount() const { return blocks_.size(); }
+
+  //! \brief Get the total number of bytes that the arena has served.
+  NO_DISCARD std::size_t GetArenaBytes() const { return arena_bytes_; }
+
+  //! \brief Get the total number of bytes that arena-aware allocations had to take from the heap.
+  NO_DISCARD std::size_t GetHeapBytes() const { return heap_bytes_; }
+
+  //! \brief Reset the byte counters.
+  void ResetCounters() { arena_bytes_ = heap_bytes_ = 0; }
+
+private:
+  friend class ArenaScope;
+  friend class ArenaSuspend;
+
+  ThreadArena() = default;
+
+  Mark open() {
+    ++depth_;
+    return {block_, offset_};
+  }
+
+  void close(Mark mark) {
+    --depth_;
+    block_ = mark.block;
+    offset_ = mark.offset;
+  }
+
+  //! \brief The blocks of the arena. All blocks have block_size_ bytes.
+  std::vector<std::unique_ptr<unsigned char[]>> blocks_;
+
+  //! \brief The size of each block.
+  std::size_t block_size_ = 16 * 1024;
+
+  //! \brief The block that is currently being allocated from (may be one past the last block).
+  std::size_t block_ = 0;
+
+  //! \brief The offset of the next free byte in the current block.
+  std::size_t offset_ = 0;
+
+  //! \brief The number of open scopes.
+  std::size_t depth_ = 0;
+
+  //! \brief The number of active suspensions.
+  std::size_t suspended_ = 0;
+
+  std::size_t arena_bytes_ = 0;
+  std::size_t heap_bytes_ = 0;
+};
+
+//! \brief RAII object that lets the calling thread's arena serve allocations, releasing everything allocated
+//!        through it when it is destroyed. Scopes nest, and have to be destroyed in the reverse order that
+//!        they were opened in.
+//!
+//! A default constructed scope is not opened until Open is called.
+class ArenaScope {
+public:
+  ArenaScope() = default;
+
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+  ~ArenaScope() {
+    if (arena_) {
+      arena_->close(mark_);
+    }
+  }
+
+  //! \brief Open the scope, if it is not open already.
+  void Open() {
+    if (!arena_) {
+      arena_ = &ThreadArena::Local();
+      mark_ = arena_->open();
+    }
+  }
+
+  //! \brief Check whether the scope was opened.
+  NO_DISCARD bool IsOpen() const { return arena_ != nullptr; }
+
+private:
+  ThreadArena* arena_ = nullptr;
+  ThreadArena::Mark mark_ {};
+};
+
+//! \brief RAII object that stops the calling thread's arena from serving allocations while it exists. This is
+//!        needed for memory that has to outlive the current scope, e.g. copies of records that are handed to
+//!        another thread.
+class ArenaSuspend {
+public:
+  ArenaSuspend()
+      : arena_(ThreadArena::Local()) {
+    ++arena_.suspended_;
+  }
+
+  ArenaSuspend(const ArenaSuspend&) = delete;
+  ArenaSuspend& operator=(const ArenaSuspend&) = delete;
+
+  ~ArenaSuspend() { --arena_.suspended_; }
+
+private:
+  ThreadArena& arena_;
+};
+
+//! \brief A standard allocator that allocates from the calling thread's arena when it is active, and from the
+//!        heap otherwise.
+template<typename T>
+struct ArenaAllocator {
+  using value_type = T;
+
+  ArenaAllocator() noexcept = default;
+
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U>&) noexcept {}  // NOLINT(google-explicit-constructor)
+
+  NO_DISCARD T* allocate(std::size_t n) {
+    auto& arena = ThreadArena::Local();
+    if (auto ptr = arena.Allocate(n * sizeof(T), alignof(T))) {
+      return static_cast<T*>(ptr);
+    }
+    arena.NoteHeapAllocation(n * sizeof(T));
+    return std::allocator<T> {}.allocate(n);
+  }
+
+  void deallocate(T* ptr, std::size_t n) noexcept {
+    if (!ThreadArena::Local().Owns(ptr)) {
+      std::allocator<T> {}.deallocate(ptr, n);
+    }
+  }
+
+  template<typename U>
+  bool operator==(const ArenaAllocator<U>&) const noexcept {
+    return true;
+  }
+
+  template<typename U>
+  bool operator!=(const ArenaAllocator<U>&) const noexcept {
+    return false;
+  }
+};
+
 //! \brief A vector (-like class) that has a predetermined amount of stack storage and uses a vector for the
 //!        rest of the storage.
 //!
@@ -571,7 +1048,9 @@ inline void AppendBuffer(BasicMemoryBuffer<char>& buffer, const char* start, con
 //!       that wraps around an ostream, and flushes the fixed buffer to the ostream whenever it is full, and
 //!       then resets. Obviously, you cannot index into an arbitrary place in a class like this. So for now,
 //!       despite their similarities, I am keeping these classes distinct and unrelated.
-template<typename T, std::size_t stack_size_v>
+//!
+//! \tparam Allocator_t The allocator that the vector used for the rest of the storage uses.
+template<typename T, std::size_t stack_size_v, typename Allocator_t = std::allocator<T>>
 class HybridVector {
 public:
   //! \brief Move an element onto the back of the hybrid vector.
@@ -633,7 +1112,7 @@ private:
   T stack_buffer_[stack_size_v];
 
   //! \brief Regular vector, for the remaining storage.
-  std::vector<T> heap_buffer_;
+  std::vector<T, Allocator_t> heap_buffer_;
 
   //! \brief The utilized size of the stack storage.
   std::size_t stack_size_ {};
@@ -729,6 +1208,34 @@ inline Month MonthIntToMonth(int month) {
   return months_[month - 1];
 }
 
+//! \brief Get the number of days from 1970-01-01 to a date in the (proleptic) Gregorian calendar.
+//!
+//! This is the days_from_civil algorithm from http://howardhinnant.github.io/date_algorithms.html.
+constexpr std::int64_t DaysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  const std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const auto year_of_era = static_cast<unsigned>(year - era * 400);
+  const auto day_of_year = static_cast<unsigned>((153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1);
+  const auto day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + static_cast<std::int64_t>(day_of_era) - 719468;
+}
+
+//! \brief Get the year, month, and day in the (proleptic) Gregorian calendar that is a number of days after
+//!        1970-01-01. This is the inverse of DaysFromCivil.
+//!
+//! This is the civil_from_days algorithm from http://howardhinnant.github.io/date_algorithms.html.
+constexpr void CivilFromDays(std::int64_t days, int& year, int& month, int& day) {
+  days += 719468;
+  const std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const auto day_of_era = static_cast<unsigned>(days - era * 146097);
+  const auto year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+  const auto day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const auto mp = (5 * day_of_year + 2) / 153;
+  day = static_cast<int>(day_of_year - (153 * mp + 2) / 5 + 1);
+  month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+  year = static_cast<int>(static_cast<std::int64_t>(year_of_era) + era * 400 + (month <= 2));
+}
+
 //! \brief A class that represents a date and time, down to millisecond precision.
 //!
 //! The year must satisfy 0 <= year < 4096.
@@ -818,6 +1325,41 @@ public:
   //! \brief Get the microsecond from the datetime.
   NO_DISCARD int GetMicrosecond() const noexcept { return static_cast<int>(y_m_d_h_m_s_um_ & us_mask_); }
 
+  //! \brief Get the number of microseconds from 1970-01-01 00:00:00 to the date time, in the timezone of the
+  //!        date time itself (usually local time).
+  NO_DISCARD std::int64_t EpochMicroseconds() const noexcept {
+    const auto days = DaysFromCivil(GetYear(), GetMonthInt(), GetDay());
+    const auto seconds = ((days * 24 + GetHour()) * 60 + GetMinute()) * 60 + GetSecond();
+    return seconds * 1'000'000 + GetMicrosecond();
+  }
+
+  //! \brief Create a date time from a number of microseconds since 1970-01-01 00:00:00. This is the inverse of
+  //!        EpochMicroseconds, no timezone conversion is done.
+  static DateTime FromEpochMicroseconds(std::int64_t microseconds) {
+    constexpr std::int64_t us_per_day = 86'400'000'000;
+    auto days = microseconds / us_per_day, remainder = microseconds % us_per_day;
+    if (remainder < 0) {
+      --days, remainder += us_per_day;
+    }
+    int year {}, month {}, day {};
+    CivilFromDays(days, year, month, day);
+    const auto seconds = static_cast<int>(remainder / 1'000'000);
+    return {year,
+            month,
+            day,
+            seconds / 3600,
+            (seconds / 60) % 60,
+            seconds % 60,
+            static_cast<int>(remainder % 1'000'000)};
+  }
+
+  //! \brief Get the date time with the microseconds set to zero.
+  NO_DISCARD DateTime TruncatedToSecond() const noexcept {
+    DateTime dt;
+    dt.y_m_d_h_m_s_um_ = y_m_d_h_m_s_um_ & ~static_cast<decltype(y_m_d_h_m_s_um_)>(us_mask_);
+    return dt;
+  }
+
   //! \brief Check if the date is a non-null (empty) date.
   explicit operator bool() const noexcept { return y_m_d_h_m_s_um_ != 0; }
 
@@ -881,8 +1423,9 @@ private:
   //! \param month Set the month of the date.
   //! \param day Set the day of the date.
   //! \param validate Whether to validate the date.
-  void setYMD(const int year, const int month, const int day, const bool validate = true) {
-    if (validate)
+  constexpr void setYMD(const int year, const int month, const int day, const bool validate = true) {
+    // The check is constexpr, and only an invalid date calls validateYMD, which throws with the reason.
+    if (validate && !isValidYMD(year, month, day))
       validateYMD(year, month, day);
     // Zero previous y-m-d.
     y_m_d_h_m_s_um_ = (y_m_d_h_m_s_um_ << 32) >> 32;
@@ -898,12 +1441,12 @@ private:
   //! \param second Set the seconds of the time.
   //! \param microseconds Set the microseconds of the time.
   //! \param validate Whether to validate the date.
-  void setHMSUS(const int hour,
-                const int minute,
-                const int second,
-                const int microseconds,
-                const bool validate = true) {
-    if (validate)
+  constexpr void setHMSUS(const int hour,
+                          const int minute,
+                          const int second,
+                          const int microseconds,
+                          const bool validate = true) {
+    if (validate && !isValidHMSUS(hour, minute, second, microseconds))
       validateHMSUS(hour, minute, second, microseconds);
     // Zero previous h-m-s-us.
     y_m_d_h_m_s_um_ = (y_m_d_h_m_s_um_ >> 32) << 32;
@@ -912,6 +1455,24 @@ private:
         | (static_cast<std::uint64_t>(second) << shift_second_) | static_cast<std::uint64_t>(microseconds);
   }
 
+  //! \brief Check whether a year, month, and day form a valid date.
+  static constexpr bool isValidYMD(const int year, const int month, const int day) {
+    if (year <= 0 || month <= 0 || 12 < month || day <= 0) {
+      return false;
+    }
+    constexpr int days_in_month[] = {0 /* Unused */, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    return day <= days_in_month[month] + (month == 2 && IsLeapYear(year) ? 1 : 0);
+  }
+
+  //! \brief Check whether an hour, minute, second, and microseconds form a valid time.
+  static constexpr bool isValidHMSUS(const int hour,
+                                     const int minute,
+                                     const int second,
+                                     const int microseconds) {
+    return 0 <= hour && hour < 24 && 0 <= minute && minute < 60 && 0 <= second && second < 60
+        && 0 <= microseconds && microseconds < 1'000'000;
+  }
+
   //! \brief Validate whether a year, month, and day are valid.
   //!
   //! \param year The year to validate.
@@ -1019,89 +1580,706 @@ inline DateTime AddMicroseconds(const DateTime& time, unsigned long long microse
     new_days = 0;
     ++new_months;
     if (new_months == 13) {
-      ++new_months, new_years = 1;
+      new_months = 1, ++new_years;
     }
   }
 
   return {new_years, new_months, new_days, new_hours, new_minutes, new_seconds, new_us};
 }
 
-//! \brief The conversion from a clock point to a local time is relatively slow, much slower than just
-//!        getting a time point, or subtracting time points. We can use this to quickly generate date times by
-//!        calculate the DateTime once, then just calculating microsecond offsets from that and adding that to
-//!        the original DateTime.
-class FastDateGenerator {
+//! \brief Where a TimeSource gets the current time from for each time stamp.
+enum class ClockSource {
+  //! \brief Read std::chrono::system_clock.
+  System,
+  //! \brief Read CLOCK_REALTIME_COARSE. This is much cheaper than the system clock, but only has the
+  //!        resolution of the kernel's tick, usually a few milliseconds.
+  RealtimeCoarse,
+  //! \brief Read the CPU's time stamp counter, converting it to a time with a rate that is calibrated against
+  //!        the system clock, and corrected once per second. Only available on x86 with an invariant TSC.
+  Tsc,
+};
+
+//! \brief A source of time stamps that can be shared by any number of threads.
+//!
+//! Turning a time into a DateTime means converting to broken down local time, which is slow. The time source
+//! only does this once per second, and publishes the result, the DateTime of the start of the current second,
+//! through a seqlock. Every other time stamp is the published DateTime plus the microseconds since the start
+//! of the second, read without any locking. Whichever thread first sees that the second has passed does the
+//! conversion again.
+//!
+//! There is one process wide time source, Global(), which all loggers use by default.
+class TimeSource {
 public:
-  FastDateGenerator() noexcept {
-    start_time_point_ = std::chrono::system_clock::now();
-    base_date_time_ = DateTime(start_time_point_);
+  explicit TimeSource(ClockSource clock = ClockSource::System) { SetClock(clock); }
+
+  TimeSource(const TimeSource&) = delete;
+  TimeSource& operator=(const TimeSource&) = delete;
+
+  //! \brief Get the process wide time source.
+  static TimeSource& Global() {
+    static TimeSource source;
+    return source;
+  }
+
+  //! \brief Check whether a clock source can be used on this machine.
+  static bool IsAvailable(ClockSource clock) noexcept {
+    switch (clock) {
+      case ClockSource::System:
+        return true;
+      case ClockSource::RealtimeCoarse:
+#if defined(CLOCK_REALTIME_COARSE)
+        return true;
+#else
+        return false;
+#endif
+      case ClockSource::Tsc:
+        return hasInvariantTsc();
+    }
+    return false;
+  }
+
+  //! \brief Set the clock that is read for each time stamp. If the clock is not available, the system clock
+  //!        is used instead.
+  void SetClock(ClockSource clock) {
+    if (!IsAvailable(clock)) {
+      clock = ClockSource::System;
+    }
+    if (clock == ClockSource::Tsc) {
+      calibrateTsc();
+    }
+    clock_.store(clock, std::memory_order_relaxed);
   }
 
-  NO_DISCARD DateTime CurrentTime() const noexcept {
-    const auto current_time = std::chrono::system_clock::now();
-    const auto dt = current_time - start_time_point_;
-    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(dt).count();
+  //! \brief Get the clock that is read for each time stamp.
+  NO_DISCARD ClockSource GetClock() const noexcept { return clock_.load(std::memory_order_relaxed); }
+
+  //! \brief Get the current time, in local time.
+  NO_DISCARD DateTime Now() noexcept {
+    const auto clock = GetClock();
+    while (true) {
+      const auto sequence = sequence_.load(std::memory_order_acquire);
+      if (sequence & 1) {
+        // Another thread is publishing a new second.
+        std::this_thread::yield();
+        continue;
+      }
+      const auto second_us = second_us_.load(std::memory_order_relaxed);
+      const auto second_date = second_date_.load(std::memory_order_relaxed);
+      const auto now_us = clock == ClockSource::Tsc ? tscMicroseconds() : readClock(clock);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence_.load(std::memory_order_relaxed) != sequence) {
+        continue;
+      }
 
-    if (1'000'000 < us) {
-      start_time_point_ = current_time;
-      base_date_time_ = DateTime(start_time_point_);
-      return base_date_time_;
+      const auto offset = now_us - second_us;
+      if (0 <= offset && offset < 1'000'000) {
+        return AddMicroseconds(second_date, static_cast<unsigned long long>(offset));
+      }
+      return publish(sequence, now_us);
     }
+  }
 
-    return AddMicroseconds(base_date_time_, static_cast<unsigned long long>(us));
+  //! \brief Get how many times the published second (or the TSC calibration) has been updated.
+  NO_DISCARD std::uint64_t GetUpdateCount() const noexcept {
+    return sequence_.load(std::memory_order_relaxed) / 2;
   }
 
 private:
-  //! \brief Keep track of when the logger was created.
-  mutable std::chrono::time_point<std::chrono::system_clock> start_time_point_;
-  //! \brief The DateTime at the time that the generator was created.
-  mutable DateTime base_date_time_;
-};
+  //! \brief Read the current time from the system clock or the coarse realtime clock, as microseconds since
+  //!        the epoch.
+  static std::int64_t readClock([[maybe_unused]] ClockSource clock) noexcept {
+#if defined(CLOCK_REALTIME_COARSE)
+    if (clock == ClockSource::RealtimeCoarse) {
+      timespec ts {};
+      clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+      return static_cast<std::int64_t>(ts.tv_sec) * 1'000'000 + ts.tv_nsec / 1'000;
+    }
+#endif
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
 
-}  // namespace time
+  static std::uint64_t readTsc() noexcept {
+#if LL_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+  }
 
-// ==============================================================================
-//  Formatting.
-// ==============================================================================
+  static bool hasInvariantTsc() noexcept {
+#if LL_HAS_TSC && defined(_MSC_VER)
+    int info[4] {};
+    __cpuid(info, 0x80000000);
+    if (static_cast<unsigned>(info[0]) < 0x80000007) {
+      return false;
+    }
+    __cpuid(info, 0x80000007);
+    return (info[3] >> 8) & 1;
+#elif LL_HAS_TSC
+    unsigned eax {}, ebx {}, ecx {}, edx {};
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && ((edx >> 8) & 1);
+#else
+    return false;
+#endif
+  }
 
-namespace formatting {
-namespace detail {
+  //! \brief Convert the TSC to microseconds since the epoch, relative to the last time the TSC was anchored to
+  //!        the system clock. Only called inside the seqlock's read section.
+  std::int64_t tscMicroseconds() const noexcept {
+    const auto ticks = static_cast<std::int64_t>(readTsc() - tsc_anchor_.load(std::memory_order_relaxed));
+    return anchor_us_.load(std::memory_order_relaxed)
+           + static_cast<std::int64_t>(static_cast<double>(ticks) / ticks_per_us_.load(std::memory_order_relaxed));
+  }
 
-//! \brief Store all powers of ten that fit in an unsigned long long.
-constexpr unsigned long long powers_of_ten[] = {
-    1,
-    10,
-    100,
-    1'000,
-    10'000,
-    100'000,
-    1'000'000,
-    10'000'000,
-    100'000'000,
-    1'000'000'000,
-    10'000'000'000,
-    100'000'000'000,
-    1'000'000'000'000,
-    10'000'000'000'000,
-    100'000'000'000'000,
-    1'000'000'000'000'000,
-    10'000'000'000'000'000,
-    100'000'000'000'000'000,
-    1'000'000'000'000'000'000,
-    10'000'000'000'000'000'000ull,
-};
+  //! \brief Calibrate the rate of the TSC against the system clock by spinning for a short time.
+  void calibrateTsc() {
+    const auto start_tsc = readTsc();
+    const auto start_us = readClock(ClockSource::System);
+    auto now_us = start_us;
+    while (now_us - start_us < 2'000) {
+      now_us = readClock(ClockSource::System);
+    }
+    const auto now_tsc = readTsc();
+
+    auto sequence = lock();
+    ticks_per_us_.store(static_cast<double>(now_tsc - start_tsc) / static_cast<double>(now_us - start_us),
+                        std::memory_order_relaxed);
+    tsc_anchor_.store(now_tsc, std::memory_order_relaxed);
+    anchor_us_.store(now_us, std::memory_order_relaxed);
+    // Make the next time stamp publish a new second, so it is anchored to the new rate.
+    second_us_.store(std::numeric_limits<std::int64_t>::min(), std::memory_order_relaxed);
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  //! \brief Spin until the seqlock is acquired for writing. Returns the (even) sequence number from before
+  //!        the lock was acquired.
+  std::uint64_t lock() noexcept {
+    while (true) {
+      auto sequence = sequence_.load(std::memory_order_relaxed);
+      if ((sequence & 1) == 0
+          && sequence_.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire)) {
+        std::atomic_thread_fence(std::memory_order_release);
+        return sequence;
+      }
+      std::this_thread::yield();
+    }
+  }
 
-//! \brief The largest power of ten that fits in an unsigned long long.
-constexpr unsigned long long max_ull_power_of_ten = 10'000'000'000'000'000'000ull;
+  //! \brief Convert the start of the second that contains a time, and publish it if no other thread published
+  //!        a second since the caller read the sequence number. Returns the DateTime of the time.
+  DateTime publish(std::uint64_t sequence, std::int64_t now_us) noexcept {
+    // Floor to the start of the second, even for times before the epoch.
+    const auto second_us = now_us - ((now_us % 1'000'000) + 1'000'000) % 1'000'000;
+    const auto second_date =
+        DateTime(std::chrono::system_clock::time_point(std::chrono::microseconds(second_us)));
+
+    // Re-anchor the TSC every second, so its conversion does not drift away from the system clock.
+    const bool reanchor = GetClock() == ClockSource::Tsc;
+    const auto anchor_tsc = reanchor ? readTsc() : 0;
+    const auto anchor_us = reanchor ? readClock(ClockSource::System) : 0;
+
+    // If this fails, another thread is already publishing, or has published, a newer second.
+    if (sequence_.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) {
+      std::atomic_thread_fence(std::memory_order_release);
+      second_us_.store(second_us, std::memory_order_relaxed);
+      second_date_.store(second_date, std::memory_order_relaxed);
+      if (reanchor) {
+        tsc_anchor_.store(anchor_tsc, std::memory_order_relaxed);
+        anchor_us_.store(anchor_us, std::memory_order_relaxed);
+      }
+      sequence_.store(sequence + 2, std::memory_order_release);
+    }
+    return AddMicroseconds(second_date, static_cast<unsigned long long>(now_us - second_us));
+  }
 
-//! \brief The largest power of ten that fits in an unsigned long long is (10 ^ log10_max_ull_power_of_ten).
-constexpr int log10_max_ull_power_of_ten = 19;
+  //! \brief The clock to read for each time stamp.
+  std::atomic<ClockSource> clock_ {ClockSource::System};
 
-}  // namespace detail
+  //! \brief The seqlock's sequence number. Odd while a thread is writing the fields below.
+  std::atomic<std::uint64_t> sequence_ {0};
 
-//! \brief Returns how many digits the decimal representation of a ull will have.
+  //! \brief The start of the current second, in microseconds since the epoch.
+  std::atomic<std::int64_t> second_us_ {std::numeric_limits<std::int64_t>::min()};
+  //! \brief The start of the current second, as a (local time) DateTime.
+  std::atomic<DateTime> second_date_ {};
+
+  //! \brief TSC value at the time anchor_us_.
+  std::atomic<std::uint64_t> tsc_anchor_ {0};
+  //! \brief The time, in microseconds since the epoch, that the TSC was last anchored at.
+  std::atomic<std::int64_t> anchor_us_ {0};
+  //! \brief The calibrated rate of the TSC.
+  std::atomic<double> ticks_per_us_ {1.};
+};
+
+//! \brief Generates time stamps from a TimeSource, by default the process wide time source.
 //!
-//! \param x The number to count the digits of.
+//! The generator only refers to the time source, so it is cheap to copy and can be used from any number of
+//! threads at once.
+class FastDateGenerator {
+public:
+  explicit FastDateGenerator(TimeSource& source = TimeSource::Global()) noexcept
+      : source_(&source) {}
+
+  NO_DISCARD DateTime CurrentTime() const noexcept { return source_->Now(); }
+
+  //! \brief Get the time source that the generator reads.
+  NO_DISCARD TimeSource& GetTimeSource() const noexcept { return *source_; }
+
+private:
+  //! \brief The time source that time stamps come from.
+  TimeSource* source_;
+};
+
+}  // namespace time
+
+// ==============================================================================
+//  SIMD kernels.
+// ==============================================================================
+
+namespace simd {
+
+//! \brief Instruction sets that the string kernels have implementations for.
+enum class Isa {
+  Scalar,
+  SSE2,
+  AVX2,
+  NEON,
+};
+
+namespace detail {
+
+//! \brief Get the index of the lowest set bit. The mask must be non-zero.
+inline unsigned lowestSetBit(std::uint64_t mask) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<unsigned>(__builtin_ctzll(mask));
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanForward64(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  unsigned index = 0;
+  for (; (mask & 1) == 0; mask >>= 1, ++index)
+    ;
+  return index;
+#endif
+}
+
+//! \brief Get the index of the highest set bit. The mask must be non-zero.
+inline unsigned highestSetBit(std::uint64_t mask) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+  return 63u - static_cast<unsigned>(__builtin_clzll(mask));
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanReverse64(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  unsigned index = 0;
+  for (; mask >>= 1; ++index)
+    ;
+  return index;
+#endif
+}
+
+//! \brief Whether a character has to be escaped when formatting a debug string.
+constexpr bool isDebugEscape(char c) noexcept {
+  return c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t';
+}
+
+//! \brief Whether a character has to be escaped in a JSON string, i.e. '"', '\\', or a control character.
+constexpr bool isJsonEscape(char c) noexcept {
+  return static_cast<unsigned char>(c) < 0x20 || c == '"' || c == '\\';
+}
+
+// ---- Scalar kernels, also used for the tails of the vector kernels.
+
+inline const char* findByteScalar(const char* begin, const char* end, char c) noexcept {
+  // The C library's memchr is usually vectorized already.
+  auto found = begin == end ? nullptr : std::memchr(begin, c, static_cast<std::size_t>(end - begin));
+  return found ? static_cast<const char*>(found) : end;
+}
+
+inline const char* findLastByteScalar(const char* begin, const char* end, char c) noexcept {
+  for (auto it = end; it != begin;) {
+    if (*--it == c) {
+      return it;
+    }
+  }
+  return end;
+}
+
+inline const char* findDebugEscapeScalar(const char* begin, const char* end) noexcept {
+  for (; begin != end && !isDebugEscape(*begin); ++begin)
+    ;
+  return begin;
+}
+
+inline const char* findJsonEscapeScalar(const char* begin, const char* end) noexcept {
+  for (; begin != end && !isJsonEscape(*begin); ++begin)
+    ;
+  return begin;
+}
+
+#if LL_HAS_SSE2
+
+inline const char* findByteSSE2(const char* begin, const char* end, char c) noexcept {
+  const auto needle = _mm_set1_epi8(c);
+  for (; 16 <= end - begin; begin += 16) {
+    const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    if (const auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)))) {
+      return begin + lowestSetBit(mask);
+    }
+  }
+  return findByteScalar(begin, end, c);
+}
+
+inline const char* findLastByteSSE2(const char* begin, const char* end, char c) noexcept {
+  const auto needle = _mm_set1_epi8(c);
+  auto it = end;
+  for (; 16 <= it - begin; it -= 16) {
+    const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it - 16));
+    if (const auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)))) {
+      return it - 16 + highestSetBit(mask);
+    }
+  }
+  const auto found = findLastByteScalar(begin, it, c);
+  return found == it ? end : found;
+}
+
+inline const char* findDebugEscapeSSE2(const char* begin, const char* end) noexcept {
+  const auto quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+  const auto newline = _mm_set1_epi8('\n'), carriage_return = _mm_set1_epi8('\r'), tab = _mm_set1_epi8('\t');
+  for (; 16 <= end - begin; begin += 16) {
+    const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    auto matches = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, newline));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, carriage_return));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, tab));
+    if (const auto mask = static_cast<unsigned>(_mm_movemask_epi8(matches))) {
+      return begin + lowestSetBit(mask);
+    }
+  }
+  return findDebugEscapeScalar(begin, end);
+}
+
+inline const char* findJsonEscapeSSE2(const char* begin, const char* end) noexcept {
+  const auto quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), last_control = _mm_set1_epi8(0x1f);
+  for (; 16 <= end - begin; begin += 16) {
+    const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    // There is no unsigned comparison, but max(c, 0x1f) == 0x1f exactly when c <= 0x1f.
+    auto matches = _mm_cmpeq_epi8(_mm_max_epu8(chunk, last_control), last_control);
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, quote));
+    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, backslash));
+    if (const auto mask = static_cast<unsigned>(_mm_movemask_epi8(matches))) {
+      return begin + lowestSetBit(mask);
+    }
+  }
+  return findJsonEscapeScalar(begin, end);
+}
+
+#endif  // LL_HAS_SSE2
+
+#if LL_HAS_AVX2_DISPATCH
+
+__attribute__((target("avx2"))) inline const char* findByteAVX2(const char* begin,
+                                                                const char* end,
+                                                                char c) noexcept {
+  const auto needle = _mm256_set1_epi8(c);
+  for (; 32 <= end - begin; begin += 32) {
+    const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    if (const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)))) {
+      return begin + lowestSetBit(mask);
+    }
+  }
+  return findByteSSE2(begin, end, c);
+}
+
+__attribute__((target("avx2"))) inline const char* findLastByteAVX2(const char* begin,
+                                                                    const char* end,
+                                                                    char c) noexcept {
+  const auto needle = _mm256_set1_epi8(c);
+  auto it = end;
+  for (; 32 <= it - begin; it -= 32) {
+    const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it - 32));
+    if (const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)))) {
+      return it - 32 + highestSetBit(mask);
+    }
+  }
+  const auto found = findLastByteSSE2(begin, it, c);
+  return found == it ? end : found;
+}
+
+__attribute__((target("avx2"))) inline const char* findDebugEscapeAVX2(const char* begin,
+                                                                       const char* end) noexcept {
+  const auto quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+  const auto newline = _mm256_set1_epi8('\n'), carriage_return = _mm256_set1_epi8('\r');
+  const auto tab = _mm256_set1_epi8('\t');
+  for (; 32 <= end - begin; begin += 32) {
+    const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    auto matches = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, newline));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, carriage_return));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, tab));
+    if (const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(matches))) {
+      return begin + lowestSetBit(mask);
+    }
+  }
+  return findDebugEscapeSSE2(begin, end);
+}
+
+__attribute__((target("avx2"))) inline const char* findJsonEscapeAVX2(const char* begin,
+                                                                      const char* end) noexcept {
+  const auto quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+  const auto last_control = _mm256_set1_epi8(0x1f);
+  for (; 32 <= end - begin; begin += 32) {
+    const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    auto matches = _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, last_control), last_control);
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, quote));
+    matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, backslash));
+    if (const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(matches))) {
+      return begin + lowestSetBit(mask);
+    }
+  }
+  return findJsonEscapeSSE2(begin, end);
+}
+
+#endif  // LL_HAS_AVX2_DISPATCH
+
+#if LL_HAS_NEON
+
+//! \brief Narrow a byte comparison result to a 64 bit mask with four bits per byte.
+inline std::uint64_t neonMask(uint8x16_t matches) noexcept {
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+}
+
+inline const char* findByteNEON(const char* begin, const char* end, char c) noexcept {
+  const auto needle = vdupq_n_u8(static_cast<std::uint8_t>(c));
+  for (; 16 <= end - begin; begin += 16) {
+    const auto chunk = vld1q_u8(reinterpret_cast<const std::uint8_t*>(begin));
+    if (const auto mask = neonMask(vceqq_u8(chunk, needle))) {
+      return begin + lowestSetBit(mask) / 4;
+    }
+  }
+  return findByteScalar(begin, end, c);
+}
+
+inline const char* findLastByteNEON(const char* begin, const char* end, char c) noexcept {
+  const auto needle = vdupq_n_u8(static_cast<std::uint8_t>(c));
+  auto it = end;
+  for (; 16 <= it - begin; it -= 16) {
+    const auto chunk = vld1q_u8(reinterpret_cast<const std::uint8_t*>(it - 16));
+    if (const auto mask = neonMask(vceqq_u8(chunk, needle))) {
+      return it - 16 + highestSetBit(mask) / 4;
+    }
+  }
+  const auto found = findLastByteScalar(begin, it, c);
+  return found == it ? end : found;
+}
+
+inline const char* findDebugEscapeNEON(const char* begin, const char* end) noexcept {
+  const auto quote = vdupq_n_u8('"'), backslash = vdupq_n_u8('\\');
+  const auto newline = vdupq_n_u8('\n'), carriage_return = vdupq_n_u8('\r'), tab = vdupq_n_u8('\t');
+  for (; 16 <= end - begin; begin += 16) {
+    const auto chunk = vld1q_u8(reinterpret_cast<const std::uint8_t*>(begin));
+    auto matches = vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash));
+    matches = vorrq_u8(matches, vceqq_u8(chunk, newline));
+    matches = vorrq_u8(matches, vceqq_u8(chunk, carriage_return));
+    matches = vorrq_u8(matches, vceqq_u8(chunk, tab));
+    if (const auto mask = neonMask(matches)) {
+      return begin + lowestSetBit(mask) / 4;
+    }
+  }
+  return findDebugEscapeScalar(begin, end);
+}
+
+inline const char* findJsonEscapeNEON(const char* begin, const char* end) noexcept {
+  const auto quote = vdupq_n_u8('"'), backslash = vdupq_n_u8('\\'), space = vdupq_n_u8(0x20);
+  for (; 16 <= end - begin; begin += 16) {
+    const auto chunk = vld1q_u8(reinterpret_cast<const std::uint8_t*>(begin));
+    auto matches = vorrq_u8(vcltq_u8(chunk, space), vceqq_u8(chunk, quote));
+    matches = vorrq_u8(matches, vceqq_u8(chunk, backslash));
+    if (const auto mask = neonMask(matches)) {
+      return begin + lowestSetBit(mask) / 4;
+    }
+  }
+  return findJsonEscapeScalar(begin, end);
+}
+
+#endif  // LL_HAS_NEON
+
+//! \brief The kernels for one instruction set.
+struct Kernels {
+  const char* (*find_byte)(const char*, const char*, char) noexcept;
+  const char* (*find_last_byte)(const char*, const char*, char) noexcept;
+  const char* (*find_debug_escape)(const char*, const char*) noexcept;
+  const char* (*find_json_escape)(const char*, const char*) noexcept;
+};
+
+//! \brief Below this length, the scalar kernels are called directly, since they can be inlined.
+constexpr std::ptrdiff_t min_vector_length = 16;
+
+}  // namespace detail
+
+//! \brief Check whether the kernels for an instruction set can be used on this machine.
+inline bool IsSupported(Isa isa) noexcept {
+  switch (isa) {
+    case Isa::Scalar:
+      return true;
+    case Isa::SSE2:
+      return LL_HAS_SSE2;
+    case Isa::AVX2:
+#if LL_HAS_AVX2_DISPATCH
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#else
+      return false;
+#endif
+    case Isa::NEON:
+      return LL_HAS_NEON;
+  }
+  return false;
+}
+
+//! \brief Get the fastest instruction set that is supported on this machine.
+inline Isa BestIsa() noexcept {
+  for (auto isa : {Isa::AVX2, Isa::SSE2, Isa::NEON}) {
+    if (IsSupported(isa)) {
+      return isa;
+    }
+  }
+  return Isa::Scalar;
+}
+
+namespace detail {
+
+inline const Kernels& getKernels(Isa isa) noexcept {
+  static constexpr Kernels scalar {
+      findByteScalar, findLastByteScalar, findDebugEscapeScalar, findJsonEscapeScalar};
+  switch (isa) {
+#if LL_HAS_SSE2
+    case Isa::SSE2: {
+      static constexpr Kernels sse2 {findByteSSE2, findLastByteSSE2, findDebugEscapeSSE2, findJsonEscapeSSE2};
+      return sse2;
+    }
+#endif
+#if LL_HAS_AVX2_DISPATCH
+    case Isa::AVX2: {
+      static constexpr Kernels avx2 {findByteAVX2, findLastByteAVX2, findDebugEscapeAVX2, findJsonEscapeAVX2};
+      return avx2;
+    }
+#endif
+#if LL_HAS_NEON
+    case Isa::NEON: {
+      static constexpr Kernels neon {findByteNEON, findLastByteNEON, findDebugEscapeNEON, findJsonEscapeNEON};
+      return neon;
+    }
+#endif
+    default:
+      return scalar;
+  }
+}
+
+//! \brief The kernels in use, the best supported ones unless set otherwise by SetIsa.
+inline std::atomic<Isa>& activeIsa() noexcept {
+  static std::atomic<Isa> isa {BestIsa()};
+  return isa;
+}
+
+inline const Kernels& activeKernels() noexcept {
+  return getKernels(activeIsa().load(std::memory_order_relaxed));
+}
+
+}  // namespace detail
+
+//! \brief Get the instruction set whose kernels are in use.
+inline Isa GetIsa() noexcept { return detail::activeIsa().load(std::memory_order_relaxed); }
+
+//! \brief Choose the instruction set whose kernels are used, e.g. for testing and benchmarking. By default, the
+//!        best supported instruction set is used.
+inline void SetIsa(Isa isa) {
+  LL_REQUIRE(IsSupported(isa), "instruction set is not supported on this machine");
+  detail::activeIsa().store(isa, std::memory_order_relaxed);
+}
+
+//! \brief Find the first occurrence of a character in a range, or end if there is none.
+inline const char* FindByte(const char* begin, const char* end, char c) noexcept {
+  if (end - begin < detail::min_vector_length) {
+    return detail::findByteScalar(begin, end, c);
+  }
+  return detail::activeKernels().find_byte(begin, end, c);
+}
+
+//! \brief Find the last occurrence of a character in a range, or end if there is none.
+inline const char* FindLastByte(const char* begin, const char* end, char c) noexcept {
+  if (end - begin < detail::min_vector_length) {
+    return detail::findLastByteScalar(begin, end, c);
+  }
+  return detail::activeKernels().find_last_byte(begin, end, c);
+}
+
+//! \brief Find the first character in a range that has to be escaped in a debug string, or end if there is
+//!        none. These are '"', '\\', '\n', '\r', and '\t'.
+inline const char* FindDebugEscape(const char* begin, const char* end) noexcept {
+  if (end - begin < detail::min_vector_length) {
+    return detail::findDebugEscapeScalar(begin, end);
+  }
+  return detail::activeKernels().find_debug_escape(begin, end);
+}
+
+//! \brief Find the first character in a range that has to be escaped in a JSON string, or end if there is
+//!        none. These are '"', '\\', and the control characters below 0x20.
+inline const char* FindJsonEscape(const char* begin, const char* end) noexcept {
+  if (end - begin < detail::min_vector_length) {
+    return detail::findJsonEscapeScalar(begin, end);
+  }
+  return detail::activeKernels().find_json_escape(begin, end);
+}
+
+}  // namespace simd
+
+// ==============================================================================
+//  Formatting.
+// ==============================================================================
+
+namespace formatting {
+namespace detail {
+
+//! \brief Store all powers of ten that fit in an unsigned long long.
+constexpr unsigned long long powers_of_ten[] = {
+    1,
+    10,
+    100,
+    1'000,
+    10'000,
+    100'000,
+    1'000'000,
+    10'000'000,
+    100'000'000,
+    1'000'000'000,
+    10'000'000'000,
+    100'000'000'000,
+    1'000'000'000'000,
+    10'000'000'000'000,
+    100'000'000'000'000,
+    1'000'000'000'000'000,
+    10'000'000'000'000'000,
+    100'000'000'000'000'000,
+    1'000'000'000'000'000'000,
+    10'000'000'000'000'000'000ull,
+};
+
+//! \brief The largest power of ten that fits in an unsigned long long.
+constexpr unsigned long long max_ull_power_of_ten = 10'000'000'000'000'000'000ull;
+
+//! \brief The largest power of ten that fits in an unsigned long long is (10 ^ log10_max_ull_power_of_ten).
+constexpr int log10_max_ull_power_of_ten = 19;
+
+}  // namespace detail
+
+//! \brief Returns how many digits the decimal representation of a ull will have.
+//!
+//! \param x The number to count the digits of.
 //! \param upper Indicates that the number has at most `upper` digits.
 inline unsigned NumberOfDigitsULL(const unsigned long long x,
                                   int upper = detail::log10_max_ull_power_of_ten) {
@@ -1167,6 +2345,10 @@ struct FmtData {
   //! \brief The requested width of the segment.
   unsigned width = 0;
 
+  //! \brief The requested precision, e.g. the number of digits after the decimal point of a floating point
+  //!        number, or -1 if no precision was requested.
+  int precision = -1;
+
   //! \brief The alignment of data within the segment. Default is left aligned.
   Alignment alignment = Alignment::Left;
 
@@ -1235,33 +2417,32 @@ inline void formatIntegerWithCommas(const unsigned long long x, memory::BasicMem
 //! \param str The string to format.
 //! \param buffer The buffer to format the string into.
 inline void formatDebugString(const std::string_view str, memory::BasicMemoryBuffer<char>& buffer) {
-  // Debug formatting.
+  buffer.ReserveAdditional(str.size() + 2);
   buffer.PushBack('"');
-  for (auto c : str) {
-    switch (c) {
-      case '"':
-        buffer.PushBack('\\');
-        buffer.PushBack('"');
-        break;
-      case '\\':
-        buffer.PushBack('\\');
-        buffer.PushBack('\\');
-        break;
+  // Copy runs of characters that do not need escaping in bulk.
+  for (auto it = str.data(), end = str.data() + str.size(); it != end;) {
+    const auto next = simd::FindDebugEscape(it, end);
+    buffer.Append(it, next);
+    if (next == end) {
+      break;
+    }
+    char escape[2] = {'\\', *next};
+    switch (*next) {
       case '\n':
-        buffer.PushBack('\\');
-        buffer.PushBack('n');
+        escape[1] = 'n';
         break;
       case '\r':
-        buffer.PushBack('\\');
-        buffer.PushBack('r');
+        escape[1] = 'r';
         break;
       case '\t':
-        buffer.PushBack('\\');
-        buffer.PushBack('t');
+        escape[1] = 't';
         break;
       default:
-        buffer.PushBack(c);
+        // '"' and '\\' are escaped as themselves.
+        break;
     }
+    buffer.Append(escape, escape + 2);
+    it = next + 1;
   }
   buffer.PushBack('"');
 }
@@ -1275,6 +2456,49 @@ inline const char* getHexDigits(const bool upper_case) {
   return upper_case ? upper_hex_digits : lower_hex_digits;
 }
 
+//! \brief Append a string to a buffer, escaped so that it can be the contents of a JSON string.
+//!
+//! \param str The string to escape.
+//! \param buffer The buffer to write the escaped string into.
+inline void appendJsonEscaped(const std::string_view str, memory::BasicMemoryBuffer<char>& buffer) {
+  buffer.ReserveAdditional(str.size());
+  // Copy runs of characters that do not need escaping in bulk.
+  for (auto it = str.data(), end = str.data() + str.size(); it != end;) {
+    const auto next = simd::FindJsonEscape(it, end);
+    buffer.Append(it, next);
+    if (next == end) {
+      break;
+    }
+    char escape[6] = {'\\', *next};
+    std::size_t size = 2;
+    switch (*next) {
+      case '\n':
+        escape[1] = 'n';
+        break;
+      case '\r':
+        escape[1] = 'r';
+        break;
+      case '\t':
+        escape[1] = 't';
+        break;
+      case '"':
+      case '\\':
+        break;
+      default: {
+        // Other control characters are written as \u00XX.
+        const auto hex_digits = getHexDigits(false);
+        const auto c = static_cast<unsigned char>(*next);
+        escape[1] = 'u', escape[2] = '0', escape[3] = '0';
+        escape[4] = hex_digits[c >> 4], escape[5] = hex_digits[c & 0xf];
+        size = 6;
+        break;
+      }
+    }
+    buffer.Append(escape, escape + size);
+    it = next + 1;
+  }
+}
+
 //! \brief Extract formatting options from the interior of a formatting segment, i.e. the section between the
 //!        '{' and '}' in a formatting string.
 //!
@@ -1342,6 +2566,17 @@ inline void extractFormatting(std::string_view fmt, FmtData& fmt_data) {
     std::from_chars(digits, digits + num_digits, fmt_data.width);
   }
 
+  // Get the precision.
+  if (index < fmt.size() && fmt[index] == '.') {
+    const auto begin = ++index;
+    while (index < fmt.size() && std::isdigit(fmt[index])) {
+      ++index;
+    }
+    LL_REQUIRE(begin != index && index - begin <= 4,
+               "invalid precision in format string '" << fmt << "', the precision must be 0 to 9999");
+    std::from_chars(fmt.data() + begin, fmt.data() + index, fmt_data.precision);
+  }
+
   // Check if number separators should be used.
   if (index < fmt.size() && fmt[index] == 'L') {
     ++index;
@@ -1540,6 +2775,7 @@ void FormatInteger(const std::string_view fmt,
   // Default type for integers is 'd' (decimal).
   fmt_data.type = 'd';
   detail::extractFormatting(fmt, fmt_data);
+  LL_REQUIRE(fmt_data.precision < 0, "cannot specify a precision for formatting an integer");
 
   // ==============================================================================
   //  All formatting discovered, do the formatting.
@@ -1605,6 +2841,138 @@ void FormatInteger(const std::string_view fmt,
   }
 }
 
+namespace detail {
+
+//! \brief Append text to a buffer, padded with the fill character to the requested width.
+inline void appendAligned(std::string_view text,
+                          const FmtData& fmt_data,
+                          memory::BasicMemoryBuffer<char>& buffer) {
+  const auto size = static_cast<unsigned>(text.size());
+  const auto padding = size < fmt_data.width ? fmt_data.width - size : 0u;
+  const auto left_width = fmt_data.alignment == Alignment::Right    ? padding
+                          : fmt_data.alignment == Alignment::Center ? padding / 2
+                                                                    : 0u;
+  buffer.AppendN(fmt_data.fill_char, left_width);
+  AppendBuffer(buffer, text);
+  buffer.AppendN(fmt_data.fill_char, padding - left_width);
+}
+
+//! \brief Write a floating point number to a buffer in the notation that a formatting type asks for, see
+//!        FormatFloat.
+template<typename Floating_t>
+void writeFloat(Floating_t number, char type, int precision, memory::BasicMemoryBuffer<char>& buffer) {
+  // The number is written with to_chars, or with snprintf if to_chars does not support the type.
+  [[maybe_unused]] auto format = std::chars_format::general;
+  switch (type) {
+    case '\0':
+    case 'g':
+    case 'G':
+      break;
+    case 'f':
+    case 'F':
+      format = std::chars_format::fixed;
+      break;
+    case 'e':
+    case 'E':
+      format = std::chars_format::scientific;
+      break;
+    default:
+      LL_FAIL("unrecognized / unhandled formatting option '" << type << "' for floating point segment");
+  }
+  // With neither a type nor a precision, the number is written in the shortest form that reads back exactly.
+  const bool shortest = type == '\0' && precision < 0;
+  if (!shortest && precision < 0) {
+    precision = 6;
+  }
+
+  char stack_text[64];
+  std::unique_ptr<char[]> heap_text;
+  char *begin = stack_text, *end = nullptr;
+  if constexpr (typetraits::has_to_chars<Floating_t>) {
+    auto write = [&](char* first, char* last) {
+      return shortest ? std::to_chars(first, last, number)
+                      : std::to_chars(first, last, number, format, precision);
+    };
+    auto result = write(stack_text, stack_text + sizeof(stack_text));
+    if (result.ec != std::errc {}) {
+      // Only fixed notation of large numbers, or a large precision, needs more space than the stack buffer.
+      const auto size =
+          static_cast<std::size_t>(std::numeric_limits<Floating_t>::max_exponent10 + precision + 8);
+      heap_text.reset(new char[size]);
+      begin = heap_text.get();
+      result = write(begin, begin + size);
+    }
+    end = result.ptr;
+    if ('A' <= type && type <= 'Z') {
+      std::transform(begin, end, begin, [](char c) { return static_cast<char>(std::toupper(c)); });
+    }
+  }
+  else {
+    if (shortest) {
+      // snprintf can not find the shortest form, but this many digits always read back as the same number.
+      precision = std::numeric_limits<Floating_t>::max_digits10;
+    }
+    const auto value = static_cast<long double>(number);
+    // The precision is passed as an argument, so each notation has a fixed format string.
+    auto print = [type, precision, value](char* text, std::size_t capacity) {
+      switch (type) {
+        case 'f':
+          return std::snprintf(text, capacity, "%.*Lf", precision, value);
+        case 'F':
+          return std::snprintf(text, capacity, "%.*LF", precision, value);
+        case 'e':
+          return std::snprintf(text, capacity, "%.*Le", precision, value);
+        case 'E':
+          return std::snprintf(text, capacity, "%.*LE", precision, value);
+        case 'G':
+          return std::snprintf(text, capacity, "%.*LG", precision, value);
+        default:
+          return std::snprintf(text, capacity, "%.*Lg", precision, value);
+      }
+    };
+    const auto length = print(stack_text, sizeof(stack_text));
+    LL_REQUIRE(0 <= length, "could not format floating point number");
+    const auto size = static_cast<std::size_t>(length);
+    if (sizeof(stack_text) <= size) {
+      heap_text.reset(new char[size + 1]);
+      begin = heap_text.get();
+      print(begin, size + 1);
+    }
+    end = begin + size;
+  }
+  buffer.Append(begin, end);
+}
+
+}  // namespace detail
+
+//! \brief Format a floating point number to a buffer, applying formatting options.
+//!
+//! The type is 'f' for fixed, 'e' for scientific, or 'g' for general notation, or their upper case versions,
+//! which write upper case exponents, "INF" and "NAN". The precision is the number of digits after the decimal
+//! point for fixed and scientific notation, and the number of significant digits for general notation, and is
+//! 6 if a type is given but no precision. With neither, the number is written in the shortest form that reads
+//! back as the same number. A width pads the number like it pads integers.
+//!
+//! \param fmt The formatting segment, what would go inside the "{}" in a usual format string.
+//! \param number The number to format.
+//! \param buffer The buffer to format the number into.
+template<typename Floating_t, LL_ENABLE_IF(std::is_floating_point_v<Floating_t>)>
+void FormatFloat(const std::string_view fmt,
+                 const Floating_t number,
+                 memory::BasicMemoryBuffer<char>& buffer) {
+  FmtData fmt_data;
+  detail::extractFormatting(fmt, fmt_data);
+  LL_REQUIRE(!fmt_data.use_separators,
+             "cannot specify use separators ('L') for formatting a floating point number");
+  if (fmt_data.width == 0) {
+    detail::writeFloat(number, fmt_data.type, fmt_data.precision, buffer);
+    return;
+  }
+  memory::MemoryBuffer<char, 64> temp_buffer;
+  detail::writeFloat(number, fmt_data.type, fmt_data.precision, temp_buffer);
+  detail::appendAligned(temp_buffer.ToView(), fmt_data, buffer);
+}
+
 //! \brief Format a string to a buffer, applying formatting options.
 //!
 //! \param fmt The formatting segment, what would go inside the "{}" in a usual format string.
@@ -1842,25 +3210,203 @@ inline std::string AnsiReset() {
 }
 
 //! \brief Count the number of characters in a range that are not part of an Ansi escape sequence.
+//!
+//! An escape sequence starts with an ESC and ends with the next 'm'.
 inline unsigned CountNonAnsiSequenceCharacters(const char* begin, const char* end) {
   unsigned count = 0;
-  bool in_escape = false;
-  for (auto it = begin; it != end; ++it) {
-    if (*it == '\x1b') {
-      in_escape = true;
+  while (begin != end) {
+    const auto escape = simd::FindByte(begin, end, '\x1b');
+    count += static_cast<unsigned>(escape - begin);
+    if (escape == end) {
+      break;
     }
-    if (!in_escape) {
-      ++count;
+    const auto escape_end = simd::FindByte(escape + 1, end, 'm');
+    begin = escape_end == end ? end : escape_end + 1;
+  }
+  return count;
+}
+
+
+// ==============================================================================
+//  Compile-time format strings.
+// ==============================================================================
+
+namespace detail {
+
+//! \brief Get the ANSI foreground color code for the name in a "{@NAME}" tag, or -1 if the name is not a
+//!        color. Matches the colors supported by getSpecialFormatter.
+constexpr int specialColorCode(std::string_view name) {
+  constexpr std::pair<std::string_view, AnsiForegroundColor> colors[] = {
+      {"DEFAULT", AnsiForegroundColor::Default},
+      {"RED", AnsiForegroundColor::Red},
+      {"BRED", AnsiForegroundColor::BrightRed},
+      {"GREEN", AnsiForegroundColor::Green},
+      {"BGREEN", AnsiForegroundColor::BrightGreen},
+      {"BLUE", AnsiForegroundColor::Blue},
+      {"BBLUE", AnsiForegroundColor::BrightBlue},
+      {"YELLOW", AnsiForegroundColor::Yellow},
+      {"BYELLOW", AnsiForegroundColor::BrightYellow},
+      {"CYAN", AnsiForegroundColor::Cyan},
+      {"BCYAN", AnsiForegroundColor::BrightCyan},
+      {"BLACK", AnsiForegroundColor::Black},
+      {"BBLACK", AnsiForegroundColor::BrightBlack},
+      {"WHITE", AnsiForegroundColor::White},
+      {"BWHITE", AnsiForegroundColor::BrightWhite},
+      {"MAGENTA", AnsiForegroundColor::Magenta},
+      {"BMAGENTA", AnsiForegroundColor::BrightMagenta},
+      {"RESET", AnsiForegroundColor::Reset},
+  };
+  for (auto& [color_name, color] : colors) {
+    if (color_name == name) {
+      return static_cast<int>(color);
     }
-    if (*it == 'm') {
-      in_escape = false;
+  }
+  return -1;
+}
+
+//! \brief A format string, parsed into the literal text between its slots and the format spec of each slot.
+//!
+//! The literal text has all escapes ("{{") resolved and all color tags ("{@RED}") replaced by their ANSI
+//! escape sequences. Resolving can only make the text shorter, so the literals fit in Capacity characters.
+template<std::size_t Capacity, std::size_t NumSlots>
+struct ParsedFormat {
+  //! \brief All the literal text, concatenated.
+  char literals[Capacity + 1] {};
+
+  //! \brief The end of the i-th literal in the literals array. The i-th literal starts where the previous
+  //!        one ends.
+  std::size_t literal_ends[NumSlots + 1] {};
+
+  //! \brief The start and size of the spec of each slot in the source format string.
+  std::size_t spec_begins[NumSlots + 1] {};
+  std::size_t spec_sizes[NumSlots + 1] {};
+};
+
+//! \brief Parse a format string at compile time. If the counting flag is set, only the slots are counted and
+//!        nothing is written into the parsed format.
+//!
+//! Follows the same rules as formatting::FormatTo, except that a malformed slot is a compile error.
+template<std::size_t Capacity, std::size_t NumSlots>
+constexpr std::size_t parseFormat(std::string_view fmt, ParsedFormat<Capacity, NumSlots>* parsed) {
+  std::size_t count = 0, out = 0;
+  auto emit = [&](char c) {
+    if (parsed) {
+      parsed->literals[out] = c;
+    }
+    ++out;
+  };
+  for (std::size_t i = 0; i < fmt.size(); ++i) {
+    if (fmt[i] != '{') {
+      emit(fmt[i]);
+      continue;
+    }
+    if (i + 1 == fmt.size()) {
+      emit('{');
+    }
+    else if (fmt[i + 1] == '{') {
+      emit('{');
+      ++i;
+    }
+    else if (fmt[i + 1] == '@') {
+      const auto close = fmt.find('}', i + 2);
+      const auto code = close == std::string_view::npos ? -1 : specialColorCode(fmt.substr(i + 2, close - i - 2));
+      if (code < 0) {
+        // Not a color tag, so the "{@" is just characters.
+        emit('{');
+        emit('@');
+        ++i;
+        continue;
+      }
+      emit('\x1b');
+      emit('[');
+      if (10 <= code) {
+        emit(static_cast<char>('0' + code / 10));
+      }
+      emit(static_cast<char>('0' + code % 10));
+      emit('m');
+      i = close;
+    }
+    else {
+      const auto close = fmt.find('}', i + 1);
+      if (close == std::string_view::npos) {
+        throw std::invalid_argument("unterminated slot in format string");
+      }
+      if (parsed) {
+        parsed->literal_ends[count] = out;
+        parsed->spec_begins[count] = i + 1;
+        parsed->spec_sizes[count] = close - i - 1;
+      }
+      ++count;
+      i = close;
     }
   }
+  if (parsed) {
+    parsed->literal_ends[count] = out;
+  }
   return count;
 }
 
+//! \brief Count the slots in a format string at compile time.
+constexpr std::size_t countFormatSlots(std::string_view fmt) {
+  return parseFormat<0, 0>(fmt, nullptr);
+}
+
+//! \brief Parse a format string with a known number of slots at compile time.
+template<std::size_t Capacity, std::size_t NumSlots>
+constexpr ParsedFormat<Capacity, NumSlots> parseFormatString(std::string_view fmt) {
+  ParsedFormat<Capacity, NumSlots> parsed {};
+  parseFormat(fmt, &parsed);
+  return parsed;
+}
+
+}  // namespace detail
+
+//! \brief A format string that is parsed at compile time, created with the LL_FMT macro.
+//!
+//! The source of the format string is a type with a static constexpr value() function returning the string,
+//! which the LL_FMT macro generates. Since the whole string is known at compile time, the positions of the
+//! slots and their format specs are found, and the color tags resolved, while compiling. Format functions
+//! that take a CompiledFormat can then check the number of arguments with a static_assert and write the
+//! literal text with a single copy per literal.
+template<typename Source_t>
+class CompiledFormat {
+  static constexpr std::string_view source_ = Source_t::value();
+  static constexpr std::size_t num_slots_ = detail::countFormatSlots(source_);
+  static constexpr auto parsed_ = detail::parseFormatString<source_.size(), num_slots_>(source_);
+
+public:
+  //! \brief Get the number of slots in the format string.
+  static constexpr std::size_t NumSlots() { return num_slots_; }
+
+  //! \brief Get the original format string.
+  static constexpr std::string_view Source() { return source_; }
+
+  //! \brief Get the I-th literal, the resolved text before the I-th slot (or after the last slot, for
+  //!        I == NumSlots()).
+  static constexpr std::string_view Literal(std::size_t i) {
+    const auto begin = i == 0 ? 0 : parsed_.literal_ends[i - 1];
+    return {parsed_.literals + begin, parsed_.literal_ends[i] - begin};
+  }
+
+  //! \brief Get the format spec of the I-th slot, what is between the "{" and "}".
+  static constexpr std::string_view Spec(std::size_t i) {
+    return source_.substr(parsed_.spec_begins[i], parsed_.spec_sizes[i]);
+  }
+};
+
 }  // namespace formatting
 
+//! \brief Create a formatting::CompiledFormat from a string literal, parsing it at compile time.
+//!
+//! E.g. formatting::Format(LL_FMT("{@RED}{}{@RESET} of {}"), x, y).
+#define LL_FMT(fmt_string)                                                    \
+  ([] {                                                                       \
+    struct LightningFormatSource {                                            \
+      static constexpr std::string_view value() { return fmt_string; }       \
+    };                                                                        \
+    return ::lightning::formatting::CompiledFormat<LightningFormatSource> {}; \
+  }())
+
 namespace time {
 
 //! \brief Streaming operator for DateTime. Put in the time namespace so it can be found by ADL.
@@ -1930,6 +3476,15 @@ struct BaseSegment {
   //! \param storage The storage to copy the segment into.
   virtual void CopyTo(class SegmentStorage& storage) const = 0;
 
+  //! \brief Copy the segment to the supplied storage, such that the copy does not refer to any memory that the
+  //!        segment does not own, e.g. the characters viewed by a string view segment.
+  //!
+  //! This is used when a record has to outlive the logging statement that created it, e.g. when it is queued
+  //! for another thread. By default, this is the same as CopyTo.
+  //!
+  //! \param storage The storage to copy the segment into.
+  virtual void CopyDetachedTo(class SegmentStorage& storage) const { CopyTo(storage); }
+
   //! \brief Indicates whether message indentation needs to be calculated.
   //!
   //! Some formatting segments need the message indentation (the distance from the start of the message back
@@ -1937,6 +3492,11 @@ struct BaseSegment {
   //! aligned newline. The indentation is only calculated if needed, to save time, since it is rarely needed.
   NO_DISCARD virtual bool NeedsMessageIndentation() const { return false; }
 
+  //! \brief Indicates whether the formatted segment depends on where the message starts in the formatted
+  //!        record, i.e. on the header in front of it. If no segment does, the formatted message can be shared
+  //!        by sinks whose headers differ.
+  NO_DISCARD virtual bool DependsOnPosition() const { return NeedsMessageIndentation(); }
+
 private:
   //! \brief Add the segment to the supplied buffer, using the given formatting settings.
   //!
@@ -1956,7 +3516,8 @@ private:
 //! \brief Object designed to store a base segment object.
 //!
 //! Acts like a unique pointer for an object deriving from BaseSegment, but uses a SBO to put small segments
-//! on the stack.
+//! on the stack. Larger segments are put in the thread's memory::ThreadArena if it is active, and on the heap
+//! otherwise.
 class SegmentStorage {
 public:
   //! \brief Default construct an empty SegmentStorage object.
@@ -1971,9 +3532,9 @@ public:
   }
 
   ~SegmentStorage() {
-    if (segment_pointer_ && !IsUsingBuffer()) {
-      if (IsUsingBuffer()) {
-        // Call the destructor manually.
+    if (segment_pointer_) {
+      if (IsUsingBuffer() || in_arena_) {
+        // Call the destructor manually, the arena releases its memory in bulk.
         segment_pointer_->~BaseSegment();
       }
       else {
@@ -1989,8 +3550,16 @@ public:
       segment_pointer_ = new (buffer_) Segment_t(std::forward<Args>(args)...);
     }
     else {
-      // Have to allocate on the heap.
-      segment_pointer_ = new Segment_t(std::forward<Args>(args)...);
+      auto& arena = memory::ThreadArena::Local();
+      if (auto ptr = arena.Allocate(sizeof(Segment_t), alignof(Segment_t))) {
+        segment_pointer_ = new (ptr) Segment_t(std::forward<Args>(args)...);
+        in_arena_ = true;
+      }
+      else {
+        // Have to allocate on the heap.
+        arena.NoteHeapAllocation(sizeof(Segment_t));
+        segment_pointer_ = new Segment_t(std::forward<Args>(args)...);
+      }
     }
     return *this;
   }
@@ -2019,6 +3588,9 @@ public:
 
   NO_DISCARD bool HasData() const { return segment_pointer_; }
 
+  //! \brief Check whether the segment was allocated in the thread's arena.
+  NO_DISCARD bool IsUsingArena() const { return in_arena_; }
+
   [[maybe_unused]] static constexpr std::size_t BufferSize() { return sizeof(buffer_); }
 
 private:
@@ -2035,7 +3607,9 @@ private:
       else {
         segment_pointer_ = storage.segment_pointer_;
       }
+      in_arena_ = storage.in_arena_;
       storage.segment_pointer_ = nullptr;
+      storage.in_arena_ = false;
     }
   }
 
@@ -2049,6 +3623,9 @@ private:
   //! \brief The internal buffer for data. Note that all BaseSegments have a vptr, so that takes up
   //!        sizeof(void*) bytes by itself.
   unsigned char buffer_[default_buffer_size] = {0};
+
+  //! \brief Whether the segment was placed in the thread's arena.
+  bool in_arena_ = false;
 };
 
 //! \brief Formatting segment that changes the coloration of a terminal.
@@ -2105,6 +3682,8 @@ struct FillUntil : public BaseSegment {
 
   void CopyTo(SegmentStorage& storage) const override { storage.Create<FillUntil>(*this); }
 
+  NO_DISCARD bool DependsOnPosition() const override { return pad_type_ == FmtDistanceType::TOTAL_LENGTH; }
+
 private:
   void addToBuffer(const FormattingSettings& settings,
                    const formatting::MessageInfo& msg_info,
@@ -2189,10 +3768,12 @@ NEW_TYPE_TRAIT(has_segment_formatter_v,
                    std::declval<std::decay_t<typetraits::remove_cvref_t<Value_t>>>()))
 
 //! \brief Template specialization for string segments.
+//!
+//! The segment keeps its own copy of the string, which is allocated in the thread's arena if it is active.
 template<>
 struct Segment<std::string> : public BaseSegment {
-  explicit Segment(std::string s)
-      : str_(std::move(s)) {}
+  explicit Segment(std::string_view s)
+      : str_(s.data(), s.size()) {}
 
   void CopyTo(SegmentStorage& storage) const override { storage.Create<Segment>(*this); }
 
@@ -2202,14 +3783,14 @@ private:
                    memory::BasicMemoryBuffer<char>& buffer,
                    [[maybe_unused]] const std::string_view& fmt) const override {
     if (!fmt.empty()) {
-      formatting::FormatString(fmt, str_, buffer);
+      formatting::FormatString(fmt, std::string_view(str_), buffer);
     }
     else {
-      AppendBuffer(buffer, str_);
+      AppendBuffer(buffer, std::string_view(str_));
     }
   }
 
-  const std::string str_;
+  const std::basic_string<char, std::char_traits<char>, memory::ArenaAllocator<char>> str_;
 };
 
 //! \brief Template specialization for string-view segments.
@@ -2220,6 +3801,10 @@ struct Segment<std::string_view> : public BaseSegment {
 
   void CopyTo(SegmentStorage& storage) const override { storage.Create<Segment>(*this); }
 
+  void CopyDetachedTo(SegmentStorage& storage) const override {
+    storage.Create<Segment<std::string>>(str_view_);
+  }
+
 private:
   void addToBuffer(const FormattingSettings&,
                    const formatting::MessageInfo&,
@@ -2245,6 +3830,10 @@ struct Segment<char*> : public BaseSegment {
 
   void CopyTo(SegmentStorage& storage) const override { storage.Create<Segment>(*this); }
 
+  void CopyDetachedTo(SegmentStorage& storage) const override {
+    storage.Create<Segment<std::string>>(std::string_view(cstr_, size_required_));
+  }
+
 private:
   void addToBuffer([[maybe_unused]] const FormattingSettings& settings,
                    const formatting::MessageInfo&,
@@ -2306,18 +3895,7 @@ private:
                    const formatting::MessageInfo&,
                    memory::BasicMemoryBuffer<char>& buffer,
                    [[maybe_unused]] const std::string_view& fmt) const override {
-    if constexpr (typetraits::has_to_chars<Floating_t>) {
-      constexpr std::size_t buffer_size = 64;
-      char serialization_buffer[buffer_size];
-      auto result = std::to_chars(serialization_buffer, serialization_buffer + buffer_size, number_);
-      auto string_length = static_cast<std::string_view::size_type>(result.ptr - serialization_buffer);
-      AppendBuffer(buffer, std::string_view(serialization_buffer, string_length));
-    }
-    else {
-      std::ostringstream stream;
-      stream << number_;
-      AppendBuffer(buffer, stream.str());
-    }
+    formatting::FormatFloat(fmt, number_, buffer);
   }
 
   Floating_t number_;
@@ -2422,7 +4000,44 @@ private:
   Segment<std::decay_t<typetraits::remove_cvref_t<T>>> segment_;
 };
 
+namespace detail {
+
+//! \brief Tags that describe the type of each argument that a RefBundle captures in deferred mode.
+//!
+//! Each captured argument is stored as its tag byte followed by its raw bytes. For strings, the raw bytes are a
+//! 32-bit length followed by the characters. Anything that cannot be captured becomes a regular segment, and a
+//! Segment tag, followed by the 32-bit index of the segment, marks where it goes in the message.
+enum class CaptureTag : unsigned char {
+  Segment,
+  Bool,
+  Char,
+  Signed,
+  Unsigned,
+  Float,
+  Double,
+  DateTime,
+  String,
+};
+
+//! \brief Whether a RefBundle in deferred mode stores a type as raw bytes instead of creating a segment.
+template<typename T>
+inline constexpr bool is_capturable_v =
+    std::is_same_v<T, bool> || std::is_same_v<T, char>
+    || (std::is_integral_v<T> && !std::is_same_v<T, wchar_t> && !std::is_same_v<T, char16_t>
+        && !std::is_same_v<T, char32_t> && sizeof(T) <= sizeof(std::uint64_t))
+    || std::is_same_v<T, float> || std::is_same_v<T, double> || std::is_same_v<T, time::DateTime>
+    || std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view> || std::is_same_v<T, char*>;
+
+}  // namespace detail
+
 //! \brief An object that has a bundle of data, to be formatted.
+//!
+//! Normally, every object streamed into the bundle becomes a segment right away. In deferred capture mode,
+//! the raw bytes of simple objects (numbers, characters, DateTimes, and the characters of strings) are instead
+//! copied into a compact buffer, along with a tag for their type, and are only turned into text when the
+//! record is formatted. This makes logging a simple object little more than a memcpy, moves the formatting work
+//! to wherever the record is formatted (e.g. the consumer thread of an AsyncSink), and means the bundle does
+//! not refer to any memory of the logging statement. See Core::SetDeferredFormatting.
 class RefBundle {
 public:
   //! \brief Stream data into a RefBundle.
@@ -2431,33 +4046,62 @@ public:
 
   template<typename Segment_t, typename... Args>
   void CreateSegment(Args&&... args) {
-    segments_.EmplaceBack();
-    segments_.Back().Create<Segment_t>(std::forward<Args>(args)...);
+    AddSegment().Create<Segment_t>(std::forward<Args>(args)...);
   }
 
   SegmentStorage& AddSegment() {
+    if (deferred_) {
+      captureTag(detail::CaptureTag::Segment);
+      captureRaw(static_cast<std::uint32_t>(segments_.Size()));
+    }
     segments_.EmplaceBack();
     return segments_.Back();
   }
 
+  //! \brief Set whether simple objects should be captured as raw bytes, and formatted later.
+  //!
+  //! This should be set before anything is streamed into the bundle.
+  void SetDeferredCapture(bool deferred) { deferred_ = deferred; }
+
+  //! \brief Check whether the bundle is in deferred capture mode.
+  NO_DISCARD bool IsDeferredCapture() const { return deferred_; }
+
   void FmtString(const FormattingSettings& settings,
                  memory::BasicMemoryBuffer<char>& buffer,
                  formatting::MessageInfo& msg_info) const {
     // Reset message length counter.
     msg_info.message_length = 0;
     msg_info.is_in_message_segment = true;
-    // Add message.
-    for (auto i = 0u; i < segments_.Size(); ++i) {
-      auto& bundle = segments_[i];
+    auto add_to_buffer = [&](const BaseSegment& segment) {
       const auto size_before = buffer.Size();
-      bundle.Get()->AddToBuffer(settings, msg_info, buffer);
+      segment.AddToBuffer(settings, msg_info, buffer);
       const auto size_after = buffer.Size();
       msg_info.message_length += static_cast<unsigned>(size_after - size_before);
       msg_info.total_length = static_cast<unsigned>(buffer.Size());
+    };
+    // Add message.
+    if (deferred_) {
+      formatCaptured(add_to_buffer);
+    }
+    else {
+      for (auto i = 0u; i < segments_.Size(); ++i) {
+        add_to_buffer(*segments_[i].Get());
+      }
     }
     msg_info.is_in_message_segment = false;
   }
 
+  //! \brief Copy all segments into another bundle, such that the copies do not refer to memory owned by
+  //!        anything other than the copies themselves.
+  void CopyDetachedTo(RefBundle& bundle) const {
+    for (auto i = 0u; i < segments_.Size(); ++i) {
+      segments_[i].Get()->CopyDetachedTo(bundle.AddSegment());
+    }
+    // Segments were added to the other bundle in the same order, so the captured segment indices stay valid.
+    bundle.captured_.Append(captured_);
+    bundle.deferred_ = deferred_;
+  }
+
   //! \brief Returns whether any segment needs the message indentation to be calculated.
   NO_DISCARD bool NeedsMessageIndentation() const {
     if (segments_.Empty()) {
@@ -2472,9 +4116,247 @@ public:
     return false;
   }
 
+  //! \brief Returns whether any segment depends on where the message starts in the formatted record.
+  //!
+  //! Captured values never do, so only the segments have to be checked.
+  NO_DISCARD bool DependsOnPosition() const {
+    for (auto i = 0u; i < segments_.Size(); ++i) {
+      if (segments_[i].Get()->DependsOnPosition()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //! \brief Write the message into a buffer as a sequence of tagged values, in the same format that deferred
+  //!        capture uses (see detail::CaptureTag). Segments that are not simple values are formatted with the
+  //!        given settings and written as strings.
+  //!
+  //! Since the message is not formatted as a whole, segments that need the message indentation see an
+  //! indentation of zero.
+  void EncodeTo(const FormattingSettings& settings, memory::BasicMemoryBuffer<char>& buffer) const {
+    formatting::MessageInfo msg_info {};
+    memory::MemoryBuffer<char> formatted;
+    auto encode_segment = [&](const BaseSegment& segment) {
+      formatted.Clear();
+      segment.AddToBuffer(settings, msg_info, formatted);
+      buffer.PushBack(static_cast<char>(detail::CaptureTag::String));
+      const auto size = static_cast<std::uint32_t>(formatted.Size());
+      buffer.Append(reinterpret_cast<const char*>(&size), reinterpret_cast<const char*>(&size) + sizeof(size));
+      buffer.Append(formatted);
+    };
+
+    if (!deferred_) {
+      for (auto i = 0u; i < segments_.Size(); ++i) {
+        encode_segment(*segments_[i].Get());
+      }
+      return;
+    }
+    for (auto ptr = captured_.Data(); ptr < captured_.End();) {
+      const auto tag = static_cast<detail::CaptureTag>(*ptr);
+      const auto size = 1 + payloadSize(tag, ptr + 1, static_cast<std::size_t>(captured_.End() - ptr - 1));
+      if (tag == detail::CaptureTag::Segment) {
+        std::uint32_t index;
+        std::memcpy(&index, ptr + 1, sizeof(index));
+        encode_segment(*segments_[index].Get());
+      }
+      else {
+        buffer.Append(reinterpret_cast<const char*>(ptr), reinterpret_cast<const char*>(ptr + size));
+      }
+      ptr += size;
+    }
+  }
+
+  //! \brief Append values that were written by EncodeTo to the bundle. This puts the bundle in deferred
+  //!        capture mode.
+  void AppendEncoded(std::string_view encoded) {
+    LL_REQUIRE(deferred_ || segments_.Empty(), "cannot append encoded values after immediate segments");
+    const auto begin = reinterpret_cast<const unsigned char*>(encoded.data());
+    // Check that the encoded values are well formed before accepting them.
+    for (std::size_t i = 0; i < encoded.size();) {
+      const auto tag = static_cast<detail::CaptureTag>(begin[i]);
+      LL_REQUIRE(tag != detail::CaptureTag::Segment && tag <= detail::CaptureTag::String,
+                 "invalid tag " << static_cast<int>(begin[i]) << " in encoded values");
+      i += 1 + payloadSize(tag, begin + i + 1, encoded.size() - i - 1);
+    }
+    deferred_ = true;
+    captured_.Append(begin, begin + encoded.size());
+  }
+
 private:
-  //! \brief Segment storage, use a stack size of 10.
-  memory::HybridVector<SegmentStorage, 10> segments_;
+  //! \brief Get the size of the payload that follows a tag in the captured bytes, checking that it fits in the
+  //!        remaining bytes.
+  static std::size_t payloadSize(detail::CaptureTag tag, const unsigned char* payload, std::size_t remaining) {
+    using detail::CaptureTag;
+    std::size_t size = 0;
+    switch (tag) {
+      case CaptureTag::Bool:
+        size = sizeof(bool);
+        break;
+      case CaptureTag::Char:
+        size = sizeof(char);
+        break;
+      case CaptureTag::Signed:
+        size = sizeof(std::int64_t);
+        break;
+      case CaptureTag::Unsigned:
+        size = sizeof(std::uint64_t);
+        break;
+      case CaptureTag::Float:
+        size = sizeof(float);
+        break;
+      case CaptureTag::Double:
+        size = sizeof(double);
+        break;
+      case CaptureTag::DateTime:
+        size = sizeof(time::DateTime);
+        break;
+      case CaptureTag::Segment:
+        size = sizeof(std::uint32_t);
+        break;
+      case CaptureTag::String: {
+        std::uint32_t length = 0;
+        LL_REQUIRE(sizeof(length) <= remaining, "truncated string in encoded values");
+        std::memcpy(&length, payload, sizeof(length));
+        size = sizeof(length) + length;
+        break;
+      }
+    }
+    LL_REQUIRE(size <= remaining, "truncated value in encoded values");
+    return size;
+  }
+
+  void captureTag(detail::CaptureTag tag) { captured_.PushBack(static_cast<unsigned char>(tag)); }
+
+  template<typename T>
+  void captureRaw(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    auto [begin, _] = captured_.Allocate(sizeof(T));
+    std::memcpy(begin, &value, sizeof(T));
+  }
+
+  void captureString(std::string_view str) {
+    captureTag(detail::CaptureTag::String);
+    captureRaw(static_cast<std::uint32_t>(str.size()));
+    auto [begin, _] = captured_.Allocate(str.size());
+    std::memcpy(begin, str.data(), str.size());
+  }
+
+  //! \brief Capture a simple, non-string object. Only used in deferred mode.
+  template<typename T>
+  void capture(T value) {
+    using detail::CaptureTag;
+    if constexpr (std::is_same_v<T, bool>) {
+      captureTag(CaptureTag::Bool);
+      captureRaw(value);
+    }
+    else if constexpr (std::is_same_v<T, char>) {
+      captureTag(CaptureTag::Char);
+      captureRaw(value);
+    }
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      captureTag(CaptureTag::Signed);
+      captureRaw(static_cast<std::int64_t>(value));
+    }
+    else if constexpr (std::is_integral_v<T>) {
+      captureTag(CaptureTag::Unsigned);
+      captureRaw(static_cast<std::uint64_t>(value));
+    }
+    else if constexpr (std::is_same_v<T, float>) {
+      captureTag(CaptureTag::Float);
+      captureRaw(value);
+    }
+    else if constexpr (std::is_same_v<T, double>) {
+      captureTag(CaptureTag::Double);
+      captureRaw(value);
+    }
+    else {
+      static_assert(std::is_same_v<T, time::DateTime>);
+      captureTag(CaptureTag::DateTime);
+      captureRaw(value);
+    }
+  }
+
+  //! \brief Turn each captured object back into a segment, in order, and pass it to the function.
+  template<typename Func_t>
+  void formatCaptured(Func_t&& func) const {
+    using detail::CaptureTag;
+    auto ptr = captured_.Data();
+    const auto end = captured_.End();
+    auto read = [&ptr](auto& value) {
+      std::memcpy(&value, ptr, sizeof(value));
+      ptr += sizeof(value);
+    };
+    while (ptr < end) {
+      const auto tag = static_cast<CaptureTag>(*ptr++);
+      switch (tag) {
+        case CaptureTag::Segment: {
+          std::uint32_t index;
+          read(index);
+          func(*segments_[index].Get());
+          break;
+        }
+        case CaptureTag::Bool: {
+          bool value;
+          read(value);
+          func(Segment<bool>(value));
+          break;
+        }
+        case CaptureTag::Char: {
+          char value;
+          read(value);
+          func(Segment<char>(value));
+          break;
+        }
+        case CaptureTag::Signed: {
+          std::int64_t value;
+          read(value);
+          func(Segment<std::int64_t>(value));
+          break;
+        }
+        case CaptureTag::Unsigned: {
+          std::uint64_t value;
+          read(value);
+          func(Segment<std::uint64_t>(value));
+          break;
+        }
+        case CaptureTag::Float: {
+          float value;
+          read(value);
+          func(Segment<float>(value));
+          break;
+        }
+        case CaptureTag::Double: {
+          double value;
+          read(value);
+          func(Segment<double>(value));
+          break;
+        }
+        case CaptureTag::DateTime: {
+          time::DateTime value;
+          read(value);
+          func(Segment<time::DateTime>(value));
+          break;
+        }
+        case CaptureTag::String: {
+          std::uint32_t size;
+          read(size);
+          func(Segment<std::string_view>(std::string_view(reinterpret_cast<const char*>(ptr), size)));
+          ptr += size;
+          break;
+        }
+      }
+    }
+  }
+
+  //! \brief Segment storage, use a stack size of 10. Overflow goes to the thread's arena if it is active.
+  memory::HybridVector<SegmentStorage, 10, memory::ArenaAllocator<SegmentStorage>> segments_;
+
+  //! \brief The tags and raw bytes of the objects captured in deferred mode.
+  memory::MemoryBuffer<unsigned char, 128> captured_;
+
+  //! \brief Whether the bundle is in deferred capture mode.
+  bool deferred_ = false;
 };
 
 //! \brief  Create a type trait that determines if a 'format_logstream' function has been defined for a type.
@@ -2492,6 +4374,19 @@ RefBundle& RefBundle::operator<<(T&& obj) {
     obj.CopyTo(AddSegment());
   }
   else if constexpr (has_segment_formatter_v<decay_t>) {
+    if constexpr (detail::is_capturable_v<decay_t>) {
+      if (deferred_) {
+        if constexpr (std::is_same_v<decay_t, std::string> || std::is_same_v<decay_t, std::string_view>
+                      || std::is_same_v<decay_t, char*>)
+        {
+          captureString(std::string_view(obj));
+        }
+        else {
+          capture<decay_t>(obj);
+        }
+        return *this;
+      }
+    }
     // Add a formatting segment.
     CreateSegment<Segment<decay_t>>(obj);
   }
@@ -2500,9 +4395,17 @@ RefBundle& RefBundle::operator<<(T&& obj) {
     operator<<(to_string(std::forward<T>(obj)));
   }
   else if constexpr (typetraits::is_ostreamable_v<decay_t>) {
-    std::ostringstream str;
-    str << obj;
-    operator<<(str.str());
+    // Stream into a buffer on the stack, which the segment (or the capture) copies.
+    memory::MemoryBuffer<char> text;
+    memory::BufferStreambuf streambuf(text);
+    std::ostream stream(&streambuf);
+    stream << obj;
+    if (deferred_) {
+      captureString(text.ToView());
+    }
+    else {
+      CreateSegment<Segment<std::string>>(text.ToView());
+    }
   }
   else {
     static_assert(typetraits::always_false_v<T>, "No streaming available for this type");
@@ -2510,60 +4413,231 @@ RefBundle& RefBundle::operator<<(T&& obj) {
   return *this;
 }
 
-//! \brief Base class for "freestanding" attributes that can be attached to logging messages,
-//!        but are not the "permanent" record attributes like severity, time, logger name, etc.
+//! \brief Intern a string, returning a view of a copy of it that stays valid for the rest of the program.
+//!
+//! Interning takes a lock, so it is meant for strings that are used over and over, like attribute keys or
+//! tenant names, not for strings that are different in every record.
+inline std::string_view InternString(std::string_view str) {
+  static std::mutex mutex;
+  static std::set<std::string, std::less<>> strings;
+  std::lock_guard guard(mutex);
+  auto it = strings.find(str);
+  if (it == strings.end()) {
+    it = strings.emplace(str).first;
+  }
+  return *it;
+}
+
+//! \brief A typed key/value pair that can be attached to logging messages, in addition to the "permanent"
+//!        record attributes like severity, time, logger name, etc. These are the fields of structured
+//!        logging.
 //!
-//! NOTE(Nate): I have not put a lot of time or attention into this class, so it does not do much right now,
-//!             but it is here for future expansion.
-class Attribute : public ImplBase {
+//! Attributes are small, trivially copyable values, stored inline in records, so attaching one never
+//! allocates. Keys and string values are views. Keys should be string literals or interned strings (see
+//! InternString). String values must outlive the record, with the exception that sinks which keep records
+//! after they are dispatched, like AsyncSink, copy them. Interned string values are never copied.
+class Attribute {
 public:
-  class Impl : public ImplBase::Impl {
-  public:
-    NO_DISCARD virtual std::unique_ptr<Impl> Copy() const = 0;
-  };
+  enum class Type : std::uint8_t { Int, UInt, Float, Bool, String, InternedString };
+
+  //! \brief Left uninitialized, so that arrays of attributes cost nothing until they are used.
+  Attribute() = default;
+
+  template<typename Number_t,
+           LL_ENABLE_IF(std::is_arithmetic_v<Number_t> && !std::is_same_v<Number_t, bool>
+                        && !std::is_same_v<Number_t, char>)>
+  Attribute(std::string_view key, Number_t value)
+      : key_(key) {
+    if constexpr (std::is_floating_point_v<Number_t>) {
+      type_ = Type::Float;
+      value_.float_value = static_cast<double>(value);
+    }
+    else if constexpr (std::is_signed_v<Number_t>) {
+      type_ = Type::Int;
+      value_.int_value = value;
+    }
+    else {
+      type_ = Type::UInt;
+      value_.uint_value = value;
+    }
+  }
 
-  NO_DISCARD Attribute Copy() const { return Attribute(impl<Attribute>()->Copy()); }
+  Attribute(std::string_view key, bool value)
+      : key_(key)
+      , type_(Type::Bool) {
+    value_.bool_value = value;
+  }
+
+  Attribute(std::string_view key, std::string_view value, Type type = Type::String)
+      : key_(key)
+      , type_(type)
+      , size_(static_cast<std::uint32_t>(value.size())) {
+    LL_ASSERT(type == Type::String || type == Type::InternedString, "not a string attribute type");
+    value_.string_value = value.data();
+  }
 
-  explicit Attribute(std::unique_ptr<Impl>&& impl)
-      : ImplBase(std::move(impl)) {}
+  Attribute(std::string_view key, const char* value)
+      : Attribute(key, std::string_view(value)) {}
 
-  Attribute(const Attribute& other)
-      : ImplBase(other.impl<Attribute>()->Copy()) {}
+  Attribute(std::string_view key, const std::string& value)
+      : Attribute(key, std::string_view(value)) {}
 
-  Attribute& operator=(const Attribute& other) {
-    impl_ = other.impl<Attribute>()->Copy();
-    return *this;
+  //! \brief The value would be destroyed before the record is, so it has to be interned, see Interned.
+  Attribute(std::string_view key, std::string&& value) = delete;
+
+  //! \brief Create an attribute whose value is interned, so it stays valid however long records are kept.
+  static Attribute Interned(std::string_view key, std::string_view value) {
+    return {key, InternString(value), Type::InternedString};
   }
-};
 
-//! \brief The integer type used for severity.
-using SeverityInt_t = int32_t;
+  NO_DISCARD std::string_view GetKey() const { return key_; }
 
-//! \brief Severity enum.
-enum class Severity : SeverityInt_t {
-  Trace = 0b1,
-  Debug = 0b10,
-  Info = 0b100,
-  Major = 0b1000,
-  Warning = 0b10000,
-  Error = 0b100000,
-  Fatal = 0b1000000
+  NO_DISCARD Type GetType() const { return type_; }
+
+  //! \brief Whether the value is a string, interned or not.
+  NO_DISCARD bool IsString() const { return type_ == Type::String || type_ == Type::InternedString; }
+
+  NO_DISCARD std::int64_t GetInt() const { return value_.int_value; }
+
+  NO_DISCARD std::uint64_t GetUInt() const { return value_.uint_value; }
+
+  NO_DISCARD double GetFloat() const { return value_.float_value; }
+
+  NO_DISCARD bool GetBool() const { return value_.bool_value; }
+
+  NO_DISCARD std::string_view GetString() const { return {value_.string_value, size_}; }
+
+  //! \brief Point a string value at another, equal, string, e.g. at a copy owned by a queued record.
+  void Rebind(std::string_view value) {
+    LL_ASSERT(IsString() && value.size() == size_, "can only rebind a string value to an equal string");
+    value_.string_value = value.data();
+  }
+
+private:
+  std::string_view key_;
+
+  union {
+    std::int64_t int_value;
+    std::uint64_t uint_value;
+    double float_value;
+    bool bool_value;
+    const char* string_value;
+  } value_;
+
+  Type type_;
+
+  //! \brief The length of a string value.
+  std::uint32_t size_;
 };
 
-//! \brief A vector of all severities.
-static std::vector ALL_SEVERITIES {Severity::Trace,
-                                   Severity::Debug,
-                                   Severity::Info,
-                                   Severity::Major,
-                                   Severity::Warning,
-                                   Severity::Error,
-                                   Severity::Fatal};
+//! \brief A fixed capacity list of attributes, stored inline, so that adding attributes to a record does not
+//!        allocate.
+class AttributeList {
+public:
+  //! \brief The largest number of attributes that a list can hold.
+  static constexpr std::size_t capacity = 8;
 
-//! \brief Return the index of a severity level in the ALL_SEVERITIES vector.
-inline int SeverityIndex(Severity severity) {
-  switch (severity) {
-    case Severity::Trace:
-      return 0;
+  AttributeList() = default;
+
+  AttributeList(const AttributeList& other)
+      : size_(other.size_) {
+    std::copy(other.begin(), other.end(), attributes_);
+  }
+
+  AttributeList& operator=(const AttributeList& other) {
+    size_ = other.size_;
+    std::copy(other.begin(), other.end(), attributes_);
+    return *this;
+  }
+
+  //! \brief Add an attribute, replacing any attribute with the same key. If the list is full, the attribute
+  //!        is discarded and false is returned.
+  bool Set(const Attribute& attribute) {
+    for (auto& existing : *this) {
+      if (existing.GetKey() == attribute.GetKey()) {
+        existing = attribute;
+        return true;
+      }
+    }
+    if (size_ == capacity) {
+      return false;
+    }
+    attributes_[size_++] = attribute;
+    return true;
+  }
+
+  //! \brief Find the attribute with a key, or null if there is none.
+  NO_DISCARD const Attribute* Find(std::string_view key) const {
+    for (auto& attribute : *this) {
+      if (attribute.GetKey() == key) {
+        return &attribute;
+      }
+    }
+    return nullptr;
+  }
+
+  void Clear() { size_ = 0; }
+
+  NO_DISCARD std::size_t Size() const { return size_; }
+
+  NO_DISCARD bool Empty() const { return size_ == 0; }
+
+  NO_DISCARD Attribute* begin() { return attributes_; }
+  NO_DISCARD Attribute* end() { return attributes_ + size_; }
+  NO_DISCARD const Attribute* begin() const { return attributes_; }
+  NO_DISCARD const Attribute* end() const { return attributes_ + size_; }
+
+private:
+  Attribute attributes_[capacity];
+  std::size_t size_ = 0;
+};
+
+//! \brief The integer type used for severity.
+using SeverityInt_t = int32_t;
+
+//! \brief Severity enum.
+enum class Severity : SeverityInt_t {
+  Trace = 0b1,
+  Debug = 0b10,
+  Info = 0b100,
+  Major = 0b1000,
+  Warning = 0b10000,
+  Error = 0b100000,
+  Fatal = 0b1000000
+};
+
+//! \brief The lowest severity for which LOG_SEV and LOG_SEV_TO statements are compiled.
+//!
+//! Set by defining LL_MIN_SEVERITY to the name of a severity, e.g. -DLL_MIN_SEVERITY=Info (or with the CMake
+//! option LIGHTNING_MIN_SEVERITY). Statements with a lower severity are still type checked, but are discarded
+//! at compile time, so neither the check nor the streamed expressions end up in the binary.
+#ifdef LL_MIN_SEVERITY
+inline constexpr Severity min_compiled_severity = Severity::LL_MIN_SEVERITY;
+#else
+inline constexpr Severity min_compiled_severity = Severity::Trace;
+#endif  // LL_MIN_SEVERITY
+
+//! \brief Whether LOG_SEV and LOG_SEV_TO statements with the severity are compiled, see min_compiled_severity.
+//!
+//! Severities are single bits that grow with the severity, so comparing the bit values orders them.
+constexpr bool IsCompiledIn(Severity severity) {
+  return static_cast<SeverityInt_t>(min_compiled_severity) <= static_cast<SeverityInt_t>(severity);
+}
+
+//! \brief A vector of all severities.
+static std::vector ALL_SEVERITIES {Severity::Trace,
+                                   Severity::Debug,
+                                   Severity::Info,
+                                   Severity::Major,
+                                   Severity::Warning,
+                                   Severity::Error,
+                                   Severity::Fatal};
+
+//! \brief Return the index of a severity level in the ALL_SEVERITIES vector.
+inline int SeverityIndex(Severity severity) {
+  switch (severity) {
+    case Severity::Trace:
+      return 0;
     case Severity::Debug:
       return 1;
     case Severity::Info:
@@ -2581,6 +4655,15 @@ inline int SeverityIndex(Severity severity) {
   }
 }
 
+//! \brief Get the name of a severity level, e.g. "Warning".
+inline std::string_view SeverityName(Severity severity) {
+  static constexpr std::string_view names[] = {
+      "Trace", "Debug", "Info", "Major", "Warning", "Error", "Fatal"};
+  const auto index = SeverityIndex(severity);
+  LL_REQUIRE(index != -1, "unrecognized severity");
+  return names[index];
+}
+
 //! \brief A "severity set," which acts as a filter of which severities are "acceptable."
 //!
 //! This is encoded as a bit mask. Boolean operations can be performed on SeveritySets to create more complex
@@ -2682,20 +4765,58 @@ inline SeveritySet operator!=(LoggingSeverity_t, Severity severity) {
   return severity != LoggingSeverity;
 }
 
+//! \brief The integer type used for thread IDs.
+using ThreadID_t = std::uint64_t;
+
 namespace detail {
 
-inline std::string ThreadIDAsString() {
-  std::ostringstream stream;
-  stream << std::this_thread::get_id();
-  return stream.str();
+//! \brief Ask the OS for the ID of the current thread.
+inline ThreadID_t osThreadID() {
+#if defined(__linux__)
+  return static_cast<ThreadID_t>(::syscall(SYS_gettid));
+#elif defined(__APPLE__)
+  std::uint64_t thread_id {};
+  pthread_threadid_np(nullptr, &thread_id);
+  return thread_id;
+#elif defined(_WIN32)
+  return static_cast<ThreadID_t>(::GetCurrentThreadId());
+#else
+  return static_cast<ThreadID_t>(std::hash<std::thread::id> {}(std::this_thread::get_id()));
+#endif
+}
+
+//! \brief What records need to know about the thread that created them.
+struct ThreadInfo {
+  ThreadID_t id = osThreadID();
+
+  //! \brief The name of the thread, interned, or empty if the thread has no name.
+  std::string_view name {};
+};
+
+inline ThreadInfo& currentThread() {
+  thread_local ThreadInfo info;
+  return info;
 }
 
 }  // namespace detail
 
-//! \brief Get a const reference to the thread ID string.
-inline const std::string& GetThreadID() {
-  thread_local auto thread_id = detail::ThreadIDAsString();
-  return thread_id;
+//! \brief Get the OS thread ID of the current thread, e.g. gettid() on Linux. This is the number that tools
+//!        like top and perf show, so log lines can be matched with profiles.
+inline ThreadID_t GetThreadID() {
+  return detail::currentThread().id;
+}
+
+//! \brief Name the current thread. The name is attached to every record that the thread creates afterwards.
+//!
+//! The name is interned (see InternString), so that it stays valid after the thread exits, which matters for
+//! records that are formatted on another thread, e.g. by an AsyncSink. An empty name removes the name.
+inline void SetThreadName(std::string_view name) {
+  detail::currentThread().name = name.empty() ? std::string_view {} : InternString(name);
+}
+
+//! \brief Get the name of the current thread, or an empty string if it has none.
+inline std::string_view GetThreadName() {
+  return detail::currentThread().name;
 }
 
 //! \brief Go through a file path at compile time to get the index of where the file name starts in a path.
@@ -2709,9 +4830,64 @@ constexpr std::size_t GetFileNameIndex(const char* file_name) {
   return index;
 }
 
+//! \brief Describes the place in the code that a logging statement is at.
+//!
+//! The logging macros create one of these as a static constexpr object for each statement, so a record only
+//! has to store a pointer to it, the offset of the file name in the path is worked out at compile time, and
+//! the address of the call site is a stable key for the statement, e.g. for the string table of a binary log.
+struct CallSite {
+  constexpr CallSite() = default;
+
+  constexpr CallSite(const char* file_path,
+                     const char* function_name,
+                     const std::optional<unsigned> line_number,
+                     const std::optional<Severity> severity = {})
+      : file_path(file_path)
+      , file_name_index(file_path ? GetFileNameIndex(file_path) : 0)
+      , function_name(function_name)
+      , line_number(line_number)
+      , severity(severity) {}
+
+  //! \brief The name of the file, without the directories in its path. Null if there is no file path.
+  NO_DISCARD constexpr const char* FileName() const { return file_path ? file_path + file_name_index : nullptr; }
+
+  //! \brief Const char* to the path of the file, as given by __FILE__. Null if no file path.
+  const char* file_path {};
+
+  //! \brief The index in the file path at which the file name starts.
+  std::size_t file_name_index {};
+
+  //! \brief Const char* to the function name. Null if no function name.
+  const char* function_name {};
+
+  //! \brief Optionally, the line number that the log is from.
+  std::optional<unsigned> line_number {};
+
+  //! \brief The severity of the logging statement, if it has a fixed severity.
+  std::optional<Severity> severity {};
+};
+
+namespace detail {
+
+//! \brief Get a call site for a location that does not have a static call site, e.g. one given to the
+//!        deprecated BasicAttributes constructor. The call site lives for the rest of the program, and there
+//!        is one per distinct file name, function name, and line number pointer triple.
+inline const CallSite* InternCallSite(const char* file_path,
+                                      const char* function_name,
+                                      unsigned line_number) {
+  static std::mutex mutex;
+  static std::map<std::tuple<const char*, const char*, unsigned>, CallSite> call_sites;
+  std::lock_guard guard(mutex);
+  auto [it, _] = call_sites.try_emplace(
+      std::make_tuple(file_path, function_name, line_number), file_path, function_name, line_number);
+  return &it->second;
+}
+
+}  // namespace detail
+
 //! \brief Structure storing very common attributes that a logging message will often have.
 //!
-//! Additional attributes can be implemented as Attribute objects.
+//! Additional attributes are Attribute objects, see RecordAttributes.
 struct BasicAttributes {
   BasicAttributes() = default;
 
@@ -2725,24 +4901,42 @@ struct BasicAttributes {
       time_stamp = time::DateTime::Now();
   }
 
-  //! \brief Create a basic attributes with all possible data.
+  //! \brief Create a basic attributes for a record from a call site, which must outlive the record.
+  explicit BasicAttributes(const std::optional<Severity> lvl, const CallSite* call_site)
+      : level(lvl)
+      , call_site(call_site) {}
+
+  //! \brief Create a basic attributes with a file name, function name, and line number.
   //!
-  //! Note that we usually set do_timestamp off, since loggers create their own timestamps with their fast
-  //! datetime generators.
+  //! Records now point at a static call site instead of carrying the location. This looks up a call site for
+  //! the location, under a lock, every time, so it is slower than passing a static call site.
+  [[deprecated("use BasicAttributes(level, &call_site), see LL_CALL_SITE")]]
   explicit BasicAttributes(const std::optional<Severity> lvl,
                            const char* file_name,
                            const char* function_name,
                            const unsigned line_number)
       : level(lvl)
-      , file_name(file_name)
-      , function_name(function_name)
-      , line_number(line_number) {}
+      , call_site(detail::InternCallSite(file_name, function_name, line_number)) {}
+
+  //! \brief Create a basic attributes for a record that was not created on the current thread, e.g. a record
+  //!        read back from a log file. The call site and the thread name must outlive the attributes.
+  BasicAttributes(const std::optional<Severity> lvl,
+                  const CallSite* call_site,
+                  ThreadID_t thread_id,
+                  std::string_view thread_name = {})
+      : level(lvl)
+      , thread_id(thread_id)
+      , thread_name(thread_name)
+      , call_site(call_site) {}
 
   //! \brief The severity level of the record.
   std::optional<Severity> level {};
 
-  //! \brief String representation of the thread ID.
-  const std::string& thread_id = GetThreadID();
+  //! \brief The OS thread ID of the thread that created the record, see GetThreadID.
+  ThreadID_t thread_id = detail::currentThread().id;
+
+  //! \brief The name of the thread that created the record, see SetThreadName. Empty if it has no name.
+  std::string_view thread_name = detail::currentThread().name;
 
   //! \brief The time at which the record was created.
   std::optional<time::DateTime> time_stamp {};
@@ -2750,16 +4944,16 @@ struct BasicAttributes {
   //! \brief A string view of the name of the logger which sent a message.
   std::string_view logger_name {};
 
-  //! \brief Const char* to the file name. Null if no file name.
-  const char* file_name {};
-
-  //! \brief Const char* to the function name. Null if no function name.
-  const char* function_name {};
+  //! \brief The attributes of the logger which sent a message, which are not copied into the record. Null if
+  //!        the logger has none.
+  const AttributeList* logger_attributes {};
 
-  //! \brief Optionally, the line number that the log is from.
-  std::optional<unsigned> line_number {};
+  //! \brief The place in the code that the record was logged from. Null if it is not known.
+  const CallSite* call_site {};
 };
 
+static_assert(std::is_trivially_copyable_v<BasicAttributes>, "records are copied into queues as raw bytes");
+
 //! \brief A filter that checks whether a record should be accepted solely based on its severity.
 //!
 //! Essentially, this is a wrapper around a SeveritySet, plus an option to accept messages that do not have a
@@ -2800,9 +4994,32 @@ struct RecordAttributes {
   template<typename... Attrs_t>
   explicit RecordAttributes(const BasicAttributes basic_attributes = {}, Attrs_t&&... attrs)
       : basic_attributes(basic_attributes) {
-    if constexpr (0 < sizeof...(Attrs_t)) {
-      attributes.reserve(sizeof...(attrs));
-      (attributes.emplace_back(std::forward<Attrs_t>(attrs)), ...);
+    static_assert(sizeof...(Attrs_t) <= AttributeList::capacity, "too many attributes for a record");
+    (attributes.Set(Attribute(std::forward<Attrs_t>(attrs))), ...);
+  }
+
+  //! \brief Find an attribute of the record, or of the logger that logged it, by key. The record's own
+  //!        attributes take precedence. Returns null if neither has one.
+  NO_DISCARD const Attribute* FindAttribute(std::string_view key) const {
+    if (auto attribute = attributes.Find(key)) {
+      return attribute;
+    }
+    return basic_attributes.logger_attributes ? basic_attributes.logger_attributes->Find(key) : nullptr;
+  }
+
+  //! \brief Call a function on every attribute, first the logger's, then the record's. Logger attributes that
+  //!        the record overrides are skipped.
+  template<typename Func_t>
+  void ForEachAttribute(Func_t&& func) const {
+    if (auto logger_attributes = basic_attributes.logger_attributes) {
+      for (auto& attribute : *logger_attributes) {
+        if (!attributes.Find(attribute.GetKey())) {
+          func(attribute);
+        }
+      }
+    }
+    for (auto& attribute : attributes) {
+      func(attribute);
     }
   }
 
@@ -2811,87 +5028,87 @@ struct RecordAttributes {
   BasicAttributes basic_attributes {};
 
   //! \brief Additional attributes, beyond the basic attributes.
-  std::vector<Attribute> attributes;
+  AttributeList attributes;
 };
 
-namespace filter {
-
-//! \brief Class that can be configured to test whether a record should be accepted based on its attributes.
-class AttributeFilter {
-public:
-  virtual ~AttributeFilter() = default;
+namespace detail {
 
-  NO_DISCARD bool WillAccept(const RecordAttributes& attributes) const {
-    // Check basic attributes.
-    if (!severity_filter_.Check(attributes.basic_attributes.level)) {
-      return false;
-    }
-    return willAccept(attributes.attributes);
-  }
+//! \brief Bit in an acceptance mask that stands for "a message with no severity".
+constexpr std::uint64_t acceptance_no_severity_bit = 1u << 7;
 
-  //! \brief Check if a message whose only attribute is severity of the specified level will be accepted.
-  NO_DISCARD bool WillAccept(std::optional<Severity> severity) const {
-    return severity_filter_.Check(severity);
-  }
+//! \brief Bit in an acceptance mask that marks the mask as up to date.
+constexpr std::uint64_t acceptance_valid_bit = 1u << 8;
 
-  //! \brief Set the severity levels that will be accepted.
-  AttributeFilter& Accept(const std::set<Severity>& acceptable) {
-    for (auto sev : ALL_SEVERITIES) {
-      severity_filter_.SetAcceptance(sev, acceptable.count(sev) != 0);
-    }
-    return *this;
-  }
+//! \brief Get the bit in an acceptance mask that corresponds to a severity (or lack of severity).
+//!
+//! Severities are single bits, all of which are below the no-severity bit.
+constexpr std::uint64_t AcceptanceBit(std::optional<Severity> severity) {
+  return severity ? static_cast<std::uint64_t>(*severity) : acceptance_no_severity_bit;
+}
 
-  AttributeFilter& Accept(SeveritySet acceptable) {
-    severity_filter_.SetAcceptance(acceptable);
-    return *this;
+//! \brief Process wide registry of the acceptance masks that cores cache.
+//!
+//! A cached mask is the union of everything a core and its sinks accept. Since filters can be modified in place
+//! (e.g. via Sink::GetFilter()), and a filter does not know which cores it feeds, any change to any filter
+//! invalidates every registered mask. Filters change rarely, so this is cheap, and it keeps the check on the
+//! logging path to a single relaxed load.
+//!
+//! An invalidated mask holds a new generation number in its upper bits. A core that recomputes its mask only
+//! installs the result if the mask still holds the generation it saw before it started, so an invalidation
+//! that races with the recomputation is never lost.
+class AcceptanceCacheRegistry {
+public:
+  //! \brief Get the registry. It is deliberately leaked, so cores that are destroyed during static
+  //!        destruction can still unregister.
+  static AcceptanceCacheRegistry& Get() {
+    static auto registry = new AcceptanceCacheRegistry;
+    return *registry;
   }
 
-  //! \brief Shortcut for accepting all severities.
-  AttributeFilter& Accept(LoggingSeverity_t) {
-    severity_filter_.SetAcceptance(SeveritySet(true));
-    return *this;
+  void Register(std::atomic<std::uint64_t>* cache) {
+    std::lock_guard guard(mutex_);
+    caches_.push_back(cache);
   }
 
-  //! \brief Set whether a message with no severity level should be accepted.
-  AttributeFilter& AcceptNoSeverity(bool flag) {
-    severity_filter_.AcceptNoSeverity(flag);
-    return *this;
+  void Unregister(std::atomic<std::uint64_t>* cache) {
+    std::lock_guard guard(mutex_);
+    caches_.erase(std::remove(caches_.begin(), caches_.end(), cache), caches_.end());
   }
 
-  //! \brief Reset the filter.
-  AttributeFilter& Clear() {
-    ClearBasicSeverityFilter();
-    additional_filters_.clear();
-    return *this;
-  }
+  //! \brief Get the number of invalidations so far, which changes whenever any filter is modified.
+  NO_DISCARD std::uint32_t Generation() const { return generation_.load(std::memory_order_acquire); }
 
-  //! \brief Reset just the basic severity filter, setting it to accept all messages regardless of severity,
-  //!        and leaving the additional filters intact.
-  AttributeFilter& ClearBasicSeverityFilter() {
-    severity_filter_ = BasicSeverityFilter();
-    return *this;
+  //! \brief Invalidate every registered acceptance mask.
+  void InvalidateAll() {
+    std::lock_guard guard(mutex_);
+    const auto generation = generation_.fetch_add(1, std::memory_order_relaxed) + 1;
+    const auto invalidated = static_cast<std::uint64_t>(generation) << 32;
+    for (auto cache : caches_) {
+      cache->store(invalidated, std::memory_order_release);
+    }
   }
 
 private:
-  //! \brief Private implementation of whether a message should be accepted based on its attributes.
-  NO_DISCARD virtual bool willAccept([[maybe_unused]] const std::vector<Attribute>& attributes) const {
-    // TODO.
-    return true;
-  }
+  std::mutex mutex_;
+  std::vector<std::atomic<std::uint64_t>*> caches_;
+  std::atomic<std::uint32_t> generation_ {};
+};
 
-  //! \brief The filter used to decide if a record should be accepted based on its severity settings.
-  BasicSeverityFilter severity_filter_;
+//! \brief Invalidate the acceptance mask of every core. Called whenever a filter or the set of sinks changes.
+inline void InvalidateAcceptanceCaches() {
+  AcceptanceCacheRegistry::Get().InvalidateAll();
+}
 
-  //! \brief Additional filters that can be applied to records to see if they should be accepted.
-  //!
-  //! These are and-ed with the basic severity filter, so if some more complex filtering is desired, e.g.
-  //! "accept info if the logger name is 'foo,' otherwise, accept warning or higher" then the basic severity
-  //! filter should be cleared, and only the additional filters should be used.
-  std::vector<std::function<bool(const RecordAttributes&)>> additional_filters_;
-};
+}  // namespace detail
+
+namespace filter {
+
+class Program;
 
 //! \brief Convenient base class for objects that do some simple testing of records based on their attributes.
+//!
+//! Tests are combined with &&, || and !, which builds a tree of tests. Filters do not evaluate the tree, they
+//! compile it into a flat Program, see AttributeFilter::Require.
 class AttributeTest : public ImplBase {
   friend class ImplBase;
 
@@ -2901,1822 +5118,6303 @@ public:
     return impl<AttributeTest>()->Accepts(attributes);
   }
 
-protected:
-  explicit AttributeTest(const std::shared_ptr<Impl>& impl)
-      : ImplBase(impl) {}
+  //! \brief Append the test to a program, in postfix order.
+  void CompileTo(Program& program) const { impl<AttributeTest>()->CompileTo(program); }
 
-  class Impl : public ImplBase::Impl {
+protected:
+  class Impl
+      : public ImplBase::Impl
+      , public std::enable_shared_from_this<Impl> {
   public:
     NO_DISCARD virtual bool Accepts(const RecordAttributes& attributes) const = 0;
-  };
-};
 
-//! \brief Attribute test representing the conjunction of two other tests.
-class ConjunctionTest final : public AttributeTest {
-  friend class ImplBase;
-
-protected:
-  class Impl final : public AttributeTest::Impl {
-  public:
-    Impl(const AttributeTest& lhs, const AttributeTest& rhs)
-        : lhs(lhs)
-        , rhs(rhs) {}
-    NO_DISCARD bool Accepts(const RecordAttributes& attributes) const override {
-      return lhs.Accepts(attributes) && rhs.Accepts(attributes);
-    }
-    AttributeTest lhs, rhs;
+    //! \brief Append the test to a program. By default, the program calls Accepts through a predicate, so
+    //!        tests that are defined outside the library work, but do not get the compiled fast path.
+    inline virtual void CompileTo(Program& program) const;
   };
 
-public:
-  ConjunctionTest(const AttributeTest& lhs, const AttributeTest& rhs)
-      : AttributeTest(std::make_shared<Impl>(lhs, rhs)) {}
+  explicit AttributeTest(const std::shared_ptr<Impl>& impl)
+      : ImplBase(impl) {}
 };
 
-//! \brief AttributeTest representing the disjunction of two other tests.
-class DisjunctionTest final : public AttributeTest {
-  friend class ImplBase;
+//! \brief A filter, compiled to a flat sequence of instructions that are evaluated in postfix order on a
+//!        stack of bits, so a record is checked without any indirect calls (except for Predicate tests).
+//!
+//! Strings that tests compare against are interned in the program, and instructions refer to them by index.
+//! When a program is finished, it works out for which severities its result can be true, and for which it is
+//! true regardless of the other attributes. The first lets filters fold the program into the acceptance mask
+//! that cores check before they create a record, the second lets them skip running the program.
+class Program {
+public:
+  enum class Op : std::uint8_t {
+    //! \brief Push whether the severity bit (see lightning::detail::AcceptanceBit) is in the mask in `arg`.
+    Severity,
+    //! \brief Push whether the logger name equals string `arg`.
+    LoggerName,
+    //! \brief Push whether the logger name starts with string `arg`.
+    LoggerNamePrefix,
+    //! \brief Push whether the record has a call site whose file path starts with string `arg`.
+    FilePathPrefix,
+    //! \brief Push whether the record has a call site whose function name starts with string `arg`.
+    FunctionNamePrefix,
+    //! \brief Push whether the record (or its logger) has an attribute with key `arg`.
+    HasAttribute,
+    //! \brief Push whether the record (or its logger) has a string attribute with key `arg & 0xffff` whose
+    //!        value is string `arg >> 16`.
+    AttributeIs,
+    //! \brief Push the result of predicate `arg`.
+    Predicate,
+    //! \brief Pop two results, push their conjunction.
+    And,
+    //! \brief Pop two results, push their disjunction.
+    Or,
+    //! \brief Pop a result, push its negation.
+    Not,
+  };
 
-protected:
-  class Impl final : public AttributeTest::Impl {
-  public:
-    Impl(const AttributeTest& lhs, const AttributeTest& rhs)
-        : lhs(lhs)
-        , rhs(rhs) {}
-    NO_DISCARD bool Accepts(const RecordAttributes& attributes) const override {
-      return lhs.Accepts(attributes) || rhs.Accepts(attributes);
-    }
-    AttributeTest lhs, rhs;
+  struct Instruction {
+    Op op;
+    std::uint32_t arg;
   };
 
-public:
-  DisjunctionTest(const AttributeTest& lhs, const AttributeTest& rhs)
-      : AttributeTest(std::make_shared<Impl>(lhs, rhs)) {}
-};
+  //! \brief The largest number of intermediate results, the stack is the bits of a single integer.
+  static constexpr std::size_t max_depth = 64;
 
-//! \brief AttributeTest representing the negation of another test.
-class NegationTest final : public AttributeTest {
-  friend class ImplBase;
+  //! \brief Add an instruction that takes no argument.
+  Program& Emit(Op op) { return Emit(op, 0); }
 
-protected:
-  class Impl final : public AttributeTest::Impl {
-  public:
-    explicit Impl(const AttributeTest& test)
-        : test(test) {}
-    NO_DISCARD bool Accepts(const RecordAttributes& attributes) const override {
-      return !test.Accepts(attributes);
+  Program& Emit(Op op, std::uint32_t arg) {
+    LL_REQUIRE(!finished_, "cannot add instructions to a finished program");
+    switch (op) {
+      case Op::And:
+      case Op::Or:
+        LL_REQUIRE(2 <= depth_, "not enough operands for a binary operation");
+        --depth_;
+        break;
+      case Op::Not:
+        LL_REQUIRE(1 <= depth_, "not enough operands for a negation");
+        break;
+      default:
+        ++depth_;
+        LL_REQUIRE(depth_ <= max_depth, "filter program is too deeply nested");
+        break;
     }
-    AttributeTest test;
-  };
+    code_.push_back({op, arg});
+    return *this;
+  }
 
-public:
-  explicit NegationTest(const AttributeTest& test)
-      : AttributeTest(std::make_shared<Impl>(test)) {}
-};
+  //! \brief Add an instruction that compares against a string, interning the string.
+  Program& Emit(Op op, std::string_view str) { return Emit(op, intern(str)); }
 
-inline ConjunctionTest operator&&(const AttributeTest& lhs, const AttributeTest& rhs) {
-  return {lhs, rhs};
-}
+  //! \brief Add an instruction that compares against two strings, e.g. an attribute's key and value.
+  Program& Emit(Op op, std::string_view first, std::string_view second) {
+    const auto first_id = intern(first), second_id = intern(second);
+    LL_REQUIRE(first_id <= 0xffff && second_id <= 0xffff, "too many strings in a filter program");
+    return Emit(op, first_id | (second_id << 16));
+  }
 
-inline DisjunctionTest operator||(const AttributeTest& lhs, const AttributeTest& rhs) {
-  return {lhs, rhs};
-}
+  //! \brief Add an instruction that calls a predicate.
+  Program& Emit(std::function<bool(const RecordAttributes&)> predicate) {
+    predicates_.push_back(std::move(predicate));
+    return Emit(Op::Predicate, static_cast<std::uint32_t>(predicates_.size() - 1));
+  }
 
-inline NegationTest operator!(const AttributeTest& test) {
-  return NegationTest(test);
-}
+  //! \brief Append another program's instructions, e.g. to combine it with this program.
+  Program& Append(const Program& other) {
+    for (auto [op, arg] : other.code_) {
+      switch (op) {
+        case Op::LoggerName:
+        case Op::LoggerNamePrefix:
+        case Op::FilePathPrefix:
+        case Op::FunctionNamePrefix:
+        case Op::HasAttribute:
+          Emit(op, std::string_view(other.strings_[arg]));
+          break;
+        case Op::AttributeIs:
+          Emit(op, other.strings_[arg & 0xffff], other.strings_[arg >> 16]);
+          break;
+        case Op::Predicate:
+          Emit(other.predicates_[arg]);
+          break;
+        default:
+          Emit(op, arg);
+          break;
+      }
+    }
+    return *this;
+  }
 
-}  // namespace filter
+  //! \brief Finish the program, which must leave exactly one result, and work out how it depends on severity.
+  Program& Finish() {
+    LL_REQUIRE(depth_ == 1, "a filter program must leave exactly one result, not " << depth_);
+    may_accept_mask_ = always_accept_mask_ = 0;
+    for (std::size_t i = 0; i <= ALL_SEVERITIES.size(); ++i) {
+      const auto bit = i < ALL_SEVERITIES.size()
+                           ? lightning::detail::AcceptanceBit(ALL_SEVERITIES[i])
+                           : lightning::detail::acceptance_no_severity_bit;
+      const auto result = evaluateForSeverity(bit);
+      if (result != Tri::False) {
+        may_accept_mask_ |= bit;
+      }
+      if (result == Tri::True) {
+        always_accept_mask_ |= bit;
+      }
+    }
+    finished_ = true;
+    return *this;
+  }
 
-// Forward declare core.
-class Core;
+  //! \brief Run the program on a record's attributes.
+  NO_DISCARD bool Run(const RecordAttributes& attributes) const {
+    const auto& basic = attributes.basic_attributes;
+    std::uint64_t stack = 0;
+    for (auto [op, arg] : code_) {
+      bool result;
+      switch (op) {
+        case Op::Severity:
+          result = (lightning::detail::AcceptanceBit(basic.level) & arg) != 0;
+          break;
+        case Op::LoggerName:
+          result = basic.logger_name == strings_[arg];
+          break;
+        case Op::LoggerNamePrefix:
+          result = startsWith(basic.logger_name, strings_[arg]);
+          break;
+        case Op::FilePathPrefix:
+          result = basic.call_site && basic.call_site->file_path
+                   && startsWith(basic.call_site->file_path, strings_[arg]);
+          break;
+        case Op::FunctionNamePrefix:
+          result = basic.call_site && basic.call_site->function_name
+                   && startsWith(basic.call_site->function_name, strings_[arg]);
+          break;
+        case Op::HasAttribute:
+          result = attributes.FindAttribute(strings_[arg]) != nullptr;
+          break;
+        case Op::AttributeIs: {
+          auto attribute = attributes.FindAttribute(strings_[arg & 0xffff]);
+          result = attribute && attribute->IsString() && attribute->GetString() == strings_[arg >> 16];
+          break;
+        }
+        case Op::Predicate:
+          result = predicates_[arg](attributes);
+          break;
+        case Op::And:
+          stack = (stack >> 2 << 1) | ((stack >> 1) & stack & 1);
+          continue;
+        case Op::Or:
+          stack = (stack >> 2 << 1) | (((stack >> 1) | stack) & 1);
+          continue;
+        case Op::Not:
+          stack ^= 1;
+          continue;
+        default:
+          LL_FAIL("invalid filter instruction");
+      }
+      stack = (stack << 1) | static_cast<std::uint64_t>(result);
+    }
+    return stack & 1;
+  }
 
-//! \brief The result of logging, a collection of a message, attributes, and values.
-class Record {
-public:
-  Record() = default;
+  //! \brief Check whether the program can accept a record with the severity, given its other attributes.
+  NO_DISCARD bool MayAccept(std::optional<Severity> severity) const {
+    return (may_accept_mask_ & lightning::detail::AcceptanceBit(severity)) != 0;
+  }
 
-  template<typename... Attrs_t>
-  explicit Record(BasicAttributes basic_attributes = {}, Attrs_t&&... attrs)
-      : attributes_(basic_attributes, std::forward<Attrs_t>(attrs)...) {}
+  //! \brief Check whether the program accepts every record with the severity, whatever its other attributes.
+  NO_DISCARD bool AlwaysAccepts(std::optional<Severity> severity) const {
+    return (always_accept_mask_ & lightning::detail::AcceptanceBit(severity)) != 0;
+  }
 
-  //! \brief Get the message bundle from the record.
-  RefBundle& Bundle() { return bundle_; }
+  NO_DISCARD const std::vector<Instruction>& GetCode() const { return code_; }
 
-  //! \brief Get a const ref to the RefBundle of the record.
-  NO_DISCARD const RefBundle& Bundle() const { return bundle_; }
+  NO_DISCARD const std::vector<std::string>& GetStrings() const { return strings_; }
 
-  //! \brief Get the record attributes.
-  NO_DISCARD const RecordAttributes& Attributes() const { return attributes_; }
+private:
+  //! \brief Three valued logic, for results that are not known without the record's other attributes.
+  enum class Tri : std::uint8_t { False, True, Unknown };
+
+  NO_DISCARD Tri evaluateForSeverity(std::uint64_t severity_bit) const {
+    std::vector<Tri> stack;
+    for (auto [op, arg] : code_) {
+      switch (op) {
+        case Op::Severity:
+          stack.push_back((severity_bit & arg) != 0 ? Tri::True : Tri::False);
+          break;
+        case Op::And:
+        case Op::Or: {
+          const auto rhs = stack.back();
+          stack.pop_back();
+          auto& lhs = stack.back();
+          const auto dominant = op == Op::And ? Tri::False : Tri::True;
+          if (lhs == dominant || rhs == dominant) {
+            lhs = dominant;
+          }
+          else if (lhs == Tri::Unknown || rhs == Tri::Unknown) {
+            lhs = Tri::Unknown;
+          }
+          break;
+        }
+        case Op::Not:
+          if (stack.back() != Tri::Unknown) {
+            stack.back() = stack.back() == Tri::True ? Tri::False : Tri::True;
+          }
+          break;
+        default:
+          stack.push_back(Tri::Unknown);
+          break;
+      }
+    }
+    return stack.back();
+  }
 
-  NO_DISCARD RecordAttributes& Attributes() { return attributes_; }
+  std::uint32_t intern(std::string_view str) {
+    auto it = std::find(strings_.begin(), strings_.end(), str);
+    const auto id = static_cast<std::uint32_t>(it - strings_.begin());
+    if (it == strings_.end()) {
+      strings_.emplace_back(str);
+    }
+    return id;
+  }
 
-  //! \brief Try to open the record for a core. Returns whether the record opened.
-  inline bool TryOpen(std::shared_ptr<Core> core);
+  static bool startsWith(std::string_view str, std::string_view prefix) {
+    return prefix.size() <= str.size() && std::memcmp(str.data(), prefix.data(), prefix.size()) == 0;
+  }
 
-  //! \brief Test whether a record is open.
-  inline explicit operator bool() const;
+  std::vector<Instruction> code_;
+  std::vector<std::string> strings_;
+  std::vector<std::function<bool(const RecordAttributes&)>> predicates_;
 
-  //! \brief Dispatch the record to the associated core.
-  inline void Dispatch();
+  std::size_t depth_ = 0;
+  bool finished_ = false;
+  std::uint64_t may_accept_mask_ = 0, always_accept_mask_ = 0;
+};
 
-private:
-  //! \brief The log message, contained as a RefBundle.
-  RefBundle bundle_ {};
+void AttributeTest::Impl::CompileTo(Program& program) const {
+  // The predicate keeps the test alive, since the program can outlive the AttributeTest it was compiled from.
+  program.Emit(
+      [test = shared_from_this()](const RecordAttributes& attributes) { return test->Accepts(attributes); });
+}
 
-  //! \brief The attributes collection of the message.
-  RecordAttributes attributes_ {};
+//! \brief Remembers the results of the programs that were already run on a record, so that sinks that share a
+//!        filter (e.g. because one was cloned from the other) only run it once.
+class EvaluationCache {
+public:
+  //! \brief Run the program, unless its result for this record is already known.
+  bool Run(const Program& program, const RecordAttributes& attributes) {
+    for (std::size_t i = 0; i < size_; ++i) {
+      if (entries_[i].program == &program) {
+        return entries_[i].result;
+      }
+    }
+    const auto result = program.Run(attributes);
+    if (size_ < entries_.size()) {
+      entries_[size_++] = {&program, result};
+    }
+    return result;
+  }
+
+private:
+  struct Entry {
+    const Program* program;
+    bool result;
+  };
 
-  //! \brief The core that the record is destined for, or null if the record is closed.
-  std::shared_ptr<Core> core_ {};
+  std::array<Entry, 8> entries_ {};
+  std::size_t size_ = 0;
 };
 
-//! \brief An RAII structure that dispatches the contained record upon the destruction of the
-//!        RecordDispatcher.
-class RecordDispatcher {
+//! \brief Class that can be configured to test whether a record should be accepted based on its attributes.
+//!
+//! A filter has a severity filter, and optionally a compiled Program, which is and-ed with it. Programs are
+//! immutable and shared between copies of a filter.
+//!
+//! Every modification of a filter invalidates the acceptance masks that cores cache, see
+//! detail::AcceptanceCacheRegistry.
+class AttributeFilter {
 public:
-  //! \brief Create a closed, empty record.
-  RecordDispatcher() = default;
-
-  //! \brief Wrap a record in a record handler.
-  [[maybe_unused]] explicit RecordDispatcher(Record&& record)
-      : record_(std::move(record))
-      , uncaught_exceptions_(std::uncaught_exceptions()) {}
+  AttributeFilter() = default;
+  AttributeFilter(const AttributeFilter&) = default;
+  AttributeFilter(AttributeFilter&&) = default;
+
+  AttributeFilter& operator=(const AttributeFilter& other) {
+    severity_filter_ = other.severity_filter_;
+    program_ = other.program_;
+    lightning::detail::InvalidateAcceptanceCaches();
+    return *this;
+  }
 
-  //! \brief Construct a record handler, constructing the record in-place inside it.
-  template<typename... Attrs_t>
-  explicit RecordDispatcher(std::shared_ptr<Core> core,
-                            BasicAttributes basic_attributes = {},
-                            Attrs_t&&... attrs)
-      : record_(basic_attributes, std::forward<Attrs_t>(attrs)...)
-      , uncaught_exceptions_(std::uncaught_exceptions()) {
-    record_.TryOpen(std::move(core));
+  AttributeFilter& operator=(AttributeFilter&& other) noexcept {
+    severity_filter_ = other.severity_filter_;
+    program_ = std::move(other.program_);
+    lightning::detail::InvalidateAcceptanceCaches();
+    return *this;
   }
 
-  //! \brief RecordDispatcher is an RAII structure for dispatching records.
-  ~RecordDispatcher() {
-    if (std::uncaught_exceptions() <= uncaught_exceptions_) {
-      record_.Dispatch();
+  virtual ~AttributeFilter() = default;
+
+  NO_DISCARD bool WillAccept(const RecordAttributes& attributes) const {
+    // Check basic attributes.
+    if (!severity_filter_.Check(attributes.basic_attributes.level)) {
+      return false;
+    }
+    if (program_ && !program_->AlwaysAccepts(attributes.basic_attributes.level)
+        && !program_->Run(attributes))
+    {
+      return false;
     }
+    return willAccept(attributes.attributes);
   }
 
-  //! \brief Check whether a record is open.
-  NO_DISCARD bool RecordIsOpen() const { return static_cast<bool>(record_); }
-
-  //! \brief Check whether a record is open via explicit conversion to bool.
-  explicit operator bool() const { return RecordIsOpen(); }
+  //! \brief Check whether the filter accepts the record, using the cache to avoid running a program that was
+  //!        already run on the record.
+  NO_DISCARD bool WillAccept(const RecordAttributes& attributes, EvaluationCache& cache) const {
+    if (!severity_filter_.Check(attributes.basic_attributes.level)) {
+      return false;
+    }
+    if (program_ && !program_->AlwaysAccepts(attributes.basic_attributes.level)
+        && !cache.Run(*program_, attributes))
+    {
+      return false;
+    }
+    return willAccept(attributes.attributes);
+  }
 
-  //! \brief Get the record from the RecordDispatcher.
-  Record& GetRecord() { return record_; }
+  //! \brief Check if a message whose only attribute is severity of the specified level could be accepted.
+  //!
+  //! This includes the severities that the filter's program could accept, which is what lets the program
+  //! reject records through the cores' acceptance masks.
+  NO_DISCARD bool WillAccept(std::optional<Severity> severity) const {
+    return severity_filter_.Check(severity) && (!program_ || program_->MayAccept(severity));
+  }
 
-  template<typename T>
-  RecordDispatcher& operator<<(T&& obj) {
-    record_.Bundle() << std::forward<T>(obj);
+  //! \brief Set the severity levels that will be accepted.
+  AttributeFilter& Accept(const std::set<Severity>& acceptable) {
+    for (auto sev : ALL_SEVERITIES) {
+      severity_filter_.SetAcceptance(sev, acceptable.count(sev) != 0);
+    }
+    lightning::detail::InvalidateAcceptanceCaches();
     return *this;
   }
 
-private:
-  Record record_ {};
-  int uncaught_exceptions_ {};
-};
-
-namespace formatting {
+  AttributeFilter& Accept(SeveritySet acceptable) {
+    severity_filter_.SetAcceptance(acceptable);
+    lightning::detail::InvalidateAcceptanceCaches();
+    return *this;
+  }
 
-//! \brief Base class for attribute formatters, objects that know how to serialize attribute representations
-//!        to strings.
-class AttributeFormatter {
-public:
-  virtual ~AttributeFormatter() = default;
+  //! \brief Shortcut for accepting all severities.
+  AttributeFilter& Accept(LoggingSeverity_t) {
+    severity_filter_.SetAcceptance(SeveritySet(true));
+    lightning::detail::InvalidateAcceptanceCaches();
+    return *this;
+  }
 
-  virtual void AddToBuffer(const RecordAttributes& attributes,
-                           const FormattingSettings& settings,
-                           const MessageInfo& msg_info,
-                           memory::BasicMemoryBuffer<char>& buffer) const = 0;
-};
+  //! \brief Set whether a message with no severity level should be accepted.
+  AttributeFilter& AcceptNoSeverity(bool flag) {
+    severity_filter_.AcceptNoSeverity(flag);
+    lightning::detail::InvalidateAcceptanceCaches();
+    return *this;
+  }
 
-//! \brief Format the severity attribute.
-class SeverityAttributeFormatter : public AttributeFormatter {
-public:
-  explicit SeverityAttributeFormatter(bool aligned_names = true) {
-    if (aligned_names) {
-      setAlignedNames();
+  //! \brief Require that records pass a test, in addition to everything else that the filter requires.
+  //!
+  //! The test is compiled, together with any tests that were already required, into the filter's program.
+  AttributeFilter& Require(const AttributeTest& test) {
+    auto program = std::make_shared<Program>();
+    if (program_) {
+      program->Append(*program_);
     }
-    else {
-      setUnalignedNames();
+    test.CompileTo(*program);
+    if (program_) {
+      program->Emit(Program::Op::And);
     }
+    program->Finish();
+    program_ = std::move(program);
+    lightning::detail::InvalidateAcceptanceCaches();
+    return *this;
   }
 
-  void AddToBuffer(const RecordAttributes& attributes,
-                   const FormattingSettings& settings,
-                   const MessageInfo& msg_info,
-                   memory::BasicMemoryBuffer<char>& buffer) const override {
-    if (attributes.basic_attributes.level) {
-      colorSegment(attributes.basic_attributes.level.value()).AddToBuffer(settings, msg_info, buffer);
-      auto& str = getString(attributes.basic_attributes.level.value());
-      AppendBuffer(buffer, str);
-      AnsiResetSegment.AddToBuffer(settings, msg_info, buffer);
-    }
-  }
+  //! \brief Get the filter's compiled program, or null if no tests are required.
+  NO_DISCARD const Program* GetProgram() const { return program_.get(); }
 
-  SeverityAttributeFormatter& SeverityName(Severity severity, const std::string& name) {
-    getString(severity) = name;
+  //! \brief Reset the filter.
+  AttributeFilter& Clear() {
+    ClearBasicSeverityFilter();
+    program_.reset();
     return *this;
   }
 
-  SeverityAttributeFormatter& SeverityFormatting(Severity severity,
-                                                 std::optional<AnsiForegroundColor> foreground,
-                                                 std::optional<AnsiBackgroundColor> background = {}) {
-    auto& color_formatting = colorSegment(severity);
-    color_formatting.SetColors(foreground, background);
+  //! \brief Reset just the basic severity filter, setting it to accept all messages regardless of severity,
+  //!        and leaving the required tests intact.
+  AttributeFilter& ClearBasicSeverityFilter() {
+    severity_filter_ = BasicSeverityFilter();
+    lightning::detail::InvalidateAcceptanceCaches();
     return *this;
   }
 
 private:
-  void setAlignedNames() {
-    trace_ = "Trace  ";
-    debug_ = "Debug  ";
-    info_ = "Info   ";
-    major_ = "Major  ";
-    warn_ = "Warning";
-    error_ = "Error  ";
-    fatal_ = "Fatal  ";
+  //! \brief Private implementation of whether a message should be accepted based on its attributes.
+  NO_DISCARD virtual bool willAccept([[maybe_unused]] const AttributeList& attributes) const {
+    return true;
   }
 
-  void setUnalignedNames() {
-    trace_ = "Trace";
-    debug_ = "Debug";
-    info_ = "Info";
-    major_ = "Major";
-    warn_ = "Warning";
-    error_ = "Error";
-    fatal_ = "Fatal";
-  }
+  //! \brief The filter used to decide if a record should be accepted based on its severity settings.
+  BasicSeverityFilter severity_filter_;
 
-  NO_DISCARD const std::string& getString(Severity severity) const {
-    switch (severity) {
-      case Severity::Trace:
-        return trace_;
-      case Severity::Debug:
-        return debug_;
-      case Severity::Info:
-        return info_;
-      case Severity::Major:
-        return major_;
-      case Severity::Warning:
-        return warn_;
-      case Severity::Error:
-        return error_;
-      case Severity::Fatal:
+  //! \brief The compiled tests that records have to pass, see Require.
+  //!
+  //! These are and-ed with the basic severity filter, so if some more complex filtering is desired, e.g.
+  //! "accept info if the logger name is 'foo,' otherwise, accept warning or higher" then the basic severity
+  //! filter should be cleared, and the severity tested in the program instead.
+  std::shared_ptr<const Program> program_;
+};
+
+//! \brief Attribute test representing the conjunction of two other tests.
+class ConjunctionTest final : public AttributeTest {
+  friend class ImplBase;
+
+protected:
+  class Impl final : public AttributeTest::Impl {
+  public:
+    Impl(const AttributeTest& lhs, const AttributeTest& rhs)
+        : lhs(lhs)
+        , rhs(rhs) {}
+    NO_DISCARD bool Accepts(const RecordAttributes& attributes) const override {
+      return lhs.Accepts(attributes) && rhs.Accepts(attributes);
+    }
+    void CompileTo(Program& program) const override {
+      lhs.CompileTo(program);
+      rhs.CompileTo(program);
+      program.Emit(Program::Op::And);
+    }
+    AttributeTest lhs, rhs;
+  };
+
+public:
+  ConjunctionTest(const AttributeTest& lhs, const AttributeTest& rhs)
+      : AttributeTest(std::make_shared<Impl>(lhs, rhs)) {}
+};
+
+//! \brief AttributeTest representing the disjunction of two other tests.
+class DisjunctionTest final : public AttributeTest {
+  friend class ImplBase;
+
+protected:
+  class Impl final : public AttributeTest::Impl {
+  public:
+    Impl(const AttributeTest& lhs, const AttributeTest& rhs)
+        : lhs(lhs)
+        , rhs(rhs) {}
+    NO_DISCARD bool Accepts(const RecordAttributes& attributes) const override {
+      return lhs.Accepts(attributes) || rhs.Accepts(attributes);
+    }
+    void CompileTo(Program& program) const override {
+      lhs.CompileTo(program);
+      rhs.CompileTo(program);
+      program.Emit(Program::Op::Or);
+    }
+    AttributeTest lhs, rhs;
+  };
+
+public:
+  DisjunctionTest(const AttributeTest& lhs, const AttributeTest& rhs)
+      : AttributeTest(std::make_shared<Impl>(lhs, rhs)) {}
+};
+
+//! \brief AttributeTest representing the negation of another test.
+class NegationTest final : public AttributeTest {
+  friend class ImplBase;
+
+protected:
+  class Impl final : public AttributeTest::Impl {
+  public:
+    explicit Impl(const AttributeTest& test)
+        : test(test) {}
+    NO_DISCARD bool Accepts(const RecordAttributes& attributes) const override {
+      return !test.Accepts(attributes);
+    }
+    void CompileTo(Program& program) const override {
+      test.CompileTo(program);
+      program.Emit(Program::Op::Not);
+    }
+    AttributeTest test;
+  };
+
+public:
+  explicit NegationTest(const AttributeTest& test)
+      : AttributeTest(std::make_shared<Impl>(test)) {}
+};
+
+//! \brief A test made of a single program instruction, which is also how it is evaluated as a tree.
+class InstructionTest final : public AttributeTest {
+  friend class ImplBase;
+
+protected:
+  class Impl final : public AttributeTest::Impl {
+  public:
+    template<typename Arg_t>
+    Impl(Program::Op op, Arg_t&& arg) {
+      if constexpr (std::is_convertible_v<Arg_t, std::string_view>) {
+        program.Emit(op, std::string_view(arg));
+      }
+      else {
+        program.Emit(op, std::forward<Arg_t>(arg));
+      }
+      program.Finish();
+    }
+    Impl(Program::Op op, std::string_view first, std::string_view second) {
+      program.Emit(op, first, second).Finish();
+    }
+    explicit Impl(std::function<bool(const RecordAttributes&)> predicate) {
+      program.Emit(std::move(predicate)).Finish();
+    }
+    NO_DISCARD bool Accepts(const RecordAttributes& attributes) const override {
+      return program.Run(attributes);
+    }
+    void CompileTo(Program& other) const override { other.Append(program); }
+    Program program;
+  };
+
+public:
+  template<typename Arg_t>
+  InstructionTest(Program::Op op, Arg_t&& arg)
+      : AttributeTest(std::make_shared<Impl>(op, std::forward<Arg_t>(arg))) {}
+
+  InstructionTest(Program::Op op, std::string_view first, std::string_view second)
+      : AttributeTest(std::make_shared<Impl>(op, first, second)) {}
+
+  explicit InstructionTest(std::function<bool(const RecordAttributes&)> predicate)
+      : AttributeTest(std::make_shared<Impl>(std::move(predicate))) {}
+};
+
+//! \brief Test whether a record's severity is in the set. Records without a severity pass if
+//!        `accept_no_severity` is true.
+inline InstructionTest HasSeverity(SeveritySet severities, bool accept_no_severity = false) {
+  const auto no_severity_bit = static_cast<std::uint32_t>(detail::acceptance_no_severity_bit);
+  const auto severity_bits = static_cast<std::uint32_t>(severities.GetMask() & 0b1111111);
+  const auto mask = severity_bits | (accept_no_severity ? no_severity_bit : 0);
+  return {Program::Op::Severity, mask};
+}
+
+//! \brief Test whether a record came from a logger with the given name.
+inline InstructionTest LoggerNameIs(std::string_view name) {
+  return {Program::Op::LoggerName, name};
+}
+
+//! \brief Test whether a record came from a logger whose name starts with the prefix.
+inline InstructionTest LoggerNameStartsWith(std::string_view prefix) {
+  return {Program::Op::LoggerNamePrefix, prefix};
+}
+
+//! \brief Test whether a record was logged from a file whose path (as given by __FILE__) starts with the
+//!        prefix.
+inline InstructionTest FilePathStartsWith(std::string_view prefix) {
+  return {Program::Op::FilePathPrefix, prefix};
+}
+
+//! \brief Test whether a record was logged from a function whose name starts with the prefix.
+inline InstructionTest FunctionNameStartsWith(std::string_view prefix) {
+  return {Program::Op::FunctionNamePrefix, prefix};
+}
+
+//! \brief Test whether a record, or the logger that logged it, has an attribute with the key.
+inline InstructionTest HasAttribute(std::string_view key) {
+  return {Program::Op::HasAttribute, key};
+}
+
+//! \brief Test whether a record, or the logger that logged it, has a string attribute with the key and value.
+inline InstructionTest AttributeIs(std::string_view key, std::string_view value) {
+  return {Program::Op::AttributeIs, key, value};
+}
+
+//! \brief Test records with an arbitrary function. This is the only kind of test that costs an indirect call.
+inline InstructionTest Predicate(std::function<bool(const RecordAttributes&)> predicate) {
+  return InstructionTest(std::move(predicate));
+}
+
+inline ConjunctionTest operator&&(const AttributeTest& lhs, const AttributeTest& rhs) {
+  return {lhs, rhs};
+}
+
+inline DisjunctionTest operator||(const AttributeTest& lhs, const AttributeTest& rhs) {
+  return {lhs, rhs};
+}
+
+inline NegationTest operator!(const AttributeTest& test) {
+  return NegationTest(test);
+}
+
+}  // namespace filter
+
+// Forward declare core.
+class Core;
+
+namespace detail {
+
+//! \brief Which of a core's sinks accept a record, worked out when the record is opened, so the sinks'
+//!        filters are not run a second time when the record is dispatched.
+//!
+//! The result is only used if neither the core's configuration nor any filter changed in between, which the
+//! generation numbers tell. A configuration generation of zero means that the result is not known.
+struct SinkAcceptance {
+  std::uint64_t configuration_generation {};
+  std::uint32_t filter_generation {};
+
+  //! \brief Bit i is set if the i-th sink accepts the record.
+  std::uint64_t mask {};
+};
+
+}  // namespace detail
+
+//! \brief The result of logging, a collection of a message, attributes, and values.
+class Record {
+public:
+  Record() = default;
+
+  template<typename... Attrs_t>
+  explicit Record(BasicAttributes basic_attributes = {}, Attrs_t&&... attrs)
+      : attributes_(basic_attributes, std::forward<Attrs_t>(attrs)...) {}
+
+  Record(const Record&) = default;
+  Record& operator=(const Record&) = default;
+
+  //! \brief Moving a record moves where it is destined, so the moved-from record is closed.
+  Record(Record&& other) noexcept
+      : bundle_(std::move(other.bundle_))
+      , attributes_(std::move(other.attributes_))
+      , core_(std::exchange(other.core_, nullptr))
+      , sink_acceptance_(other.sink_acceptance_) {}
+
+  Record& operator=(Record&& other) noexcept {
+    bundle_ = std::move(other.bundle_);
+    attributes_ = std::move(other.attributes_);
+    core_ = std::exchange(other.core_, nullptr);
+    sink_acceptance_ = other.sink_acceptance_;
+    return *this;
+  }
+
+  //! \brief Get the message bundle from the record.
+  RefBundle& Bundle() { return bundle_; }
+
+  //! \brief Get a const ref to the RefBundle of the record.
+  NO_DISCARD const RefBundle& Bundle() const { return bundle_; }
+
+  //! \brief Get the record attributes.
+  NO_DISCARD const RecordAttributes& Attributes() const { return attributes_; }
+
+  NO_DISCARD RecordAttributes& Attributes() { return attributes_; }
+
+  //! \brief Try to open the record for a core. Returns whether the record opened.
+  //!
+  //! The record only borrows the core, which must outlive the record (or at least its dispatch). Loggers own
+  //! their cores, so this holds for records made by a logger, and it means that logging does not touch the
+  //! core's reference count, which every thread logging to the same core would otherwise contend on.
+  inline bool TryOpen(Core* core);
+
+  //! \brief Test whether a record is open.
+  inline explicit operator bool() const;
+
+  //! \brief Dispatch the record to the associated core.
+  inline void Dispatch();
+
+  //! \brief Get which of the core's sinks accept the record, as found when the record was opened.
+  NO_DISCARD const detail::SinkAcceptance& GetSinkAcceptance() const { return sink_acceptance_; }
+
+private:
+  //! \brief The log message, contained as a RefBundle.
+  RefBundle bundle_ {};
+
+  //! \brief The attributes collection of the message.
+  RecordAttributes attributes_ {};
+
+  //! \brief The core that the record is destined for, or null if the record is closed. Not owned.
+  Core* core_ {};
+
+  //! \brief Which of the core's sinks accept the record.
+  detail::SinkAcceptance sink_acceptance_ {};
+};
+
+//! \brief An RAII structure that dispatches the contained record upon the destruction of the
+//!        RecordDispatcher.
+class RecordDispatcher {
+public:
+  //! \brief Create a closed, empty record.
+  RecordDispatcher() = default;
+
+  //! \brief Wrap a record in a record handler.
+  [[maybe_unused]] explicit RecordDispatcher(Record&& record)
+      : record_(std::move(record))
+      , uncaught_exceptions_(std::uncaught_exceptions()) {}
+
+  //! \brief Construct a record handler, constructing the record in-place inside it.
+  //!
+  //! If the core uses arena allocation, the record's segments are allocated from the thread's arena, and are
+  //! released when the dispatcher is destroyed, so the record must not be moved out of the dispatcher.
+  //!
+  //! The core is borrowed, see Record::TryOpen, so it must outlive the dispatcher.
+  template<typename... Attrs_t>
+  explicit RecordDispatcher(Core* core, BasicAttributes basic_attributes = {}, Attrs_t&&... attrs)
+      : record_(basic_attributes, std::forward<Attrs_t>(attrs)...)
+      , uncaught_exceptions_(std::uncaught_exceptions()) {
+    open(core);
+  }
+
+  //! \brief Construct a record handler for a core that is held by a shared pointer. The core is still only
+  //!        borrowed, so the shared pointer must outlive the dispatcher.
+  template<typename... Attrs_t>
+  explicit RecordDispatcher(const std::shared_ptr<Core>& core,
+                            BasicAttributes basic_attributes = {},
+                            Attrs_t&&... attrs)
+      : RecordDispatcher(core.get(), basic_attributes, std::forward<Attrs_t>(attrs)...) {}
+
+  //! \brief RecordDispatcher is an RAII structure for dispatching records.
+  ~RecordDispatcher() {
+    if (std::uncaught_exceptions() <= uncaught_exceptions_) {
+      record_.Dispatch();
+    }
+  }
+
+  //! \brief Check whether a record is open.
+  NO_DISCARD bool RecordIsOpen() const { return static_cast<bool>(record_); }
+
+  //! \brief Check whether a record is open via explicit conversion to bool.
+  explicit operator bool() const { return RecordIsOpen(); }
+
+  //! \brief Get the record from the RecordDispatcher.
+  Record& GetRecord() { return record_; }
+
+  template<typename T>
+  RecordDispatcher& operator<<(T&& obj) {
+    record_.Bundle() << std::forward<T>(obj);
+    return *this;
+  }
+
+private:
+  //! \brief Try to open the record, opening the arena scope too if the core uses arena allocation.
+  inline void open(Core* core);
+
+  //! \brief Scope for the thread's arena. This is declared before the record, so the scope closes only after
+  //!        the record has been destroyed.
+  memory::ArenaScope arena_scope_ {};
+
+  Record record_ {};
+  int uncaught_exceptions_ {};
+};
+
+//! \brief Formats the message of a record at most once per set of settings that affect it, so that every sink
+//!        a core dispatches the record to can share the formatted message, and only format its own header.
+//!
+//! The only setting that changes how a message is formatted is has_virtual_terminal_processing (the message
+//! terminator is added by the formatter, after the message), so there are at most two versions of the message.
+//! Each is formatted the first time that a sink asks for it. Messages that depend on where they start in the
+//! formatted record, e.g. because they contain a NewLineIndent, are never shared.
+class MessageBodyCache {
+public:
+  explicit MessageBodyCache(const Record& record)
+      : record_(record)
+      , shareable_(!record.Bundle().DependsOnPosition()) {}
+
+  //! \brief Get the message, formatted with the given settings, or null if the message cannot be shared and
+  //!        must be formatted as part of each record.
+  const memory::BasicMemoryBuffer<char>* Get(const FormattingSettings& settings) {
+    if (!shareable_) {
+      return nullptr;
+    }
+    auto& body = bodies_[settings.has_virtual_terminal_processing ? 1 : 0];
+    if (!body) {
+      body.emplace();
+      formatting::MessageInfo msg_info {};
+      record_.Bundle().FmtString(settings, *body, msg_info);
+    }
+    return &*body;
+  }
+
+private:
+  const Record& record_;
+
+  //! \brief Whether the message can be formatted independently of the header.
+  bool shareable_;
+
+  //! \brief The message formatted without and with virtual terminal processing.
+  std::optional<memory::MemoryBuffer<char>> bodies_[2];
+};
+
+namespace formatting {
+
+//! \brief Base class for attribute formatters, objects that know how to serialize attribute representations
+//!        to strings.
+class AttributeFormatter {
+public:
+  virtual ~AttributeFormatter() = default;
+
+  virtual void AddToBuffer(const RecordAttributes& attributes,
+                           const FormattingSettings& settings,
+                           const MessageInfo& msg_info,
+                           memory::BasicMemoryBuffer<char>& buffer) const = 0;
+};
+
+//! \brief Format the severity attribute.
+class SeverityAttributeFormatter : public AttributeFormatter {
+public:
+  explicit SeverityAttributeFormatter(bool aligned_names = true) {
+    if (aligned_names) {
+      setAlignedNames();
+    }
+    else {
+      setUnalignedNames();
+    }
+  }
+
+  void AddToBuffer(const RecordAttributes& attributes,
+                   const FormattingSettings& settings,
+                   const MessageInfo& msg_info,
+                   memory::BasicMemoryBuffer<char>& buffer) const override {
+    if (attributes.basic_attributes.level) {
+      colorSegment(attributes.basic_attributes.level.value()).AddToBuffer(settings, msg_info, buffer);
+      auto& str = getString(attributes.basic_attributes.level.value());
+      AppendBuffer(buffer, str);
+      AnsiResetSegment.AddToBuffer(settings, msg_info, buffer);
+    }
+  }
+
+  SeverityAttributeFormatter& SeverityName(Severity severity, const std::string& name) {
+    getString(severity) = name;
+    return *this;
+  }
+
+  SeverityAttributeFormatter& SeverityFormatting(Severity severity,
+                                                 std::optional<AnsiForegroundColor> foreground,
+                                                 std::optional<AnsiBackgroundColor> background = {}) {
+    auto& color_formatting = colorSegment(severity);
+    color_formatting.SetColors(foreground, background);
+    return *this;
+  }
+
+private:
+  void setAlignedNames() {
+    trace_ = "Trace  ";
+    debug_ = "Debug  ";
+    info_ = "Info   ";
+    major_ = "Major  ";
+    warn_ = "Warning";
+    error_ = "Error  ";
+    fatal_ = "Fatal  ";
+  }
+
+  void setUnalignedNames() {
+    trace_ = "Trace";
+    debug_ = "Debug";
+    info_ = "Info";
+    major_ = "Major";
+    warn_ = "Warning";
+    error_ = "Error";
+    fatal_ = "Fatal";
+  }
+
+  NO_DISCARD const std::string& getString(Severity severity) const {
+    switch (severity) {
+      case Severity::Trace:
+        return trace_;
+      case Severity::Debug:
+        return debug_;
+      case Severity::Info:
+        return info_;
+      case Severity::Major:
+        return major_;
+      case Severity::Warning:
+        return warn_;
+      case Severity::Error:
+        return error_;
+      case Severity::Fatal:
+        return fatal_;
+      default:
+        LL_FAIL("unrecognized severity attribute");
+    }
+  }
+
+  NO_DISCARD std::string& getString(Severity severity) {
+    switch (severity) {
+      case Severity::Trace:
+        return trace_;
+      case Severity::Debug:
+        return debug_;
+      case Severity::Info:
+        return info_;
+      case Severity::Major:
+        return major_;
+      case Severity::Warning:
+        return warn_;
+      case Severity::Error:
+        return error_;
+      case Severity::Fatal:
         return fatal_;
       default:
         LL_FAIL("unrecognized severity attribute");
     }
   }
 
-  NO_DISCARD std::string& getString(Severity severity) {
-    switch (severity) {
-      case Severity::Trace:
-        return trace_;
-      case Severity::Debug:
-        return debug_;
-      case Severity::Info:
-        return info_;
-      case Severity::Major:
-        return major_;
-      case Severity::Warning:
-        return warn_;
-      case Severity::Error:
-        return error_;
-      case Severity::Fatal:
-        return fatal_;
-      default:
-        LL_FAIL("unrecognized severity attribute");
+  NO_DISCARD const AnsiColorSegment& colorSegment(Severity severity) const {
+    switch (severity) {
+      case Severity::Trace:
+        return trace_colors_;
+      case Severity::Debug:
+        return debug_colors_;
+      case Severity::Info:
+        return info_colors_;
+      case Severity::Major:
+        return major_colors_;
+      case Severity::Warning:
+        return warn_colors_;
+      case Severity::Error:
+        return error_colors_;
+      case Severity::Fatal:
+        return fatal_colors_;
+      default:
+        LL_FAIL("unrecognized severity attribute");
+    }
+  }
+
+  NO_DISCARD AnsiColorSegment& colorSegment(Severity severity) {
+    switch (severity) {
+      case Severity::Trace:
+        return trace_colors_;
+      case Severity::Debug:
+        return debug_colors_;
+      case Severity::Info:
+        return info_colors_;
+      case Severity::Major:
+        return major_colors_;
+      case Severity::Warning:
+        return warn_colors_;
+      case Severity::Error:
+        return error_colors_;
+      case Severity::Fatal:
+        return fatal_colors_;
+      default:
+        LL_FAIL("unrecognized severity attribute");
+    }
+  }
+
+  std::string trace_ = "Trace  ";
+  std::string debug_ = "Debug  ";
+  std::string info_ = "Info   ";
+  std::string major_ = "Major  ";
+  std::string warn_ = "Warning";
+  std::string error_ = "Error  ";
+  std::string fatal_ = "Fatal  ";
+
+  AnsiColorSegment trace_colors_ {AnsiForegroundColor::White};
+  AnsiColorSegment debug_colors_ {AnsiForegroundColor::BrightWhite};
+  AnsiColorSegment info_colors_ {AnsiForegroundColor::Green};
+  AnsiColorSegment major_colors_ {AnsiForegroundColor::BrightBlue};
+  AnsiColorSegment warn_colors_ {AnsiForegroundColor::Yellow};
+  AnsiColorSegment error_colors_ {AnsiForegroundColor::Red};
+  AnsiColorSegment fatal_colors_ {AnsiForegroundColor::BrightRed};
+};
+
+//! \brief Predefined layouts for DateTimeAttributeFormatter.
+enum class DateTimeLayout {
+  //! \brief "2024-03-05 12:30:15.123456", the same as FormatDateTo.
+  Standard,
+  //! \brief "2024-03-05T12:30:15.123456Z". Note that date times are not converted to UTC, they are usually
+  //!        in local time, so the "Z" is only correct if the process runs in UTC.
+  Iso8601,
+  //! \brief "2024-03-05 12:30:15.123".
+  Milliseconds,
+  //! \brief The number of microseconds since the epoch (in the date time's timezone), e.g. "1709641815123456".
+  EpochMicroseconds,
+};
+
+//! \brief Attribute formatter that writes the record's time stamp.
+//!
+//! The layout is given by a format string, where
+//!     %Y %m %d %H %M %S are the zero padded year, month, day, hour, minute, and second,
+//!     %f and %L are the microseconds (six digits) and milliseconds (three digits),
+//!     %s is the number of whole seconds since the epoch, and
+//!     %% is a literal '%'.
+//!
+//! Everything but the sub-second digits only changes once per second, so the formatter keeps a thread local
+//! cache of the text for the last second it formatted, and for each record, only copies the cached text and
+//! writes the sub-second digits into it.
+class DateTimeAttributeFormatter final : public AttributeFormatter {
+public:
+  DateTimeAttributeFormatter()
+      : DateTimeAttributeFormatter(DateTimeLayout::Standard) {}
+
+  explicit DateTimeAttributeFormatter(DateTimeLayout layout)
+      : DateTimeAttributeFormatter(layoutFormat(layout)) {}
+
+  explicit DateTimeAttributeFormatter(std::string_view format)
+      : id_(nextID()) {
+    for (std::size_t i = 0; i < format.size(); ++i) {
+      if (format[i] != '%') {
+        pieces_.push_back({Field::Literal, format[i]});
+        continue;
+      }
+      LL_REQUIRE(i + 1 < format.size(), "date time format '" << format << "' ends with a '%'");
+      switch (format[++i]) {
+        case 'Y':
+          pieces_.push_back({Field::Year});
+          break;
+        case 'm':
+          pieces_.push_back({Field::Month});
+          break;
+        case 'd':
+          pieces_.push_back({Field::Day});
+          break;
+        case 'H':
+          pieces_.push_back({Field::Hour});
+          break;
+        case 'M':
+          pieces_.push_back({Field::Minute});
+          break;
+        case 'S':
+          pieces_.push_back({Field::Second});
+          break;
+        case 'f':
+          pieces_.push_back({Field::Microsecond});
+          break;
+        case 'L':
+          pieces_.push_back({Field::Millisecond});
+          break;
+        case 's':
+          pieces_.push_back({Field::EpochSeconds});
+          break;
+        case '%':
+          pieces_.push_back({Field::Literal, '%'});
+          break;
+        default:
+          LL_FAIL("unknown specifier '%" << format[i] << "' in date time format '" << format << "'");
+      }
+    }
+  }
+
+  void AddToBuffer(const RecordAttributes& attributes,
+                   const FormattingSettings&,
+                   const MessageInfo&,
+                   memory::BasicMemoryBuffer<char>& buffer) const override {
+    if (attributes.basic_attributes.time_stamp) {
+      auto& dt = attributes.basic_attributes.time_stamp.value();
+      auto& cache = cacheFor(dt);
+      auto [start, end] = buffer.Allocate(cache.text.size());
+      std::memcpy(start, cache.text.data(), cache.text.size());
+      for (auto [offset, digits] : cache.sub_second_fields) {
+        const auto value = digits == 6 ? dt.GetMicrosecond() : dt.GetMillisecond();
+        writeDigits(start + offset, static_cast<unsigned>(value), digits);
+      }
+    }
+  }
+
+private:
+  enum class Field : unsigned char {
+    Literal,
+    Year,
+    Month,
+    Day,
+    Hour,
+    Minute,
+    Second,
+    Microsecond,
+    Millisecond,
+    EpochSeconds
+  };
+
+  struct Piece {
+    Field field;
+    char literal = '\0';
+  };
+
+  //! \brief The text of one second, with space left for the sub-second digits.
+  struct SecondCache {
+    //! \brief Which formatter the cache belongs to, zero if none.
+    std::uint64_t owner = 0;
+    time::DateTime second {};
+    std::string text;
+    //! \brief The offset into the text, and number of digits, of each sub-second field.
+    std::vector<std::pair<std::size_t, int>> sub_second_fields;
+  };
+
+  static std::string_view layoutFormat(DateTimeLayout layout) {
+    switch (layout) {
+      case DateTimeLayout::Standard:
+        return "%Y-%m-%d %H:%M:%S.%f";
+      case DateTimeLayout::Iso8601:
+        return "%Y-%m-%dT%H:%M:%S.%fZ";
+      case DateTimeLayout::Milliseconds:
+        return "%Y-%m-%d %H:%M:%S.%L";
+      case DateTimeLayout::EpochMicroseconds:
+        return "%s%f";
+    }
+    LL_FAIL("unknown date time layout");
+  }
+
+  static std::uint64_t nextID() {
+    static std::atomic<std::uint64_t> next_id {1};
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static void writeDigits(char* c, unsigned value, int digits) {
+    for (auto i = digits - 1; 0 <= i; --i, value /= 10) {
+      c[i] = static_cast<char>('0' + value % 10);
+    }
+  }
+
+  //! \brief Get this thread's cached text for the second that a date time is in, rendering it if needed.
+  //!
+  //! A few formatters can be cached at once, so e.g. sinks with different layouts do not evict each other.
+  const SecondCache& cacheFor(const time::DateTime& dt) const {
+    thread_local SecondCache caches[4];
+    auto& cache = caches[id_ % 4];
+    const auto second = dt.TruncatedToSecond();
+    if (cache.owner == id_ && cache.second == second) {
+      return cache;
+    }
+
+    cache.owner = id_;
+    cache.second = second;
+    cache.text.clear();
+    cache.sub_second_fields.clear();
+    auto append = [&cache](int value, int digits) {
+      const auto offset = cache.text.size();
+      cache.text.append(static_cast<std::size_t>(digits), '0');
+      writeDigits(cache.text.data() + offset, static_cast<unsigned>(value), digits);
+    };
+    for (const auto& piece : pieces_) {
+      switch (piece.field) {
+        case Field::Literal:
+          cache.text.push_back(piece.literal);
+          break;
+        case Field::Year:
+          append(dt.GetYear(), 4);
+          break;
+        case Field::Month:
+          append(dt.GetMonthInt(), 2);
+          break;
+        case Field::Day:
+          append(dt.GetDay(), 2);
+          break;
+        case Field::Hour:
+          append(dt.GetHour(), 2);
+          break;
+        case Field::Minute:
+          append(dt.GetMinute(), 2);
+          break;
+        case Field::Second:
+          append(dt.GetSecond(), 2);
+          break;
+        case Field::Microsecond:
+        case Field::Millisecond: {
+          const auto digits = piece.field == Field::Microsecond ? 6 : 3;
+          cache.sub_second_fields.emplace_back(cache.text.size(), digits);
+          cache.text.append(static_cast<std::size_t>(digits), '0');
+          break;
+        }
+        case Field::EpochSeconds: {
+          char digits[24];
+          const auto seconds = second.EpochMicroseconds() / 1'000'000;
+          const auto end = std::to_chars(digits, digits + sizeof(digits), seconds).ptr;
+          cache.text.append(digits, end);
+          break;
+        }
+      }
+    }
+    return cache;
+  }
+
+  //! \brief Identifies the formatter's entries in the thread local caches. Copies of a formatter have the same
+  //!        format, so they can share an ID.
+  std::uint64_t id_;
+
+  //! \brief The parsed format string.
+  std::vector<Piece> pieces_;
+};
+
+//! \brief Attribute formatter that writes the logger's name.
+class LoggerNameAttributeFormatter final : public AttributeFormatter {
+public:
+  void AddToBuffer(const RecordAttributes& attributes,
+                   const FormattingSettings&,
+                   const MessageInfo&,
+                   memory::BasicMemoryBuffer<char>& buffer) const override {
+    AppendBuffer(buffer, attributes.basic_attributes.logger_name);
+  }
+};
+
+//! \brief Attribute formatter that writes the name of the file attached to the record.
+class FileNameAttributeFormatter final : public AttributeFormatter {
+public:
+  explicit FileNameAttributeFormatter(bool only_file_name = false)
+      : only_file_name_(only_file_name) {}
+
+  void AddToBuffer(const RecordAttributes& attributes,
+                   [[maybe_unused]] const FormattingSettings& settings,
+                   [[maybe_unused]] const MessageInfo& info,
+                   memory::BasicMemoryBuffer<char>& buffer) const override {
+    if (auto call_site = attributes.basic_attributes.call_site; call_site && call_site->file_path) {
+      AppendBuffer(buffer, only_file_name_ ? call_site->FileName() : call_site->file_path);
+    }
+  }
+
+private:
+  //! \brief If true, only the file name is displayed, not the full path.
+  bool only_file_name_;
+};
+
+//! \brief Attribute formatter that writes the name of the function name attached to the record.
+class FunctionNameAttributeFormatter final : public AttributeFormatter {
+public:
+  void AddToBuffer(const RecordAttributes& attributes,
+                   [[maybe_unused]] const FormattingSettings& settings,
+                   [[maybe_unused]] const MessageInfo& info,
+                   memory::BasicMemoryBuffer<char>& buffer) const override {
+    if (auto call_site = attributes.basic_attributes.call_site; call_site && call_site->function_name) {
+      AppendBuffer(buffer, call_site->function_name);
+    }
+  }
+};
+
+//! \brief Attribute formatter that writes file line attached to the record.
+class FileLineAttributeFormatter final : public AttributeFormatter {
+public:
+  void AddToBuffer(const RecordAttributes& attributes,
+                   [[maybe_unused]] const FormattingSettings& settings,
+                   [[maybe_unused]] const MessageInfo& info,
+                   memory::BasicMemoryBuffer<char>& buffer) const override {
+    if (auto call_site = attributes.basic_attributes.call_site; call_site && call_site->line_number) {
+      // Calculate the length, base 10, of line_number
+      auto size = NumberOfDigits(*call_site->line_number);
+      // Reserve this much additional size
+      auto [start, end] = buffer.Allocate(size);
+      std::to_chars(start, end, *call_site->line_number);
+    }
+  }
+};
+
+//! \brief Attribute formatter that writes the thread attached to the record, either as its name or as its
+//!        OS thread ID.
+class ThreadAttributeFormatter final : public AttributeFormatter {
+public:
+  //! \brief Create a thread formatter.
+  //!
+  //! \param prefer_name If true, the thread name is written when the thread has one (see SetThreadName),
+  //!                    otherwise the thread ID is always written.
+  //! \param width If non-zero, the output is padded on the right with spaces to at least this many
+  //!              characters, so that columns line up. Longer names are not truncated.
+  explicit ThreadAttributeFormatter(bool prefer_name = true, unsigned width = 0)
+      : prefer_name_(prefer_name)
+      , width_(width) {}
+
+  void AddToBuffer(const RecordAttributes& attributes,
+                   [[maybe_unused]] const FormattingSettings& settings,
+                   [[maybe_unused]] const MessageInfo& info,
+                   memory::BasicMemoryBuffer<char>& buffer) const override {
+    const auto& basic = attributes.basic_attributes;
+    std::size_t size {};
+    if (prefer_name_ && !basic.thread_name.empty()) {
+      AppendBuffer(buffer, basic.thread_name);
+      size = basic.thread_name.size();
+    }
+    else {
+      size = NumberOfDigits(basic.thread_id);
+      auto [start, end] = buffer.Allocate(size);
+      std::to_chars(start, end, basic.thread_id);
+    }
+    if (size < width_) {
+      auto [start, end] = buffer.Allocate(width_ - size);
+      std::fill(start, end, ' ');
+    }
+  }
+
+private:
+  bool prefer_name_;
+  unsigned width_;
+};
+
+//! \brief  Function to calculate how far the start of the message is from the last newline in the header,
+//!         counting only visible (non ansi virtual terminal) characters.
+inline unsigned CalculateMessageIndentation(const char* buffer_end, const MessageInfo& msg_info) {
+  if (msg_info.total_length == 0) {
+    return 0;
+  }
+  const auto begin = buffer_end - msg_info.total_length;
+  const auto newline = simd::FindLastByte(begin, buffer_end, '\n');
+  // Start after the '\n', or at the beginning.
+  return CountNonAnsiSequenceCharacters(newline == buffer_end ? begin : newline + 1, buffer_end);
+}
+
+//! \brief Base class for message formatters, objects capable of taking a record and formatting it into a
+//!        string, according to the formatting settings.
+class BaseMessageFormatter {
+public:
+  virtual ~BaseMessageFormatter() = default;
+
+  //! \brief Format the record into a buffer, given the formatting settings.
+  //!
+  //! \param record The record to format.
+  //! \param sink_settings The settings for formatting the message.
+  //! \param buffer The buffer to write the formatted message into.
+  //! \param formatted_msg If the message has already been formatted, this is a pointer to the buffer
+  //!                      containing the formatted message, otherwise, a nullptr.
+  void Format(const Record& record,
+              const FormattingSettings& sink_settings,
+              memory::BasicMemoryBuffer<char>& buffer,
+              const memory::BasicMemoryBuffer<char>* formatted_msg = {}) const {
+    format(record, sink_settings, buffer, formatted_msg);
+  }
+
+  //! \brief Make a deep copy of the message formatter.
+  NO_DISCARD virtual std::unique_ptr<BaseMessageFormatter> Copy() const = 0;
+
+protected:
+  //! \brief Private implementation of the format method.
+  virtual void format(const Record& record,
+                      const FormattingSettings& sink_settings,
+                      memory::BasicMemoryBuffer<char>& buffer,
+                      const memory::BasicMemoryBuffer<char>* formatted_msg) const = 0;
+};
+
+//! \brief Object used to represent a placeholder for the logging message.
+struct MSG_t {};
+
+//! \brief Global prototypical MSG_t object.
+constexpr inline MSG_t MSG;
+
+//! \brief Standard message formatter.
+//!
+//! Currently the main and most useful message formatter, this formatter is templated by the types of
+//! the segments that it contains. It is defined with a string that contains literal segments and segments
+//! that are replaced by the values of the attributes. There are several helper functions, below, that make
+//! creating a MsgFormatter easier.
+template<typename... Types>
+class MsgFormatter : public BaseMessageFormatter {
+  static_assert(((std::is_base_of_v<AttributeFormatter, Types> || std::is_same_v<MSG_t, Types>)&&...),
+                "All types must be AttributeFormatters or a MSG tag.");
+
+public:
+  explicit MsgFormatter(const std::string& fmt_string, const Types&... types)
+      : formatters_(types...) {
+    // Find the segments, ensure that there are the right number of arguments.
+    auto count_slots = 0;
+    literals_.emplace_back();
+    for (auto i = 0u; i < fmt_string.size();) {
+      if (fmt_string[i] == '{') {
+        // Always advance i, since it is either an escaped '{' or we need to find the end of the "{...}"
+        if (i + 1 < fmt_string.size() && fmt_string[++i] != '{') {
+          // Start of a slot, end of the literal.
+          literals_.emplace_back();  // start a new literal
+          ++count_slots;
+          // Find the closing '}' TODO: Capture a formatting string?
+          for (; i < fmt_string.size() && fmt_string[i] != '}'; ++i)
+            ;
+          ++i;
+          continue;
+        }
+      }
+      literals_.back().push_back(fmt_string[i]);
+      ++i;
+    }
+
+    // Make sure there are the right number of slots.
+    LL_ASSERT(count_slots == sizeof...(Types),
+              "mismatch in the number of slots (" << count_slots << ") and the number of formatters ("
+                                                  << sizeof...(Types) << ")");
+    LL_ASSERT(literals_.size() == sizeof...(Types) + 1,
+              "not the right number of literals, needed " << sizeof...(Types) + 1 << ", but had "
+                                                          << literals_.size());
+  }
+
+  //! \brief Create a message formatter from a format string that was parsed at compile time (see LL_FMT).
+  //!
+  //! The number of slots is checked at compile time, and color tags like "{@RED}" in the format string are
+  //! replaced with their ANSI sequences.
+  template<typename Source_t>
+  explicit MsgFormatter(CompiledFormat<Source_t>, const Types&... types)
+      : formatters_(types...) {
+    static_assert(CompiledFormat<Source_t>::NumSlots() == sizeof...(Types),
+                  "mismatch in the number of slots and the number of formatters");
+    literals_.reserve(sizeof...(Types) + 1);
+    for (auto i = 0u; i <= sizeof...(Types); ++i) {
+      literals_.emplace_back(CompiledFormat<Source_t>::Literal(i));
+    }
+  }
+
+
+private:
+  void format(const Record& record,
+              const FormattingSettings& sink_settings,
+              memory::BasicMemoryBuffer<char>& buffer,
+              const memory::BasicMemoryBuffer<char>* formatted_msg) const override {
+    MessageInfo msg_info {};
+    msg_info.needs_message_indentation = record.Bundle().NeedsMessageIndentation();
+
+    // Format all the segments.
+    format<0>(buffer, record, sink_settings, formatted_msg, msg_info);
+    // Add the terminator.
+    AppendBuffer(buffer, sink_settings.message_terminator);
+  }
+
+  NO_DISCARD std::unique_ptr<BaseMessageFormatter> Copy() const override {
+    return std::unique_ptr<BaseMessageFormatter>(new MsgFormatter(*this));
+  }
+
+  template<std::size_t N>
+  void format(memory::BasicMemoryBuffer<char>& buffer,
+              [[maybe_unused]] const Record& record,
+              [[maybe_unused]] const FormattingSettings& sink_settings,
+              const memory::BasicMemoryBuffer<char>* formatted_msg,
+              MessageInfo& msg_info) const {
+    // First, the next literal segment.
+    AppendBuffer(buffer, literals_[N]);
+    msg_info.total_length = static_cast<unsigned>(buffer.Size());
+
+    if constexpr (N != sizeof...(Types)) {
+      // Then the formatter from the slot.
+      if constexpr (std::is_same_v<MSG_t, std::tuple_element_t<N, decltype(formatters_)>>) {
+        // If the message was already formatted, just append it.
+        if (formatted_msg) {
+          buffer.Append(*formatted_msg);
+        }
+        // Otherwise, we have to do the work.
+        else {
+          // Since this calculation can take some time, only calculate if needed.
+          if (msg_info.needs_message_indentation) {
+            // At this point, we can calculate the true message indentation by looking for the last newline
+            // (if any), and not counting escape characters.
+            msg_info.message_indentation = CalculateMessageIndentation(buffer.End(), msg_info);
+          }
+          else {
+            msg_info.message_indentation = 0u;
+          }
+          // Bundle's FmtString function will set msg_info.is_in_message_segment to true, so we don't need to
+          // here.
+          record.Bundle().FmtString(sink_settings, buffer, msg_info);
+        }
+      }
+      else {
+        std::get<N>(formatters_).AddToBuffer(record.Attributes(), sink_settings, msg_info, buffer);
+      }
+      msg_info.total_length = static_cast<unsigned>(buffer.Size());
+
+      // Recursively format the next literal and (if it does not terminate) segment.
+      format<N + 1>(buffer, record, sink_settings, formatted_msg, msg_info);
+    }
+  }
+
+  std::tuple<Types...> formatters_;
+  std::vector<std::string> literals_;
+};
+
+//! \brief Helper function to create a unique pointer to a MsgFormatter
+template<typename... Types>
+auto MakeMsgFormatter(const std::string& fmt_string, const Types&... types) {
+  return std::unique_ptr<BaseMessageFormatter>(new MsgFormatter<Types...>(fmt_string, types...));
+}
+
+//! \brief Helper function to create a unique pointer to a MsgFormatter from a compile-time parsed format string.
+template<typename Source_t, typename... Types>
+auto MakeMsgFormatter(CompiledFormat<Source_t> fmt, const Types&... types) {
+  return std::unique_ptr<BaseMessageFormatter>(new MsgFormatter<Types...>(fmt, types...));
+}
+
+//! \brief Helper function that makes the "standard" MsgFormatter.
+//!
+//! What is standard may change, and only be "standard" in the eye of the beholder, but I am the beholder, and
+//! these are the basic things I want in a simple logging formatter.
+inline auto MakeStandardFormatter() {
+  return MakeMsgFormatter("[{}] [{}] {}",
+                          formatting::SeverityAttributeFormatter {},
+                          formatting::DateTimeAttributeFormatter {},
+                          formatting::MSG);
+}
+
+//! \brief A message formatter that delegates formatting to a different formatter based on the severity of the
+//!        record.
+class FormatterBySeverity final : public BaseMessageFormatter {
+public:
+  NO_DISCARD std::unique_ptr<BaseMessageFormatter> Copy() const override {
+    auto formatter = std::make_unique<FormatterBySeverity>();
+    for (auto i = 0u; i < 7; ++i) {
+      formatter->formatters_[i] = formatters_[i] ? formatters_[i]->Copy() : nullptr;
+    }
+    formatter->default_formatter_ = default_formatter_ ? default_formatter_->Copy() : nullptr;
+    return formatter;
+  }
+
+  FormatterBySeverity& SetFormatterForSeverity(Severity severity,
+                                               std::unique_ptr<BaseMessageFormatter>&& formatter) {
+    if (auto index = SeverityIndex(severity); index != -1) {
+      formatters_[index] = std::move(formatter);
+      return *this;
+    }
+    LL_FAIL("unrecognized severity");
+  }
+  FormatterBySeverity& SetFormatterForSeverity(Severity severity, const BaseMessageFormatter& formatter) {
+    if (auto index = SeverityIndex(severity); index != -1) {
+      formatters_[index] = formatter.Copy();
+      return *this;
+    }
+    LL_FAIL("unrecognized severity");
+  }
+
+  FormatterBySeverity& SetFormatterForSeverity(SeveritySet condition, const BaseMessageFormatter& formatter) {
+    for (auto severity : ALL_SEVERITIES) {
+      if (condition(severity))
+        formatters_[SeverityIndex(severity)] = formatter.Copy();
+    }
+    return *this;
+  }
+
+  FormatterBySeverity& SetDefaultFormatter(std::unique_ptr<BaseMessageFormatter>&& formatter) {
+    default_formatter_ = std::move(formatter);
+    return *this;
+  }
+  FormatterBySeverity& SetDefaultFormatter(const BaseMessageFormatter& formatter) {
+    default_formatter_ = formatter.Copy();
+    return *this;
+  }
+
+private:
+  void format(const Record& record,
+              const FormattingSettings& sink_settings,
+              memory::BasicMemoryBuffer<char>& buffer,
+              const memory::BasicMemoryBuffer<char>* formatted_msg) const override {
+    // Format all the segments.
+    if (const auto* formatter = getFormatter(record.Attributes().basic_attributes.level)) {
+      MessageInfo msg_info {};
+      msg_info.needs_message_indentation = record.Bundle().NeedsMessageIndentation();
+      formatter->Format(record, sink_settings, buffer, formatted_msg);
+    }
+  }
+
+  //! \brief A function that, given the severity level, returns the formatter for that level.
+  //! If the severity is not recognized, returns the default formatter.
+  NO_DISCARD const BaseMessageFormatter* getFormatter(std::optional<Severity> severity) const {
+    if (severity) {
+      if (auto index = SeverityIndex(*severity); index != -1) {
+        if (formatters_[index]) {
+          return formatters_[index].get();
+        }
+        return default_formatter_.get();
+      }
+      // Severity provided but it is ill-formed.
+      LL_FAIL("unrecognized severity");
+    }
+    return default_formatter_.get();
+  }
+
+  //! \brief The formatters for each severity level.
+  std::unique_ptr<BaseMessageFormatter> formatters_[7];
+  std::unique_ptr<BaseMessageFormatter> default_formatter_;
+};
+
+//! \brief Another type of BaseMessageFormatter, this one can be created and added to without being templated
+//! by the segment types, but is generally lower performance.
+class RecordFormatter final : public BaseMessageFormatter {
+public:
+  //! \brief The default record formatter just prints the message.
+  RecordFormatter() { AddMsgSegment(); }
+
+  NO_DISCARD std::unique_ptr<BaseMessageFormatter> Copy() const override {
+    return std::unique_ptr<BaseMessageFormatter>(new RecordFormatter(*this));
+  }
+
+  RecordFormatter& AddMsgSegment() {
+    formatters_.emplace_back(MSG);
+    return *this;
+  }
+
+  RecordFormatter& AddAttributeFormatter(std::shared_ptr<AttributeFormatter> formatter) {
+    formatters_.emplace_back(std::move(formatter));
+    return *this;
+  }
+
+  RecordFormatter& AddLiteralSegment(std::string literal) {
+    formatters_.emplace_back(std::move(literal));
+    return *this;
+  }
+
+  RecordFormatter& ClearSegments() {
+    formatters_.clear();
+    return *this;
+  }
+
+  NO_DISCARD std::size_t NumSegments() const { return formatters_.size(); }
+
+private:
+  void format(const Record& record,
+              const FormattingSettings& sink_settings,
+              memory::BasicMemoryBuffer<char>& buffer,
+              const memory::BasicMemoryBuffer<char>* formatted_msg) const override {
+    MessageInfo msg_info {};
+    for (const auto& formatter : formatters_) {
+      switch (formatter.index()) {
+        default:
+        case 0: {  // Message.
+          if (formatted_msg) {
+            buffer.Append(*formatted_msg);
+          }
+          else {
+            // TODO: Update for LogNewLine type alignment.
+            record.Bundle().FmtString(sink_settings, buffer, msg_info);
+          }
+          break;
+        }
+        case 1: {  // AttributeFormatter
+          std::get<1>(formatter)->AddToBuffer(record.Attributes(), sink_settings, msg_info, buffer);
+          break;
+        }
+        case 2: {  // String.
+          AppendBuffer(buffer, std::get<2>(formatter));
+          break;
+        }
+      }
+    }
+    // Add terminator.
+    AppendBuffer(buffer, sink_settings.message_terminator);
+  }
+
+  std::vector<std::variant<MSG_t, std::shared_ptr<AttributeFormatter>, std::string>> formatters_;
+};
+
+//! \brief The layouts that a StructuredFormatter can write records in.
+enum class StructuredStyle {
+  //! \brief One JSON object per record, e.g. {"time":"2024-03-05T12:30:15.123456Z","level":"Info","msg":"Hi"}
+  JsonLines,
+  //! \brief Space separated key=value pairs, e.g. time=2024-03-05T12:30:15.123456Z level=Info msg=Hi.
+  //!        Values are quoted, and escaped as in JSON, if they are empty or contain spaces, '=', or
+  //!        characters that need escaping.
+  Logfmt,
+};
+
+//! \brief A message formatter that writes records as structured data, in JSON lines or logfmt, so that log
+//!        shippers can read the fields without parsing text.
+//!
+//! The fields are the time stamp ("time"), severity ("level"), logger name ("logger"), thread ID ("thread")
+//! and name ("thread_name"), and call site ("file", "line", and "function"), each if the record has it, then
+//! the message ("msg"), then the attributes of the logger and of the record. Everything is written straight
+//! into the buffer, and strings are escaped with the vectorized kernels, see simd::FindJsonEscape.
+class StructuredFormatter final : public BaseMessageFormatter {
+public:
+  explicit StructuredFormatter(StructuredStyle style = StructuredStyle::JsonLines,
+                               DateTimeLayout time_layout = DateTimeLayout::Iso8601)
+      : style_(style)
+      , time_formatter_(time_layout)
+      , time_is_number_(time_layout == DateTimeLayout::EpochMicroseconds) {}
+
+  NO_DISCARD std::unique_ptr<BaseMessageFormatter> Copy() const override {
+    return std::make_unique<StructuredFormatter>(*this);
+  }
+
+  //! \brief Set whether to write the thread ID of records.
+  StructuredFormatter& IncludeThread(bool flag) {
+    include_thread_ = flag;
+    return *this;
+  }
+
+  //! \brief Set whether to write the file path, line number, and function name of records.
+  StructuredFormatter& IncludeCallSite(bool flag) {
+    include_call_site_ = flag;
+    return *this;
+  }
+
+private:
+  void format(const Record& record,
+              const FormattingSettings& sink_settings,
+              memory::BasicMemoryBuffer<char>& buffer,
+              const memory::BasicMemoryBuffer<char>* formatted_msg) const override {
+    const auto& attributes = record.Attributes();
+    const auto& basic = attributes.basic_attributes;
+    bool first = true;
+    if (style_ == StructuredStyle::JsonLines) {
+      buffer.PushBack('{');
+    }
+
+    if (basic.time_stamp) {
+      memory::MemoryBuffer<char, 64> time;
+      time_formatter_.AddToBuffer(attributes, sink_settings, {}, time);
+      writeKey("time", first, buffer);
+      if (time_is_number_) {
+        buffer.Append(time);
+      }
+      else {
+        writeString(time.ToView(), buffer);
+      }
+    }
+    if (basic.level) {
+      writeKey("level", first, buffer);
+      writeString(SeverityName(*basic.level), buffer);
+    }
+    if (!basic.logger_name.empty()) {
+      writeKey("logger", first, buffer);
+      writeString(basic.logger_name, buffer);
+    }
+    if (include_thread_) {
+      writeKey("thread", first, buffer);
+      writeNumber(basic.thread_id, buffer);
+      if (!basic.thread_name.empty()) {
+        writeKey("thread_name", first, buffer);
+        writeString(basic.thread_name, buffer);
+      }
+    }
+    if (auto call_site = basic.call_site; call_site && include_call_site_) {
+      if (call_site->file_path) {
+        writeKey("file", first, buffer);
+        writeString(call_site->file_path, buffer);
+      }
+      if (call_site->line_number) {
+        writeKey("line", first, buffer);
+        writeNumber(*call_site->line_number, buffer);
+      }
+      if (call_site->function_name) {
+        writeKey("function", first, buffer);
+        writeString(call_site->function_name, buffer);
+      }
+    }
+
+    writeKey("msg", first, buffer);
+    if (formatted_msg) {
+      writeString(formatted_msg->ToView(), buffer);
+    }
+    else {
+      memory::MemoryBuffer<char> message;
+      MessageInfo msg_info {};
+      record.Bundle().FmtString(sink_settings, message, msg_info);
+      writeString(message.ToView(), buffer);
+    }
+
+    attributes.ForEachAttribute([&](const Attribute& attribute) {
+      writeKey(attribute.GetKey(), first, buffer);
+      writeValue(attribute, buffer);
+    });
+
+    if (style_ == StructuredStyle::JsonLines) {
+      buffer.PushBack('}');
+    }
+    AppendBuffer(buffer, sink_settings.message_terminator);
+  }
+
+  void writeKey(std::string_view key, bool& first, memory::BasicMemoryBuffer<char>& buffer) const {
+    if (!first) {
+      buffer.PushBack(style_ == StructuredStyle::JsonLines ? ',' : ' ');
+    }
+    first = false;
+    if (style_ == StructuredStyle::JsonLines) {
+      buffer.PushBack('"');
+      detail::appendJsonEscaped(key, buffer);
+      AppendBuffer(buffer, "\":");
+    }
+    else {
+      AppendBuffer(buffer, key);
+      buffer.PushBack('=');
+    }
+  }
+
+  void writeString(std::string_view str, memory::BasicMemoryBuffer<char>& buffer) const {
+    if (style_ == StructuredStyle::Logfmt && !needsQuotes(str)) {
+      AppendBuffer(buffer, str);
+      return;
+    }
+    buffer.PushBack('"');
+    detail::appendJsonEscaped(str, buffer);
+    buffer.PushBack('"');
+  }
+
+  void writeValue(const Attribute& attribute, memory::BasicMemoryBuffer<char>& buffer) const {
+    switch (attribute.GetType()) {
+      case Attribute::Type::Int:
+        writeNumber(attribute.GetInt(), buffer);
+        break;
+      case Attribute::Type::UInt:
+        writeNumber(attribute.GetUInt(), buffer);
+        break;
+      case Attribute::Type::Float:
+        // JSON has no representation of infinities or NaN.
+        if (style_ == StructuredStyle::JsonLines && !std::isfinite(attribute.GetFloat())) {
+          AppendBuffer(buffer, "null");
+        }
+        else {
+          writeNumber(attribute.GetFloat(), buffer);
+        }
+        break;
+      case Attribute::Type::Bool:
+        AppendBuffer(buffer, attribute.GetBool() ? "true" : "false");
+        break;
+      case Attribute::Type::String:
+      case Attribute::Type::InternedString:
+        writeString(attribute.GetString(), buffer);
+        break;
+    }
+  }
+
+  template<typename Number_t>
+  static void writeNumber(Number_t number, memory::BasicMemoryBuffer<char>& buffer) {
+    if constexpr (typetraits::has_to_chars<Number_t>) {
+      char text[32];
+      const auto result = std::to_chars(text, text + sizeof(text), number);
+      buffer.Append(text, result.ptr);
+    }
+    else {
+      std::ostringstream stream;
+      stream << number;
+      AppendBuffer(buffer, stream.str());
+    }
+  }
+
+  //! \brief Whether a logfmt value has to be quoted.
+  static bool needsQuotes(std::string_view str) {
+    const auto begin = str.data(), end = str.data() + str.size();
+    return str.empty() || simd::FindJsonEscape(begin, end) != end || simd::FindByte(begin, end, ' ') != end
+           || simd::FindByte(begin, end, '=') != end;
+  }
+
+  StructuredStyle style_;
+
+  //! \brief Formats the time stamps, caching the text of the current second.
+  DateTimeAttributeFormatter time_formatter_;
+
+  //! \brief Whether time stamps are formatted as numbers, which are not quoted.
+  bool time_is_number_;
+
+  bool include_thread_ = true;
+  bool include_call_site_ = true;
+};
+
+//! \brief Helper function to create a unique pointer to a StructuredFormatter.
+inline auto MakeStructuredFormatter(StructuredStyle style = StructuredStyle::JsonLines,
+                                    DateTimeLayout time_layout = DateTimeLayout::Iso8601) {
+  return std::unique_ptr<BaseMessageFormatter>(new StructuredFormatter(style, time_layout));
+}
+
+}  // namespace formatting
+
+namespace flush {
+
+//! \brief Base class for objects that determine whether a sink should be flushed.
+class FlushHandler : public ImplBase {
+public:
+  class Impl : public ImplBase::Impl {
+  public:
+    virtual bool DoFlush(const Record& record) = 0;
+
+    //! \brief Decide whether to flush, also knowing the size of the record's formatted message. By default,
+    //!        only the record is used.
+    virtual bool DoFlushMessage(const Record& record, [[maybe_unused]] std::size_t message_size) {
+      return DoFlush(record);
+    }
+
+    NO_DISCARD virtual std::shared_ptr<Impl> Clone() const = 0;
+  };
+
+  bool DoFlush(const Record& record) { return impl<FlushHandler>()->DoFlush(record); }
+  bool DoFlush(const Record& record, std::size_t message_size) {
+    return impl<FlushHandler>()->DoFlushMessage(record, message_size);
+  }
+  NO_DISCARD FlushHandler Clone() const { return FlushHandler(impl<FlushHandler>()->Clone()); }
+
+  explicit FlushHandler(const std::shared_ptr<Impl>& impl)
+      : ImplBase(impl) {}
+};
+
+//! \brief Flush after every message.
+class AutoFlush final : public FlushHandler {
+public:
+  class Impl final : public FlushHandler::Impl {
+  public:
+    bool DoFlush(const Record&) override { return true; }
+    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override { return std::make_shared<Impl>(); }
+  };
+
+  AutoFlush()
+      : FlushHandler(std::make_shared<Impl>()) {}
+};
+
+//! \brief Flush after every N messages.
+class FlushEveryN final : public FlushHandler {
+public:
+  class Impl final : public FlushHandler::Impl {
+  public:
+    explicit Impl(std::size_t N)
+        : N_(N) {
+      LL_REQUIRE(0 < N, "N cannot be 0");
+    }
+
+    bool DoFlush(const Record&) override {
+      // Unlocked sinks can call the handler from several threads at once.
+      return (count_.fetch_add(1, std::memory_order_relaxed) + 1) % N_ == 0;
+    }
+
+    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
+      return std::make_shared<Impl>(N_);
+    }
+
+  private:
+    std::atomic<std::size_t> count_ {};
+    const std::size_t N_;
+  };
+
+  explicit FlushEveryN(std::size_t N)
+      : FlushHandler(std::make_shared<Impl>(N)) {}
+};
+
+//! \brief Flush once the formatted messages since the last flush add up to some number of bytes.
+//!
+//! Only the messages that the frontend formats are counted, so this never flushes backends that do not use
+//! the formatted message, like the BinaryFileSink.
+class FlushAfterBytes final : public FlushHandler {
+public:
+  class Impl final : public FlushHandler::Impl {
+  public:
+    explicit Impl(std::size_t num_bytes)
+        : num_bytes_(num_bytes) {
+      LL_REQUIRE(0 < num_bytes, "the number of bytes cannot be 0");
+    }
+
+    bool DoFlush(const Record& record) override { return DoFlushMessage(record, 0); }
+
+    bool DoFlushMessage(const Record&, std::size_t message_size) override {
+      if (unflushed_.fetch_add(message_size, std::memory_order_relaxed) + message_size < num_bytes_) {
+        return false;
+      }
+      // If several threads pass the limit at once, only the first one to reset the count flushes.
+      return num_bytes_ <= unflushed_.exchange(0, std::memory_order_relaxed);
+    }
+
+    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
+      return std::make_shared<Impl>(num_bytes_);
+    }
+
+  private:
+    std::atomic<std::size_t> unflushed_ {};
+    const std::size_t num_bytes_;
+  };
+
+  explicit FlushAfterBytes(std::size_t num_bytes)
+      : FlushHandler(std::make_shared<Impl>(num_bytes)) {}
+};
+
+//! \brief Flush on a record if this handler has not asked for a flush for some time.
+//!
+//! The time is only checked when a record is logged, so a sink that stops getting records is not flushed. The
+//! BackgroundFlusher flushes sinks on its own schedule instead.
+class FlushAfterInterval final : public FlushHandler {
+public:
+  class Impl final : public FlushHandler::Impl {
+  public:
+    explicit Impl(std::chrono::steady_clock::duration interval)
+        : interval_(interval.count()) {}
+
+    bool DoFlush(const Record&) override {
+      const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+      auto last_flush = last_flush_.load(std::memory_order_relaxed);
+      return interval_ <= now - last_flush
+             && last_flush_.compare_exchange_strong(last_flush, now, std::memory_order_relaxed);
+    }
+
+    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
+      return std::make_shared<Impl>(std::chrono::steady_clock::duration(interval_));
+    }
+
+  private:
+    const std::chrono::steady_clock::rep interval_;
+    std::atomic<std::chrono::steady_clock::rep> last_flush_ {
+        std::chrono::steady_clock::now().time_since_epoch().count()};
+  };
+
+  template<typename Rep_t, typename Period_t>
+  explicit FlushAfterInterval(std::chrono::duration<Rep_t, Period_t> interval)
+      : FlushHandler(std::make_shared<Impl>(
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval))) {}
+};
+
+//! \brief Flush after every record with one of a set of severities, e.g. so errors are never lost.
+class FlushOnSeverity final : public FlushHandler {
+public:
+  class Impl final : public FlushHandler::Impl {
+  public:
+    explicit Impl(SeveritySet severities)
+        : severities_(severities) {}
+
+    bool DoFlush(const Record& record) override {
+      const auto& level = record.Attributes().basic_attributes.level;
+      return level && severities_.Check(*level);
+    }
+
+    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
+      return std::make_shared<Impl>(severities_);
+    }
+
+  private:
+    const SeveritySet severities_;
+  };
+
+  explicit FlushOnSeverity(SeveritySet severities)
+      : FlushHandler(std::make_shared<Impl>(severities)) {}
+};
+
+class DisjunctionFlushHandler final : public FlushHandler {
+public:
+  class Impl final : public FlushHandler::Impl {
+  public:
+    Impl(FlushHandler lhs, FlushHandler rhs)
+        : lhs_(std::move(lhs))
+        , rhs_(std::move(rhs)) {}
+
+    bool DoFlush(const Record& record) override { return lhs_.DoFlush(record) || rhs_.DoFlush(record); }
+
+    bool DoFlushMessage(const Record& record, std::size_t message_size) override {
+      return lhs_.DoFlush(record, message_size) || rhs_.DoFlush(record, message_size);
+    }
+
+    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
+      return std::make_shared<Impl>(lhs_.Clone(), rhs_.Clone());
+    }
+
+  private:
+    FlushHandler lhs_, rhs_;
+  };
+
+  DisjunctionFlushHandler(FlushHandler lhs, FlushHandler rhs)
+      : FlushHandler(std::make_shared<Impl>(std::move(lhs), std::move(rhs))) {}
+};
+
+class ConjunctionFlushHandler final : public FlushHandler {
+public:
+  class Impl final : public FlushHandler::Impl {
+  public:
+    Impl(FlushHandler lhs, FlushHandler rhs)
+        : lhs_(std::move(lhs))
+        , rhs_(std::move(rhs)) {}
+
+    bool DoFlush(const Record& record) override { return lhs_.DoFlush(record) && rhs_.DoFlush(record); }
+
+    bool DoFlushMessage(const Record& record, std::size_t message_size) override {
+      return lhs_.DoFlush(record, message_size) && rhs_.DoFlush(record, message_size);
+    }
+
+    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
+      return std::make_shared<Impl>(lhs_.Clone(), rhs_.Clone());
+    }
+
+  private:
+    FlushHandler lhs_, rhs_;
+  };
+
+  ConjunctionFlushHandler(FlushHandler lhs, FlushHandler rhs)
+      : FlushHandler(std::make_shared<Impl>(std::move(lhs), std::move(rhs))) {}
+};
+
+inline DisjunctionFlushHandler operator||(const FlushHandler& lhs, const FlushHandler& rhs) {
+  return {lhs, rhs};
+}
+
+inline ConjunctionFlushHandler operator&&(const FlushHandler& lhs, const FlushHandler& rhs) {
+  return {lhs, rhs};
+}
+
+}  // namespace flush
+
+// ==============================================================================================
+//  Per call site sampling.
+// ==============================================================================================
+
+//! \brief Policies that decide whether a logging statement should emit a message, used by the LOG_EVERY_N,
+//!        LOG_FIRST_N, LOG_EVERY_T and LOG_RATE_LIMITED macros.
+//!
+//! Each macro keeps its policy in a function-local static, so every call site has its own state. The state is
+//! made of relaxed atomics, so threads that log from the same call site never wait on each other, and the
+//! decision is made before a record is created, so suppressed messages cost little more than the atomic
+//! operation. A policy can optionally count the messages it suppresses, and report them in the next message
+//! that it lets through.
+namespace sampling {
+
+//! \brief Emit the first message and every N-th message after it.
+class EveryN {
+public:
+  explicit EveryN(std::size_t N, bool report_suppressed = false)
+      : N_(N)
+      , report_suppressed_(report_suppressed) {
+    LL_REQUIRE(0 < N, "N cannot be 0");
+  }
+
+  bool ShouldLog() { return count_.fetch_add(1, std::memory_order_relaxed) % N_ == 0; }
+
+  //! \brief The number of messages suppressed since the last message that was emitted. Every message but the
+  //!        first follows exactly N - 1 suppressed messages, so there is nothing to count.
+  NO_DISCARD std::size_t TakeSuppressed() const {
+    return report_suppressed_ && N_ <= count_.load(std::memory_order_relaxed) ? N_ - 1 : 0;
+  }
+
+private:
+  std::atomic<std::size_t> count_ {};
+  const std::size_t N_;
+  const bool report_suppressed_;
+};
+
+//! \brief Emit only the first N messages.
+//!
+//! Since no message is ever emitted after the suppressed ones, there is nothing to report.
+class FirstN {
+public:
+  explicit FirstN(std::size_t N)
+      : N_(N) {}
+
+  bool ShouldLog() {
+    // Once the limit is reached, only read the counter, so the cache line is not written to anymore.
+    if (N_ <= count_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    return count_.fetch_add(1, std::memory_order_relaxed) < N_;
+  }
+
+  NO_DISCARD std::size_t TakeSuppressed() const { return 0; }
+
+private:
+  std::atomic<std::size_t> count_ {};
+  const std::size_t N_;
+};
+
+//! \brief Emit at most one message per period. The first message is always emitted.
+class EveryT {
+public:
+  template<typename Rep_t, typename Period_t>
+  explicit EveryT(std::chrono::duration<Rep_t, Period_t> period, bool report_suppressed = false)
+      : period_ns_(std::chrono::duration_cast<std::chrono::nanoseconds>(period).count())
+      , report_suppressed_(report_suppressed) {
+    LL_REQUIRE(0 < period_ns_, "the period must be positive");
+  }
+
+  bool ShouldLog() { return ShouldLog(std::chrono::steady_clock::now()); }
+
+  //! \brief Decide whether to log, given the current time.
+  bool ShouldLog(std::chrono::steady_clock::time_point now) {
+    const auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    auto last_ns = last_ns_.load(std::memory_order_relaxed);
+    // Only one of the threads that see the period elapse wins the exchange, the others are suppressed.
+    if (last_ns == never || period_ns_ <= now_ns - last_ns) {
+      if (last_ns_.compare_exchange_strong(last_ns, now_ns, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    if (report_suppressed_) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return false;
+  }
+
+  //! \brief The number of messages suppressed since the last call, for reporting in the emitted message.
+  std::size_t TakeSuppressed() {
+    return report_suppressed_ ? suppressed_.exchange(0, std::memory_order_relaxed) : 0;
+  }
+
+private:
+  static constexpr long long never = std::numeric_limits<long long>::min();
+
+  std::atomic<long long> last_ns_ {never};
+  std::atomic<std::size_t> suppressed_ {};
+  const long long period_ns_;
+  const bool report_suppressed_;
+};
+
+//! \brief A token bucket: emits on average at most `rate` messages per second, with bursts of up to `burst`
+//!        messages.
+//!
+//! The bucket is kept as a single "theoretical arrival time," the time at which the bucket would be full again
+//! (the generic cell rate algorithm), so taking a token is one compare-and-exchange.
+class RateLimited {
+public:
+  explicit RateLimited(double rate, std::size_t burst = 1, bool report_suppressed = false)
+      : interval_ns_(0 < rate ? static_cast<long long>(1e9 / rate) : 0)
+      , tolerance_ns_(interval_ns_ * static_cast<long long>(burst))
+      , report_suppressed_(report_suppressed) {
+    LL_REQUIRE(0 < rate, "the rate must be positive");
+    LL_REQUIRE(0 < burst, "the burst size cannot be 0");
+  }
+
+  bool ShouldLog() { return ShouldLog(std::chrono::steady_clock::now()); }
+
+  //! \brief Decide whether to log, given the current time.
+  bool ShouldLog(std::chrono::steady_clock::time_point now) {
+    const auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    auto full_at = full_at_ns_.load(std::memory_order_relaxed);
+    for (;;) {
+      // Taking a token pushes the time at which the bucket is full again one interval further out.
+      const auto next = std::max(full_at, now_ns - tolerance_ns_) + interval_ns_;
+      if (now_ns < next) {
+        if (report_suppressed_) {
+          suppressed_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return false;
+      }
+      if (full_at_ns_.compare_exchange_weak(full_at, next, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  }
+
+  //! \brief The number of messages suppressed since the last call, for reporting in the emitted message.
+  std::size_t TakeSuppressed() {
+    return report_suppressed_ ? suppressed_.exchange(0, std::memory_order_relaxed) : 0;
+  }
+
+private:
+  //! \brief Starts out far in the past, so the bucket starts out full.
+  std::atomic<long long> full_at_ns_ {std::numeric_limits<long long>::min() / 2};
+  std::atomic<std::size_t> suppressed_ {};
+  const long long interval_ns_, tolerance_ns_;
+  const bool report_suppressed_;
+};
+
+//! \brief Streamed at the start of a sampled message. Notes how many messages the call site suppressed since it
+//!        last emitted a message, and adds nothing if there were none.
+struct SuppressedNote {
+  std::size_t count {};
+};
+
+inline void format_logstream(const SuppressedNote& note, RefBundle& bundle) {
+  if (note.count != 0) {
+    bundle << "[suppressed " << note.count << (note.count == 1 ? " message] " : " messages] ");
+  }
+}
+
+}  // namespace sampling
+
+// ==============================================================================================
+//  Pipeline metrics.
+// ==============================================================================================
+
+//! \brief Counters describing what logging costs: how many records the cores accept and reject, how long
+//!        sinks spend formatting and waiting for locks, and how long backends spend dispatching and flushing.
+//!
+//! Counters are only collected if LL_ENABLE_METRICS is defined to be 1 (e.g. with the CMake option
+//! LIGHTNING_ENABLE_METRICS). Otherwise, no counters are stored and nothing is recorded, and the snapshots
+//! returned by Core::GetStats(), Sink::GetStats(), and SinkBackend::GetStats() only contain the values that are
+//! tracked anyway, like the queue depth of an AsyncSink.
+namespace metrics {
+
+//! \brief Whether metrics are being collected.
+inline constexpr bool enabled = LL_ENABLE_METRICS != 0;
+
+//! \brief The number of severity slots in the per-severity counters: one per severity, plus one for records
+//!        without a severity.
+inline constexpr std::size_t num_severity_slots = 8;
+
+//! \brief Get the slot of a severity in the per-severity counters. Records without a severity use the last
+//!        slot.
+inline std::size_t SeveritySlot(std::optional<Severity> severity) {
+  return severity ? static_cast<std::size_t>(SeverityIndex(*severity)) : num_severity_slots - 1;
+}
+
+namespace detail {
+
+//! \brief The number of shards in a ShardedCounters.
+inline constexpr std::size_t num_shards = 8;
+
+//! \brief Get the shard that the calling thread updates. Threads are assigned shards round-robin.
+inline std::size_t ShardIndex() {
+  static std::atomic<std::size_t> next_shard {0};
+  thread_local const std::size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % num_shards;
+  return shard;
+}
+
+}  // namespace detail
+
+//! \brief A set of N counters, split into shards that are updated by different threads, so concurrent updates
+//!        rarely contend on the same cache line. Reading a counter sums the shards.
+template<std::size_t N>
+class ShardedCounters {
+public:
+  //! \brief Add to a counter.
+  void Add(std::size_t counter, std::uint64_t amount = 1) noexcept {
+    shards_[detail::ShardIndex()].values[counter].fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  //! \brief Get the value of a counter, summed over all shards.
+  NO_DISCARD std::uint64_t Get(std::size_t counter) const noexcept {
+    std::uint64_t total = 0;
+    for (auto& shard : shards_) {
+      total += shard.values[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  //! \brief Set all counters back to zero.
+  void Reset() noexcept {
+    for (auto& shard : shards_) {
+      for (auto& value : shard.values) {
+        value.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  struct alignas(64) Shard {
+    std::atomic<std::uint64_t> values[N] {};
+  };
+
+  std::array<Shard, detail::num_shards> shards_ {};
+};
+
+//! \brief Adds the nanoseconds that it is alive for to a counter.
+template<std::size_t N>
+class ScopedTimer {
+public:
+  ScopedTimer(ShardedCounters<N>& counters, std::size_t counter)
+      : counters_(counters)
+      , counter_(counter)
+      , start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    counters_.Add(counter_,
+                  static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+  ShardedCounters<N>& counters_;
+  std::size_t counter_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+//! \brief The counters of a SinkBackend.
+struct BackendStats {
+  std::uint64_t dispatch_count {}, dispatch_ns {};
+  std::uint64_t flush_count {}, flush_ns {};
+};
+
+//! \brief The counters of a Sink, and of its backend.
+struct SinkStats {
+  //! \brief Records handed to the sink's backend.
+  std::uint64_t records {};
+
+  //! \brief Bytes produced by the sink's formatter, and the time the formatter took.
+  std::uint64_t bytes_formatted {}, format_ns {};
+
+  //! \brief Time spent waiting to acquire the lock of a SynchronousSink.
+  std::uint64_t lock_wait_ns {};
+
+  //! \brief For an AsyncSink, the number of queued records when the snapshot was taken, the capacity of the
+  //!        queue, and the number of records dropped because the queue was full. These are tracked even when
+  //!        metrics are disabled.
+  std::size_t queue_depth {}, queue_capacity {};
+  std::uint64_t dropped {};
+
+  BackendStats backend;
+};
+
+//! \brief The counters of a Core, and of each of its sinks.
+struct CoreStats {
+  //! \brief Records accepted (i.e. dispatched to the sinks) and rejected, per severity. See SeveritySlot.
+  std::array<std::uint64_t, num_severity_slots> accepted {}, rejected {};
+
+  //! \brief The stats of each sink, in the order the sinks were added to the core.
+  std::vector<SinkStats> sinks;
+
+  NO_DISCARD std::uint64_t GetAccepted(std::optional<Severity> severity) const {
+    return accepted[SeveritySlot(severity)];
+  }
+
+  NO_DISCARD std::uint64_t GetRejected(std::optional<Severity> severity) const {
+    return rejected[SeveritySlot(severity)];
+  }
+
+  NO_DISCARD std::uint64_t TotalAccepted() const {
+    return std::accumulate(accepted.begin(), accepted.end(), std::uint64_t {0});
+  }
+
+  NO_DISCARD std::uint64_t TotalRejected() const {
+    return std::accumulate(rejected.begin(), rejected.end(), std::uint64_t {0});
+  }
+};
+
+namespace detail {
+
+//! \brief Indices of the backend counters.
+enum BackendCounter : std::size_t {
+  backend_dispatch_count,
+  backend_dispatch_ns,
+  backend_flush_count,
+  backend_flush_ns,
+};
+inline constexpr std::size_t num_backend_counters = 4;
+
+//! \brief Indices of the sink counters.
+enum SinkCounter : std::size_t { sink_records, sink_bytes_formatted, sink_format_ns, sink_lock_wait_ns };
+inline constexpr std::size_t num_sink_counters = 4;
+
+//! \brief Indices of the core counters: the accepted counts, then the rejected counts, per severity slot.
+inline constexpr std::size_t core_accepted = 0, core_rejected = num_severity_slots;
+inline constexpr std::size_t num_core_counters = 2 * num_severity_slots;
+
+}  // namespace detail
+}  // namespace metrics
+
+//! \brief A record in a batch that is dispatched all at once, along with its formatted message.
+//!
+//! Batches passed to a sink frontend may leave the message null, in which case the frontend formats the
+//! record. Batches passed to a sink backend always have the message.
+struct BatchEntry {
+  const Record* record {};
+  const memory::BasicMemoryBuffer<char>* formatted_msg {};
+};
+
+//! \brief The type of function that can be used as a sink callback.
+using SinkCallback = std::function<void(const memory::BasicMemoryBuffer<char>& buffer, const Record& record)>;
+
+//! \brief Base class for sink backends, which are responsible for actually handling the record and
+//!        doing something with it. Not responsible for thread synchronization, this is the job of the
+//!        frontend.
+class SinkBackend {
+  friend class Sink;
+  friend class ShardedFileSink;
+
+public:
+  //! \brief Flush the sink upon deletion.
+  virtual ~SinkBackend() { Flush(); }
+
+  //! \brief Dispatch a record.
+  void Dispatch(const memory::BasicMemoryBuffer<char>& buffer, const Record& record) {
+    dispatchMessage(buffer, record, [&] { dispatch(buffer, record); });
+  }
+
+  //! \brief Dispatch a record whose formatted message the backend may take over by moving from the buffer,
+  //!        e.g. to hand it to a writer thread without copying it. Frontends use this for the messages they
+  //!        formatted themselves. Afterwards, the buffer is valid, but its contents are unspecified.
+  void DispatchOwned(memory::MemoryBuffer<char>&& buffer, const Record& record) {
+    dispatchMessage(buffer, record, [&] { dispatchOwned(buffer, record); });
+  }
+
+  //! \brief Dispatch a batch of records at once.
+  //!
+  //! The callback is called, and the flush handler consulted, for every record, but the pre- and post-message
+  //! actions happen once for the whole batch, the sink is flushed at most once, and the backend can write all
+  //! the messages together.
+  void DispatchBatch(const std::vector<BatchEntry>& batch) {
+    if (batch.empty()) {
+      return;
+    }
+    LL_METRICS(counters_.Add(metrics::detail::backend_dispatch_count, batch.size()));
+    LL_METRICS(metrics::ScopedTimer timer(counters_, metrics::detail::backend_dispatch_ns));
+    if (callback_) {
+      for (auto& entry : batch) {
+        callback_(*entry.formatted_msg, *entry.record);
+      }
+    }
+    preMessage();
+    dispatchBatch(batch);
+    postMessage();
+    // Every record is handed to the flush handler, so handlers that count records stay exact.
+    bool do_flush = auto_flush_;
+    if (flush_handler_) {
+      for (auto& entry : batch) {
+        do_flush = flush_handler_->DoFlush(*entry.record, entry.formatted_msg->Size()) || do_flush;
+      }
+    }
+    if (do_flush) {
+      Flush();
+    }
+  }
+
+  //! \brief Flush the sink. This is implementation defined.
+  SinkBackend& Flush() {
+    LL_METRICS(counters_.Add(metrics::detail::backend_flush_count));
+    LL_METRICS(metrics::ScopedTimer timer(counters_, metrics::detail::backend_flush_ns));
+    flush();
+    return *this;
+  }
+
+  //! \brief Get a snapshot of the backend's counters. These are all zero unless metrics are enabled.
+  NO_DISCARD metrics::BackendStats GetStats() const {
+    metrics::BackendStats stats;
+#if LL_ENABLE_METRICS
+    stats.dispatch_count = counters_.Get(metrics::detail::backend_dispatch_count);
+    stats.dispatch_ns = counters_.Get(metrics::detail::backend_dispatch_ns);
+    stats.flush_count = counters_.Get(metrics::detail::backend_flush_count);
+    stats.flush_ns = counters_.Get(metrics::detail::backend_flush_ns);
+#endif
+    return stats;
+  }
+
+  //! \brief Get the sink formatting settings.
+  NO_DISCARD const FormattingSettings& GetFormattingSettings() const { return settings_; }
+
+  //! \brief Mutably get the sink formatting settings.
+  NO_DISCARD FormattingSettings& GetFormattingSettings() { return settings_; }
+
+  //! \brief Create a new flush handler for the sink.
+  template<typename FlushHandler_t, typename... Args_t>
+  SinkBackend& CreateFlushHandler(Args_t&&... args) {
+    flush_handler_ = FlushHandler_t(std::forward<Args_t>(args)...);
+    return *this;
+  }
+
+  //! \brief Set the flush handler.
+  SinkBackend& SetFlushHandler(flush::FlushHandler&& flush_handler) {
+    flush_handler_ = std::move(flush_handler);
+    return *this;
+  }
+
+  //! \brief Clear the flush handler.
+  SinkBackend& ClearFlushHandler() {
+    flush_handler_ = {};
+    return *this;
+  }
+
+  //! \brief Set the sink auto-flush.
+  //!
+  //! This will take precedence over any flush handler.
+  SinkBackend& SetAutoFlush(bool auto_flush) {
+    auto_flush_ = auto_flush;
+    return *this;
+  }
+
+  //! \brief Clone a sink backend, making a deep copy of the backend.
+  //!
+  //! Certain objects, e.g., the call-back function (if any), may not be deeply copied.
+  NO_DISCARD virtual std::unique_ptr<SinkBackend> Clone() const = 0;
+
+  //! \brief Copy the basic settings from another sink backend to this backend.
+  void CopySettings(const SinkBackend& other) {
+    settings_ = other.settings_;
+    flush_handler_ = other.copyFlushHandler();
+    callback_ = other.callback_;
+    auto_flush_ = other.auto_flush_;
+  }
+
+  //! \brief Set the sink backend callback function.
+  void SetCallback(SinkCallback&& callback) { callback_ = std::move(callback); }
+
+  //! \brief Remove the sink backend callback function.
+  void ClearCallback() { callback_ = {}; }
+
+protected:
+  //! \brief Private dispatch implementation.
+  virtual void dispatch(const memory::BasicMemoryBuffer<char>& buffer, const Record& record) = 0;
+
+  //! \brief Private implementation of dispatching a message that the backend may move from, see
+  //!        DispatchOwned. By default, the message is dispatched like any other.
+  virtual void dispatchOwned(memory::MemoryBuffer<char>& buffer, const Record& record) {
+    dispatch(buffer, record);
+  }
+
+  //! \brief Private implementation of dispatching a batch. By default, each record is dispatched on its own.
+  virtual void dispatchBatch(const std::vector<BatchEntry>& batch) {
+    for (auto& entry : batch) {
+      dispatch(*entry.formatted_msg, *entry.record);
+    }
+  }
+
+  //! \brief Protected implementation of flushing the sink.
+  virtual void flush() { flushLockFree(); }
+
+  //! \brief Protected implementation of flushing the sink, must be without locking.
+  virtual void flushLockFree() {}
+
+  NO_DISCARD std::optional<flush::FlushHandler> copyFlushHandler() const {
+    return flush_handler_ ? std::optional(flush_handler_->Clone()) : std::nullopt;
+  }
+
+  //! \brief Any pre-message actions that need to be taken.
+  virtual void preMessage() {}
+
+  //! \brief Any post-message actions that need to be taken.
+  virtual void postMessage() {}
+
+  //! \brief Dispatch a record with the callback, the pre- and post-message actions, and the flush logic
+  //!        around the dispatch itself.
+  template<typename Func_t>
+  void dispatchMessage(const memory::BasicMemoryBuffer<char>& buffer,
+                       const Record& record,
+                       Func_t&& dispatch_func) {
+    LL_METRICS(counters_.Add(metrics::detail::backend_dispatch_count));
+    LL_METRICS(metrics::ScopedTimer timer(counters_, metrics::detail::backend_dispatch_ns));
+    if (callback_) {
+      // If there is a callback, call it.
+      callback_(buffer, record);
+    }
+    // The backend may take the message, so its size is read first.
+    const auto message_size = buffer.Size();
+    preMessage();
+    dispatch_func();
+    postMessage();
+    // Flush logic.
+    if (auto_flush_ || (flush_handler_ && flush_handler_->DoFlush(record, message_size))) {
+      Flush();
+    }
+  }
+
+  //! \brief The sink formatting settings.
+  FormattingSettings settings_;
+
+  //! \brief An optional flush handler, which determines whether the sink should be flushed based on the
+  //!        record.
+  std::optional<flush::FlushHandler> flush_handler_ {};
+
+  //! \brief A callback that can choose to do some action based on the buffer (serialized data, via the
+  //!        frontend) and record itself (containing all the attributes).
+  SinkCallback callback_;
+
+  //! \brief Whether to automatically flush the sink after each message.
+  bool auto_flush_ = false;
+
+#if LL_ENABLE_METRICS
+  //! \brief Dispatch and flush counters.
+  metrics::ShardedCounters<metrics::detail::num_backend_counters> counters_;
+#endif
+};
+
+// ==============================================================================================
+//  Synchronization wrappers
+// ==============================================================================================
+
+//! \brief Base class for object wrappers. These, in general, potentially lock the object while it exists,
+//!        keeping other threads from accessing it while the wrapper is alive.
+//!
+//! Sink frontends are responsible for thread synchronization, and only frontend sinks that use a mutex will
+//! return a truly "locked" sink, others will just return a SinkWrapper.
+template<typename Object_t>
+class ObjectWrapper : public ImplBase {
+  friend class ImplBase;
+
+protected:
+  struct Impl : ImplBase::Impl {
+    explicit Impl(Object_t* obj)
+        : object(obj) {}
+    Object_t* object {};
+  };
+
+  explicit ObjectWrapper(const std::shared_ptr<Impl>& impl)
+      : ImplBase(impl) {}
+
+public:
+  explicit ObjectWrapper(Object_t* obj)
+      : ImplBase(std::make_shared<Impl>(obj)) {}
+
+  Object_t* operator->() { return impl<ObjectWrapper>()->object; }
+  Object_t& operator*() { return *impl<ObjectWrapper>()->object; }
+  const Object_t& operator*() const { return *impl<ObjectWrapper>()->object; }
+
+  explicit operator bool() { return static_cast<bool>(impl<ObjectWrapper>()->object); }
+
+  //! \brief Try casting the object to a specific type.
+  template<typename OtherObject_t>
+  OtherObject_t* As() {
+    return dynamic_cast<OtherObject_t*>(impl<ObjectWrapper>()->backend);
+  }
+};
+
+//! \brief A locked object wrapper that controlls access via a mutex.
+template<typename Object_t>
+class LockedObject : public ObjectWrapper<Object_t> {
+protected:
+  template<typename Mutex_t>
+  struct Impl : ObjectWrapper<Object_t>::Impl {
+    explicit Impl(Object_t* backend, Mutex_t& mutex)
+        : ObjectWrapper<Object_t>::Impl(backend)
+        , lock(mutex) {}
+    std::unique_lock<Mutex_t> lock;
+  };
+
+public:
+  template<typename Mutex_t>
+  explicit LockedObject(Object_t* object, Mutex_t& mutex)
+      : ObjectWrapper<Object_t>(std::make_shared<Impl<Mutex_t>>(object, mutex)) {}
+};
+
+namespace locks {
+
+//! \brief Shared (reader) lock guard that is only used if the `do_lock` flag is true.
+//!
+//! This allows us to toggle via a flag whether synchronization is necessary.
+template<typename Mutex_t>
+class PotentiallySharedLock {
+public:
+  PotentiallySharedLock(Mutex_t& mutex, bool do_lock) {
+    if (do_lock) {
+      lock_ = std::shared_lock<Mutex_t>(mutex);
+    }
+  }
+
+private:
+  std::shared_lock<Mutex_t> lock_;
+};
+
+//! \brief Unique (writer) lock guard that is only used if the `do_lock` flag is true.
+//!
+//! This allows us to toggle via a flag whether synchronization is necessary.
+template<typename Mutex_t>
+class PotentiallyUniqueLock {
+public:
+  PotentiallyUniqueLock(Mutex_t& mutex, bool do_lock) {
+    if (do_lock) {
+      lock_ = std::unique_lock<Mutex_t>(mutex);
+    }
+  }
+
+private:
+  std::unique_lock<Mutex_t> lock_;
+};
+
+//! \brief A mutex that keeps track of which thread, if any, currently holds it.
+//!
+//! This lets code that may or may not already be running under the lock (e.g. a sink being flushed through a
+//! locked sink wrapper) avoid locking the mutex a second time.
+class OwnerTrackingMutex {
+public:
+  void lock() {
+    mutex_.lock();
+    owner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  }
+
+  bool try_lock() {
+    if (mutex_.try_lock()) {
+      owner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  void unlock() {
+    owner_.store(std::thread::id {}, std::memory_order_relaxed);
+    mutex_.unlock();
+  }
+
+  //! \brief Check whether the calling thread is the thread that holds the mutex.
+  NO_DISCARD bool IsHeldByCurrentThread() const {
+    return owner_.load(std::memory_order_relaxed) == std::this_thread::get_id();
+  }
+
+private:
+  std::mutex mutex_;
+
+  //! \brief The thread that holds the mutex, or a default constructed ID if the mutex is not held.
+  std::atomic<std::thread::id> owner_ {};
+};
+
+}  // namespace locks
+
+namespace concurrency {
+
+//! \brief A bounded, lock-free, multi-producer multi-consumer queue.
+//!
+//! This is Dmitry Vyukov's bounded MPMC queue: every cell carries a sequence number that tells producers and
+//! consumers whether the cell is ready to be written to or read from, so a push or pop is a single CAS on the
+//! enqueue or dequeue position, plus the move of the object itself. No memory is allocated after construction.
+//! The capacity is rounded up to a power of two.
+template<typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(std::size_t capacity)
+      : capacity_(roundUpToPowerOfTwo(capacity))
+      , mask_(capacity_ - 1)
+      , cells_(std::make_unique<Cell[]>(capacity_)) {
+    for (std::size_t i = 0; i < capacity_; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  ~BoundedQueue() {
+    std::optional<T> discard;
+    while (TryPop(discard)) {
+      discard.reset();
+    }
+  }
+
+  //! \brief Try to push an object onto the queue. The object is moved from only if the push succeeds.
+  //!
+  //! \return Whether there was space in the queue for the object.
+  bool TryPush(T& object) {
+    Cell* cell;
+    auto position = enqueue_position_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[position & mask_];
+      const auto sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+      if (difference == 0) {
+        if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (difference < 0) {
+        return false;  // The queue is full.
+      }
+      else {
+        position = enqueue_position_.load(std::memory_order_relaxed);
+      }
+    }
+    new (cell->storage) T(std::move(object));
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  //! \brief Try to pop the oldest object from the queue into `object`.
+  //!
+  //! \return Whether there was an object to pop.
+  bool TryPop(std::optional<T>& object) {
+    Cell* cell;
+    auto position = dequeue_position_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[position & mask_];
+      const auto sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position + 1);
+      if (difference == 0) {
+        if (dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (difference < 0) {
+        return false;  // The queue is empty.
+      }
+      else {
+        position = dequeue_position_.load(std::memory_order_relaxed);
+      }
+    }
+    auto stored = std::launder(reinterpret_cast<T*>(cell->storage));
+    object.emplace(std::move(*stored));
+    stored->~T();
+    cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  //! \brief Check whether the queue is empty. This is only a snapshot, other threads may be modifying the
+  //!        queue.
+  NO_DISCARD bool Empty() const {
+    return enqueue_position_.load(std::memory_order_acquire) == dequeue_position_.load(std::memory_order_acquire);
+  }
+
+  //! \brief Get the number of objects in the queue. This is only a snapshot, other threads may be modifying
+  //!        the queue.
+  NO_DISCARD std::size_t ApproximateSize() const {
+    const auto dequeue_position = dequeue_position_.load(std::memory_order_acquire);
+    const auto enqueue_position = enqueue_position_.load(std::memory_order_acquire);
+    return enqueue_position < dequeue_position ? 0 : std::min(enqueue_position - dequeue_position, capacity_);
+  }
+
+  //! \brief Get the number of objects the queue can hold.
+  NO_DISCARD std::size_t Capacity() const { return capacity_; }
+
+private:
+  static std::size_t roundUpToPowerOfTwo(std::size_t n) {
+    std::size_t power = 1;
+    while (power < n) {
+      power <<= 1;
+    }
+    return power;
+  }
+
+  struct Cell {
+    std::atomic<std::size_t> sequence {};
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  const std::size_t capacity_;
+  const std::size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+
+  //! \brief The enqueue and dequeue positions are kept on separate cache lines, since producers and
+  //!        consumers hammer on them independently.
+  alignas(64) std::atomic<std::size_t> enqueue_position_ {0};
+  alignas(64) std::atomic<std::size_t> dequeue_position_ {0};
+};
+
+//! \brief Read-copy-update support. Readers use a published object without writing to any memory that other
+//!        threads use, and a writer that replaced the object can wait until no reader can still be using the
+//!        old one, and then free it.
+//!
+//! Every thread that reads gets its own slot, holding a counter that the thread increments when it enters and
+//! when it leaves a read section, so the counter is odd while the thread is reading. Only the owning thread
+//! writes to a slot, so a read section is two plain stores to a cache line that no other thread writes to,
+//! with no read-modify-write. After publishing a new object, a writer calls Synchronize, which waits until the
+//! counter of every thread that was reading has changed. Readers that start later can only see the new object.
+class EpochDomain {
+  struct alignas(64) Slot {
+    std::atomic<std::uint64_t> counter {0};
+
+    //! \brief Depth of nested read sections. Only used by the owning thread.
+    std::size_t depth {0};
+  };
+
+public:
+  //! \brief Get the domain. It is deliberately leaked, so threads that exit during static destruction can still
+  //!        release their slots.
+  static EpochDomain& Get() {
+    static auto domain = new EpochDomain;
+    return *domain;
+  }
+
+  //! \brief RAII read section. Read sections may nest. A section constructed with `enter = false` does nothing,
+  //!        which lets unsynchronized users skip the cost.
+  class ReadSection {
+  public:
+    explicit ReadSection(bool enter = true)
+        : slot_(enter ? &localSlot() : nullptr) {
+      if (slot_ && slot_->depth++ == 0) {
+        // The store has to be ordered before the loads of the published object, hence sequential consistency.
+        slot_->counter.store(slot_->counter.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+      }
+    }
+
+    ~ReadSection() {
+      if (slot_ && --slot_->depth == 0) {
+        slot_->counter.store(slot_->counter.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      }
+    }
+
+    ReadSection(const ReadSection&) = delete;
+    ReadSection& operator=(const ReadSection&) = delete;
+
+  private:
+    Slot* slot_;
+  };
+
+  //! \brief Check whether the calling thread is inside a read section.
+  NO_DISCARD static bool InReadSection() { return localSlot().depth != 0; }
+
+  //! \brief Wait until every read section that was in progress when this was called has ended.
+  //!
+  //! Must not be called from inside a read section, since that section could never end.
+  void Synchronize() {
+    LL_REQUIRE(!InReadSection(), "cannot wait for readers from inside a read section");
+    std::vector<std::pair<const Slot*, std::uint64_t>> readers;
+    {
+      std::lock_guard guard(mutex_);
+      for (const auto& slot : slots_) {
+        if (const auto counter = slot.counter.load(std::memory_order_seq_cst); counter & 1) {
+          readers.emplace_back(&slot, counter);
+        }
+      }
+    }
+    // Slots are never freed, only reused, and their counters keep counting, so this is safe even if a thread
+    // exits in the meantime.
+    for (auto [slot, counter] : readers) {
+      while (slot->counter.load(std::memory_order_acquire) == counter) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  //! \brief Get the number of slots, i.e. the largest number of threads that have read at the same time.
+  NO_DISCARD std::size_t GetNumSlots() {
+    std::lock_guard guard(mutex_);
+    return slots_.size();
+  }
+
+private:
+  //! \brief Owns the calling thread's slot, returning it to the domain when the thread exits.
+  struct LocalSlot {
+    LocalSlot()
+        : slot(Get().acquire()) {}
+    ~LocalSlot() { Get().release(slot); }
+    Slot* slot;
+  };
+
+  static Slot& localSlot() {
+    thread_local LocalSlot local;
+    return *local.slot;
+  }
+
+  Slot* acquire() {
+    std::lock_guard guard(mutex_);
+    if (!free_slots_.empty()) {
+      auto slot = free_slots_.back();
+      free_slots_.pop_back();
+      return slot;
+    }
+    return &slots_.emplace_back();
+  }
+
+  void release(Slot* slot) {
+    std::lock_guard guard(mutex_);
+    free_slots_.push_back(slot);
+  }
+
+  std::mutex mutex_;
+
+  //! \brief A deque, so slots keep their address as more are added.
+  std::deque<Slot> slots_;
+  std::vector<Slot*> free_slots_;
+};
+
+}  // namespace concurrency
+
+// ==============================================================================================
+//  Sinks
+// ==============================================================================================
+
+//! \brief Base class for sink frontends. These are responsible for common tasks, like filtering
+//!        and controlling access to the sink backend, i.e. synchronization.
+class Sink {
+  friend class Core;
+  friend class BacktraceSink;
+
+public:
+  //! \brief Construct a sink around a specific backend.
+  explicit Sink(std::unique_ptr<SinkBackend>&& backend)
+      : sink_backend_(std::move(backend))
+      , formatter_(formatting::MakeStandardFormatter()) {}
+
+  virtual ~Sink() = default;
+
+  //! \brief Check if a sink, given the record's attributes, will accept the record.
+  NO_DISCARD bool WillAccept(const RecordAttributes& attributes) const {
+    return filter_.WillAccept(attributes);
+  }
+
+  //! \brief Check if a sink will accept the record, reusing the results of filter programs that other sinks
+  //!        already ran on it.
+  NO_DISCARD bool WillAccept(const RecordAttributes& attributes, filter::EvaluationCache& cache) const {
+    return filter_.WillAccept(attributes, cache);
+  }
+
+  //! \brief Check if a sink, given the record's severity, will accept the record.
+  NO_DISCARD bool WillAccept(std::optional<Severity> severity) const { return filter_.WillAccept(severity); }
+
+  //! \brief Get the AttributeFilter for the sink.
+  filter::AttributeFilter& GetFilter() { return filter_; }
+
+  //! \brief Dispatch a record.
+  virtual void Dispatch(const Record& record) { dispatch(record, nullptr); }
+
+  //! \brief Dispatch a record, given the pre-formatted record.
+  virtual void Dispatch(const Record& record, const memory::BasicMemoryBuffer<char>& buffer) {
+    dispatch(record, &buffer);
+  }
+
+  //! \brief Dispatch a record, taking its formatted message from a cache that is shared with other sinks.
+  //!
+  //! Frontends that format the record right away only format their header, others ignore the cache.
+  void Dispatch(const Record& record, MessageBodyCache& body_cache) { dispatchShared(record, body_cache); }
+
+  //! \brief Dispatch a batch of records, some of which may already be formatted.
+  //!
+  //! Like Dispatch, this does not check the sink's filter, the caller (normally the core) does that.
+  void DispatchBatch(const std::vector<BatchEntry>& batch) {
+    if (!batch.empty()) {
+      dispatchBatch(batch);
+    }
+  }
+
+  // ==============================================================================================
+  //  Pass-through methods to the backend.
+  // ==============================================================================================
+
+  //! \brief Get the record formatter.
+  NO_DISCARD formatting::BaseMessageFormatter& GetFormatter() { return *formatter_; }
+
+  //! \brief Set the severity filter.
+  Sink& SetFilter(SeveritySet severity_set) {
+    filter_.Accept(severity_set);
+    return *this;
+  }
+
+  //! \brief Set the filter back to default.
+  Sink& ClearFilters() {
+    filter_ = filter::AttributeFilter {};
+    return *this;
+  }
+
+  //! \brief Set the sink's formatter.
+  Sink& SetFormatter(std::unique_ptr<formatting::BaseMessageFormatter>&& formatter) {
+    formatter_ = std::move(formatter);
+    return *this;
+  }
+
+  //! \brief 'Flush' the sink. This is implementation defined.
+  Sink& Flush() {
+    flush();
+    return *this;
+  }
+
+  //! \brief Mutably get the sink backend.
+  //!
+  //! \note Does not perform any locking.
+  SinkBackend& GetBackend() { return *sink_backend_; }
+
+  //! \brief Get the sink backend.
+  //!
+  //! \note Does not perform any locking.
+  NO_DISCARD const SinkBackend& GetBackend() const { return *sink_backend_; }
+
+  //! \brief Locks (if necessary) the sink backend, returning a locked sink.
+  NO_DISCARD ObjectWrapper<Sink> GetLockedSink() { return getLockedSink(); }
+
+  //! \brief Get the sink backend, cast to a specific type.
+  //!
+  //! \return nullptr if the type was not correct.
+  template<typename SinkBackend_t>
+  SinkBackend_t* GetBackendAs() {
+    return dynamic_cast<SinkBackend_t*>(sink_backend_.get());
+  }
+
+  //! \brief Get a snapshot of the sink's and its backend's counters, see metrics::SinkStats.
+  NO_DISCARD metrics::SinkStats GetStats() const {
+    metrics::SinkStats stats;
+#if LL_ENABLE_METRICS
+    stats.records = counters_.Get(metrics::detail::sink_records);
+    stats.bytes_formatted = counters_.Get(metrics::detail::sink_bytes_formatted);
+    stats.format_ns = counters_.Get(metrics::detail::sink_format_ns);
+    stats.lock_wait_ns = counters_.Get(metrics::detail::sink_lock_wait_ns);
+#endif
+    if (sink_backend_) {
+      stats.backend = sink_backend_->GetStats();
     }
+    addStats(stats);
+    return stats;
   }
 
-  NO_DISCARD const AnsiColorSegment& colorSegment(Severity severity) const {
-    switch (severity) {
-      case Severity::Trace:
-        return trace_colors_;
-      case Severity::Debug:
-        return debug_colors_;
-      case Severity::Info:
-        return info_colors_;
-      case Severity::Major:
-        return major_colors_;
-      case Severity::Warning:
-        return warn_colors_;
-      case Severity::Error:
-        return error_colors_;
-      case Severity::Fatal:
-        return fatal_colors_;
-      default:
-        LL_FAIL("unrecognized severity attribute");
+  //! \brief Make a deep copy of the Sink, including a deep copy of the sink backend.
+  NO_DISCARD std::shared_ptr<Sink> Clone() const {
+    auto sink = clone();
+    sink->filter_ = filter_;
+    sink->formatter_ = formatter_->Copy();
+    return sink;
+  }
+
+protected:
+  //! \brief Private virtual dispatch method for a pre-formatted message.
+  virtual void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>* formatted_msg) = 0;
+
+  //! \brief Private virtual method for dispatching a record whose formatted message may be shared. By default,
+  //!        the cache is not used.
+  virtual void dispatchShared(const Record& record, [[maybe_unused]] MessageBodyCache& body_cache) {
+    dispatch(record, nullptr);
+  }
+
+  //! \brief Private virtual method for dispatching a batch. By default, each record is dispatched on its own.
+  virtual void dispatchBatch(const std::vector<BatchEntry>& batch) {
+    for (auto& entry : batch) {
+      dispatch(*entry.record, entry.formatted_msg);
+    }
+  }
+
+  //! \brief Prepare a batch for the backend, formatting every record that does not already have a message that
+  //!        the backend accepts. Records that need formatting are formatted into the matching buffer.
+  void formatBatch(const std::vector<BatchEntry>& batch,
+                   std::vector<memory::MemoryBuffer<char>>& buffers,
+                   std::vector<BatchEntry>& formatted) {
+    const auto& settings = sink_backend_->GetFormattingSettings();
+    if (buffers.size() < batch.size()) {
+      buffers.resize(batch.size());
+    }
+    formatted.clear();
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      auto& entry = batch[i];
+      LL_METRICS(counters_.Add(metrics::detail::sink_records));
+      if (entry.formatted_msg && settings.accepts_preformatted) {
+        formatted.push_back(entry);
+        continue;
+      }
+      auto& buffer = buffers[i];
+      buffer.Clear();
+      if (settings.needs_formatting) {
+        format(*entry.record, settings, buffer, entry.formatted_msg);
+      }
+      formatted.push_back({entry.record, &buffer});
+    }
+  }
+
+  //! \brief Private implementation of the clone method.
+  NO_DISCARD virtual std::shared_ptr<Sink> clone() const = 0;
+
+  //! \brief Protected implementation of flushing the sink. By default, this just flushes the backend.
+  virtual void flush() { sink_backend_->Flush(); }
+
+  //! \brief Get the sink backend, wrapped in a SinkWrapper. The default implementation does not lock the
+  //!        sink, since the Sink base class has no mutex.
+  virtual ObjectWrapper<Sink> getLockedSink() { return ObjectWrapper(this); }
+
+  //! \brief Flush the sink without locking, from the signal handler, see Core::flushLockFree.
+  virtual void flushLockFree() const {
+    if (sink_backend_) {
+      sink_backend_->flushLockFree();
+    }
+  }
+
+  //! \brief Add any frontend specific values to a stats snapshot.
+  virtual void addStats([[maybe_unused]] metrics::SinkStats& stats) const {}
+
+  //! \brief Format a record with the sink's formatter, counting the time taken and bytes produced if metrics
+  //!        are enabled.
+  void format(const Record& record,
+              const FormattingSettings& settings,
+              memory::BasicMemoryBuffer<char>& buffer,
+              const memory::BasicMemoryBuffer<char>* formatted_msg = nullptr) {
+#if LL_ENABLE_METRICS
+    metrics::ScopedTimer timer(counters_, metrics::detail::sink_format_ns);
+    const auto initial_size = buffer.Size();
+    formatter_->Format(record, settings, buffer, formatted_msg);
+    counters_.Add(metrics::detail::sink_bytes_formatted, buffer.Size() - initial_size);
+#else
+    formatter_->Format(record, settings, buffer, formatted_msg);
+#endif
+  }
+
+  //! \brief The sink backend, to which the frontend feeds record.
+  std::unique_ptr<SinkBackend> sink_backend_ {};
+
+  //! \brief The Sink's attribute filters.
+  filter::AttributeFilter filter_;
+
+  //! \brief The sink's formatter.
+  std::unique_ptr<formatting::BaseMessageFormatter> formatter_;
+
+#if LL_ENABLE_METRICS
+  //! \brief Record, formatting, and lock counters.
+  metrics::ShardedCounters<metrics::detail::num_sink_counters> counters_;
+#endif
+};
+
+//! \brief A locked sink that uses a mutex to lock the sink, controlling access.
+using LockedSink = LockedObject<Sink>;
+
+//! \brief Sink frontend that uses no synchronization methods.
+//!
+//! This is the simplest sink frontend, but it is recommended that a SynchronousSink is used for all real
+//! applications.
+class UnlockedSink : public Sink {
+public:
+  explicit UnlockedSink(std::unique_ptr<SinkBackend>&& backend)
+      : Sink(std::move(backend)) {}
+
+  template<typename SinkBackend_t, typename... Args_t>
+  static std::shared_ptr<UnlockedSink> From(Args_t&&... args) {
+    static_assert(std::is_base_of_v<SinkBackend, SinkBackend_t>, "sink type must be a child of SinkBackend");
+    return std::make_shared<UnlockedSink>(std::make_unique<SinkBackend_t>(std::forward<Args_t>(args)...));
+  }
+
+private:
+  void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>* formatted_msg) override {
+    const auto& settings = sink_backend_->GetFormattingSettings();
+
+    LL_METRICS(counters_.Add(metrics::detail::sink_records));
+    // If the formatted message was already provided, pass that in.
+    if (formatted_msg && settings.accepts_preformatted) {
+      sink_backend_->Dispatch(*formatted_msg, record);
+      return;
+    }
+
+    auto buffer = memory::BufferPool::Local().Acquire();
+    if (settings.needs_formatting) {
+      format(record, sink_backend_->GetFormattingSettings(), *buffer, formatted_msg);
+    }
+    sink_backend_->DispatchOwned(std::move(*buffer), record);
+  }
+
+  void dispatchShared(const Record& record, MessageBodyCache& body_cache) override {
+    LL_METRICS(counters_.Add(metrics::detail::sink_records));
+    const auto& settings = sink_backend_->GetFormattingSettings();
+    auto buffer = memory::BufferPool::Local().Acquire();
+    if (settings.needs_formatting) {
+      format(record, settings, *buffer, body_cache.Get(settings));
+    }
+    sink_backend_->DispatchOwned(std::move(*buffer), record);
+  }
+
+  void dispatchBatch(const std::vector<BatchEntry>& batch) override {
+    std::vector<memory::MemoryBuffer<char>> buffers;
+    std::vector<BatchEntry> formatted;
+    formatBatch(batch, buffers, formatted);
+    sink_backend_->DispatchBatch(formatted);
+  }
+
+  NO_DISCARD std::shared_ptr<Sink> clone() const override {
+    return std::make_shared<UnlockedSink>(sink_backend_->Clone());
+  }
+};
+
+//! \brief Sink frontend that uses a mutex to control access.
+class SynchronousSink : public Sink {
+public:
+  explicit SynchronousSink(std::unique_ptr<SinkBackend>&& backend)
+      : Sink(std::move(backend)) {}
+
+  template<typename SinkBackend_t, typename... Args_t>
+  static std::shared_ptr<SynchronousSink> From(Args_t&&... args) {
+    static_assert(std::is_base_of_v<SinkBackend, SinkBackend_t>, "sink type must be a child of SinkBackend");
+    return std::make_shared<SynchronousSink>(std::make_unique<SinkBackend_t>(std::forward<Args_t>(args)...));
+  }
+
+  bool IsLocked() const {
+    if (lock_.try_lock()) {
+      lock_.unlock();
+      return false;
+    }
+    return true;
+  }
+
+private:
+  void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>* formatted_msg) override {
+    LL_METRICS(counters_.Add(metrics::detail::sink_records));
+    // If the formatted message was already provided, pass that in.
+    const auto& settings = sink_backend_->GetFormattingSettings();
+    if (formatted_msg && settings.accepts_preformatted) {
+      auto guard = acquireLock();
+      sink_backend_->Dispatch(*formatted_msg, record);
+      return;
+    }
+
+    // Technically, there could be some small asynchrony issue here with needs formatting being changed by
+    // another thread, but not only is it unlikely, it cannot cause any deadlocks.
+    auto buffer = memory::BufferPool::Local().Acquire();
+    if (settings.needs_formatting) {
+      format(record, sink_backend_->GetFormattingSettings(), *buffer, formatted_msg);
     }
+    auto guard = acquireLock();
+    sink_backend_->DispatchOwned(std::move(*buffer), record);
   }
 
-  NO_DISCARD AnsiColorSegment& colorSegment(Severity severity) {
-    switch (severity) {
-      case Severity::Trace:
-        return trace_colors_;
-      case Severity::Debug:
-        return debug_colors_;
-      case Severity::Info:
-        return info_colors_;
-      case Severity::Major:
-        return major_colors_;
-      case Severity::Warning:
-        return warn_colors_;
-      case Severity::Error:
-        return error_colors_;
-      case Severity::Fatal:
-        return fatal_colors_;
-      default:
-        LL_FAIL("unrecognized severity attribute");
+  void dispatchShared(const Record& record, MessageBodyCache& body_cache) override {
+    LL_METRICS(counters_.Add(metrics::detail::sink_records));
+    const auto& settings = sink_backend_->GetFormattingSettings();
+    auto buffer = memory::BufferPool::Local().Acquire();
+    if (settings.needs_formatting) {
+      format(record, settings, *buffer, body_cache.Get(settings));
     }
+    auto guard = acquireLock();
+    sink_backend_->DispatchOwned(std::move(*buffer), record);
+  }
+
+  void dispatchBatch(const std::vector<BatchEntry>& batch) override {
+    // Format outside the lock, then hand the whole batch to the backend under a single acquisition.
+    std::vector<memory::MemoryBuffer<char>> buffers;
+    std::vector<BatchEntry> formatted;
+    formatBatch(batch, buffers, formatted);
+    auto guard = acquireLock();
+    sink_backend_->DispatchBatch(formatted);
+  }
+
+  //! \brief Lock the sink, timing how long that takes if metrics are enabled.
+  std::unique_lock<std::shared_mutex> acquireLock() {
+#if LL_ENABLE_METRICS
+    std::unique_lock guard(lock_, std::defer_lock);
+    metrics::ScopedTimer timer(counters_, metrics::detail::sink_lock_wait_ns);
+    guard.lock();
+    return guard;
+#else
+    return std::unique_lock(lock_);
+#endif
   }
 
-  std::string trace_ = "Trace  ";
-  std::string debug_ = "Debug  ";
-  std::string info_ = "Info   ";
-  std::string major_ = "Major  ";
-  std::string warn_ = "Warning";
-  std::string error_ = "Error  ";
-  std::string fatal_ = "Fatal  ";
+  NO_DISCARD ObjectWrapper<Sink> getLockedSink() override { return LockedSink(this, lock_); }
 
-  AnsiColorSegment trace_colors_ {AnsiForegroundColor::White};
-  AnsiColorSegment debug_colors_ {AnsiForegroundColor::BrightWhite};
-  AnsiColorSegment info_colors_ {AnsiForegroundColor::Green};
-  AnsiColorSegment major_colors_ {AnsiForegroundColor::BrightBlue};
-  AnsiColorSegment warn_colors_ {AnsiForegroundColor::Yellow};
-  AnsiColorSegment error_colors_ {AnsiForegroundColor::Red};
-  AnsiColorSegment fatal_colors_ {AnsiForegroundColor::BrightRed};
+  NO_DISCARD std::shared_ptr<Sink> clone() const override {
+    return std::make_shared<SynchronousSink>(sink_backend_->Clone());
+  }
+
+  //! \brief The mutex that controls access to the sink.
+  mutable std::shared_mutex lock_;
 };
 
-class DateTimeAttributeFormatter final : public AttributeFormatter {
-  // TODO: Allow for different formatting of the DateTime, via format string?
+//! \brief What an AsyncSink does when a record is dispatched to it while its queue is full.
+enum class OverflowPolicy : unsigned char {
+  //! \brief Wait until the consumer thread frees up space in the queue.
+  Block,
+  //! \brief Discard the record that is being dispatched.
+  DropNewest,
+  //! \brief Discard the oldest queued record to make room for the record that is being dispatched.
+  DropOldest,
+};
+
+//! \brief Sink frontend that hands records off to a dedicated consumer thread, which formats them and feeds
+//!        them to the backend.
+//!
+//! Records are copied, along with any strings they only view, into a bounded lock-free queue, so the logging
+//! thread never waits on the backend. What happens when the queue is full is set by the OverflowPolicy.
+//! Flushing the sink drains the queue before the backend is flushed, and destroying the sink drains the queue
+//! before the consumer thread exits.
+//!
+//! The backend is only ever used by whoever holds the sink's lock (normally the consumer thread), so it is
+//! still safe to access the backend through GetLockedSink().
+class AsyncSink : public Sink {
 public:
-  void AddToBuffer(const RecordAttributes& attributes,
-                   const FormattingSettings&,
-                   const MessageInfo&,
-                   memory::BasicMemoryBuffer<char>& buffer) const override {
-    if (attributes.basic_attributes.time_stamp) {
-      auto& dt = attributes.basic_attributes.time_stamp.value();
-      auto [start, end] = buffer.Allocate(26);
-      FormatDateTo(start, end, dt);
+  explicit AsyncSink(std::unique_ptr<SinkBackend>&& backend,
+                     std::size_t queue_capacity = 8192,
+                     OverflowPolicy overflow_policy = OverflowPolicy::Block)
+      : Sink(std::move(backend))
+      , queue_(queue_capacity)
+      , overflow_policy_(overflow_policy)
+      , consumer_([this] { consume(); }) {}
+
+  template<typename SinkBackend_t, typename... Args_t>
+  static std::shared_ptr<AsyncSink> From(Args_t&&... args) {
+    static_assert(std::is_base_of_v<SinkBackend, SinkBackend_t>, "sink type must be a child of SinkBackend");
+    return std::make_shared<AsyncSink>(std::make_unique<SinkBackend_t>(std::forward<Args_t>(args)...));
+  }
+
+  //! \brief Drains the queue and stops the consumer thread.
+  ~AsyncSink() override {
+    stop_.store(true, std::memory_order_release);
+    {
+      std::lock_guard guard(wait_mutex_);
+      wait_condition_.notify_one();
     }
+    consumer_.join();
   }
-};
 
-//! \brief Attribute formatter that writes the logger's name.
-class LoggerNameAttributeFormatter final : public AttributeFormatter {
-public:
-  void AddToBuffer(const RecordAttributes& attributes,
-                   const FormattingSettings&,
-                   const MessageInfo&,
-                   memory::BasicMemoryBuffer<char>& buffer) const override {
-    AppendBuffer(buffer, attributes.basic_attributes.logger_name);
+  //! \brief Set what the sink should do when a record is dispatched while the queue is full.
+  AsyncSink& SetOverflowPolicy(OverflowPolicy overflow_policy) {
+    overflow_policy_.store(overflow_policy, std::memory_order_relaxed);
+    return *this;
   }
-};
 
-//! \brief Attribute formatter that writes the name of the file attached to the record.
-class FileNameAttributeFormatter final : public AttributeFormatter {
-public:
-  explicit FileNameAttributeFormatter(bool only_file_name = false)
-      : only_file_name_(only_file_name) {}
+  //! \brief Get the current overflow policy.
+  NO_DISCARD OverflowPolicy GetOverflowPolicy() const { return overflow_policy_.load(std::memory_order_relaxed); }
 
-  void AddToBuffer(const RecordAttributes& attributes,
-                   [[maybe_unused]] const FormattingSettings& settings,
-                   [[maybe_unused]] const MessageInfo& info,
-                   memory::BasicMemoryBuffer<char>& buffer) const override {
-    if (attributes.basic_attributes.file_name) {
-      if (only_file_name_) {
-        auto [first, last] = getRange(attributes.basic_attributes.file_name);
-        buffer.Append(attributes.basic_attributes.file_name + first,
-                      attributes.basic_attributes.file_name + last);
+  //! \brief Get the number of records that can be queued at once.
+  NO_DISCARD std::size_t GetQueueCapacity() const { return queue_.Capacity(); }
+
+  //! \brief Get the number of records that have been discarded because the queue was full.
+  NO_DISCARD std::size_t GetDroppedCount() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  //! \brief A record, detached from the logging statement that created it, waiting in the queue.
+  struct QueuedRecord {
+    QueuedRecord(const Record& source, const memory::BasicMemoryBuffer<char>* formatted_msg)
+        : record(source.Attributes().basic_attributes)
+        , logger_name(source.Attributes().basic_attributes.logger_name) {
+      record.Attributes().attributes = source.Attributes().attributes;
+      if (auto source_logger_attributes = source.Attributes().basic_attributes.logger_attributes) {
+        logger_attributes = *source_logger_attributes;
       }
-      else {
-        AppendBuffer(buffer, attributes.basic_attributes.file_name);
+      forEachStringAttribute([this](Attribute& attribute) { attribute_text.append(attribute.GetString()); });
+      source.Bundle().CopyDetachedTo(record.Bundle());
+      if (formatted_msg) {
+        formatted = formatted_msg->ToString();
+      }
+    }
+
+    //! \brief Point the record's views of the logger name and attributes at the copies that the queued record
+    //!        owns. This has to be done after the queued record is moved for the last time.
+    void Bind() {
+      auto& basic_attributes = record.Attributes().basic_attributes;
+      basic_attributes.logger_name = logger_name;
+      basic_attributes.logger_attributes = logger_attributes.Empty() ? nullptr : &logger_attributes;
+      std::size_t offset = 0;
+      forEachStringAttribute([&](Attribute& attribute) {
+        const auto size = attribute.GetString().size();
+        attribute.Rebind(std::string_view(attribute_text).substr(offset, size));
+        offset += size;
+      });
+    }
+
+    Record record;
+
+    //! \brief Owned copy of the logger name, since the logger may not outlive the queued record.
+    std::string logger_name;
+
+    //! \brief Copy of the logger's attributes, for the same reason.
+    AttributeList logger_attributes;
+
+    //! \brief The values of the (not interned) string attributes, one after the other.
+    std::string attribute_text;
+
+    //! \brief The pre-formatted message, if one was provided and the backend accepts it.
+    std::optional<std::string> formatted;
+
+  private:
+    template<typename Func_t>
+    void forEachStringAttribute(Func_t&& func) {
+      for (auto list : {&logger_attributes, &record.Attributes().attributes}) {
+        for (auto& attribute : *list) {
+          if (attribute.GetType() == Attribute::Type::String) {
+            func(attribute);
+          }
+        }
+      }
+    }
+  };
+
+  void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>* formatted_msg) override {
+    const auto& settings = sink_backend_->GetFormattingSettings();
+    // The copy is released by the consumer thread, long after the record's arena scope closes.
+    memory::ArenaSuspend arena_suspend;
+    QueuedRecord queued(record, formatted_msg && settings.accepts_preformatted ? formatted_msg : nullptr);
+    enqueue(queued);
+  }
+
+  void enqueue(QueuedRecord& queued) {
+    switch (overflow_policy_.load(std::memory_order_relaxed)) {
+      case OverflowPolicy::Block: {
+        while (!queue_.TryPush(queued)) {
+          if (lock_.IsHeldByCurrentThread()) {
+            // The consumer cannot make progress while we hold the lock, so make room ourselves.
+            BatchScratch scratch;
+            drainLocked(scratch, std::numeric_limits<std::size_t>::max());
+          }
+          else {
+            notifyConsumer();
+            std::this_thread::yield();
+          }
+        }
+        break;
+      }
+      case OverflowPolicy::DropNewest: {
+        if (!queue_.TryPush(queued)) {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        break;
+      }
+      case OverflowPolicy::DropOldest: {
+        std::optional<QueuedRecord> oldest;
+        while (!queue_.TryPush(queued)) {
+          if (queue_.TryPop(oldest)) {
+            oldest.reset();
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+          }
+        }
+        break;
       }
     }
+    notifyConsumer();
   }
 
-private:
-  std::pair<std::size_t, std::size_t> getRange(const char* str) const {
-    std::size_t first = 0, last = 0;
-    for (auto ptr = str; *ptr != '\0'; ++ptr, ++last) {
-      if (only_file_name_ && (*ptr == '/' || *ptr == '\\'))
-        first = last + 1;
+  //! \brief Wake the consumer thread if it is waiting for records.
+  void notifyConsumer() {
+    // Pairs with the fence in waitForRecords, so either we see that the consumer is waiting, or the consumer
+    // sees the record we just pushed.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumer_waiting_.load(std::memory_order_relaxed)) {
+      std::lock_guard guard(wait_mutex_);
+      wait_condition_.notify_one();
     }
-    return {first, last};
   }
 
-  //! \brief If true, only the file name is displayed, not the full path.
-  bool only_file_name_;
-};
+  void waitForRecords() {
+    consumer_waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+      std::unique_lock guard(wait_mutex_);
+      // The timeout is only a safety net, producers notify the consumer when it is waiting.
+      wait_condition_.wait_for(guard, std::chrono::milliseconds(100), [this] {
+        return !queue_.Empty() || stop_.load(std::memory_order_acquire);
+      });
+    }
+    consumer_waiting_.store(false, std::memory_order_relaxed);
+  }
 
-//! \brief Attribute formatter that writes the name of the function name attached to the record.
-class FunctionNameAttributeFormatter final : public AttributeFormatter {
-public:
-  void AddToBuffer(const RecordAttributes& attributes,
-                   [[maybe_unused]] const FormattingSettings& settings,
-                   [[maybe_unused]] const MessageInfo& info,
-                   memory::BasicMemoryBuffer<char>& buffer) const override {
-    if (attributes.basic_attributes.function_name) {
-      AppendBuffer(buffer, attributes.basic_attributes.function_name);
+  //! \brief The consumer thread's main loop.
+  void consume() {
+    // Limit how many records are handled per acquisition of the lock, so flushes and locked access to the
+    // sink are not starved.
+    constexpr std::size_t max_batch_size = 256;
+
+    BatchScratch scratch;
+    for (;;) {
+      std::size_t num_handled;
+      {
+        std::unique_lock guard(lock_);
+        num_handled = drainLocked(scratch, max_batch_size);
+      }
+      if (num_handled == 0) {
+        if (stop_.load(std::memory_order_acquire)) {
+          std::unique_lock guard(lock_);
+          drainLocked(scratch, std::numeric_limits<std::size_t>::max());
+          return;
+        }
+        waitForRecords();
+      }
     }
   }
-};
 
-//! \brief Attribute formatter that writes file line attached to the record.
-class FileLineAttributeFormatter final : public AttributeFormatter {
-public:
-  void AddToBuffer(const RecordAttributes& attributes,
-                   [[maybe_unused]] const FormattingSettings& settings,
-                   [[maybe_unused]] const MessageInfo& info,
-                   memory::BasicMemoryBuffer<char>& buffer) const override {
-    if (attributes.basic_attributes.line_number) {
-      // Calculate the length, base 10, of line_number
-      auto size = NumberOfDigits(*attributes.basic_attributes.line_number);
-      // Reserve this much additional size
-      auto [start, end] = buffer.Allocate(size);
-      std::to_chars(start, end, *attributes.basic_attributes.line_number);
+  //! \brief Records popped from the queue together, and the buffers they are formatted into. Kept between
+  //!        batches so their memory is reused.
+  struct BatchScratch {
+    std::vector<QueuedRecord> records;
+    std::vector<memory::MemoryBuffer<char>> buffers;
+    std::vector<BatchEntry> entries;
+  };
+
+  //! \brief Format and dispatch up to `max_records` queued records, handing them to the backend in batches.
+  //!        Must be called while holding the lock.
+  std::size_t drainLocked(BatchScratch& scratch, std::size_t max_records) {
+    constexpr std::size_t max_backend_batch_size = 64;
+
+    std::size_t num_handled = 0;
+    std::optional<QueuedRecord> queued;
+    while (num_handled < max_records) {
+      scratch.records.clear();
+      while (scratch.records.size() < std::min(max_backend_batch_size, max_records - num_handled)
+             && queue_.TryPop(queued)) {
+        scratch.records.push_back(std::move(*queued));
+        queued.reset();
+      }
+      if (scratch.records.empty()) {
+        break;
+      }
+      handleBatch(scratch);
+      num_handled += scratch.records.size();
     }
+    scratch.records.clear();
+    return num_handled;
   }
-};
 
-//! \brief Attribute formatter that writes the thread ID attached to the record.
-class ThreadAttributeFormatter final : public AttributeFormatter {
-public:
-  void AddToBuffer(const RecordAttributes& attributes,
-                   [[maybe_unused]] const FormattingSettings& settings,
-                   [[maybe_unused]] const MessageInfo& info,
-                   memory::BasicMemoryBuffer<char>& buffer) const override {
-    AppendBuffer(buffer, attributes.basic_attributes.thread_id);
+  void handleBatch(BatchScratch& scratch) {
+    const auto& settings = sink_backend_->GetFormattingSettings();
+    if (scratch.buffers.size() < scratch.records.size()) {
+      scratch.buffers.resize(scratch.records.size());
+    }
+    scratch.entries.clear();
+    for (std::size_t i = 0; i < scratch.records.size(); ++i) {
+      auto& queued = scratch.records[i];
+      auto& record = queued.record;
+      // The records are not moved again, so the views stay valid.
+      queued.Bind();
+
+      auto& buffer = scratch.buffers[i];
+      buffer.Clear();
+      try {
+        LL_METRICS(counters_.Add(metrics::detail::sink_records));
+        if (queued.formatted) {
+          AppendBuffer(buffer, *queued.formatted);
+        }
+        else if (settings.needs_formatting) {
+          format(record, settings, buffer);
+        }
+        scratch.entries.push_back({&record, &buffer});
+      }
+      catch (...) {
+        // There is no one to report the error to on the consumer thread, and letting the exception escape would
+        // terminate the program, so the record is dropped.
+      }
+    }
+    try {
+      sink_backend_->DispatchBatch(scratch.entries);
+    } catch (...) {
+      // Likewise, the rest of the batch is dropped.
+    }
   }
-};
 
-//! \brief  Function to calculate how far the start of the message is from the last newline in the header,
-//!         counting only visible (non ansi virtual terminal) characters.
-inline unsigned CalculateMessageIndentation(const char* buffer_end, const MessageInfo& msg_info) {
-  if (msg_info.total_length == 0) {
-    return 0;
+  void flush() override {
+    BatchScratch scratch;
+    if (lock_.IsHeldByCurrentThread()) {
+      // E.g. flushed through GetLockedSink(), as the core does.
+      drainLocked(scratch, std::numeric_limits<std::size_t>::max());
+      sink_backend_->Flush();
+    }
+    else {
+      std::unique_lock guard(lock_);
+      drainLocked(scratch, std::numeric_limits<std::size_t>::max());
+      sink_backend_->Flush();
+    }
   }
-  auto c = buffer_end - 1;
-  const auto rend = c - msg_info.total_length;
-  for (; c != rend && *c != '\n'; --c)
-    ;
-  ++c;  // Start after the '\n' or char-before-begin.
-  return CountNonAnsiSequenceCharacters(c, buffer_end);
+
+  NO_DISCARD ObjectWrapper<Sink> getLockedSink() override { return LockedSink(this, lock_); }
+
+  void addStats(metrics::SinkStats& stats) const override {
+    stats.queue_depth = queue_.ApproximateSize();
+    stats.queue_capacity = queue_.Capacity();
+    stats.dropped = GetDroppedCount();
+  }
+
+  NO_DISCARD std::shared_ptr<Sink> clone() const override {
+    return std::make_shared<AsyncSink>(sink_backend_->Clone(), queue_.Capacity(), GetOverflowPolicy());
+  }
+
+  //! \brief The queue of records waiting to be formatted and dispatched.
+  concurrency::BoundedQueue<QueuedRecord> queue_;
+
+  //! \brief What to do when the queue is full.
+  std::atomic<OverflowPolicy> overflow_policy_;
+
+  //! \brief The number of records that were discarded because the queue was full.
+  std::atomic<std::size_t> dropped_ {0};
+
+  //! \brief The lock that must be held to use the backend or dequeue records to the backend.
+  locks::OwnerTrackingMutex lock_;
+
+  //! \brief Mutex and condition variable used to put the consumer to sleep when there are no records.
+  std::mutex wait_mutex_;
+  std::condition_variable wait_condition_;
+  std::atomic<bool> consumer_waiting_ {false};
+
+  //! \brief Set when the sink is being destroyed.
+  std::atomic<bool> stop_ {false};
+
+  //! \brief The consumer thread. This must be the last member, so everything it uses is constructed first.
+  std::thread consumer_;
+};
+
+//! \brief  Create a new sink frontend / backend pair.
+template<typename Backend_t, typename Frontend_t = SynchronousSink, typename... Args_t>
+std::shared_ptr<Frontend_t> NewSink(Args_t&&... args) {
+  return std::make_shared<Frontend_t>(std::make_unique<Backend_t>(std::forward<Args_t>(args)...));
 }
 
-//! \brief Base class for message formatters, objects capable of taking a record and formatting it into a
-//!        string, according to the formatting settings.
-class BaseMessageFormatter {
+//! \brief Object that can receive records from multiple loggers, and dispatches them to multiple sinks.
+//!        The core has its own filter, which is checked before any of the individual sinks' filters.
+//!
+//! The sinks and the core level filter form a configuration that is never changed once it is published. Adding
+//! or removing sinks, or replacing the filter, copies the configuration, changes the copy, and swaps it in
+//! (read-copy-update). Logging never takes a lock or writes to memory shared with other threads, it only marks
+//! its own thread as reading, see concurrency::EpochDomain. So the configuration can be changed while other
+//! threads log, e.g. to reload it, without pausing them.
+//!
+//! The core has a flag that allows it to operate in synchronous mode, which means that changes are serialized,
+//! and that the old configuration is only destroyed once no thread can still be using it. This is only
+//! necessary if the core is going to be *modified* while it is in use. Without synchronous mode, logging does
+//! not even mark the thread as reading, but you should not add or remove sinks while other threads log.
+//!
+//! Synchonous mode is on by default, and can be turned on or off after initialization. In synchronous mode,
+//! the core must not be changed from inside a sink (while a record is being dispatched), or by a thread that
+//! holds a lock that logging threads could be waiting for, since the change waits for those threads.
+class Core {
 public:
-  virtual ~BaseMessageFormatter() = default;
+  friend class Global;
+
+  virtual ~Core() {
+    detail::AcceptanceCacheRegistry::Get().Unregister(&acceptance_mask_);
+    delete configuration_.load(std::memory_order_relaxed);
+  }
+
+  //! \brief Construct the core with a particular mode (synchronous by default).
+  explicit Core(bool synchronous_mode = true)
+      : synchronous_mode_(synchronous_mode) {
+    detail::AcceptanceCacheRegistry::Get().Register(&acceptance_mask_);
+  }
+
+  //! \brief Set the synchronicity mode of the Core.
+  void SetSynchronousMode(bool synchronous_mode) { synchronous_mode_ = synchronous_mode; }
+
+  //! \brief Set whether records opened for this core capture simple objects as raw bytes, deferring their
+  //!        formatting until the record is formatted by a sink. See RefBundle.
+  //!
+  //! This pairs well with an AsyncSink, since then all formatting happens on the sink's consumer thread.
+  Core& SetDeferredFormatting(bool deferred_formatting) {
+    deferred_formatting_ = deferred_formatting;
+    return *this;
+  }
+
+  //! \brief Check whether records opened for this core use deferred formatting.
+  NO_DISCARD bool UsesDeferredFormatting() const { return deferred_formatting_; }
+
+  //! \brief Set whether records that a RecordDispatcher opens for this core should allocate their segments
+  //!        from the thread's memory::ThreadArena, releasing the memory in bulk once the record is dispatched.
+  Core& SetArenaAllocation(bool arena_allocation) {
+    arena_allocation_ = arena_allocation;
+    return *this;
+  }
+
+  //! \brief Check whether records opened for this core allocate from the thread's arena.
+  NO_DISCARD bool UsesArenaAllocation() const { return arena_allocation_; }
+
+  //! \brief Check whether at least one sink would accept the record.
+  //!
+  //! If `acceptance` is given, every sink is checked, and which sinks accept the record is stored there, so
+  //! that dispatching the record does not have to run the sinks' filters again.
+  bool WillAccept(const RecordAttributes& attributes, detail::SinkAcceptance* acceptance = nullptr) {
+    // Reject on severity alone without entering a read section, if possible. This counts its own rejections.
+    if (!WillAccept(attributes.basic_attributes.level)) {
+      return false;
+    }
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    auto& configuration = current();
+    auto& sinks = configuration.sinks;
+    // Check the core level filter, and that at least one sink will accept. If there are no sinks, there are no
+    // things that *can* accept.
+    bool accepts = !sinks.empty() && configuration.filter.WillAccept(attributes);
+    if (accepts && acceptance && sinks.size() <= 64) {
+      filter::EvaluationCache cache;
+      const auto filter_generation = detail::AcceptanceCacheRegistry::Get().Generation();
+      std::uint64_t mask = 0;
+      for (std::size_t i = 0; i < sinks.size(); ++i) {
+        mask |= static_cast<std::uint64_t>(sinks[i]->WillAccept(attributes, cache)) << i;
+      }
+      *acceptance = {configuration.generation, filter_generation, mask};
+      accepts = mask != 0;
+    }
+    else if (accepts) {
+      accepts = std::any_of(
+          sinks.begin(), sinks.end(), [&attributes](auto& sink) { return sink->WillAccept(attributes); });
+    }
+#if LL_ENABLE_METRICS
+    if (!accepts) {
+      countRejection(attributes.basic_attributes.level);
+    }
+#endif
+    return accepts;
+  }
+
+  //! \brief Check whether at least one sink would potentially accept a message with a particular severity.
+  //!
+  //! Since most filtering is done only based on severity, it makes sense to have this as a quick check up
+  //! front. The answer comes from a cached mask of the severities that the core and at least one sink accept,
+  //! so unless the mask was invalidated by a filter or sink change, this is a single relaxed load and a bit
+  //! test, and takes no lock.
+  bool WillAccept(std::optional<Severity> severity) {
+    auto mask = acceptance_mask_.load(std::memory_order_relaxed);
+    if ((mask & detail::acceptance_valid_bit) == 0) {
+      mask = recomputeAcceptanceMask();
+    }
+#if LL_ENABLE_METRICS
+    if ((mask & detail::AcceptanceBit(severity)) == 0) {
+      countRejection(severity);
+      return false;
+    }
+    return true;
+#else
+    return (mask & detail::AcceptanceBit(severity)) != 0;
+#endif
+  }
+
+  //! \brief Dispatch a ref bundle to the sinks.
+  void Dispatch(const Record& record) const {
+    LL_METRICS(counters_.Add(metrics::detail::core_accepted
+                             + metrics::SeveritySlot(record.Attributes().basic_attributes.level)));
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    dispatch(record);
+  }
 
-  //! \brief Format the record into a buffer, given the formatting settings.
+  //! \brief Dispatch a batch of records to the sinks, entering a read section once, and handing each sink all
+  //!        the records it accepts at once.
   //!
-  //! \param record The record to format.
-  //! \param sink_settings The settings for formatting the message.
-  //! \param buffer The buffer to write the formatted message into.
-  //! \param formatted_msg If the message has already been formatted, this is a pointer to the buffer
-  //!                      containing the formatted message, otherwise, a nullptr.
-  void Format(const Record& record,
-              const FormattingSettings& sink_settings,
-              memory::BasicMemoryBuffer<char>& buffer,
-              const memory::BasicMemoryBuffer<char>* formatted_msg = {}) const {
-    format(record, sink_settings, buffer, formatted_msg);
+  //! Records sent through Dispatch were already checked against the core's filter when they were opened. These
+  //! records need not have been opened, e.g. they can be records read back from a binary log, so each one is
+  //! checked against the core's filter here.
+  void DispatchBatch(const std::vector<const Record*>& records) const {
+    std::vector<const Record*> accepted;
+    accepted.reserve(records.size());
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    auto& filter = current().filter;
+    for (auto* record : records) {
+      [[maybe_unused]] const auto slot = metrics::SeveritySlot(record->Attributes().basic_attributes.level);
+      if (filter.WillAccept(record->Attributes())) {
+        accepted.push_back(record);
+        LL_METRICS(counters_.Add(metrics::detail::core_accepted + slot));
+      }
+      else {
+        LL_METRICS(counters_.Add(metrics::detail::core_rejected + slot));
+      }
+    }
+    if (!accepted.empty()) {
+      dispatchBatch(accepted);
+    }
   }
 
-  //! \brief Make a deep copy of the message formatter.
-  NO_DISCARD virtual std::unique_ptr<BaseMessageFormatter> Copy() const = 0;
+  //! \brief Get a snapshot of the core's counters, and the counters of each of its sinks.
+  //!
+  //! The accepted and rejected counts are all zero unless metrics are enabled, see the metrics namespace.
+  NO_DISCARD metrics::CoreStats GetStats() const {
+    metrics::CoreStats stats;
+#if LL_ENABLE_METRICS
+    for (std::size_t slot = 0; slot < metrics::num_severity_slots; ++slot) {
+      stats.accepted[slot] = counters_.Get(metrics::detail::core_accepted + slot);
+      stats.rejected[slot] = counters_.Get(metrics::detail::core_rejected + slot);
+    }
+#endif
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    auto& sinks = current().sinks;
+    stats.sinks.reserve(sinks.size());
+    for (const auto& sink : sinks) {
+      stats.sinks.push_back(sink->GetStats());
+    }
+    return stats;
+  }
 
-protected:
-  //! \brief Private implementation of the format method.
-  virtual void format(const Record& record,
-                      const FormattingSettings& sink_settings,
-                      memory::BasicMemoryBuffer<char>& buffer,
-                      const memory::BasicMemoryBuffer<char>* formatted_msg) const = 0;
-};
+  //! \brief Add a sink to the core.
+  Core& AddSink(std::shared_ptr<Sink> sink) {
+    return update([&sink](Configuration& configuration) { configuration.sinks.emplace_back(std::move(sink)); });
+  }
 
-//! \brief Object used to represent a placeholder for the logging message.
-struct MSG_t {};
+  //! \brief Get the number of sinks the core points at.
+  NO_DISCARD std::size_t GetNumSinks() const {
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    return current().sinks.size();
+  }
 
-//! \brief Global prototypical MSG_t object.
-constexpr inline MSG_t MSG;
+  //! \brief Set the formatter for every sink the core points at.
+  //!
+  //! The sinks are not replaced, so this only needs the sinks' own locks, the core's configuration is unchanged.
+  Core& SetAllFormatters(const formatting::BaseMessageFormatter& formatter) {
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    for (const auto& sink : current().sinks) {
+      sink->GetLockedSink()->SetFormatter(formatter.Copy());
+    }
+    return *this;
+  }
 
-//! \brief Standard message formatter.
-//!
-//! Currently the main and most useful message formatter, this formatter is templated by the types of
-//! the segments that it contains. It is defined with a string that contains literal segments and segments
-//! that are replaced by the values of the attributes. There are several helper functions, below, that make
-//! creating a MsgFormatter easier.
-template<typename... Types>
-class MsgFormatter : public BaseMessageFormatter {
-  static_assert(((std::is_base_of_v<AttributeFormatter, Types> || std::is_same_v<MSG_t, Types>)&&...),
-                "All types must be AttributeFormatters or a MSG tag.");
+  //! \brief Set the formatter for every sink the core points at.
+  Core& SetAllFormatters(const std::unique_ptr<formatting::BaseMessageFormatter>& formatter) {
+    return SetAllFormatters(*formatter);
+  }
 
-public:
-  explicit MsgFormatter(const std::string& fmt_string, const Types&... types)
-      : formatters_(types...) {
-    // Find the segments, ensure that there are the right number of arguments.
-    auto count_slots = 0;
-    literals_.emplace_back();
-    for (auto i = 0u; i < fmt_string.size();) {
-      if (fmt_string[i] == '{') {
-        // Always advance i, since it is either an escaped '{' or we need to find the end of the "{...}"
-        if (i + 1 < fmt_string.size() && fmt_string[++i] != '{') {
-          // Start of a slot, end of the literal.
-          literals_.emplace_back();  // start a new literal
-          ++count_slots;
-          // Find the closing '}' TODO: Capture a formatting string?
-          for (; i < fmt_string.size() && fmt_string[i] != '}'; ++i)
-            ;
-          ++i;
-          continue;
-        }
+  //! \brief Map a function across sinks, locking the sink before passing it to the function.
+  template<typename SinkBackend_t, typename Func_t>
+  void MapOnSinks(Func_t&& func) const {
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    for (auto& sink : current().sinks) {
+      // Lock the sink (if it supports this).
+      auto locked_sink = sink->GetLockedSink();
+      if (auto backend_ptr = locked_sink->GetBackendAs<SinkBackend_t>()) {
+        func(*sink, *backend_ptr);
       }
-      literals_.back().push_back(fmt_string[i]);
-      ++i;
     }
-
-    // Make sure there are the right number of slots.
-    LL_ASSERT(count_slots == sizeof...(Types),
-              "mismatch in the number of slots (" << count_slots << ") and the number of formatters ("
-                                                  << sizeof...(Types) << ")");
-    LL_ASSERT(literals_.size() == sizeof...(Types) + 1,
-              "not the right number of literals, needed " << sizeof...(Types) + 1 << ", but had "
-                                                          << literals_.size());
   }
 
+  //! \brief A copy of the core level filter, which is published back to the core when it is destroyed. This
+  //!        is what lets `core->GetFilter().Accept(...)` change a core that other threads are logging to.
+  class FilterEditor : public filter::AttributeFilter {
+  public:
+    explicit FilterEditor(Core& core)
+        : filter::AttributeFilter(core.GetFilterCopy())
+        , core_(core) {}
 
-private:
-  void format(const Record& record,
-              const FormattingSettings& sink_settings,
-              memory::BasicMemoryBuffer<char>& buffer,
-              const memory::BasicMemoryBuffer<char>* formatted_msg) const override {
-    MessageInfo msg_info {};
-    msg_info.needs_message_indentation = record.Bundle().NeedsMessageIndentation();
+    FilterEditor(const FilterEditor&) = delete;
+    FilterEditor& operator=(const FilterEditor&) = delete;
 
-    // Format all the segments.
-    format<0>(buffer, record, sink_settings, formatted_msg, msg_info);
-    // Add the terminator.
-    AppendBuffer(buffer, sink_settings.message_terminator);
-  }
+    ~FilterEditor() { core_.SetFilter(*this); }
 
-  NO_DISCARD std::unique_ptr<BaseMessageFormatter> Copy() const override {
-    return std::unique_ptr<BaseMessageFormatter>(new MsgFormatter(*this));
-  }
+  private:
+    Core& core_;
+  };
 
-  template<std::size_t N>
-  void format(memory::BasicMemoryBuffer<char>& buffer,
-              [[maybe_unused]] const Record& record,
-              [[maybe_unused]] const FormattingSettings& sink_settings,
-              const memory::BasicMemoryBuffer<char>* formatted_msg,
-              MessageInfo& msg_info) const {
-    // First, the next literal segment.
-    AppendBuffer(buffer, literals_[N]);
-    msg_info.total_length = static_cast<unsigned>(buffer.Size());
+  //! \brief Get the core level filter, to change it.
+  //!
+  //! The published filter is never changed in place, since threads that are logging may be reading it. This
+  //! returns a copy, and publishes the changed copy, as SetFilter does, at the end of the full expression (or
+  //! when the editor goes out of scope).
+  NO_DISCARD FilterEditor GetFilter() { return FilterEditor(*this); }
 
-    if constexpr (N != sizeof...(Types)) {
-      // Then the formatter from the slot.
-      if constexpr (std::is_same_v<MSG_t, std::tuple_element_t<N, decltype(formatters_)>>) {
-        // If the message was already formatted, just append it.
-        if (formatted_msg) {
-          buffer.Append(*formatted_msg);
-        }
-        // Otherwise, we have to do the work.
-        else {
-          // Since this calculation can take some time, only calculate if needed.
-          if (msg_info.needs_message_indentation) {
-            // At this point, we can calculate the true message indentation by looking for the last newline
-            // (if any), and not counting escape characters.
-            msg_info.message_indentation = CalculateMessageIndentation(buffer.End(), msg_info);
-          }
-          else {
-            msg_info.message_indentation = 0u;
-          }
-          // Bundle's FmtString function will set msg_info.is_in_message_segment to true, so we don't need to
-          // here.
-          record.Bundle().FmtString(sink_settings, buffer, msg_info);
-        }
-      }
-      else {
-        std::get<N>(formatters_).AddToBuffer(record.Attributes(), sink_settings, msg_info, buffer);
-      }
-      msg_info.total_length = static_cast<unsigned>(buffer.Size());
+  //! \brief Get a copy of the core level filter.
+  NO_DISCARD filter::AttributeFilter GetFilter() const { return GetFilterCopy(); }
 
-      // Recursively format the next literal and (if it does not terminate) segment.
-      format<N + 1>(buffer, record, sink_settings, formatted_msg, msg_info);
-    }
+  //! \brief Get a copy of the core level filter.
+  NO_DISCARD filter::AttributeFilter GetFilterCopy() const {
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    return current().filter;
   }
 
-  std::tuple<Types...> formatters_;
-  std::vector<std::string> literals_;
-};
+  //! \brief Replace the core level filter. Threads that are logging keep using the old filter until they are
+  //!        done with their current record.
+  Core& SetFilter(filter::AttributeFilter filter) {
+    return update([&filter](Configuration& configuration) { configuration.filter = std::move(filter); });
+  }
 
-//! \brief Helper function to create a unique pointer to a MsgFormatter
-template<typename... Types>
-auto MakeMsgFormatter(const std::string& fmt_string, const Types&... types) {
-  return std::unique_ptr<BaseMessageFormatter>(new MsgFormatter<Types...>(fmt_string, types...));
-}
+  //! \brief Reset the core's filters.
+  Core& ClearFilters() {
+    return update([](Configuration& configuration) { configuration.filter.Clear(); });
+  }
 
-//! \brief Helper function that makes the "standard" MsgFormatter.
-//!
-//! What is standard may change, and only be "standard" in the eye of the beholder, but I am the beholder, and
-//! these are the basic things I want in a simple logging formatter.
-inline auto MakeStandardFormatter() {
-  return MakeMsgFormatter("[{}] [{}] {}",
-                          formatting::SeverityAttributeFormatter {},
-                          formatting::DateTimeAttributeFormatter {},
-                          formatting::MSG);
-}
+  //! \brief Get a copy of the vector of all sinks.
+  //!
+  //! This is a copy, since the core's current configuration may be replaced, e.g. by AddSink or ClearSinks on
+  //! another thread, as soon as the read section that gets the sinks ends.
+  NO_DISCARD std::vector<std::shared_ptr<Sink>> GetSinks() const {
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    return current().sinks;
+  }
 
-//! \brief A message formatter that delegates formatting to a different formatter based on the severity of the
-//!        record.
-class FormatterBySeverity final : public BaseMessageFormatter {
-public:
-  NO_DISCARD std::unique_ptr<BaseMessageFormatter> Copy() const override {
-    auto formatter = std::make_unique<FormatterBySeverity>();
-    for (auto i = 0u; i < 7; ++i) {
-      formatter->formatters_[i] = formatters_[i] ? formatters_[i]->Copy() : nullptr;
-    }
-    formatter->default_formatter_ = default_formatter_ ? default_formatter_->Copy() : nullptr;
-    return formatter;
+  //! \brief Apply a function to all sinks.
+  //!
+  //! Each sink is locked before the function is applied.
+  template<typename Func_t>
+  Core& ApplyToAllSink(Func_t&& func) {
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    auto& sinks = current().sinks;
+    std::for_each(sinks.begin(), sinks.end(), [f = std::forward<Func_t>(func)](auto& sink) {
+      auto locked_sink = sink->GetLockedSink();
+      f(*sink);
+    });
+    return *this;
   }
 
-  FormatterBySeverity& SetFormatterForSeverity(Severity severity,
-                                               std::unique_ptr<BaseMessageFormatter>&& formatter) {
-    if (auto index = SeverityIndex(severity); index != -1) {
-      formatters_[index] = std::move(formatter);
-      return *this;
-    }
-    LL_FAIL("unrecognized severity");
+  //! \brief Remove all sinks from the core.
+  Core& ClearSinks() {
+    return update([](Configuration& configuration) { configuration.sinks.clear(); });
   }
-  FormatterBySeverity& SetFormatterForSeverity(Severity severity, const BaseMessageFormatter& formatter) {
-    if (auto index = SeverityIndex(severity); index != -1) {
-      formatters_[index] = formatter.Copy();
-      return *this;
-    }
-    LL_FAIL("unrecognized severity");
+
+  //! \brief Flush all sinks.
+  //!
+  //! Note: This function MAY discard.
+  const Core& Flush() const {
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    auto& sinks = current().sinks;
+    std::for_each(sinks.begin(), sinks.end(), [](auto& sink) { sink->GetLockedSink()->Flush(); });
+    return *this;
   }
 
-  FormatterBySeverity& SetFormatterForSeverity(SeveritySet condition, const BaseMessageFormatter& formatter) {
-    for (auto severity : ALL_SEVERITIES) {
-      if (condition(severity))
-        formatters_[SeverityIndex(severity)] = formatter.Copy();
+  //! \brief Make a deep copy of the core, including deep copies of all sinks.
+  NO_DISCARD std::shared_ptr<Core> Clone() const {
+    auto core = std::make_shared<Core>();
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    auto& configuration = current();
+    auto& cloned = *core->configuration_.load(std::memory_order_relaxed);
+    cloned.filter = configuration.filter;
+    for (const auto& sink : configuration.sinks) {
+      cloned.sinks.emplace_back(sink->GetLockedSink()->Clone());
     }
-    return *this;
+    return core;
   }
 
-  FormatterBySeverity& SetDefaultFormatter(std::unique_ptr<BaseMessageFormatter>&& formatter) {
-    default_formatter_ = std::move(formatter);
-    return *this;
+  //! \brief Have every BacktraceSink of the core dispatch the records it holds to its target sink, as if a
+  //!        record with a trigger severity had arrived.
+  inline void DumpBacktrace() const;
+
+  //! \brief Get a locked handle to the core. This serializes changes to the core's configuration, logging is
+  //!        not blocked.
+  NO_DISCARD LockedObject<Core> Lock() { return LockedObject(this, lock_); }
+
+  //! \brief Check whether the core is locked.
+  bool IsLocked() const {
+    if (lock_.try_lock()) {
+      lock_.unlock();
+      return false;
+    }
+    return true;
   }
-  FormatterBySeverity& SetDefaultFormatter(const BaseMessageFormatter& formatter) {
-    default_formatter_ = formatter.Copy();
-    return *this;
+
+protected:
+  //! \brief Get the sinks of the current configuration. Like current(), this must be called inside a read
+  //!        section, and the sinks can only be used until the section ends. Dispatch enters the section.
+  NO_DISCARD const std::vector<std::shared_ptr<Sink>>& currentSinks() const { return current().sinks; }
+
+  //! \brief Dispatch method, protected implementation.
+  //!
+  //! By default, dispatch is done by dispatching to every sink.
+  virtual void dispatch(const Record& record) const {
+    if (currentSinks().size() < 2) {
+      forEachAcceptingSink(record, [&record](Sink& sink) { sink.Dispatch(record); });
+      return;
+    }
+    // With several sinks, the message is formatted once (per distinct setting) and shared by the sinks.
+    MessageBodyCache body_cache(record);
+    forEachAcceptingSink(record, [&](Sink& sink) { sink.Dispatch(record, body_cache); });
   }
 
-private:
-  void format(const Record& record,
-              const FormattingSettings& sink_settings,
-              memory::BasicMemoryBuffer<char>& buffer,
-              const memory::BasicMemoryBuffer<char>* formatted_msg) const override {
-    // Format all the segments.
-    if (const auto* formatter = getFormatter(record.Attributes().basic_attributes.level)) {
-      MessageInfo msg_info {};
-      msg_info.needs_message_indentation = record.Bundle().NeedsMessageIndentation();
-      formatter->Format(record, sink_settings, buffer, formatted_msg);
+  //! \brief Call a function on every sink that accepts the record, running each distinct filter at most
+  //!        once.
+  //!
+  //! Uses the sinks that were found to accept the record when it was opened, unless the configuration or a
+  //! filter changed since then.
+  template<typename Func_t>
+  void forEachAcceptingSink(const Record& record, Func_t&& func) const {
+    auto& configuration = current();
+    auto& acceptance = record.GetSinkAcceptance();
+    if (acceptance.configuration_generation == configuration.generation
+        && acceptance.filter_generation == detail::AcceptanceCacheRegistry::Get().Generation())
+    {
+      for (auto mask = acceptance.mask; mask != 0; mask &= mask - 1) {
+        func(*configuration.sinks[simd::detail::lowestSetBit(mask)]);
+      }
+      return;
+    }
+    filter::EvaluationCache cache;
+    for (auto& sink : configuration.sinks) {
+      if (sink->WillAccept(record.Attributes(), cache)) {
+        func(*sink);
+      }
     }
   }
 
-  //! \brief A function that, given the severity level, returns the formatter for that level.
-  //! If the severity is not recognized, returns the default formatter.
-  NO_DISCARD const BaseMessageFormatter* getFormatter(std::optional<Severity> severity) const {
-    if (severity) {
-      if (auto index = SeverityIndex(*severity); index != -1) {
-        if (formatters_[index]) {
-          return formatters_[index].get();
+  //! \brief Batch dispatch method, protected implementation.
+  //!
+  //! By default, every sink is given the batch of records that it accepts.
+  virtual void dispatchBatch(const std::vector<const Record*>& records) const {
+    std::vector<BatchEntry> batch;
+    for (auto& sink : currentSinks()) {
+      batch.clear();
+      for (auto* record : records) {
+        if (sink->WillAccept(record->Attributes())) {
+          batch.push_back({record});
         }
-        return default_formatter_.get();
       }
-      // Severity provided but it is ill-formed.
-      LL_FAIL("unrecognized severity");
+      sink->DispatchBatch(batch);
     }
-    return default_formatter_.get();
   }
 
-  //! \brief The formatters for each severity level.
-  std::unique_ptr<BaseMessageFormatter> formatters_[7];
-  std::unique_ptr<BaseMessageFormatter> default_formatter_;
-};
+private:
+  //! \brief The sinks and core level filter. A configuration is never changed once it has been published, a
+  //!        change publishes a new configuration instead.
+  struct Configuration {
+    //! \brief Identifies the configuration, see detail::SinkAcceptance. Never zero.
+    std::uint64_t generation = nextGeneration();
 
-//! \brief Another type of BaseMessageFormatter, this one can be created and added to without being templated
-//! by the segment types, but is generally lower performance.
-class RecordFormatter final : public BaseMessageFormatter {
-public:
-  //! \brief The default record formatter just prints the message.
-  RecordFormatter() { AddMsgSegment(); }
+    //! \brief All sinks the core will dispatch messages to.
+    std::vector<std::shared_ptr<Sink>> sinks;
 
-  NO_DISCARD std::unique_ptr<BaseMessageFormatter> Copy() const override {
-    return std::unique_ptr<BaseMessageFormatter>(new RecordFormatter(*this));
-  }
+    //! \brief Core-level attribute filters.
+    filter::AttributeFilter filter;
 
-  RecordFormatter& AddMsgSegment() {
-    formatters_.emplace_back(MSG);
-    return *this;
+    Configuration() = default;
+
+    //! \brief Copying a configuration makes a new configuration, with a new generation.
+    Configuration(const Configuration& other)
+        : sinks(other.sinks)
+        , filter(other.filter) {}
+  };
+
+  static std::uint64_t nextGeneration() {
+    static std::atomic<std::uint64_t> generation {0};
+    return generation.fetch_add(1, std::memory_order_relaxed) + 1;
   }
 
-  RecordFormatter& AddAttributeFormatter(std::shared_ptr<AttributeFormatter> formatter) {
-    formatters_.emplace_back(std::move(formatter));
-    return *this;
+  //! \brief Get the current configuration. Must be called from inside a read section (unless the core is not in
+  //!        synchronous mode), and the configuration can only be used until the section ends.
+  NO_DISCARD const Configuration& current() const {
+    // Sequentially consistent, so the load can't move before the store that entered the read section.
+    return *configuration_.load(std::memory_order_seq_cst);
   }
 
-  RecordFormatter& AddLiteralSegment(std::string literal) {
-    formatters_.emplace_back(std::move(literal));
+  //! \brief Copy the current configuration, change the copy, and publish it.
+  //!
+  //! In synchronous mode, changes are serialized by the core's lock, and the old configuration (and so any sink
+  //! that was removed) is only destroyed once every thread that could still be using it is done.
+  template<typename Func_t>
+  Core& update(Func_t&& func) {
+    locks::PotentiallyUniqueLock guard(lock_, synchronous_mode_);
+    auto next = new Configuration(*configuration_.load(std::memory_order_relaxed));
+    func(*next);
+    std::unique_ptr<Configuration> previous(configuration_.exchange(next, std::memory_order_seq_cst));
+    detail::InvalidateAcceptanceCaches();
+    if (synchronous_mode_) {
+      concurrency::EpochDomain::Get().Synchronize();
+    }
     return *this;
   }
 
-  RecordFormatter& ClearSegments() {
-    formatters_.clear();
-    return *this;
+  //! \brief A function that flushes all sinks without locking. This is for use by the signal handler, since
+  //!        it is UB for the signal handler to call functions that use locks.
+  //!
+  //! This does not enter a read section, since the first read section on a thread registers the thread,
+  //! which takes a lock. So it may only be called when the configuration can't be changed concurrently, e.g.
+  //! from the signal handler of a crashing process, or once logging has stopped.
+  void flushLockFree() {
+    for (auto& sink : current().sinks) {
+      sink->flushLockFree();
+    }
   }
 
-  NO_DISCARD std::size_t NumSegments() const { return formatters_.size(); }
+  //! \brief Recompute the acceptance mask and install it, unless it was invalidated again in the meantime.
+  //!
+  //! \return The mask that was computed.
+  std::uint64_t recomputeAcceptanceMask() {
+    concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+    auto observed = acceptance_mask_.load(std::memory_order_acquire);
+    for (;;) {
+      if (observed & detail::acceptance_valid_bit) {
+        return observed;  // Someone else already recomputed it.
+      }
 
-private:
-  void format(const Record& record,
-              const FormattingSettings& sink_settings,
-              memory::BasicMemoryBuffer<char>& buffer,
-              const memory::BasicMemoryBuffer<char>* formatted_msg) const override {
-    MessageInfo msg_info {};
-    for (const auto& formatter : formatters_) {
-      switch (formatter.index()) {
-        default:
-        case 0: {  // Message.
-          if (formatted_msg) {
-            buffer.Append(*formatted_msg);
-          }
-          else {
-            // TODO: Update for LogNewLine type alignment.
-            record.Bundle().FmtString(sink_settings, buffer, msg_info);
-          }
-          break;
-        }
-        case 1: {  // AttributeFormatter
-          std::get<1>(formatter)->AddToBuffer(record.Attributes(), sink_settings, msg_info, buffer);
-          break;
+      auto& configuration = current();
+      auto accepts = [&configuration](std::optional<Severity> severity) {
+        if (!configuration.filter.WillAccept(severity)) {
+          return false;
         }
-        case 2: {  // String.
-          AppendBuffer(buffer, std::get<2>(formatter));
-          break;
+        return std::any_of(configuration.sinks.begin(), configuration.sinks.end(), [severity](auto& sink) {
+          return sink->WillAccept(severity);
+        });
+      };
+      std::uint64_t mask = 0;
+      for (auto severity : ALL_SEVERITIES) {
+        if (accepts(severity)) {
+          mask |= detail::AcceptanceBit(severity);
         }
       }
+      if (accepts(std::nullopt)) {
+        mask |= detail::acceptance_no_severity_bit;
+      }
+
+      // Keep the generation number, so a concurrent invalidation makes the exchange fail.
+      const auto desired = (observed & ~std::uint64_t {0xFFFFFFFF}) | mask | detail::acceptance_valid_bit;
+      if (acceptance_mask_.compare_exchange_strong(observed, desired, std::memory_order_acq_rel)) {
+        return desired;
+      }
     }
-    // Add terminator.
-    AppendBuffer(buffer, sink_settings.message_terminator);
   }
 
-  std::vector<std::variant<MSG_t, std::shared_ptr<AttributeFormatter>, std::string>> formatters_;
-};
+  //! \brief The current configuration, which readers load, and changes replace. See update.
+  std::atomic<Configuration*> configuration_ {new Configuration};
 
-}  // namespace formatting
+  //! \brief Mutex that serializes changes to the core's configuration. Logging does not take it.
+  mutable std::shared_mutex lock_;
 
-namespace flush {
+  //! \brief Cached mask of the severities (and "no severity") that the core and at least one sink accept, along
+  //!        with a valid bit and the generation number used to invalidate it.
+  //!
+  //! See detail::AcceptanceCacheRegistry.
+  std::atomic<std::uint64_t> acceptance_mask_ {0};
 
-//! \brief Base class for objects that determine whether a sink should be flushed.
-class FlushHandler : public ImplBase {
-public:
-  class Impl : public ImplBase::Impl {
-  public:
-    virtual bool DoFlush(const Record& record) = 0;
-    NO_DISCARD virtual std::shared_ptr<Impl> Clone() const = 0;
-  };
+  //! \brief Whether the core should synchronize changes to its configuration with the threads that use it.
+  //!
+  //! For safety, if the core is going to be modified while it is in use, this should be true.
+  //! If the core itself is not going to be modified from multiple threads, this can be false. Note that it
+  //! is fine for multiple threads to use the core, e.g., to log via the same core from multiple threads, as
+  //! long as you don't do something like add or remove sinks while also logging, or add sinks from multiple
+  //! threads simultaneously.
+  bool synchronous_mode_;
 
-  bool DoFlush(const Record& record) { return impl<FlushHandler>()->DoFlush(record); }
-  NO_DISCARD FlushHandler Clone() const { return FlushHandler(impl<FlushHandler>()->Clone()); }
+  //! \brief Whether records opened for this core should use deferred capture.
+  bool deferred_formatting_ = false;
 
-  explicit FlushHandler(const std::shared_ptr<Impl>& impl)
-      : ImplBase(impl) {}
+  //! \brief Whether records opened for this core should allocate from the thread's arena.
+  bool arena_allocation_ = false;
+
+#if LL_ENABLE_METRICS
+  void countRejection(std::optional<Severity> severity) {
+    counters_.Add(metrics::detail::core_rejected + metrics::SeveritySlot(severity));
+  }
+
+  //! \brief Accepted and rejected records, per severity.
+  mutable metrics::ShardedCounters<metrics::detail::num_core_counters> counters_;
+#endif
 };
 
-//! \brief Flush after every message.
-class AutoFlush final : public FlushHandler {
+class FormattingCore : public Core {
 public:
-  class Impl final : public FlushHandler::Impl {
-  public:
-    bool DoFlush(const Record&) override { return true; }
-    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override { return std::make_shared<Impl>(); }
-  };
+  explicit FormattingCore(std::unique_ptr<formatting::BaseMessageFormatter>&& formatter,
+                          bool synchronous_mode = false)
+      : Core(synchronous_mode)
+      , formatter_(std::move(formatter)) {}
 
-  AutoFlush()
-      : FlushHandler(std::make_shared<Impl>()) {}
+  void SetFormatter(std::unique_ptr<formatting::BaseMessageFormatter>&& formatter) {
+    formatter_ = std::move(formatter);
+  }
+
+protected:
+  //! \brief Dispatch method, protected implementation.
+  //!
+  //! By default, dispatch is done by dispatching to every sink.
+  void dispatch(const Record& record) const override {
+    // Format the message.
+    auto buffer = memory::BufferPool::Local().Acquire();
+    formatter_->Format(record, formatting_settings_, *buffer);
+    // Pass the formatted record into the sinks as well.
+    forEachAcceptingSink(record, [&](Sink& sink) { sink.Dispatch(record, *buffer); });
+  }
+
+  void dispatchBatch(const std::vector<const Record*>& records) const override {
+    // Format every message once, then pass the formatted records into the sinks.
+    std::vector<memory::MemoryBuffer<char>> buffers(records.size());
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      formatter_->Format(*records[i], formatting_settings_, buffers[i]);
+    }
+    std::vector<BatchEntry> batch;
+    for (auto& sink : currentSinks()) {
+      batch.clear();
+      for (std::size_t i = 0; i < records.size(); ++i) {
+        if (sink->WillAccept(records[i]->Attributes())) {
+          batch.push_back({records[i], &buffers[i]});
+        }
+      }
+      sink->DispatchBatch(batch);
+    }
+  }
+
+  FormattingSettings formatting_settings_;
+
+  //! \brief The sink's formatter.
+  std::unique_ptr<formatting::BaseMessageFormatter> formatter_;
 };
 
-//! \brief Flush after every N messages.
-class FlushEveryN final : public FlushHandler {
+// ==============================================================================
+//  Background flusher.
+// ==============================================================================
+
+namespace flush {
+
+//! \brief A thread that flushes sinks on a schedule, so that no sink is left unflushed for longer than its
+//!        maximum delay, without the logging threads paying for the flushes.
+//!
+//! Sinks are flushed through their locked sink, like Core::Flush does. The flusher only keeps weak pointers
+//! to the sinks, so sinks that are destroyed are forgotten. The thread is started when the first sink is
+//! registered, and most programs can share the Global() flusher.
+class BackgroundFlusher {
 public:
-  class Impl final : public FlushHandler::Impl {
-  public:
-    explicit Impl(std::size_t N)
-        : N_(N) {
-      LL_REQUIRE(0 < N, "N cannot be 0");
+  BackgroundFlusher() = default;
+
+  BackgroundFlusher(const BackgroundFlusher&) = delete;
+  BackgroundFlusher& operator=(const BackgroundFlusher&) = delete;
+
+  //! \brief Stop the thread, flushing the sinks one last time.
+  ~BackgroundFlusher() {
+    {
+      std::lock_guard guard(mutex_);
+      stop_ = true;
     }
+    wake_.notify_one();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
 
-    bool DoFlush(const Record&) override {
-      ++count_;
-      count_ %= N_;
-      return count_ == 0;
+  //! \brief Get the flusher that the whole program can share.
+  static BackgroundFlusher& Global() {
+    static BackgroundFlusher flusher;
+    return flusher;
+  }
+
+  //! \brief Flush a sink at least as often as the maximum delay. Registering a sink again changes its delay.
+  template<typename Rep_t, typename Period_t>
+  void Register(const std::shared_ptr<Sink>& sink, std::chrono::duration<Rep_t, Period_t> max_delay) {
+    LL_REQUIRE(sink, "cannot register a null sink with the background flusher");
+    const auto delay = std::chrono::duration_cast<clock::duration>(max_delay);
+    LL_REQUIRE(0 < delay.count(), "the maximum delay must be positive");
+    {
+      std::lock_guard guard(mutex_);
+      const auto deadline = clock::now() + delay;
+      if (auto entry = find(sink); entry != entries_.end()) {
+        entry->delay = delay;
+        entry->deadline = std::min(entry->deadline, deadline);
+      }
+      else {
+        entries_.push_back({sink, delay, deadline});
+      }
+      // The sink may be due before the thread would next wake up.
+      rescheduled_ = true;
+      if (!thread_.joinable()) {
+        thread_ = std::thread([this] { run(); });
+      }
     }
+    wake_.notify_one();
+  }
 
-    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
-      return std::make_shared<Impl>(N_);
+  //! \brief Stop flushing a sink.
+  //!
+  //! \return Whether the sink was registered.
+  bool Unregister(const std::shared_ptr<Sink>& sink) {
+    std::lock_guard guard(mutex_);
+    if (auto entry = find(sink); entry != entries_.end()) {
+      entries_.erase(entry);
+      return true;
     }
+    return false;
+  }
 
-  private:
-    std::size_t count_ {}, N_;
-  };
+  //! \brief Get the number of registered sinks that still exist.
+  NO_DISCARD std::size_t GetNumSinks() const {
+    std::lock_guard guard(mutex_);
+    return static_cast<std::size_t>(
+        std::count_if(entries_.begin(), entries_.end(), [](auto& entry) { return !entry.sink.expired(); }));
+  }
 
-  explicit FlushEveryN(std::size_t N)
-      : FlushHandler(std::make_shared<Impl>(N)) {}
-};
+private:
+  using clock = std::chrono::steady_clock;
 
-class DisjunctionFlushHandler final : public FlushHandler {
-public:
-  class Impl final : public FlushHandler::Impl {
-  public:
-    Impl(FlushHandler lhs, FlushHandler rhs)
-        : lhs_(std::move(lhs))
-        , rhs_(std::move(rhs)) {}
+  struct Entry {
+    std::weak_ptr<Sink> sink;
+    clock::duration delay;
+    clock::time_point deadline;
+  };
 
-    bool DoFlush(const Record& record) override { return lhs_.DoFlush(record) || rhs_.DoFlush(record); }
+  std::vector<Entry>::iterator find(const std::shared_ptr<Sink>& sink) {
+    return std::find_if(entries_.begin(), entries_.end(), [&sink](auto& entry) {
+      return entry.sink.lock() == sink;
+    });
+  }
 
-    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
-      return std::make_shared<Impl>(lhs_.Clone(), rhs_.Clone());
+  void run() {
+    std::vector<std::shared_ptr<Sink>> due;
+    std::unique_lock lock(mutex_);
+    for (;;) {
+      auto woken = [this] { return stop_ || rescheduled_; };
+      if (entries_.empty()) {
+        wake_.wait(lock, woken);
+      }
+      else {
+        auto next_deadline = entries_.front().deadline;
+        for (auto& entry : entries_) {
+          next_deadline = std::min(next_deadline, entry.deadline);
+        }
+        wake_.wait_until(lock, next_deadline, woken);
+      }
+      rescheduled_ = false;
+
+      // Take the sinks that are due, forgetting the ones that were destroyed, and flush them without holding
+      // the mutex, so registering never waits on a flush. When stopping, every sink is flushed one last time.
+      const bool stopping = stop_;
+      const auto now = clock::now();
+      for (auto entry = entries_.begin(); entry != entries_.end();) {
+        auto sink = entry->sink.lock();
+        if (!sink) {
+          entry = entries_.erase(entry);
+          continue;
+        }
+        if (stopping || entry->deadline <= now) {
+          due.push_back(std::move(sink));
+          entry->deadline = now + entry->delay;
+        }
+        ++entry;
+      }
+      lock.unlock();
+      for (auto& sink : due) {
+        try {
+          sink->GetLockedSink()->Flush();
+        } catch (...) {
+          // There is no one to report the error to on the flusher thread, the sink is tried again next time.
+        }
+      }
+      due.clear();
+      if (stopping) {
+        return;
+      }
+      lock.lock();
     }
+  }
 
-  private:
-    FlushHandler lhs_, rhs_;
-  };
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::vector<Entry> entries_;
+  bool stop_ = false;
 
-  DisjunctionFlushHandler(FlushHandler lhs, FlushHandler rhs)
-      : FlushHandler(std::make_shared<Impl>(std::move(lhs), std::move(rhs))) {}
-};
+  //! \brief Set when a sink is registered, so the thread works out when to wake up again.
+  bool rescheduled_ = false;
 
-class ConjunctionFlushHandler final : public FlushHandler {
-public:
-  class Impl final : public FlushHandler::Impl {
-  public:
-    Impl(FlushHandler lhs, FlushHandler rhs)
-        : lhs_(std::move(lhs))
-        , rhs_(std::move(rhs)) {}
+  //! \brief Started when the first sink is registered.
+  std::thread thread_;
+};
 
-    bool DoFlush(const Record& record) override { return lhs_.DoFlush(record) && rhs_.DoFlush(record); }
+}  // namespace flush
 
-    NO_DISCARD std::shared_ptr<FlushHandler::Impl> Clone() const override {
-      return std::make_shared<Impl>(lhs_.Clone(), rhs_.Clone());
-    }
+// ==============================================================================
+//  Definitions of Record functions that have to go after Core is defined.
+// ==============================================================================
 
-  private:
-    FlushHandler lhs_, rhs_;
-  };
+bool Record::TryOpen(Core* core) {
+  if (core->WillAccept(attributes_, &sink_acceptance_)) {
+    bundle_.SetDeferredCapture(core->UsesDeferredFormatting());
+    core_ = core;
+    return true;
+  }
+  return false;
+}
 
-  ConjunctionFlushHandler(FlushHandler lhs, FlushHandler rhs)
-      : FlushHandler(std::make_shared<Impl>(std::move(lhs), std::move(rhs))) {}
-};
+void RecordDispatcher::open(Core* core) {
+  const bool arena_allocation = core->UsesArenaAllocation();
+  if (record_.TryOpen(core) && arena_allocation) {
+    arena_scope_.Open();
+  }
+}
 
-inline DisjunctionFlushHandler operator||(const FlushHandler& lhs, const FlushHandler& rhs) {
-  return {lhs, rhs};
+Record::operator bool() const {
+  return core_ != nullptr;
 }
 
-inline ConjunctionFlushHandler operator&&(const FlushHandler& lhs, const FlushHandler& rhs) {
-  return {lhs, rhs};
+void Record::Dispatch() {
+  if (core_) {
+    core_->Dispatch(*this);
+    core_ = nullptr;  // One time use.
+  }
 }
 
-}  // namespace flush
+// ==============================================================================
+//  Logger base class.
+// ==============================================================================
 
-//! \brief The type of function that can be used as a sink callback.
-using SinkCallback = std::function<void(const memory::BasicMemoryBuffer<char>& buffer, const Record& record)>;
+//! \brief Structure that serves as a tag that a Logger should not be created with a core.
+struct NoCore_t {};
 
-//! \brief Base class for sink backends, which are responsible for actually handling the record and
-//!        doing something with it. Not responsible for thread synchronization, this is the job of the
-//!        frontend.
-class SinkBackend {
-  friend class Sink;
+//! \brief Prototypical NoCore_t object.
+inline constexpr NoCore_t NoCore;
 
+//! \brief Base logger class. Capable of creating logging records which route messages
+//!        to the logger's logging core.
+class Logger {
 public:
-  //! \brief Flush the sink upon deletion.
-  virtual ~SinkBackend() { Flush(); }
+  //! \brief Create a logger with a new core.
+  Logger()
+      : core_(std::make_shared<Core>()) {}
 
-  //! \brief Dispatch a record.
-  void Dispatch(const memory::BasicMemoryBuffer<char>& buffer, const Record& record) {
-    if (callback_) {
-      // If there is a callback, call it.
-      callback_(buffer, record);
+  //! \brief Create a logger without a logging core.
+  //!
+  //! Note that the constructor is *not* explicit on purpose, so parameters can be defaulted like
+  //! `const Logger &logger = {NoCore};`.
+  Logger(NoCore_t)  // NOLINT(*-explicit-constructor)
+      : core_(nullptr) {}
+
+  //! \brief Create a logger with a new core and a single sink.
+  explicit Logger(const std::shared_ptr<Sink>& sink)
+      : core_(std::make_shared<Core>()) {
+    core_->AddSink(sink);
+  }
+
+  //! \brief Create a logger with the specified logging core.
+  explicit Logger(std::shared_ptr<Core> core)
+      : core_(std::move(core)) {}
+
+  virtual ~Logger() {
+    Flush();  // Make sure all sinks that the logger is connected to is flushed.
+  }
+
+  template<typename... Attrs_t>
+  RecordDispatcher Log(BasicAttributes basic_attributes = {}, Attrs_t&&... attrs) const {
+    if (!core_) {
+      return {};
     }
-    preMessage();
-    dispatch(buffer, record);
-    postMessage();
-    // Flush logic.
-    if (auto_flush_ || (flush_handler_ && flush_handler_->DoFlush(record))) {
-      Flush();
+    if (do_time_stamp_) {
+      basic_attributes.time_stamp = generator_.CurrentTime();
+    }
+    if (!logger_name_.empty()) {
+      basic_attributes.logger_name = logger_name_;
     }
+    if (!logger_attributes_.Empty()) {
+      basic_attributes.logger_attributes = &logger_attributes_;
+    }
+    // The logger keeps the core alive for as long as the record, so it only lends the record a pointer.
+    return RecordDispatcher(core_.get(), basic_attributes, attrs...);
   }
 
-  //! \brief Flush the sink. This is implementation defined.
-  SinkBackend& Flush() {
-    flush();
-    return *this;
+  template<typename... Attrs_t>
+  RecordDispatcher Log(std::optional<Severity> severity, Attrs_t&&... attrs) const {
+    return Log(BasicAttributes(severity), attrs...);
   }
 
-  //! \brief Get the sink formatting settings.
-  NO_DISCARD const FormattingSettings& GetFormattingSettings() const { return settings_; }
+  //! \brief Create a record dispatcher for a logging statement, setting the severity and location from its call
+  //!        site, plus any other attributes. The call site must outlive the record, which is why the logging
+  //!        macros make their call sites static.
+  template<typename... Attrs_t>
+  RecordDispatcher LogAt(const CallSite& call_site, Attrs_t&&... attrs) const {
+    return Log(BasicAttributes(call_site.severity, &call_site), attrs...);
+  }
 
-  //! \brief Mutably get the sink formatting settings.
-  NO_DISCARD FormattingSettings& GetFormattingSettings() { return settings_; }
+  //! \brief Create a record dispatcher, setting severity, file name, line number, and any other attributes.
+  //!
+  //! The location is looked up as a call site on every call, see the matching BasicAttributes constructor.
+  template<typename... Attrs_t>
+  [[deprecated("use LogAt with a static call site, see LL_CALL_SITE")]]
+  RecordDispatcher LogWithLocation(std::optional<Severity> severity,
+                                   const char* file_name,
+                                   const char* function_name,
+                                   unsigned line_number,
+                                   Attrs_t&&... attrs) const {
+    return Log(BasicAttributes(severity, detail::InternCallSite(file_name, function_name, line_number)),
+               attrs...);
+  }
 
-  //! \brief Create a new flush handler for the sink.
-  template<typename FlushHandler_t, typename... Args_t>
-  SinkBackend& CreateFlushHandler(Args_t&&... args) {
-    flush_handler_ = FlushHandler_t(std::forward<Args_t>(args)...);
-    return *this;
+  //! \brief Check whether the logger will accept a record with the specified severity (or lack of severity).
+  NO_DISCARD bool WillAccept(std::optional<Severity> severity) const {
+    if (!core_) {
+      return false;
+    }
+    return core_->WillAccept(severity);
   }
 
-  //! \brief Set the flush handler.
-  SinkBackend& SetFlushHandler(flush::FlushHandler&& flush_handler) {
-    flush_handler_ = std::move(flush_handler);
+  //! \brief Get the logger's core.
+  NO_DISCARD const std::shared_ptr<Core>& GetCore() const { return core_; }
+
+  //! \brief Check if the logger has a core.
+  NO_DISCARD bool HasCore() const { return static_cast<bool>(core_); }
+
+  //! \brief Replace the logger's current core with a new core.
+  //!
+  //! Records only borrow the logger's core, so the core must not be replaced while the logger has open
+  //! records, e.g. while another thread is logging through the logger.
+  Logger& SetCore(std::shared_ptr<Core> core) {
+    core_ = std::move(core);
     return *this;
   }
 
-  //! \brief Clear the flush handler.
-  SinkBackend& ClearFlushHandler() {
-    flush_handler_ = {};
+  //! \brief Set whether the logger should generate a time stamp for the logs.
+  Logger& SetDoTimeStamp(bool do_timestamp) {
+    do_time_stamp_ = do_timestamp;
     return *this;
   }
 
-  //! \brief Set the sink auto-flush.
+  //! \brief Set the name of the logger. This attribute is attached to every record.
   //!
-  //! This will take precedence over any flush handler.
-  SinkBackend& SetAutoFlush(bool auto_flush) {
-    auto_flush_ = auto_flush;
+  //! Note - this operation is not thread safe.
+  Logger& SetName(const std::string& logger_name) {
+    logger_name_ = logger_name;
     return *this;
   }
 
-  //! \brief Clone a sink backend, making a deep copy of the backend.
+  //! \brief Set an attribute that is attached to every record, replacing any attribute with the same key.
   //!
-  //! Certain objects, e.g., the call-back function (if any), may not be deeply copied.
-  NO_DISCARD virtual std::unique_ptr<SinkBackend> Clone() const = 0;
-
-  //! \brief Copy the basic settings from another sink backend to this backend.
-  void CopySettings(const SinkBackend& other) {
-    settings_ = other.settings_;
-    flush_handler_ = other.copyFlushHandler();
-    callback_ = other.callback_;
-    auto_flush_ = other.auto_flush_;
+  //! Records refer to the logger's attributes instead of copying them, so string values only have to outlive
+  //! the logger. Note - this operation is not thread safe.
+  Logger& SetAttribute(const Attribute& attribute) {
+    LL_REQUIRE(logger_attributes_.Set(attribute),
+               "a logger can have at most " << AttributeList::capacity << " attributes");
+    return *this;
   }
 
-  //! \brief Set the sink backend callback function.
-  void SetCallback(SinkCallback&& callback) { callback_ = std::move(callback); }
-
-  //! \brief Remove the sink backend callback function.
-  void ClearCallback() { callback_ = {}; }
-
-protected:
-  //! \brief Private dispatch implementation.
-  virtual void dispatch(const memory::BasicMemoryBuffer<char>& buffer, const Record& record) = 0;
-
-  //! \brief Protected implementation of flushing the sink.
-  virtual void flush() { flushLockFree(); }
-
-  //! \brief Protected implementation of flushing the sink, must be without locking.
-  virtual void flushLockFree() {}
-
-  NO_DISCARD std::optional<flush::FlushHandler> copyFlushHandler() const {
-    return flush_handler_ ? std::optional(flush_handler_->Clone()) : std::nullopt;
+  //! \brief Remove all of the logger's attributes. Note - this operation is not thread safe.
+  Logger& ClearAttributes() {
+    logger_attributes_.Clear();
+    return *this;
   }
 
-  //! \brief Any pre-message actions that need to be taken.
-  virtual void preMessage() {}
-
-  //! \brief Any post-message actions that need to be taken.
-  virtual void postMessage() {}
+  //! \brief Get the attributes that are attached to every record.
+  NO_DISCARD const AttributeList& GetAttributes() const { return logger_attributes_; }
 
-  //! \brief The sink formatting settings.
-  FormattingSettings settings_;
+  //! \brief Notify the core to flush all of its sinks.
+  void Flush() const {
+    if (HasCore()) {
+      // Note - cast is to get around "result is unused" warning.
+      static_cast<void>(core_->Flush());
+    }
+  }
 
-  //! \brief An optional flush handler, which determines whether the sink should be flushed based on the
-  //!        record.
-  std::optional<flush::FlushHandler> flush_handler_ {};
+  //! \brief Get all sinks that have the specified type of backend.
+  template<typename SinkBackend_t>
+  std::vector<std::pair<Sink*, SinkBackend_t*>> GetSinks() const {
+    if (!HasCore()) {
+      return {};
+    }
 
-  //! \brief A callback that can choose to do some action based on the buffer (serialized data, via the
-  //!        frontend) and record itself (containing all the attributes).
-  SinkCallback callback_;
+    std::vector<std::pair<Sink*, SinkBackend_t*>> output;
+    GetCore()->MapOnSinks<SinkBackend_t>(
+        [&output](Sink& sink, SinkBackend_t& backend) { output.emplace_back(&sink, &backend); });
+    return output;
+  }
 
-  //! \brief Whether to automatically flush the sink after each message.
-  bool auto_flush_ = false;
-};
+  //! \brief Map a function on every sink of the specified type that is in the logger's core.
+  template<typename SinkBackend_t, typename Func_t>
+  void MapOnSinks(Func_t&& func) const {
+    if (HasCore()) {
+      core_->MapOnSinks<SinkBackend_t>(func);
+    }
+  }
 
-// ==============================================================================================
-//  Synchronization wrappers
-// ==============================================================================================
+  //! \brief Set the formatters of all sinks in the logger's core.
+  //!
+  //! Warning: this may be ill-advised if many loggers share the same core.
+  void SetAllFormats(const std::unique_ptr<formatting::BaseMessageFormatter>& formatter) const {
+    SetAllFormats(*formatter);
+  }
 
-//! \brief Base class for object wrappers. These, in general, potentially lock the object while it exists,
-//!        keeping other threads from accessing it while the wrapper is alive.
-//!
-//! Sink frontends are responsible for thread synchronization, and only frontend sinks that use a mutex will
-//! return a truly "locked" sink, others will just return a SinkWrapper.
-template<typename Object_t>
-class ObjectWrapper : public ImplBase {
-  friend class ImplBase;
+  //! \brief Set the formatters of all sinks in the logger's core.
+  //!
+  //! Warning: this may be ill-advised if many loggers share the same core.
+  void SetAllFormats(const formatting::BaseMessageFormatter& formatter) const {
+    if (auto core = GetCore()) {
+      core->SetAllFormatters(formatter);
+    }
+  }
 
-protected:
-  struct Impl : ImplBase::Impl {
-    explicit Impl(Object_t* obj)
-        : object(obj) {}
-    Object_t* object {};
-  };
+  //! \brief Create a clone of the logger.
+  //!
+  //! This not only copies the logger, but clones the core and all sinks.
+  NO_DISCARD Logger Clone() const {
+    auto core = HasCore() ? core_->Clone() : nullptr;
+    return Logger(*this).SetCore(std::move(core));
+  }
 
-  explicit ObjectWrapper(const std::shared_ptr<Impl>& impl)
-      : ImplBase(impl) {}
+private:
+  //! \brief Whether to generate a time stamp for the logs.
+  bool do_time_stamp_ = true;
 
-public:
-  explicit ObjectWrapper(Object_t* obj)
-      : ImplBase(std::make_shared<Impl>(obj)) {}
+  //! \brief A generator to create the DateTime timestamps for records.
+  time::FastDateGenerator generator_;
 
-  Object_t* operator->() { return impl<ObjectWrapper>()->object; }
-  Object_t& operator*() { return *impl<ObjectWrapper>()->object; }
-  const Object_t& operator*() const { return *impl<ObjectWrapper>()->object; }
+  //! \brief A name for the logger.
+  std::string logger_name_ {};
 
-  explicit operator bool() { return static_cast<bool>(impl<ObjectWrapper>()->object); }
+  //! \brief The logger's core.
+  std::shared_ptr<Core> core_;
 
-  //! \brief Try casting the object to a specific type.
-  template<typename OtherObject_t>
-  OtherObject_t* As() {
-    return dynamic_cast<OtherObject_t*>(impl<ObjectWrapper>()->backend);
-  }
+  //! \brief Attributes associated with a specific logger.
+  AttributeList logger_attributes_;
 };
 
-//! \brief A locked object wrapper that controlls access via a mutex.
-template<typename Object_t>
-class LockedObject : public ObjectWrapper<Object_t> {
-protected:
-  template<typename Mutex_t>
-  struct Impl : ObjectWrapper<Object_t>::Impl {
-    explicit Impl(Object_t* backend, Mutex_t& mutex)
-        : ObjectWrapper<Object_t>::Impl(backend)
-        , lock(mutex) {}
-    std::unique_lock<Mutex_t> lock;
-  };
-
+//! \brief A sink, used for testing, that does nothing.
+class EmptySink : public SinkBackend {
 public:
-  template<typename Mutex_t>
-  explicit LockedObject(Object_t* object, Mutex_t& mutex)
-      : ObjectWrapper<Object_t>(std::make_shared<Impl<Mutex_t>>(object, mutex)) {}
-};
+  EmptySink() { settings_.needs_formatting = false; }
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override { return std::make_unique<EmptySink>(); }
 
-namespace locks {
+private:
+  void dispatch(const memory::BasicMemoryBuffer<char>&, const Record&) override {}
+};
 
-//! \brief Shared (reader) lock guard that is only used if the `do_lock` flag is true.
+//! \brief A sink, used for testing, that formats a record, but does not stream the result anywhere.
 //!
-//! This allows us to toggle via a flag whether synchronization is necessary.
-template<typename Mutex_t>
-class PotentiallySharedLock {
+//! Primarily for timing and testing.
+class TrivialDispatchSink : public SinkBackend {
 public:
-  PotentiallySharedLock(Mutex_t& mutex, bool do_lock) {
-    if (do_lock) {
-      lock_ = std::shared_lock<Mutex_t>(mutex);
-    }
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    return std::make_unique<TrivialDispatchSink>();
   }
 
 private:
-  std::shared_lock<Mutex_t> lock_;
+  void dispatch([[maybe_unused]] const memory::BasicMemoryBuffer<char>& buffer,
+                [[maybe_unused]] const Record& record) override {}
 };
 
-//! \brief Unique (writer) lock guard that is only used if the `do_lock` flag is true.
-//!
-//! This allows us to toggle via a flag whether synchronization is necessary.
-template<typename Mutex_t>
-class PotentiallyUniqueLock {
+//! \brief A simple sink that writes to a file via an ofstream.
+class FileSink : public SinkBackend {
 public:
-  PotentiallyUniqueLock(Mutex_t& mutex, bool do_lock) {
-    if (do_lock) {
-      lock_ = std::unique_lock<Mutex_t>(mutex);
-    }
+  explicit FileSink(const std::string& file_path)
+      : fout_(file_path)
+      , filename_(file_path) {}
+
+  ~FileSink() override { fout_.flush(); }
+
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    return std::make_unique<FileSink>(filename_);
   }
 
 private:
-  std::unique_lock<Mutex_t> lock_;
+  void dispatch([[maybe_unused]] const memory::BasicMemoryBuffer<char>& buffer,
+                [[maybe_unused]] const Record& record) override {
+    if (!buffer.Empty()) {
+      fout_.write(buffer.Data(), static_cast<std::streamsize>(buffer.Size()));
+    }
+  }
+
+  void flushLockFree() override { fout_.flush(); }
+
+  std::ofstream fout_;
+  std::string filename_;
 };
 
-}  // namespace locks
+namespace binary {
 
-// ==============================================================================================
-//  Sinks
-// ==============================================================================================
+//! \brief The magic bytes that every binary log file starts with.
+constexpr std::string_view file_magic = "LLBINLOG";
 
-//! \brief Base class for sink frontends. These are responsible for common tasks, like filtering
-//!        and controlling access to the sink backend, i.e. synchronization.
-class Sink {
-  friend class Core;
+//! \brief The version of the binary log format.
+constexpr std::uint32_t format_version = 3;
 
-public:
-  //! \brief Construct a sink around a specific backend.
-  explicit Sink(std::unique_ptr<SinkBackend>&& backend)
-      : sink_backend_(std::move(backend))
-      , formatter_(formatting::MakeStandardFormatter()) {}
+//! \brief Written after the version, so a reader can tell if a file was written with a different byte order.
+constexpr std::uint32_t byte_order_mark = 0x01020304;
 
-  virtual ~Sink() = default;
+//! \brief The kinds of entries in a binary log file. Every entry starts with its kind, as a single byte.
+enum class EntryKind : unsigned char {
+  //! \brief A string, which later records refer to by its ID.
+  //!
+  //! Followed by the u32 ID of the string, its u32 size, and its characters.
+  String = 1,
+  //! \brief A record.
+  //!
+  //! Followed by the i64 time stamp, in microseconds since the epoch, or INT64_MIN if there is no time stamp,
+  //! the u8 severity (zero if there is no severity), the u32 ID of the call site, the u32 string ID of the
+  //! logger name (zero if there is none), the u64 thread ID, the u32 string ID of the thread name (zero if
+  //! there is none), and finally the u32 size and bytes of the message, as encoded by RefBundle::EncodeTo.
+  Record = 2,
+  //! \brief A call site, which later records refer to by its ID.
+  //!
+  //! Followed by the u32 ID of the call site, its u32 line number (all ones if there is no line number), and
+  //! the u32 string IDs of its file path and function name (zero if there is none).
+  CallSite = 3,
+};
 
-  //! \brief Check if a sink, given the record's attributes, will accept the record.
-  NO_DISCARD bool WillAccept(const RecordAttributes& attributes) const {
-    return filter_.WillAccept(attributes);
-  }
+//! \brief Time stamp value for a record without a time stamp.
+constexpr std::int64_t no_time_stamp = std::numeric_limits<std::int64_t>::min();
 
-  //! \brief Check if a sink, given the record's severity, will accept the record.
-  NO_DISCARD bool WillAccept(std::optional<Severity> severity) const { return filter_.WillAccept(severity); }
+//! \brief Line number value for a record without a line number.
+constexpr std::uint32_t no_line_number = std::numeric_limits<std::uint32_t>::max();
 
-  //! \brief Get the AttributeFilter for the sink.
-  filter::AttributeFilter& GetFilter() { return filter_; }
+}  // namespace binary
 
-  //! \brief Dispatch a record.
-  virtual void Dispatch(const Record& record) { dispatch(record, nullptr); }
+//! \brief A sink that writes records to a file in a compact binary format, instead of as text.
+//!
+//! The basic attributes are written as fixed width fields, and message values are written as raw, type
+//! tagged values (see RefBundle::EncodeTo), so logging does not pay for formatting numbers or time stamps.
+//! Call sites, logger names, and thread names are written to the file once, the first time they are used, and
+//! records refer to them by ID. Call sites are static, file and function names are string literals, and thread
+//! names are interned, so these are looked up by pointer.
+//!
+//! Use BinaryLogReader (or the decode-binary-log application) to turn the file back into text with any
+//! message formatter. Attributes other than the basic attributes are not written.
+class BinaryFileSink : public SinkBackend {
+public:
+  //! \brief Open a file, truncating it, and write the file header.
+  //!
+  //! \param file_path The file to write to.
+  //! \param buffer_capacity Entries are collected in a buffer, which is written out once it holds this many
+  //!                        bytes.
+  explicit BinaryFileSink(const std::string& file_path, std::size_t buffer_capacity = 64 * 1024)
+      : fout_(file_path, std::ios::binary | std::ios::trunc)
+      , file_path_(file_path)
+      , buffer_capacity_(buffer_capacity) {
+    LL_REQUIRE(fout_, "could not open file '" << file_path << "' for writing");
+    settings_.needs_formatting = false;
+    settings_.accepts_preformatted = false;
 
-  //! \brief Dispatch a record, given the pre-formatted record.
-  virtual void Dispatch(const Record& record, const memory::BasicMemoryBuffer<char>& buffer) {
-    dispatch(record, &buffer);
+    buffer_.ReserveAdditional(buffer_capacity_);
+    buffer_.Append(binary::file_magic.data(), binary::file_magic.data() + binary::file_magic.size());
+    put(binary::format_version);
+    put(binary::byte_order_mark);
   }
 
-  // ==============================================================================================
-  //  Pass-through methods to the backend.
-  // ==============================================================================================
-
-  //! \brief Get the record formatter.
-  NO_DISCARD formatting::BaseMessageFormatter& GetFormatter() { return *formatter_; }
+  ~BinaryFileSink() override { flushLockFree(); }
 
-  //! \brief Set the severity filter.
-  Sink& SetFilter(SeveritySet severity_set) {
-    filter_.Accept(severity_set);
-    return *this;
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    auto sink = std::make_unique<BinaryFileSink>(file_path_, buffer_capacity_);
+    sink->CopySettings(*this);
+    return sink;
   }
 
-  //! \brief Set the filter back to default.
-  Sink& ClearFilters() {
-    filter_ = filter::AttributeFilter {};
-    return *this;
-  }
+  //! \brief Get the path of the file that the sink writes to.
+  NO_DISCARD const std::string& GetFilePath() const { return file_path_; }
 
-  //! \brief Set the sink's formatter.
-  Sink& SetFormatter(std::unique_ptr<formatting::BaseMessageFormatter>&& formatter) {
-    formatter_ = std::move(formatter);
-    return *this;
+  //! \brief Get the number of strings that have been written to the file's string table.
+  NO_DISCARD std::size_t GetStringCount() const { return next_string_id_ - 1; }
+
+  //! \brief Get the number of call sites that have been written to the file.
+  NO_DISCARD std::size_t GetCallSiteCount() const { return call_site_ids_.size(); }
+
+private:
+  void dispatch(const memory::BasicMemoryBuffer<char>&, const Record& record) override {
+    const auto& basic = record.Attributes().basic_attributes;
+    // The call site and strings have to be written before the record that refers to them.
+    const auto call_site_id = intern(basic.call_site);
+    const auto logger_id = intern(basic.logger_name);
+    // Thread names are interned (see SetThreadName), so they can be looked up by pointer.
+    const auto thread_name_id = intern(basic.thread_name.empty() ? nullptr : basic.thread_name.data());
+
+    message_.Clear();
+    record.Bundle().EncodeTo(settings_, message_);
+
+    put(binary::EntryKind::Record);
+    put(basic.time_stamp ? basic.time_stamp->EpochMicroseconds() : binary::no_time_stamp);
+    put(static_cast<std::uint8_t>(basic.level ? static_cast<SeverityInt_t>(*basic.level) : 0));
+    put(call_site_id);
+    put(logger_id);
+    put(static_cast<std::uint64_t>(basic.thread_id));
+    put(thread_name_id);
+    put(static_cast<std::uint32_t>(message_.Size()));
+    buffer_.Append(message_);
+
+    if (buffer_capacity_ <= buffer_.Size()) {
+      writeBuffer();
+    }
   }
 
-  //! \brief 'Flush' the sink. This is implementation defined.
-  Sink& Flush() {
-    sink_backend_->Flush();
-    return *this;
+  void flushLockFree() override {
+    writeBuffer();
+    fout_.flush();
   }
 
-  //! \brief Mutably get the sink backend.
-  //!
-  //! \note Does not perform any locking.
-  SinkBackend& GetBackend() { return *sink_backend_; }
+  void writeBuffer() {
+    if (!buffer_.Empty()) {
+      fout_.write(buffer_.Data(), static_cast<std::streamsize>(buffer_.Size()));
+      buffer_.Clear();
+    }
+  }
 
-  //! \brief Get the sink backend.
-  //!
-  //! \note Does not perform any locking.
-  NO_DISCARD const SinkBackend& GetBackend() const { return *sink_backend_; }
+  template<typename T>
+  void put(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    buffer_.Append(reinterpret_cast<const char*>(&value), reinterpret_cast<const char*>(&value) + sizeof(T));
+  }
 
-  //! \brief Locks (if necessary) the sink backend, returning a locked sink.
-  NO_DISCARD ObjectWrapper<Sink> GetLockedSink() { return getLockedSink(); }
+  //! \brief Write a string table entry.
+  std::uint32_t putString(std::string_view str) {
+    const auto id = next_string_id_++;
+    put(binary::EntryKind::String);
+    put(id);
+    put(static_cast<std::uint32_t>(str.size()));
+    buffer_.Append(str.data(), str.data() + str.size());
+    return id;
+  }
 
-  //! \brief Get the sink backend, cast to a specific type.
-  //!
-  //! \return nullptr if the type was not correct.
-  template<typename SinkBackend_t>
-  SinkBackend_t* GetBackendAs() {
-    return dynamic_cast<SinkBackend_t*>(sink_backend_.get());
+  //! \brief Get the ID of a string with a stable address, writing the string to the file if it is new.
+  std::uint32_t intern(const char* str) {
+    if (!str) {
+      return 0;
+    }
+    auto it = pointer_ids_.find(str);
+    if (it == pointer_ids_.end()) {
+      it = pointer_ids_.emplace(str, putString(str)).first;
+    }
+    return it->second;
   }
 
-  //! \brief Make a deep copy of the Sink, including a deep copy of the sink backend.
-  NO_DISCARD std::shared_ptr<Sink> Clone() const {
-    auto sink = clone();
-    sink->filter_ = filter_;
-    sink->formatter_ = formatter_->Copy();
-    return sink;
+  //! \brief Get the ID of a call site, writing the call site and its strings to the file if it is new.
+  std::uint32_t intern(const CallSite* call_site) {
+    if (!call_site) {
+      return 0;
+    }
+    auto it = call_site_ids_.find(call_site);
+    if (it == call_site_ids_.end()) {
+      const auto file_id = intern(call_site->file_path);
+      const auto function_id = intern(call_site->function_name);
+      const auto id = static_cast<std::uint32_t>(call_site_ids_.size() + 1);
+      put(binary::EntryKind::CallSite);
+      put(id);
+      put(call_site->line_number ? static_cast<std::uint32_t>(*call_site->line_number) : binary::no_line_number);
+      put(file_id);
+      put(function_id);
+      it = call_site_ids_.emplace(call_site, id).first;
+    }
+    return it->second;
   }
 
-protected:
-  //! \brief Private virtual dispatch method for a pre-formatted message.
-  virtual void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>* formatted_msg) = 0;
+  //! \brief Get the ID of a string by its contents, writing the string to the file if it is new. The logger
+  //!        name is owned by the logger, so it can't be looked up by pointer.
+  std::uint32_t intern(std::string_view str) {
+    if (str.empty()) {
+      return 0;
+    }
+    auto it = name_ids_.find(str);
+    if (it == name_ids_.end()) {
+      it = name_ids_.emplace(std::string(str), putString(str)).first;
+    }
+    return it->second;
+  }
 
-  //! \brief Private implementation of the clone method.
-  NO_DISCARD virtual std::shared_ptr<Sink> clone() const = 0;
+  std::ofstream fout_;
+  std::string file_path_;
+  std::size_t buffer_capacity_;
 
-  //! \brief Get the sink backend, wrapped in a SinkWrapper. The default implementation does not lock the
-  //!        sink, since the Sink base class has no mutex.
-  virtual ObjectWrapper<Sink> getLockedSink() { return ObjectWrapper(this); }
+  //! \brief Entries that have not been written to the file yet.
+  memory::MemoryBuffer<char> buffer_;
 
-  void flushLockFree() const {
-    if (sink_backend_) {
-      sink_backend_->flushLockFree();
-    }
-  }
+  //! \brief Scratch buffer for encoding a record's message.
+  memory::MemoryBuffer<char> message_;
 
-  //! \brief The sink backend, to which the frontend feeds record.
-  std::unique_ptr<SinkBackend> sink_backend_ {};
+  std::unordered_map<const char*, std::uint32_t> pointer_ids_;
+  std::map<std::string, std::uint32_t, std::less<>> name_ids_;
 
-  //! \brief The Sink's attribute filters.
-  filter::AttributeFilter filter_;
+  //! \brief Call site IDs also start from one, zero means "no call site".
+  std::unordered_map<const CallSite*, std::uint32_t> call_site_ids_;
 
-  //! \brief The sink's formatter.
-  std::unique_ptr<formatting::BaseMessageFormatter> formatter_;
+  //! \brief String IDs start from one, zero means "no string".
+  std::uint32_t next_string_id_ = 1;
 };
 
-//! \brief A locked sink that uses a mutex to lock the sink, controlling access.
-using LockedSink = LockedObject<Sink>;
-
-//! \brief Sink frontend that uses no synchronization methods.
+//! \brief Reads the records back from a file written by a BinaryFileSink.
 //!
-//! This is the simplest sink frontend, but it is recommended that a SynchronousSink is used for all real
-//! applications.
-class UnlockedSink : public Sink {
+//! Records are read one at a time, so the file does not have to fit in memory. The records refer to strings
+//! owned by the reader, so they must not outlive it.
+class BinaryLogReader {
 public:
-  explicit UnlockedSink(std::unique_ptr<SinkBackend>&& backend)
-      : Sink(std::move(backend)) {}
+  explicit BinaryLogReader(const std::string& file_path)
+      : fin_(file_path, std::ios::binary) {
+    LL_REQUIRE(fin_, "could not open file '" << file_path << "' for reading");
+    char magic[binary::file_magic.size()];
+    LL_REQUIRE(fin_.read(magic, sizeof(magic)) && std::string_view(magic, sizeof(magic)) == binary::file_magic,
+               "file '" << file_path << "' is not a binary log file");
+    const auto version = get<std::uint32_t>();
+    LL_REQUIRE(version == binary::format_version, "unsupported binary log format version " << version);
+    LL_REQUIRE(get<std::uint32_t>() == binary::byte_order_mark,
+               "file '" << file_path << "' was written with a different byte order");
+  }
+
+  //! \brief Read the next record from the file. Returns null once the end of the file is reached.
+  std::unique_ptr<Record> Next() {
+    while (true) {
+      const auto kind = fin_.get();
+      if (kind == std::ifstream::traits_type::eof()) {
+        return nullptr;
+      }
+      switch (static_cast<binary::EntryKind>(kind)) {
+        case binary::EntryKind::String: {
+          const auto id = get<std::uint32_t>();
+          LL_REQUIRE(id == strings_.size() + 1,
+                     "string entry has ID " << id << ", expected " << strings_.size() + 1);
+          strings_.push_back(getString(get<std::uint32_t>()));
+          break;
+        }
+        case binary::EntryKind::CallSite: {
+          const auto id = get<std::uint32_t>();
+          LL_REQUIRE(id == call_sites_.size() + 1,
+                     "call site entry has ID " << id << ", expected " << call_sites_.size() + 1);
+          const auto line_number = get<std::uint32_t>();
+          const auto file_path = lookup(get<std::uint32_t>());
+          const auto function_name = lookup(get<std::uint32_t>());
+          call_sites_.emplace_back(
+              file_path ? file_path->c_str() : nullptr,
+              function_name ? function_name->c_str() : nullptr,
+              line_number != binary::no_line_number ? std::optional(line_number) : std::nullopt);
+          break;
+        }
+        case binary::EntryKind::Record:
+          return readRecord();
+        default:
+          LL_FAIL("invalid entry kind " << kind << " in binary log file");
+      }
+    }
+  }
 
-  template<typename SinkBackend_t, typename... Args_t>
-  static std::shared_ptr<UnlockedSink> From(Args_t&&... args) {
-    static_assert(std::is_base_of_v<SinkBackend, SinkBackend_t>, "sink type must be a child of SinkBackend");
-    return std::make_shared<UnlockedSink>(std::make_unique<SinkBackend_t>(std::forward<Args_t>(args)...));
+  //! \brief Read every remaining record, dispatching them to the core's sinks in batches of up to
+  //!        `batch_size` records. Returns the number of records that were read.
+  std::size_t ReplayTo(const Core& core, std::size_t batch_size = 256) {
+    LL_REQUIRE(0 < batch_size, "the batch size must be positive");
+    std::size_t count = 0;
+    std::vector<std::unique_ptr<Record>> records;
+    std::vector<const Record*> batch;
+    for (;;) {
+      records.clear();
+      batch.clear();
+      for (auto record = Next(); record; record = records.size() < batch_size ? Next() : nullptr) {
+        batch.push_back(record.get());
+        records.push_back(std::move(record));
+      }
+      if (batch.empty()) {
+        return count;
+      }
+      core.DispatchBatch(batch);
+      count += batch.size();
+    }
+  }
+
+  //! \brief Read every remaining record, formatting each with the formatter and writing it to the stream.
+  //!        Returns the number of records that were read.
+  std::size_t DecodeTo(std::ostream& out,
+                       const formatting::BaseMessageFormatter& formatter,
+                       const FormattingSettings& settings = {}) {
+    std::size_t count = 0;
+    memory::MemoryBuffer<char> buffer;
+    for (auto record = Next(); record; record = Next(), ++count) {
+      buffer.Clear();
+      formatter.Format(*record, settings, buffer);
+      out.write(buffer.Data(), static_cast<std::streamsize>(buffer.Size()));
+    }
+    return count;
   }
 
 private:
-  void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>* formatted_msg) override {
-    const auto& settings = sink_backend_->GetFormattingSettings();
+  std::unique_ptr<Record> readRecord() {
+    const auto time_stamp = get<std::int64_t>();
+    const auto severity = get<std::uint8_t>();
+    const auto call_site = lookupCallSite(get<std::uint32_t>());
+    const auto logger_name = lookup(get<std::uint32_t>());
+    const auto thread_id = get<std::uint64_t>();
+    const auto thread_name = lookup(get<std::uint32_t>());
+
+    auto record = std::make_unique<Record>(
+        BasicAttributes(severity != 0 ? std::optional(static_cast<Severity>(severity)) : std::nullopt,
+                        call_site,
+                        static_cast<ThreadID_t>(thread_id),
+                        thread_name ? std::string_view(*thread_name) : std::string_view {}));
+    auto& basic = record->Attributes().basic_attributes;
+    if (time_stamp != binary::no_time_stamp) {
+      basic.time_stamp = time::DateTime::FromEpochMicroseconds(time_stamp);
+    }
+    if (logger_name) {
+      basic.logger_name = *logger_name;
+    }
+    record->Bundle().AppendEncoded(getString(get<std::uint32_t>()));
+    return record;
+  }
 
-    // If the formatted message was already provided, pass that in.
-    if (formatted_msg && settings.accepts_preformatted) {
-      sink_backend_->Dispatch(*formatted_msg, record);
-      return;
+  template<typename T>
+  T get() {
+    T value {};
+    LL_REQUIRE(fin_.read(reinterpret_cast<char*>(&value), sizeof(T)), "unexpected end of binary log file");
+    return value;
+  }
+
+  std::string getString(std::uint32_t size) {
+    std::string str(size, '\0');
+    LL_REQUIRE(fin_.read(str.data(), size), "unexpected end of binary log file");
+    return str;
+  }
+
+  const std::string* lookup(std::uint32_t id) const {
+    if (id == 0) {
+      return nullptr;
     }
+    LL_REQUIRE(id <= strings_.size(), "record refers to unknown string " << id);
+    return &strings_[id - 1];
+  }
 
-    memory::MemoryBuffer<char> buffer;
-    if (settings.needs_formatting) {
-      formatter_->Format(record, sink_backend_->GetFormattingSettings(), buffer, formatted_msg);
+  const CallSite* lookupCallSite(std::uint32_t id) const {
+    if (id == 0) {
+      return nullptr;
     }
-    sink_backend_->Dispatch(buffer, record);
+    LL_REQUIRE(id <= call_sites_.size(), "record refers to unknown call site " << id);
+    return &call_sites_[id - 1];
   }
 
-  NO_DISCARD std::shared_ptr<Sink> clone() const override {
-    return std::make_shared<UnlockedSink>(sink_backend_->Clone());
-  }
+  std::ifstream fin_;
+
+  //! \brief The string table. A deque, so records can keep pointers to the strings as it grows.
+  std::deque<std::string> strings_;
+
+  //! \brief The call sites, which refer to strings in the string table.
+  std::deque<CallSite> call_sites_;
 };
 
-//! \brief Sink frontend that uses a mutex to control access.
-class SynchronousSink : public Sink {
+#if LL_HAS_POSIX
+
+//! \brief When a FastFileSink asks the OS to commit written data to the disk.
+enum class SyncPolicy {
+  //! \brief Never sync, leave it to the OS.
+  None,
+  //! \brief Sync with fdatasync whenever the sink is flushed.
+  OnFlush,
+  //! \brief Sync with fdatasync after every write to the file.
+  EveryWrite,
+};
+
+//! \brief A sink that writes to a file through a POSIX file descriptor, collecting messages in its own large
+//!        buffer.
+//!
+//! Messages are copied into the buffer, and the buffer is written to the file with a single write(2) when it
+//! is full, when the sink is flushed (e.g. by its flush handler), or when the oldest message in the buffer is
+//! older than the max age. This avoids the overhead of iostreams and makes one syscall per many messages. The
+//! file is opened with O_APPEND, so several processes can append to the same file.
+//!
+//! The max age is only checked when a message is dispatched, so an idle sink can hold messages until it is
+//! flushed. Flushing only uses write(2) (and fdatasync, depending on the sync policy), so it is safe to do
+//! from the signal handlers.
+class FastFileSink : public SinkBackend {
 public:
-  explicit SynchronousSink(std::unique_ptr<SinkBackend>&& backend)
-      : Sink(std::move(backend)) {}
+  //! \brief Open a file for appending.
+  //!
+  //! \param file_path The file to append to.
+  //! \param buffer_capacity The size of the sink's buffer, in bytes.
+  //! \param max_age If non-zero, messages are written out once the oldest message in the buffer is this old.
+  //! \param sync_policy When to call fdatasync.
+  explicit FastFileSink(const std::string& file_path,
+                        std::size_t buffer_capacity = 4 * 1024 * 1024,
+                        std::chrono::milliseconds max_age = std::chrono::milliseconds(0),
+                        SyncPolicy sync_policy = SyncPolicy::None)
+      : filename_(file_path)
+      , buffer_(new char[buffer_capacity])
+      , capacity_(buffer_capacity)
+      , max_age_(max_age)
+      , sync_policy_(sync_policy) {
+    LL_REQUIRE(0 < buffer_capacity, "the buffer capacity of a FastFileSink must be positive");
+    fd_ = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    LL_REQUIRE(0 <= fd_, "could not open file '" << file_path << "': " << std::strerror(errno));
+  }
+
+  ~FastFileSink() override {
+    flushLockFree();
+    ::close(fd_);
+  }
 
-  template<typename SinkBackend_t, typename... Args_t>
-  static std::shared_ptr<SynchronousSink> From(Args_t&&... args) {
-    static_assert(std::is_base_of_v<SinkBackend, SinkBackend_t>, "sink type must be a child of SinkBackend");
-    return std::make_shared<SynchronousSink>(std::make_unique<SinkBackend_t>(std::forward<Args_t>(args)...));
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    return std::make_unique<FastFileSink>(filename_, capacity_, max_age_, sync_policy_);
   }
 
-  bool IsLocked() const {
-    if (lock_.try_lock()) {
-      lock_.unlock();
-      return false;
-    }
-    return true;
+  //! \brief Set the max age of buffered messages. Zero means messages are only written when the buffer is
+  //!        full or the sink is flushed.
+  FastFileSink& SetMaxAge(std::chrono::milliseconds max_age) {
+    max_age_ = max_age;
+    return *this;
   }
 
+  //! \brief Set when the sink should call fdatasync.
+  FastFileSink& SetSyncPolicy(SyncPolicy sync_policy) {
+    sync_policy_ = sync_policy;
+    return *this;
+  }
+
+  //! \brief Get the size of the sink's buffer.
+  NO_DISCARD std::size_t GetBufferCapacity() const { return capacity_; }
+
+  //! \brief Get the number of bytes currently waiting in the buffer.
+  NO_DISCARD std::size_t GetBufferedSize() const { return size_; }
+
+  //! \brief Get the number of write(2)/writev(2) calls that the sink has made.
+  NO_DISCARD std::size_t GetWriteCount() const { return write_count_; }
+
+  //! \brief Get the number of writes that failed, losing their data.
+  NO_DISCARD std::size_t GetWriteErrorCount() const { return write_error_count_; }
+
 private:
-  void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>* formatted_msg) override {
-    memory::MemoryBuffer<char> buffer;
+  void dispatch(const memory::BasicMemoryBuffer<char>& buffer, [[maybe_unused]] const Record& record) override {
+    if (buffer.Empty()) {
+      return;
+    }
+    if (capacity_ - size_ < buffer.Size()) {
+      // Write the buffered messages and the new message together.
+      iovec iov[2] = {{buffer_.get(), size_}, {const_cast<char*>(buffer.Data()), buffer.Size()}};
+      writeAll(iov, 2);
+      size_ = 0;
+      return;
+    }
+    if (size_ == 0 && max_age_.count() != 0) {
+      oldest_ = std::chrono::steady_clock::now();
+    }
+    std::memcpy(buffer_.get() + size_, buffer.Data(), buffer.Size());
+    size_ += buffer.Size();
+    if (max_age_.count() != 0 && max_age_ <= std::chrono::steady_clock::now() - oldest_) {
+      writeBuffer();
+    }
+  }
 
-    // If the formatted message was already provided, pass that in.
-    const auto& settings = sink_backend_->GetFormattingSettings();
-    if (formatted_msg && settings.accepts_preformatted) {
-      sink_backend_->Dispatch(*formatted_msg, record);
+  void dispatchBatch(const std::vector<BatchEntry>& batch) override {
+    std::size_t batch_size = 0;
+    for (auto& entry : batch) {
+      batch_size += entry.formatted_msg->Size();
+    }
+    if (batch_size <= capacity_ - size_) {
+      for (auto& entry : batch) {
+        dispatch(*entry.formatted_msg, *entry.record);
+      }
       return;
     }
+    // Write the buffered messages and the whole batch together, with as few writev calls as possible.
+    constexpr std::size_t max_iov_count = 1024;  // IOV_MAX on Linux and macOS.
+    std::vector<iovec> iov;
+    iov.reserve(batch.size() + 1);
+    if (size_ != 0) {
+      iov.push_back({buffer_.get(), size_});
+    }
+    for (auto& entry : batch) {
+      if (!entry.formatted_msg->Empty()) {
+        iov.push_back({const_cast<char*>(entry.formatted_msg->Data()), entry.formatted_msg->Size()});
+      }
+    }
+    for (std::size_t start = 0; start < iov.size(); start += max_iov_count) {
+      writeAll(iov.data() + start, static_cast<int>(std::min(max_iov_count, iov.size() - start)));
+    }
+    size_ = 0;
+  }
 
-    // Technically, there could be some small asynchrony issue here with needs formatting being changed by
-    // another thread, but not only is it unlikely, it cannot cause any deadlocks.
-    if (settings.needs_formatting) {
-      formatter_->Format(record, sink_backend_->GetFormattingSettings(), buffer, formatted_msg);
+  void flushLockFree() override {
+    writeBuffer();
+    if (sync_policy_ == SyncPolicy::OnFlush) {
+      sync();
     }
-    {
-      std::unique_lock guard(lock_);
-      sink_backend_->Dispatch(buffer, record);
+  }
+
+  //! \brief Write out the buffer, if it holds anything.
+  void writeBuffer() {
+    if (size_ != 0) {
+      iovec iov {buffer_.get(), size_};
+      writeAll(&iov, 1);
+      size_ = 0;
     }
   }
 
-  NO_DISCARD ObjectWrapper<Sink> getLockedSink() override { return LockedSink(this, lock_); }
+  //! \brief Write all the data in the io vectors, retrying on partial writes and interrupts.
+  void writeAll(iovec* iov, int count) {
+    while (0 < count) {
+      ++write_count_;
+      const auto written = count == 1 ? ::write(fd_, iov->iov_base, iov->iov_len) : ::writev(fd_, iov, count);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ++write_error_count_;
+        return;
+      }
+      // Skip over everything that was written.
+      auto remaining = static_cast<std::size_t>(written);
+      while (0 < count && iov->iov_len <= remaining) {
+        remaining -= iov->iov_len;
+        ++iov;
+        --count;
+      }
+      if (0 < count) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+        iov->iov_len -= remaining;
+      }
+    }
+    if (sync_policy_ == SyncPolicy::EveryWrite) {
+      sync();
+    }
+  }
 
-  NO_DISCARD std::shared_ptr<Sink> clone() const override {
-    return std::make_shared<SynchronousSink>(sink_backend_->Clone());
+  void sync() const {
+#ifdef __APPLE__
+    ::fsync(fd_);
+#else
+    ::fdatasync(fd_);
+#endif
   }
 
-  //! \brief The mutex that controls access to the sink.
-  mutable std::shared_mutex lock_;
-};
+  std::string filename_;
 
-//! \brief  Create a new sink frontend / backend pair.
-template<typename Backend_t, typename Frontend_t = SynchronousSink, typename... Args_t>
-std::shared_ptr<Frontend_t> NewSink(Args_t&&... args) {
-  return std::make_shared<Frontend_t>(std::make_unique<Backend_t>(std::forward<Args_t>(args)...));
-}
+  //! \brief The file descriptor of the file.
+  int fd_ = -1;
 
-//! \brief Object that can receive records from multiple loggers, and dispatches them to multiple sinks.
-//!        The core has its own filter, which is checked before any of the individual sinks' filters.
+  //! \brief The buffer that messages are collected in.
+  std::unique_ptr<char[]> buffer_;
+  std::size_t capacity_;
+  std::size_t size_ = 0;
+
+  //! \brief When the oldest message in the buffer was added, only tracked if there is a max age.
+  std::chrono::steady_clock::time_point oldest_ {};
+  std::chrono::milliseconds max_age_;
+
+  SyncPolicy sync_policy_;
+
+  std::size_t write_count_ = 0;
+  std::size_t write_error_count_ = 0;
+};
+
+//! \brief A sink that writes to memory-mapped files, starting a new file when the current one is full or
+//!        when a wall-clock boundary is crossed.
 //!
-//! The core has a flag that allows it to operate in synchronous mode, which means that it will use reader /
-//! writer locks to control access to the sinks. This is only necessary if the core is going to be *modified*
-//! from multiple threads. It is always safe to read from the core from multiple threads, including logging to
-//! the same core from multiple threads, or running mapping functions on the sinks in the core. What you
-//! should not do without operating in synchronous mode is add or remove sinks from the core.
+//! Each file is created at its full size and mapped into memory, so dispatching a message is just a copy into
+//! the mapping, without any syscall. The next file is created and mapped ahead of time by a background thread,
+//! and finished files are unmapped and truncated to the size of their contents by the same thread, so a
+//! rollover only costs a rename on the logging thread.
 //!
-//! Synchonous mode is on by default, and can be turned on or off after initialization.
-class Core {
+//! Files are named "<base path>_YYYYMMDD-HHMMSS.log", using the time stamp of the first record in the file,
+//! with a ".N" added before the extension if that name is taken. While a file is being written, it has its
+//! full size, with zeros after the last message.
+//!
+//! Flushing the sink msyncs the written part of the current mapping, so flushing from a signal handler (e.g.
+//! LightningFlushAllHandler) commits everything written so far.
+class MmapRotatingFileSink : public SinkBackend {
 public:
-  friend class Global;
+  //! \brief Create a memory mapped rotating file sink.
+  //!
+  //! \param base_path The path and prefix of the log files.
+  //! \param file_size The size of each file, in bytes. A single message that is larger gets a larger file.
+  //! \param rotation_interval If non-zero, start a new file whenever a record's time stamp crosses a multiple
+  //!                          of this interval (counted from midnight, 1970-01-01), e.g. every hour.
+  explicit MmapRotatingFileSink(std::string base_path,
+                                std::size_t file_size = 64 * 1024 * 1024,
+                                std::chrono::seconds rotation_interval = std::chrono::seconds(0))
+      : base_path_(std::move(base_path))
+      , file_size_(file_size)
+      , rotation_interval_(rotation_interval) {
+    LL_REQUIRE(0 < file_size_, "the file size of a MmapRotatingFileSink must be positive");
+    LL_REQUIRE(0 <= rotation_interval_.count(), "the rotation interval must not be negative");
+    preparer_ = std::thread([this] { prepareLoop(); });
+  }
+
+  ~MmapRotatingFileSink() override {
+    {
+      std::lock_guard guard(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    preparer_.join();
+    if (current_.data) {
+      finish(current_, used_);
+    }
+    if (next_) {
+      discard(*next_);
+    }
+  }
 
-  virtual ~Core() = default;
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    return std::make_unique<MmapRotatingFileSink>(base_path_, file_size_, rotation_interval_);
+  }
 
-  //! \brief Construct the core with a particular mode (synchronous by default).
-  explicit Core(bool synchronous_mode = true)
-      : synchronous_mode_(synchronous_mode) {}
+  //! \brief Get the path of the file currently being written, empty if nothing has been written yet.
+  NO_DISCARD const std::string& GetCurrentFilePath() const { return current_.path; }
 
-  //! \brief Set the synchronicity mode of the Core.
-  void SetSynchronousMode(bool synchronous_mode) { synchronous_mode_ = synchronous_mode; }
+  //! \brief Get the number of files that the sink has started.
+  NO_DISCARD std::size_t GetFileCount() const { return file_count_; }
 
-  //! \brief Check whether at least one sink would accept the record.
-  bool WillAccept(const RecordAttributes& attributes) {
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    // If there are no sinks, there are no things that *can* accept.
-    if (sinks_.empty()) {
-      return false;
+  //! \brief Get the number of rollovers that had to create their file on the logging thread, because the
+  //!        background thread had not prepared one.
+  NO_DISCARD std::size_t GetUnpreparedRolloverCount() const { return unprepared_rollovers_; }
+
+private:
+  //! \brief A file and its mapping.
+  struct Mapping {
+    int fd = -1;
+    char* data = nullptr;
+    std::size_t capacity = 0;
+    std::string path;
+  };
+
+  void dispatch(const memory::BasicMemoryBuffer<char>& buffer, const Record& record) override {
+    if (buffer.Empty()) {
+      return;
     }
-    // Core level filtering.
-    if (!core_filter_.WillAccept(attributes)) {
-      return false;
+    const auto& time_stamp = record.Attributes().basic_attributes.time_stamp;
+    const bool crossed_boundary = rotation_interval_.count() != 0 && time_stamp
+                                  && next_boundary_ <= time_stamp->EpochMicroseconds() / 1'000'000;
+    if (!current_.data || current_.capacity - used_ < buffer.Size() || crossed_boundary) {
+      rollOver(time_stamp ? *time_stamp : time::DateTime::Now(), buffer.Size());
     }
-    // Check that at least one sink will accept.
-    return std::any_of(
-        sinks_.begin(), sinks_.end(), [attributes](auto& sink) { return sink->WillAccept(attributes); });
+    std::memcpy(current_.data + used_, buffer.Data(), buffer.Size());
+    used_ += buffer.Size();
   }
 
-  //! \brief Check whether at least one sink would potentially accept a message with a particular severity.
-  //!
-  //! Since most filtering is done only based on severity, it makes sense to have this as a quick check up
-  //! front.
-  bool WillAccept(std::optional<Severity> severity) {
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    if (!core_filter_.WillAccept(severity)) {
-      return false;
+  void flushLockFree() override {
+    if (current_.data && used_ != 0) {
+      ::msync(current_.data, used_, MS_SYNC);
     }
-    // Check that at least one sink will accept.
-    return std::any_of(
-        sinks_.begin(), sinks_.end(), [severity](auto& sink) { return sink->WillAccept(severity); });
   }
 
-  //! \brief Dispatch a ref bundle to the sinks.
-  void Dispatch(const Record& record) const {
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    dispatch(record);
-  }
+  //! \brief Start writing to a new file.
+  void rollOver(const time::DateTime& time_stamp, std::size_t min_size) {
+    Mapping next;
+    {
+      std::lock_guard guard(mutex_);
+      if (next_ && min_size <= next_->capacity) {
+        next = std::move(*next_);
+        next_.reset();
+      }
+    }
+    if (!next.data) {
+      ++unprepared_rollovers_;
+      next = createMapping(pendingPath(), std::max(file_size_, min_size));
+    }
+    auto path = fileNameFor(time_stamp);
+    LL_REQUIRE(::rename(next.path.c_str(), path.c_str()) == 0,
+               "could not rename '" << next.path << "' to '" << path << "': " << std::strerror(errno));
+    next.path = std::move(path);
 
-  //! \brief Add a sink to the core.
-  Core& AddSink(std::shared_ptr<Sink> sink) {
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    sinks_.emplace_back(std::move(sink));
-    return *this;
+    {
+      std::lock_guard guard(mutex_);
+      if (current_.data) {
+        retired_.emplace_back(std::move(current_), used_);
+      }
+      prepare_failed_ = false;
+    }
+    cv_.notify_one();
+
+    current_ = std::move(next);
+    used_ = 0;
+    ++file_count_;
+    if (rotation_interval_.count() != 0) {
+      const auto interval = static_cast<std::int64_t>(rotation_interval_.count());
+      next_boundary_ = (time_stamp.EpochMicroseconds() / 1'000'000 / interval + 1) * interval;
+    }
   }
 
-  //! \brief Get the number of sinks the core points at.
-  NO_DISCARD std::size_t GetNumSinks() const { return sinks_.size(); }
+  //! \brief Background thread that finishes retired files and prepares the next file.
+  void prepareLoop() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+      cv_.wait_for(lock, std::chrono::milliseconds(100), [this] {
+        return stop_ || !retired_.empty() || (!next_ && !prepare_failed_);
+      });
+      auto retired = std::move(retired_);
+      retired_.clear();
+      const bool prepare = !stop_ && !next_ && !prepare_failed_;
+      lock.unlock();
+
+      for (auto& [mapping, used] : retired) {
+        finish(mapping, used);
+      }
+      std::optional<Mapping> prepared;
+      if (prepare) {
+        try {
+          prepared = createMapping(pendingPath(), file_size_);
+        } catch (const std::exception&) {
+          // The logging thread will try again, and report the error, when it needs the file.
+        }
+      }
 
-  //! \brief Set the formatter for every sink the core points at.
-  Core& SetAllFormatters(const formatting::BaseMessageFormatter& formatter) {
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    for (const auto& sink : sinks_) {
-      sink->GetLockedSink()->SetFormatter(formatter.Copy());
+      lock.lock();
+      if (prepare) {
+        prepare_failed_ = !prepared;
+        if (prepared) {
+          next_ = std::move(prepared);
+        }
+      }
+      if (stop_ && retired_.empty()) {
+        return;
+      }
     }
-    return *this;
-  }
-
-  //! \brief Set the formatter for every sink the core points at.
-  Core& SetAllFormatters(const std::unique_ptr<formatting::BaseMessageFormatter>& formatter) {
-    return SetAllFormatters(*formatter);
   }
 
-  //! \brief Map a function across sinks, locking the sink before passing it to the function.
-  template<typename SinkBackend_t, typename Func_t>
-  void MapOnSinks(Func_t&& func) const {
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    for (auto& sink : sinks_) {
-      // Lock the sink (if it supports this).
-      auto locked_sink = sink->GetLockedSink();
-      if (auto backend_ptr = locked_sink->GetBackendAs<SinkBackend_t>()) {
-        func(*sink, *backend_ptr);
-      }
+  //! \brief Get a name for a file that is being prepared. The name is unique across processes and across
+  //!        sinks, since clones of a sink share its base path.
+  NO_DISCARD std::string pendingPath() const {
+    static std::atomic<std::size_t> pending_count {0};
+    return base_path_ + ".pending-" + std::to_string(::getpid()) + "-"
+           + std::to_string(pending_count.fetch_add(1, std::memory_order_relaxed));
+  }
+
+  //! \brief Get the name of a file that starts with a record with the given time stamp.
+  NO_DISCARD std::string fileNameFor(const time::DateTime& time_stamp) const {
+    char stamp[32];
+    std::snprintf(stamp,
+                  sizeof(stamp),
+                  "_%04d%02d%02d-%02d%02d%02d",
+                  time_stamp.GetYear(),
+                  time_stamp.GetMonthInt(),
+                  time_stamp.GetDay(),
+                  time_stamp.GetHour(),
+                  time_stamp.GetMinute(),
+                  time_stamp.GetSecond());
+    auto path = base_path_ + stamp + ".log";
+    for (int i = 1; ::access(path.c_str(), F_OK) == 0; ++i) {
+      path = base_path_ + stamp + "." + std::to_string(i) + ".log";
+    }
+    return path;
+  }
+
+  //! \brief Create a file of the given size and map it into memory.
+  static Mapping createMapping(const std::string& path, std::size_t size) {
+    Mapping mapping;
+    mapping.path = path;
+    mapping.capacity = size;
+    mapping.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    LL_REQUIRE(0 <= mapping.fd, "could not open file '" << path << "': " << std::strerror(errno));
+    if (::ftruncate(mapping.fd, static_cast<off_t>(size)) != 0) {
+      const auto error = errno;
+      ::close(mapping.fd);
+      ::unlink(path.c_str());
+      LL_FAIL("could not resize file '" << path << "': " << std::strerror(error));
     }
+#ifdef MAP_POPULATE
+    // Fault the pages in now, on the preparing thread, instead of on the first write to each page.
+    constexpr int flags = MAP_SHARED | MAP_POPULATE;
+#else
+    constexpr int flags = MAP_SHARED;
+#endif
+    auto data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, mapping.fd, 0);
+    if (data == MAP_FAILED) {
+      const auto error = errno;
+      ::close(mapping.fd);
+      ::unlink(path.c_str());
+      LL_FAIL("could not map file '" << path << "': " << std::strerror(error));
+    }
+    mapping.data = static_cast<char*>(data);
+    return mapping;
   }
 
-  //! \brief Get the core level filter.
-  //!
-  //! \note Does not lock the core, to use safely in a multithreaded context, use locked cores.
-  filter::AttributeFilter& GetFilter() { return core_filter_; }
+  //! \brief Unmap a file and truncate it to the size of its contents.
+  static void finish(Mapping& mapping, std::size_t used) {
+    ::munmap(mapping.data, mapping.capacity);
+    [[maybe_unused]] auto result = ::ftruncate(mapping.fd, static_cast<off_t>(used));
+    ::close(mapping.fd);
+    mapping = {};
+  }
 
-  //! \brief Reset the core's filters.
-  Core& ClearFilters() {
-    locks::PotentiallyUniqueLock guard(lock_, synchronous_mode_);
-    core_filter_.Clear();
-    return *this;
+  //! \brief Unmap and delete a file that was never used.
+  static void discard(Mapping& mapping) {
+    ::munmap(mapping.data, mapping.capacity);
+    ::close(mapping.fd);
+    ::unlink(mapping.path.c_str());
+    mapping = {};
   }
 
-  //! \brief Get the vector of all sinks.
-  //!
-  //! \note This does not lock the core, so the vector may be modified by other threads.
-  NO_DISCARD const std::vector<std::shared_ptr<Sink>>& GetSinks() const { return sinks_; }
+  std::string base_path_;
+  std::size_t file_size_;
+  std::chrono::seconds rotation_interval_;
 
-  //! \brief Apply a function to all sinks.
-  //!
-  //! Each sink is locked before the function is applied.
-  template<typename Func_t>
-  Core& ApplyToAllSink(Func_t&& func) {
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    std::for_each(sinks_.begin(), sinks_.end(), [f = std::forward<Func_t>(func)](auto& sink) {
-      auto locked_sink = sink->GetLockedSink();
-      f(*sink);
-    });
-    return *this;
-  }
+  //! \brief The file currently being written, and how much of it has been written.
+  Mapping current_;
+  std::size_t used_ = 0;
 
-  //! \brief Remove all sinks from the core.
-  Core& ClearSinks() {
-    locks::PotentiallyUniqueLock guard(lock_, synchronous_mode_);
-    sinks_.clear();
-    return *this;
+  //! \brief The time, in seconds since the epoch, at which the next file should be started.
+  std::int64_t next_boundary_ = 0;
+
+  std::size_t file_count_ = 0;
+  std::size_t unprepared_rollovers_ = 0;
+
+  //! \brief Protects the state shared with the background thread.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  //! \brief The prepared next file, if any.
+  std::optional<Mapping> next_;
+
+  //! \brief Files that are done being written to, and the size of their contents.
+  std::vector<std::pair<Mapping, std::size_t>> retired_;
+
+  //! \brief Set if preparing the next file failed, so the background thread does not retry in a loop.
+  bool prepare_failed_ = false;
+
+  bool stop_ = false;
+
+  std::thread preparer_;
+};
+
+#endif  // LL_HAS_POSIX
+
+// ==============================================================================
+//  Compressed file sink.
+// ==============================================================================
+
+//! \brief The codecs that a CompressedFileSink can compress with. A codec can only be used if the library
+//!        that implements it was found when building, see compression::IsAvailable.
+enum class Compression {
+  //! \brief gzip, through zlib (LL_HAS_ZLIB). Files can be read with zcat.
+  Gzip,
+  //! \brief The LZ4 frame format (LL_HAS_LZ4), the fastest to compress. Files can be read with lz4cat.
+  Lz4,
+  //! \brief Zstandard (LL_HAS_ZSTD), which compresses the best. Files can be read with zstdcat.
+  Zstd,
+};
+
+namespace compression {
+
+//! \brief Check whether a codec was compiled in.
+constexpr bool IsAvailable(Compression compression) {
+  switch (compression) {
+    case Compression::Gzip:
+      return LL_HAS_ZLIB;
+    case Compression::Lz4:
+      return LL_HAS_LZ4;
+    case Compression::Zstd:
+      return LL_HAS_ZSTD;
   }
+  return false;
+}
 
-  //! \brief Flush all sinks.
-  //!
-  //! Note: This function MAY discard.
-  const Core& Flush() const {
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    std::for_each(sinks_.begin(), sinks_.end(), [](auto& sink) { sink->GetLockedSink()->Flush(); });
-    return *this;
+//! \brief The codec that a CompressedFileSink uses by default, the fastest one that is available.
+constexpr Compression DefaultCompression() {
+  if (IsAvailable(Compression::Lz4)) {
+    return Compression::Lz4;
   }
+  return IsAvailable(Compression::Zstd) ? Compression::Zstd : Compression::Gzip;
+}
 
-  //! \brief Make a deep copy of the core, including deep copies of all sinks.
-  NO_DISCARD std::shared_ptr<Core> Clone() const {
-    auto core = std::make_shared<Core>();
-    locks::PotentiallySharedLock guard(lock_, synchronous_mode_);
-    core->core_filter_ = core_filter_;
-    for (const auto& sink : sinks_) {
-      core->sinks_.emplace_back(sink->GetLockedSink()->Clone());
+//! \brief Get the usual file extension for a codec, e.g. ".gz".
+inline std::string_view FileExtension(Compression compression) {
+  switch (compression) {
+    case Compression::Gzip:
+      return ".gz";
+    case Compression::Lz4:
+      return ".lz4";
+    case Compression::Zstd:
+      return ".zst";
+  }
+  return {};
+}
+
+//! \brief Compresses blocks of data, each into a self-contained frame: a gzip member, an LZ4 frame, or a zstd
+//!        frame. Frames can be concatenated, and the usual tools decompress a concatenation of frames as one
+//!        stream, so a file of frames can be read up to its last complete frame.
+//!
+//! The codec's state is kept between blocks, so it is only set up once.
+class BlockCompressor {
+public:
+  //! \brief Create a compressor. A negative level means the codec's default level.
+  explicit BlockCompressor(Compression compression, int level = -1)
+      : compression_(compression)
+      , level_(level) {
+    LL_REQUIRE(IsAvailable(compression),
+               "the codec was not compiled in, see LL_HAS_ZLIB, LL_HAS_LZ4 and LL_HAS_ZSTD");
+#if LL_HAS_ZLIB
+    if (compression_ == Compression::Gzip) {
+      // A window of 2^15 bytes, plus 16 to write a gzip header and trailer.
+      const auto zlib_level = level < 0 ? Z_DEFAULT_COMPRESSION : level;
+      const auto result = deflateInit2(&zlib_stream_, zlib_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+      LL_REQUIRE(result == Z_OK, "could not set up zlib");
     }
-    return core;
+#endif
+#if LL_HAS_ZSTD
+    if (compression_ == Compression::Zstd) {
+      zstd_context_ = ZSTD_createCCtx();
+      LL_REQUIRE(zstd_context_, "could not set up zstd");
+    }
+#endif
   }
 
-  //! \brief Get a locked handle to the core.
-  NO_DISCARD LockedObject<Core> Lock() { return LockedObject(this, lock_); }
+  BlockCompressor(const BlockCompressor&) = delete;
+  BlockCompressor& operator=(const BlockCompressor&) = delete;
 
-  //! \brief Check whether the core is locked.
-  bool IsLocked() const {
-    if (lock_.try_lock()) {
-      lock_.unlock();
-      return false;
+  ~BlockCompressor() {
+#if LL_HAS_ZLIB
+    if (compression_ == Compression::Gzip) {
+      deflateEnd(&zlib_stream_);
     }
-    return true;
+#endif
+#if LL_HAS_ZSTD
+    ZSTD_freeCCtx(zstd_context_);
+#endif
   }
 
-protected:
-  //! \brief Dispatch method, protected implementation.
-  //!
-  //! By default, dispatch is done by dispatching to every sink.
-  virtual void dispatch(const Record& record) const {
-    for (auto& sink : sinks_) {
-      if (sink->WillAccept(record.Attributes())) {
-        sink->Dispatch(record);
+  //! \brief Compress a block into a frame, appending the frame to `out`.
+  void Compress([[maybe_unused]] std::string_view block, std::string& out) {
+    [[maybe_unused]] const auto offset = out.size();
+    switch (compression_) {
+      case Compression::Gzip: {
+#if LL_HAS_ZLIB
+        LL_REQUIRE(deflateReset(&zlib_stream_) == Z_OK, "could not reset zlib");
+        out.resize(offset + deflateBound(&zlib_stream_, static_cast<uLong>(block.size())));
+        zlib_stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(block.data()));
+        zlib_stream_.avail_in = static_cast<uInt>(block.size());
+        zlib_stream_.next_out = reinterpret_cast<Bytef*>(out.data() + offset);
+        zlib_stream_.avail_out = static_cast<uInt>(out.size() - offset);
+        LL_REQUIRE(deflate(&zlib_stream_, Z_FINISH) == Z_STREAM_END, "gzip compression failed");
+        out.resize(offset + zlib_stream_.total_out);
+#endif
+        break;
+      }
+      case Compression::Lz4: {
+#if LL_HAS_LZ4
+        LZ4F_preferences_t preferences {};
+        preferences.compressionLevel = std::max(level_, 0);
+        preferences.frameInfo.contentSize = block.size();
+        const auto bound = LZ4F_compressFrameBound(block.size(), &preferences);
+        out.resize(offset + bound);
+        const auto size =
+            LZ4F_compressFrame(out.data() + offset, bound, block.data(), block.size(), &preferences);
+        LL_REQUIRE(!LZ4F_isError(size), "LZ4 compression failed: " << LZ4F_getErrorName(size));
+        out.resize(offset + size);
+#endif
+        break;
+      }
+      case Compression::Zstd: {
+#if LL_HAS_ZSTD
+        const auto bound = ZSTD_compressBound(block.size());
+        out.resize(offset + bound);
+        const auto size = ZSTD_compressCCtx(zstd_context_,
+                                            out.data() + offset,
+                                            bound,
+                                            block.data(),
+                                            block.size(),
+                                            level_ < 0 ? ZSTD_CLEVEL_DEFAULT : level_);
+        LL_REQUIRE(!ZSTD_isError(size), "zstd compression failed: " << ZSTD_getErrorName(size));
+        out.resize(offset + size);
+#endif
+        break;
       }
     }
   }
 
 private:
-  //! \brief A function that flushes all sinks without locking. This is for use by the signal handler, since
-  //!        it is UB for the signal handler to call functions that use locks.
-  void flushLockFree() {
-    for (auto& sink : sinks_) {
-      sink->flushLockFree();
+  Compression compression_;
+  int level_;
+
+#if LL_HAS_ZLIB
+  z_stream zlib_stream_ {};
+#endif
+#if LL_HAS_ZSTD
+  ZSTD_CCtx* zstd_context_ {};
+#endif
+};
+
+}  // namespace compression
+
+//! \brief A sink that compresses what it is given and appends it to a file, compressing and writing on a
+//!        worker thread, so the logging threads pay for neither.
+//!
+//! Formatted messages are collected into blocks. A block is handed to the worker once it reaches the block
+//! size, or when the sink is flushed, e.g. because its flush handler asks for it. The worker compresses each
+//! block into a self-contained frame (see compression::BlockCompressor) and writes it to the file, so after a
+//! crash, the file can still be read up to the last block that was written. Flushing waits until everything
+//! dispatched before the flush is in the file.
+//!
+//! At most `max_pending_blocks` blocks wait for the worker. Beyond that, dispatching waits for the worker to
+//! catch up, so the sink's memory stays bounded if the disk can't keep up.
+//!
+//! Compressing allocates and the worker has to be woken, so flushLockFree, which the signal handlers use,
+//! does nothing. The block that is being filled when the process crashes is lost.
+class CompressedFileSink : public SinkBackend {
+public:
+  //! \brief Open a file to write compressed logs to, replacing the file if it exists.
+  //!
+  //! \param file_path The file to write to.
+  //! \param compression The codec to compress with. It must be available, see compression::IsAvailable.
+  //! \param block_size How many bytes of formatted messages to collect before compressing them.
+  //! \param level The compression level, or a negative number for the codec's default.
+  //! \param max_pending_blocks How many full blocks may wait for the worker.
+  explicit CompressedFileSink(const std::string& file_path,
+                              Compression compression = compression::DefaultCompression(),
+                              std::size_t block_size = 1024 * 1024,
+                              int level = -1,
+                              std::size_t max_pending_blocks = 8)
+      : filename_(file_path)
+      , compression_(compression)
+      , block_size_(block_size)
+      , level_(level)
+      , max_pending_blocks_(max_pending_blocks)
+      , compressor_(compression, level)
+      , fout_(file_path, std::ios::binary | std::ios::trunc) {
+    LL_REQUIRE(0 < block_size, "the block size of a CompressedFileSink must be positive");
+    LL_REQUIRE(0 < max_pending_blocks, "a CompressedFileSink must allow at least one pending block");
+    LL_REQUIRE(fout_, "could not open file '" << file_path << "'");
+    block_.reserve(block_size_);
+    worker_ = std::thread([this] { work(); });
+  }
+
+  //! \brief Writes out everything that was dispatched, and stops the worker.
+  ~CompressedFileSink() override {
+    sealBlock();
+    {
+      std::lock_guard guard(mutex_);
+      stop_ = true;
     }
+    work_available_.notify_one();
+    worker_.join();
   }
 
-  //! \brief All sinks the core will dispatch messages to.
-  std::vector<std::shared_ptr<Sink>> sinks_;
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    return std::make_unique<CompressedFileSink>(
+        filename_, compression_, block_size_, level_, max_pending_blocks_);
+  }
 
-  //! \brief Core-level attribute filters.
-  filter::AttributeFilter core_filter_;
+  //! \brief Get the codec that the sink compresses with.
+  NO_DISCARD Compression GetCompression() const { return compression_; }
 
-  //! \brief Mutex to control access to the core.
-  mutable std::shared_mutex lock_;
+  //! \brief Get the number of bytes of formatted messages that the worker compressed.
+  NO_DISCARD std::size_t GetBytesIn() const { return bytes_in_.load(std::memory_order_relaxed); }
 
-  //! \brief Whether the core should use locks or not.
-  //!
-  //! For safety, if the core is going to be modified by multiple threads, this should be true.
-  //! If the core itself is not going to be modified from multiple threads, this can be false. Note that it
-  //! is fine for multiple threads to use the core, e.g., to log via the same core from multiple threads, as
-  //! long as you don't do something like add or remove sinks while also logging, or add sinks from multiple
-  //! threads simultaneously.
-  bool synchronous_mode_;
-};
+  //! \brief Get the number of compressed bytes that the worker wrote to the file.
+  NO_DISCARD std::size_t GetBytesOut() const { return bytes_out_.load(std::memory_order_relaxed); }
 
-class FormattingCore : public Core {
-public:
-  explicit FormattingCore(std::unique_ptr<formatting::BaseMessageFormatter>&& formatter,
-                          bool synchronous_mode = false)
-      : Core(synchronous_mode)
-      , formatter_(std::move(formatter)) {}
+private:
+  void dispatch(const memory::BasicMemoryBuffer<char>& buffer, const Record&) override {
+    block_.append(buffer.Data(), buffer.Size());
+    if (block_size_ <= block_.size()) {
+      sealBlock();
+    }
+  }
 
-  void SetFormatter(std::unique_ptr<formatting::BaseMessageFormatter>&& formatter) {
-    formatter_ = std::move(formatter);
+  void dispatchBatch(const std::vector<BatchEntry>& batch) override {
+    for (auto& entry : batch) {
+      block_.append(entry.formatted_msg->Data(), entry.formatted_msg->Size());
+    }
+    if (block_size_ <= block_.size()) {
+      sealBlock();
+    }
   }
 
-protected:
-  //! \brief Dispatch method, protected implementation.
-  //!
-  //! By default, dispatch is done by dispatching to every sink.
-  void dispatch(const Record& record) const override {
-    // Format the message.
-    memory::MemoryBuffer<char> buffer;
-    formatter_->Format(record, formatting_settings_, buffer);
-    // Pass the formatted record into the sinks as well.
-    for (auto& sink : GetSinks()) {
-      if (sink->WillAccept(record.Attributes())) {
-        sink->Dispatch(record, buffer);
+  void flush() override {
+    sealBlock();
+    std::unique_lock guard(mutex_);
+    block_written_.wait(guard, [this] { return sealed_ <= written_; });
+  }
+
+  //! \brief Hand the block that is being filled to the worker, first waiting if too many blocks are waiting.
+  void sealBlock() {
+    if (block_.empty()) {
+      return;
+    }
+    {
+      std::unique_lock guard(mutex_);
+      block_written_.wait(guard, [this] { return pending_.size() < max_pending_blocks_; });
+      pending_.push_back(std::move(block_));
+      ++sealed_;
+    }
+    work_available_.notify_one();
+    block_ = {};
+    block_.reserve(block_size_);
+  }
+
+  //! \brief The worker thread's main loop.
+  void work() {
+    std::string block, compressed;
+    for (;;) {
+      {
+        std::unique_lock guard(mutex_);
+        work_available_.wait(guard, [this] { return !pending_.empty() || stop_; });
+        if (pending_.empty()) {
+          return;
+        }
+        block = std::move(pending_.front());
+        pending_.pop_front();
       }
+      try {
+        compressed.clear();
+        compressor_.Compress(block, compressed);
+        fout_.write(compressed.data(), static_cast<std::streamsize>(compressed.size()));
+        fout_.flush();
+        bytes_in_.fetch_add(block.size(), std::memory_order_relaxed);
+        bytes_out_.fetch_add(compressed.size(), std::memory_order_relaxed);
+      }
+      catch (...) {
+        // There is no one to report the error to on the worker thread, so the block is dropped.
+      }
+      {
+        std::lock_guard guard(mutex_);
+        ++written_;
+      }
+      block_written_.notify_all();
     }
   }
 
-  FormattingSettings formatting_settings_;
+  const std::string filename_;
+  const Compression compression_;
+  const std::size_t block_size_;
+  const int level_;
+  const std::size_t max_pending_blocks_;
 
-  //! \brief The sink's formatter.
-  std::unique_ptr<formatting::BaseMessageFormatter> formatter_;
+  //! \brief The block that is being filled. Only used by whoever dispatches to the sink.
+  std::string block_;
+
+  //! \brief Only used by the worker thread, as is the file.
+  compression::BlockCompressor compressor_;
+  std::ofstream fout_;
+
+  //! \brief Guards the blocks that wait for the worker, and the counts of blocks.
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable block_written_;
+  std::deque<std::string> pending_;
+
+  //! \brief The number of blocks that were handed to the worker, and that the worker is done with.
+  std::uint64_t sealed_ {};
+  std::uint64_t written_ {};
+  bool stop_ {false};
+
+  std::atomic<std::size_t> bytes_in_ {0};
+  std::atomic<std::size_t> bytes_out_ {0};
+
+  //! \brief The worker thread. Started last, once everything it uses is constructed.
+  std::thread worker_;
 };
 
+#if LL_HAS_POSIX
+
 // ==============================================================================
-//  Definitions of Record functions that have to go after Core is defined.
+//  Shared memory sink.
 // ==============================================================================
 
-bool Record::TryOpen(std::shared_ptr<Core> core) {
-  if (core->WillAccept(attributes_)) {
-    core_ = std::move(core);
-    return true;
-  }
-  return false;
-}
+namespace ipc {
 
-Record::operator bool() const {
-  return core_ != nullptr;
-}
+//! \brief Marks a shared memory segment whose layout is set up, see Segment.
+constexpr std::uint64_t segment_magic = 0x4C4C53484D454D31;  // "LLSHMEM1"
 
-void Record::Dispatch() {
-  if (core_) {
-    core_->Dispatch(*this);
-    core_ = nullptr;  // One time use.
-  }
-}
+//! \brief The layout version of the shared memory segment.
+constexpr std::uint32_t segment_version = 1;
 
-// ==============================================================================
-//  Logger base class.
-// ==============================================================================
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free
+                  && std::atomic<std::int64_t>::is_always_lock_free,
+              "atomics in shared memory must be lock-free, so that they work across processes");
 
-//! \brief Structure that serves as a tag that a Logger should not be created with a core.
-struct NoCore_t {};
+//! \brief The header at the start of a shared memory segment.
+struct SegmentHeader {
+  //! \brief Set to segment_magic once the segment is set up, by whoever created it.
+  std::atomic<std::uint64_t> magic;
+  std::uint32_t version;
+  std::uint32_t ring_count;
+  std::uint64_t ring_capacity;
+};
 
-//! \brief Prototypical NoCore_t object.
-inline constexpr NoCore_t NoCore;
+//! \brief The header of one producer's ring, which is followed by `ring_capacity` bytes of entries.
+//!
+//! The ring is single producer, single consumer. The producer (the process that owns the ring) only writes
+//! the write position, the consumer (the collector) only writes the read position. Both positions count bytes
+//! from when the segment was created, and only ever grow.
+struct alignas(64) RingHeader {
+  //! \brief The process that owns the ring, or zero if no process does.
+  std::atomic<std::int64_t> owner_pid;
 
-//! \brief Base logger class. Capable of creating logging records which route messages
-//!        to the logger's logging core.
-class Logger {
-public:
-  //! \brief Create a logger with a new core.
-  Logger()
-      : core_(std::make_shared<Core>()) {}
+  //! \brief Incremented every time a process takes over the ring.
+  std::atomic<std::uint64_t> generation;
 
-  //! \brief Create a logger without a logging core.
-  //!
-  //! Note that the constructor is *not* explicit on purpose, so parameters can be defaulted like
-  //! `const Logger &logger = {NoCore};`.
-  Logger(NoCore_t)  // NOLINT(*-explicit-constructor)
-      : core_(nullptr) {}
+  //! \brief The number of records that the owners of the ring had to drop because the ring was full.
+  std::atomic<std::uint64_t> dropped;
 
-  //! \brief Create a logger with a new core and a single sink.
-  explicit Logger(const std::shared_ptr<Sink>& sink)
-      : core_(std::make_shared<Core>()) {
-    core_->AddSink(sink);
-  }
+  alignas(64) std::atomic<std::uint64_t> write_position;
+  alignas(64) std::atomic<std::uint64_t> read_position;
+};
 
-  //! \brief Create a logger with the specified logging core.
-  explicit Logger(std::shared_ptr<Core> core)
-      : core_(std::move(core)) {}
+//! \brief The header of an entry in a ring. Entries are aligned to 8 bytes, and never wrap around the end of
+//!        the ring. If an entry does not fit before the end, the space there is filled with padding.
+struct EntryHeader {
+  //! \brief The size of the text that follows the header.
+  std::uint32_t size;
 
-  virtual ~Logger() {
-    Flush();  // Make sure all sinks that the logger is connected to is flushed.
-  }
+  //! \brief Whether this is padding up to the end of the ring, rather than a record.
+  std::uint32_t is_padding;
 
-  template<typename... Attrs_t>
-  RecordDispatcher Log(BasicAttributes basic_attributes = {}, Attrs_t&&... attrs) const {
-    if (!core_) {
-      return {};
+  //! \brief The record's time stamp, in microseconds since the epoch, or binary::no_time_stamp.
+  std::int64_t time_stamp;
+};
+
+//! \brief The space that an entry with `size` bytes of text takes up in a ring.
+constexpr std::uint64_t EntrySpace(std::uint64_t size) {
+  return (sizeof(EntryHeader) + size + 7) & ~std::uint64_t {7};
+}
+
+//! \brief A POSIX shared memory segment holding a number of rings, which is created by whichever process
+//!        opens it first, and mapped by every producer and the collector.
+class Segment {
+public:
+  //! \brief Open a segment, creating it if it does not exist.
+  //!
+  //! \param name The name of the segment, e.g. "/my-service-logs", see shm_open.
+  //! \param ring_count How many rings, i.e. producer processes, the segment has room for.
+  //! \param ring_capacity The size of each ring, in bytes. Must be a multiple of 8.
+  Segment(const std::string& name, std::uint32_t ring_count, std::uint64_t ring_capacity)
+      : size_(ringOffset(ring_count, ring_capacity)) {
+    LL_REQUIRE(0 < ring_count, "a shared memory segment needs at least one ring");
+    LL_REQUIRE(0 < ring_capacity && ring_capacity % 8 == 0,
+               "the ring capacity must be a positive multiple of 8");
+    bool created = true;
+    auto fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+      created = false;
+      fd = ::shm_open(name.c_str(), O_RDWR, 0600);
     }
-    if (do_time_stamp_) {
-      basic_attributes.time_stamp = generator_.CurrentTime();
+    LL_REQUIRE(0 <= fd, "could not open shared memory segment '" << name << "': " << std::strerror(errno));
+    if (created && ::ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+      const auto error = errno;
+      ::close(fd);
+      ::shm_unlink(name.c_str());
+      LL_FAIL("could not size shared memory segment '" << name << "': " << std::strerror(error));
     }
-    if (!logger_name_.empty()) {
-      basic_attributes.logger_name = logger_name_;
+    if (!created) {
+      waitForSize(fd, name);
+    }
+    auto data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    LL_REQUIRE(data != MAP_FAILED,
+               "could not map shared memory segment '" << name << "': " << std::strerror(errno));
+    data_ = static_cast<char*>(data);
+
+    auto& header = Header();
+    if (created) {
+      // The new pages are zero, so the rings start out empty and unowned.
+      header.version = segment_version;
+      header.ring_count = ring_count;
+      header.ring_capacity = ring_capacity;
+      header.magic.store(segment_magic, std::memory_order_release);
+    }
+    else {
+      for (int i = 0; header.magic.load(std::memory_order_acquire) != segment_magic; ++i) {
+        LL_REQUIRE(i < 1000, "shared memory segment '" << name << "' was never set up");
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      LL_REQUIRE(header.version == segment_version && header.ring_count == ring_count
+                     && header.ring_capacity == ring_capacity,
+                 "shared memory segment '" << name << "' has a different layout, " << header.ring_count
+                                           << " rings of " << header.ring_capacity << " bytes");
     }
-    return RecordDispatcher(core_, basic_attributes, attrs...);
   }
 
-  template<typename... Attrs_t>
-  RecordDispatcher Log(std::optional<Severity> severity, Attrs_t&&... attrs) const {
-    return Log(BasicAttributes(severity), attrs...);
-  }
+  ~Segment() { ::munmap(data_, size_); }
 
-  //! \brief Create a record dispatcher, setting severity, file name, line number, and any other attributes.
-  template<typename... Attrs_t>
-  RecordDispatcher LogWithLocation(std::optional<Severity> severity,
-                                   const char* file_name,
-                                   const char* function_name,
-                                   unsigned line_number,
-                                   Attrs_t&&... attrs) const {
-    return Log(BasicAttributes(severity, file_name, function_name, line_number), attrs...);
-  }
+  Segment(const Segment&) = delete;
+  Segment& operator=(const Segment&) = delete;
 
-  //! \brief Check whether the logger will accept a record with the specified severity (or lack of severity).
-  NO_DISCARD bool WillAccept(std::optional<Severity> severity) const {
-    if (!core_) {
-      return false;
-    }
-    return core_->WillAccept(severity);
-  }
+  //! \brief Remove a segment's name, so the next process to open it creates a new segment. Processes that
+  //!        have it mapped keep using the old one.
+  static void Remove(const std::string& name) { ::shm_unlink(name.c_str()); }
 
-  //! \brief Get the logger's core.
-  NO_DISCARD const std::shared_ptr<Core>& GetCore() const { return core_; }
+  NO_DISCARD SegmentHeader& Header() const { return *reinterpret_cast<SegmentHeader*>(data_); }
 
-  //! \brief Check if the logger has a core.
-  NO_DISCARD bool HasCore() const { return static_cast<bool>(core_); }
+  NO_DISCARD std::uint32_t RingCount() const { return Header().ring_count; }
 
-  //! \brief Replace the logger's current core with a new core.
-  Logger& SetCore(std::shared_ptr<Core> core) {
-    core_ = std::move(core);
-    return *this;
-  }
+  NO_DISCARD std::uint64_t RingCapacity() const { return Header().ring_capacity; }
 
-  //! \brief Set whether the logger should generate a time stamp for the logs.
-  Logger& SetDoTimeStamp(bool do_timestamp) {
-    do_time_stamp_ = do_timestamp;
-    return *this;
+  NO_DISCARD RingHeader& Ring(std::uint32_t index) const {
+    return *reinterpret_cast<RingHeader*>(data_ + ringOffset(index, RingCapacity()));
   }
 
-  //! \brief Set the name of the logger. This attribute is attached to every record.
-  //!
-  //! Note - this operation is not thread safe.
-  Logger& SetName(const std::string& logger_name) {
-    logger_name_ = logger_name;
-    return *this;
+  //! \brief Get the entries of a ring.
+  NO_DISCARD char* RingData(std::uint32_t index) const {
+    return reinterpret_cast<char*>(&Ring(index)) + sizeof(RingHeader);
   }
 
-  //! \brief Notify the core to flush all of its sinks.
-  void Flush() const {
-    if (HasCore()) {
-      // Note - cast is to get around "result is unused" warning.
-      static_cast<void>(core_->Flush());
+private:
+  //! \brief Where the ring with the given index starts, which for index == ring_count is the segment size.
+  static std::size_t ringOffset(std::uint32_t index, std::uint64_t ring_capacity) {
+    constexpr auto first = (sizeof(SegmentHeader) + alignof(RingHeader) - 1) / alignof(RingHeader)
+                           * alignof(RingHeader);
+    const auto ring_size = (sizeof(RingHeader) + ring_capacity + alignof(RingHeader) - 1)
+                           / alignof(RingHeader) * alignof(RingHeader);
+    return first + index * ring_size;
+  }
+
+  //! \brief Wait until the process that created the segment has sized it.
+  void waitForSize(int fd, const std::string& name) const {
+    for (int i = 0;; ++i) {
+      struct stat status {};
+      if (::fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) == size_) {
+        return;
+      }
+      if (i == 1000 || (status.st_size != 0 && static_cast<std::size_t>(status.st_size) != size_)) {
+        ::close(fd);
+        LL_FAIL("shared memory segment '" << name << "' does not have the expected size of " << size_
+                                           << " bytes");
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
   }
 
-  //! \brief Get all sinks that have the specified type of backend.
-  template<typename SinkBackend_t>
-  std::vector<std::pair<Sink*, SinkBackend_t*>> GetSinks() const {
-    if (!HasCore()) {
-      return {};
-    }
-
-    std::vector<std::pair<Sink*, SinkBackend_t*>> output;
-    GetCore()->MapOnSinks<SinkBackend_t>(
-        [&output](Sink& sink, SinkBackend_t& backend) { output.emplace_back(&sink, &backend); });
-    return output;
-  }
+  std::size_t size_;
+  char* data_ {};
+};
 
-  //! \brief Map a function on every sink of the specified type that is in the logger's core.
-  template<typename SinkBackend_t, typename Func_t>
-  void MapOnSinks(Func_t&& func) const {
-    if (HasCore()) {
-      core_->MapOnSinks<SinkBackend_t>(func);
-    }
-  }
+//! \brief Check whether the process that owns a ring still exists.
+inline bool IsAlive(std::int64_t pid) {
+  return 0 < pid && (::kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH);
+}
 
-  //! \brief Set the formatters of all sinks in the logger's core.
-  //!
-  //! Warning: this may be ill-advised if many loggers share the same core.
-  void SetAllFormats(const std::unique_ptr<formatting::BaseMessageFormatter>& formatter) const {
-    SetAllFormats(*formatter);
-  }
+}  // namespace ipc
 
-  //! \brief Set the formatters of all sinks in the logger's core.
+//! \brief A sink that hands formatted records to a collector process through a ring in POSIX shared memory,
+//!        see SharedMemoryCollector.
+//!
+//! This lets several processes on a host log to one file without interleaving their writes, and without any
+//! of them doing I/O. Each process takes one of the segment's rings when its sink is created, a free one, or
+//! one whose owner died, so a process that restarts picks up where the previous process left off, and the
+//! collector still gets the records that the previous process wrote. The sink never waits: if the collector
+//! falls behind and the ring is full, the record is dropped and counted in the ring, where the collector can
+//! see it.
+//!
+//! Like other backends, the sink does not synchronize, so it should be used through a SynchronousSink if more
+//! than one thread logs to it. One sink per process.
+class SharedMemorySink : public SinkBackend {
+public:
+  //! \brief Open (or create) a shared memory segment and take one of its rings.
   //!
-  //! Warning: this may be ill-advised if many loggers share the same core.
-  void SetAllFormats(const formatting::BaseMessageFormatter& formatter) const {
-    if (auto core = GetCore()) {
-      core->SetAllFormatters(formatter);
-    }
-  }
+  //! The ring count and capacity must be the same in every process that opens the segment.
+  explicit SharedMemorySink(const std::string& name,
+                            std::uint32_t ring_count = 16,
+                            std::uint64_t ring_capacity = 4 * 1024 * 1024)
+      : name_(name)
+      , segment_(name, ring_count, ring_capacity)
+      , ring_index_(claimRing())
+      , ring_(segment_.Ring(ring_index_))
+      , data_(segment_.RingData(ring_index_))
+      , capacity_(segment_.RingCapacity()) {}
+
+  //! \brief Give the ring back, so another process can take it.
+  ~SharedMemorySink() override { ring_.owner_pid.store(0, std::memory_order_release); }
 
-  //! \brief Create a clone of the logger.
-  //!
-  //! This not only copies the logger, but clones the core and all sinks.
-  NO_DISCARD Logger Clone() const {
-    auto core = HasCore() ? core_->Clone() : nullptr;
-    return Logger(*this).SetCore(std::move(core));
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    LL_FAIL("a SharedMemorySink can not be cloned, since each process may only own one ring");
   }
 
-private:
-  //! \brief Whether to generate a time stamp for the logs.
-  bool do_time_stamp_ = true;
-
-  //! \brief A generator to create the DateTime timestamps for records.
-  time::FastDateGenerator generator_;
-
-  //! \brief A name for the logger.
-  std::string logger_name_ {};
-
-  //! \brief The logger's core.
-  std::shared_ptr<Core> core_;
-
-  //! \brief Attributes associated with a specific logger.
-  std::vector<Attribute> logger_attributes_;
-};
+  //! \brief Get the index of the ring that the sink writes to.
+  NO_DISCARD std::uint32_t GetRingIndex() const { return ring_index_; }
 
-//! \brief A sink, used for testing, that does nothing.
-class EmptySink : public SinkBackend {
-public:
-  EmptySink() { settings_.needs_formatting = false; }
-  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override { return std::make_unique<EmptySink>(); }
+  //! \brief Get the number of records that were dropped because the ring was full, by this process and by
+  //!        earlier owners of the ring.
+  NO_DISCARD std::uint64_t GetDroppedCount() const { return ring_.dropped.load(std::memory_order_relaxed); }
 
 private:
-  void dispatch(const memory::BasicMemoryBuffer<char>&, const Record&) override {}
-};
-
-//! \brief A sink, used for testing, that formats a record, but does not stream the result anywhere.
-//!
-//! Primarily for timing and testing.
-class TrivialDispatchSink : public SinkBackend {
-public:
-  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
-    return std::make_unique<TrivialDispatchSink>();
+  void dispatch(const memory::BasicMemoryBuffer<char>& buffer, const Record& record) override {
+    const auto& basic_attributes = record.Attributes().basic_attributes;
+    const auto space = ipc::EntrySpace(buffer.Size());
+    auto write = ring_.write_position.load(std::memory_order_relaxed);
+    const auto read = ring_.read_position.load(std::memory_order_acquire);
+    const auto offset = write % capacity_, until_end = capacity_ - offset;
+    const auto padding = until_end < space ? until_end : 0;
+    if (capacity_ < write + padding + space - read
+        || std::numeric_limits<std::uint32_t>::max() < buffer.Size()) {
+      ring_.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (padding != 0) {
+      // There is always room for the first half of a header, since entries are aligned to 8 bytes.
+      auto& header = *reinterpret_cast<ipc::EntryHeader*>(data_ + offset);
+      header.is_padding = 1;
+      write += padding;
+    }
+    auto entry = data_ + write % capacity_;
+    ipc::EntryHeader header {static_cast<std::uint32_t>(buffer.Size()),
+                             0,
+                             basic_attributes.time_stamp ? basic_attributes.time_stamp->EpochMicroseconds()
+                                                         : binary::no_time_stamp};
+    std::memcpy(entry, &header, sizeof(header));
+    std::memcpy(entry + sizeof(header), buffer.Data(), buffer.Size());
+    ring_.write_position.store(write + space, std::memory_order_release);
+  }
+
+  //! \brief Take a ring that no living process owns.
+  std::uint32_t claimRing() {
+    const std::int64_t pid = ::getpid();
+    for (std::uint32_t index = 0; index < segment_.RingCount(); ++index) {
+      auto& ring = segment_.Ring(index);
+      auto owner = ring.owner_pid.load(std::memory_order_acquire);
+      while (!ipc::IsAlive(owner)) {
+        if (ring.owner_pid.compare_exchange_weak(owner, pid, std::memory_order_acq_rel)) {
+          ring.generation.fetch_add(1, std::memory_order_release);
+          return index;
+        }
+      }
+    }
+    LL_FAIL("all " << segment_.RingCount() << " rings of shared memory segment '" << name_ << "' are in use");
   }
 
-private:
-  void dispatch([[maybe_unused]] const memory::BasicMemoryBuffer<char>& buffer,
-                [[maybe_unused]] const Record& record) override {}
+  std::string name_;
+  ipc::Segment segment_;
+  std::uint32_t ring_index_;
+  ipc::RingHeader& ring_;
+  char* data_;
+  std::uint64_t capacity_;
 };
 
-//! \brief A simple sink that writes to a file via an ofstream.
-class FileSink : public SinkBackend {
+//! \brief Drains the rings of a shared memory segment that SharedMemorySinks in other processes write to,
+//!        merging the records by time stamp.
+class SharedMemoryCollector {
 public:
-  explicit FileSink(const std::string& file_path)
-      : fout_(file_path)
-      , filename_(file_path) {}
+  //! \brief What the collector knows about one ring.
+  struct RingStats {
+    //! \brief The process that owns the ring, or zero if none does.
+    std::int64_t owner_pid {};
+
+    //! \brief How many times a process took over the ring, including the first.
+    std::uint64_t generation {};
+
+    //! \brief How many records were dropped because the ring was full.
+    std::uint64_t dropped {};
 
-  ~FileSink() override { fout_.flush(); }
+    //! \brief How many records the collector read from the ring.
+    std::uint64_t collected {};
+  };
 
-  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
-    return std::make_unique<FileSink>(filename_);
+  //! \brief Open (or create) a shared memory segment. Only one collector may drain a segment at a time.
+  explicit SharedMemoryCollector(const std::string& name,
+                                 std::uint32_t ring_count = 16,
+                                 std::uint64_t ring_capacity = 4 * 1024 * 1024)
+      : segment_(name, ring_count, ring_capacity)
+      , collected_(ring_count) {}
+
+  //! \brief Read every record that was written to the rings, and pass them to `func(time_stamp, text)`,
+  //!        oldest first. The time stamp is in microseconds since the epoch, or binary::no_time_stamp.
+  //!
+  //! Records from different rings are only merged with each other within one call. Records that are newer
+  //! than `hold_back` before the newest record read are kept for the next call, so that records from a
+  //! process that was slightly behind can still be put before them. If no new records were read, everything
+  //! is passed on.
+  //!
+  //! \return The number of records that were passed to the function.
+  template<typename Func_t>
+  std::size_t Poll(Func_t&& func, std::chrono::microseconds hold_back = std::chrono::microseconds(0)) {
+    std::int64_t newest = binary::no_time_stamp;
+    for (std::uint32_t index = 0; index < segment_.RingCount(); ++index) {
+      readRing(index, newest);
+    }
+    // Each ring is in order, so a stable sort keeps records with the same time stamp in the order of their
+    // ring.
+    std::stable_sort(pending_.begin(), pending_.end(), [](auto& lhs, auto& rhs) {
+      return lhs.time_stamp < rhs.time_stamp;
+    });
+    const auto cutoff = hold_back.count() == 0 || newest == binary::no_time_stamp
+                            ? std::numeric_limits<std::int64_t>::max()
+                            : newest - hold_back.count();
+    std::size_t count = 0;
+    for (; count < pending_.size() && pending_[count].time_stamp <= cutoff; ++count) {
+      func(pending_[count].time_stamp, std::string_view(pending_[count].text));
+    }
+    pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(count));
+    return count;
+  }
+
+  //! \brief Get what the collector knows about every ring.
+  NO_DISCARD std::vector<RingStats> GetRingStats() const {
+    std::vector<RingStats> stats;
+    for (std::uint32_t index = 0; index < segment_.RingCount(); ++index) {
+      auto& ring = segment_.Ring(index);
+      stats.push_back({ring.owner_pid.load(std::memory_order_relaxed),
+                       ring.generation.load(std::memory_order_relaxed),
+                       ring.dropped.load(std::memory_order_relaxed),
+                       collected_[index]});
+    }
+    return stats;
   }
 
 private:
-  void dispatch([[maybe_unused]] const memory::BasicMemoryBuffer<char>& buffer,
-                [[maybe_unused]] const Record& record) override {
-    if (!buffer.Empty()) {
-      fout_.write(buffer.Data(), static_cast<std::streamsize>(buffer.Size()));
+  struct Pending {
+    std::int64_t time_stamp;
+    std::string text;
+  };
+
+  void readRing(std::uint32_t index, std::int64_t& newest) {
+    auto& ring = segment_.Ring(index);
+    const auto data = segment_.RingData(index);
+    const auto capacity = segment_.RingCapacity();
+    auto read = ring.read_position.load(std::memory_order_relaxed);
+    const auto write = ring.write_position.load(std::memory_order_acquire);
+    while (read < write) {
+      const auto offset = read % capacity;
+      ipc::EntryHeader header {};
+      std::memcpy(&header, data + offset, std::min<std::uint64_t>(sizeof(header), capacity - offset));
+      if (header.is_padding) {
+        read += capacity - offset;
+        continue;
+      }
+      if (capacity - offset < ipc::EntrySpace(header.size)) {
+        // The ring is corrupt, e.g. a process wrote to it that was not a SharedMemorySink. Skip what is
+        // there.
+        read = write;
+        break;
+      }
+      pending_.push_back({header.time_stamp, std::string(data + offset + sizeof(header), header.size)});
+      newest = std::max(newest, header.time_stamp);
+      ++collected_[index];
+      read += ipc::EntrySpace(header.size);
     }
+    ring.read_position.store(read, std::memory_order_release);
   }
 
-  void flushLockFree() override { fout_.flush(); }
+  ipc::Segment segment_;
 
-  std::ofstream fout_;
-  std::string filename_;
+  //! \brief Records read from the rings, but not passed on yet.
+  std::vector<Pending> pending_;
+
+  //! \brief The number of records read from each ring.
+  std::vector<std::uint64_t> collected_;
 };
 
+#endif  // LL_HAS_POSIX
+
 //! \brief A sink that writes to std::cout.
 class StdoutSink : public SinkBackend {
 public:
@@ -4774,6 +11472,694 @@ private:
   std::shared_ptr<std::ostream> out_;
 };
 
+// ==============================================================================
+//  Backtrace sink.
+// ==============================================================================
+
+namespace detail {
+
+//! \brief A ring of the most recent records that one thread sent to a BacktraceSink.
+//!
+//! Only the thread that owns the ring writes to it, and it never waits for readers. Every slot has a sequence
+//! number, which is odd while the slot is being written, so other threads, or a signal handler, can copy a
+//! slot while the owner keeps logging, and throw the copy away if the slot changed while it was copied.
+class BacktraceRing {
+public:
+  //! \brief How much of a logger name is kept.
+  static constexpr std::size_t max_logger_name_size = 64;
+
+  //! \brief Everything that is kept about a record, except for the text of the logger name and the message.
+  struct Header {
+    //! \brief Which record of the ring this is, counting from zero.
+    std::uint64_t index {};
+
+    //! \brief The record's basic attributes. The logger name and attributes are cleared, since they belong to
+    //!        the logger, the call site and thread name live for the rest of the program.
+    BasicAttributes attributes {std::nullopt, nullptr, 0};
+
+    std::uint32_t logger_name_size {};
+    std::uint32_t message_size {};
+  };
+
+  BacktraceRing(std::size_t capacity, std::size_t max_message_size)
+      : capacity_(capacity)
+      , text_size_(max_logger_name_size + max_message_size)
+      , slots_(new Slot[capacity])
+      , text_(new char[capacity * text_size_]) {}
+
+  //! \brief Add a record to the ring, overwriting the oldest record if the ring is full. Only the owning
+  //!        thread may push.
+  void Push(const BasicAttributes& attributes, std::string_view logger_name, std::string_view message) {
+    const auto index = written_.load(std::memory_order_relaxed);
+    auto& slot = slots_[index % capacity_];
+    const auto sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    logger_name = logger_name.substr(0, max_logger_name_size);
+    message = message.substr(0, text_size_ - max_logger_name_size);
+    slot.header.index = index;
+    slot.header.attributes = attributes;
+    slot.header.attributes.logger_name = {};
+    slot.header.attributes.logger_attributes = nullptr;
+    slot.header.logger_name_size = static_cast<std::uint32_t>(logger_name.size());
+    slot.header.message_size = static_cast<std::uint32_t>(message.size());
+    auto text = text_.get() + (index % capacity_) * text_size_;
+    std::memcpy(text, logger_name.data(), logger_name.size());
+    std::memcpy(text + logger_name.size(), message.data(), message.size());
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    written_.store(index + 1, std::memory_order_release);
+  }
+
+  //! \brief Copy a record out of the ring. The logger name and then the message are copied to `text`, unless
+  //!        it is null, which must have room for TextSize() characters.
+  //!
+  //! \return False if the record was overwritten or is being written, in which case the copy is useless.
+  bool Read(std::uint64_t index, Header& header, char* text) const {
+    auto& slot = slots_[index % capacity_];
+    const auto sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      return false;
+    }
+    header = slot.header;
+    if (text) {
+      // The sizes are clamped, since they may be torn, in which case the copy is thrown away below.
+      const auto size = std::min<std::size_t>(header.logger_name_size + std::size_t {header.message_size},
+                                              text_size_);
+      std::memcpy(text, text_.get() + (index % capacity_) * text_size_, size);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == sequence && header.index == index
+           && header.logger_name_size + std::size_t {header.message_size} <= text_size_;
+  }
+
+  //! \brief The number of records that have been pushed to the ring, ever.
+  NO_DISCARD std::uint64_t Written() const { return written_.load(std::memory_order_acquire); }
+
+  //! \brief The index of the oldest record that is still in the ring and has not been dumped yet.
+  NO_DISCARD std::uint64_t FirstUndumped() const {
+    const auto written = Written();
+    return std::max(dumped_.load(std::memory_order_relaxed), written < capacity_ ? 0 : written - capacity_);
+  }
+
+  //! \brief Mark every record before `end` as dumped.
+  void MarkDumped(std::uint64_t end) { dumped_.store(end, std::memory_order_relaxed); }
+
+  //! \brief The space that the text of a record can take up.
+  NO_DISCARD std::size_t TextSize() const { return text_size_; }
+
+  //! \brief Whether a thread owns the ring. Rings of threads that exited are handed to new threads.
+  std::atomic<bool> in_use {true};
+
+  //! \brief The next ring of the same sink. Set before the ring is published, and not changed afterwards.
+  BacktraceRing* next {};
+
+  //! \brief Where the crash handler is in the ring. Only used by BacktraceSink::flushLockFree.
+  std::uint64_t crash_cursor {};
+
+private:
+  struct Slot {
+    std::atomic<std::uint64_t> sequence {0};
+    Header header {};
+  };
+
+  const std::size_t capacity_;
+  const std::size_t text_size_;
+  std::unique_ptr<Slot[]> slots_;
+  std::unique_ptr<char[]> text_;
+
+  std::atomic<std::uint64_t> written_ {0};
+  std::atomic<std::uint64_t> dumped_ {0};
+};
+
+//! \brief The resources that the current thread owns, one per sink it logged to, e.g. the thread's
+//!        BacktraceRing in each BacktraceSink. A resource has an atomic `in_use` flag, which is cleared when
+//!        the thread exits, so that another thread can take the resource over.
+template<typename Resource_t>
+class ThreadLeases {
+public:
+  ~ThreadLeases() {
+    for (auto& [_, resource] : leases_) {
+      resource->in_use.store(false, std::memory_order_release);
+    }
+  }
+
+  static ThreadLeases& Local() {
+    thread_local ThreadLeases leases;
+    return leases;
+  }
+
+  //! \brief Find the resource that the thread uses for a sink, or null if it does not have one yet.
+  Resource_t* Find(std::uint64_t sink_id) const {
+    for (auto& [id, resource] : leases_) {
+      if (id == sink_id) {
+        return resource.get();
+      }
+    }
+    return nullptr;
+  }
+
+  void Add(std::uint64_t sink_id, std::shared_ptr<Resource_t> resource) {
+    // Forget the resources of sinks that were destroyed, which no one else holds any more.
+    leases_.erase(std::remove_if(leases_.begin(),
+                                 leases_.end(),
+                                 [](auto& lease) { return lease.second.use_count() == 1; }),
+                  leases_.end());
+    leases_.emplace_back(sink_id, std::move(resource));
+  }
+
+private:
+  std::vector<std::pair<std::uint64_t, std::shared_ptr<Resource_t>>> leases_;
+};
+
+//! \brief Builds a line of text in a fixed buffer, without allocating, so it can be used from a signal
+//!        handler. Whatever does not fit is cut off.
+class SignalSafeLine {
+public:
+  SignalSafeLine(char* begin, char* end)
+      : begin_(begin)
+      , position_(begin)
+      , end_(end) {}
+
+  SignalSafeLine& operator<<(std::string_view str) {
+    const auto size = std::min(str.size(), static_cast<std::size_t>(end_ - position_));
+    std::memcpy(position_, str.data(), size);
+    position_ += size;
+    return *this;
+  }
+
+  SignalSafeLine& operator<<(char c) { return *this << std::string_view(&c, 1); }
+
+  //! \brief Write an integer, padded with zeros to at least `width` characters.
+  template<typename Integral_t, LL_ENABLE_IF(std::is_integral_v<Integral_t>)>
+  SignalSafeLine& Number(Integral_t number, int width = 0) {
+    char digits[24];
+    const auto [last, _] = std::to_chars(digits, digits + sizeof(digits), number);
+    for (auto size = last - digits; size < width; ++size) {
+      *this << '0';
+    }
+    return *this << std::string_view(digits, static_cast<std::size_t>(last - digits));
+  }
+
+  NO_DISCARD const char* Data() const { return begin_; }
+  NO_DISCARD std::size_t Size() const { return static_cast<std::size_t>(position_ - begin_); }
+
+private:
+  char* begin_;
+  char* position_;
+  char* end_;
+};
+
+}  // namespace detail
+
+//! \brief A sink frontend that keeps the most recent records in memory, and only sends them to a target sink
+//!        when something goes wrong: when a record with a trigger severity (by default, Error or Fatal)
+//!        arrives, or when Core::DumpBacktrace is called. The records are then dispatched to the target,
+//!        oldest first.
+//!
+//! This gives the context leading up to an error, e.g. Debug and Trace records, without writing those records
+//! out all the time. By default, the sink accepts every record, so it should be the only sink that feeds the
+//! target, otherwise records that both accept are written twice.
+//!
+//! Each thread writes to its own ring, which holds the last `capacity_per_thread` records of that thread, so
+//! logging to the sink takes no lock. Only the message is formatted when the record arrives (cut off after
+//! `max_message_size` characters), the target formats the rest when the records are dumped. Records from
+//! different threads are put in time stamp order, so the loggers should make time stamps. Dumped records only
+//! keep their basic attributes and logger name, their other attributes are dropped.
+//!
+//! When the process crashes, LightningFlushAllHandler (via Core::flushLockFree) writes the records that have
+//! not been dumped yet to a file descriptor, standard error by default, in a fixed format. This only uses
+//! memory that was allocated in advance and write(2), so it is safe to do from a signal handler.
+class BacktraceSink : public Sink {
+public:
+  explicit BacktraceSink(std::shared_ptr<Sink> target,
+                         std::size_t capacity_per_thread = 4096,
+                         SeveritySet trigger = Severity::Error <= LoggingSeverity,
+                         std::size_t max_message_size = 512)
+      : Sink(std::make_unique<EmptySink>())
+      , target_(std::move(target))
+      , capacity_(capacity_per_thread)
+      , max_message_size_(max_message_size)
+      , trigger_(trigger)
+      , crash_text_(new char[detail::BacktraceRing::max_logger_name_size + max_message_size])
+      , crash_line_(new char[crash_line_size_ + max_message_size]) {
+    LL_REQUIRE(target_, "a BacktraceSink needs a target sink");
+    LL_REQUIRE(0 < capacity_per_thread, "the capacity of a BacktraceSink must be positive");
+  }
+
+  //! \brief Set which severities make the sink dump its records.
+  //!
+  //! \note Must not be called while other threads log to the sink.
+  BacktraceSink& SetTrigger(SeveritySet trigger) {
+    trigger_ = trigger;
+    return *this;
+  }
+
+  //! \brief Set the file descriptor that the records are written to when the process crashes.
+  BacktraceSink& SetCrashFileDescriptor(int fd) {
+    crash_fd_.store(fd, std::memory_order_relaxed);
+    return *this;
+  }
+
+  //! \brief Get the sink that records are dumped to.
+  NO_DISCARD Sink& GetTarget() { return *target_; }
+
+  //! \brief Dispatch every record that is in the sink's rings, and has not been dumped before, to the target
+  //!        sink, in time stamp order.
+  void Dump() {
+    struct Captured {
+      detail::BacktraceRing::Header header;
+      std::size_t text_offset;
+    };
+
+    std::lock_guard guard(dump_mutex_);
+    std::vector<Captured> captured;
+    std::string text;
+    std::unique_ptr<char[]> scratch;
+    for (auto ring = rings_head_.load(std::memory_order_acquire); ring; ring = ring->next) {
+      if (!scratch) {
+        scratch.reset(new char[ring->TextSize()]);
+      }
+      const auto end = ring->Written();
+      for (auto index = ring->FirstUndumped(); index < end; ++index) {
+        detail::BacktraceRing::Header header;
+        if (ring->Read(index, header, scratch.get())) {
+          captured.push_back({header, text.size()});
+          text.append(scratch.get(), header.logger_name_size + std::size_t {header.message_size});
+        }
+      }
+      ring->MarkDumped(end);
+    }
+    std::stable_sort(captured.begin(), captured.end(), [](auto& lhs, auto& rhs) {
+      return lhs.header.attributes.time_stamp < rhs.header.attributes.time_stamp;
+    });
+
+    // The records view the text, which is not changed any more.
+    std::vector<Record> records;
+    records.reserve(captured.size());
+    std::vector<BatchEntry> batch;
+    batch.reserve(captured.size());
+    for (auto& entry : captured) {
+      const auto record_text = std::string_view(text).substr(entry.text_offset);
+      const auto logger_name = record_text.substr(0, entry.header.logger_name_size);
+      const auto message = record_text.substr(logger_name.size(), entry.header.message_size);
+      auto& record = records.emplace_back(entry.header.attributes);
+      record.Attributes().basic_attributes.logger_name = logger_name;
+      record.Bundle() << message;
+      batch.push_back({&record});
+    }
+    target_->DispatchBatch(batch);
+  }
+
+private:
+  void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>*) override {
+    // A pre-formatted record includes its header, so only the message is formatted.
+    memory::MemoryBuffer<char> message;
+    formatting::MessageInfo msg_info {};
+    record.Bundle().FmtString(settings_, message, msg_info);
+    capture(record, message.ToView());
+  }
+
+  void dispatchShared(const Record& record, MessageBodyCache& body_cache) override {
+    if (auto message = body_cache.Get(settings_)) {
+      capture(record, message->ToView());
+    }
+    else {
+      dispatch(record, nullptr);
+    }
+  }
+
+  void capture(const Record& record, std::string_view message) {
+    const auto& basic_attributes = record.Attributes().basic_attributes;
+    localRing().Push(basic_attributes, basic_attributes.logger_name, message);
+    if (basic_attributes.level && trigger_(*basic_attributes.level)) {
+      Dump();
+    }
+  }
+
+  //! \brief Get the calling thread's ring, giving it one if it has none yet.
+  detail::BacktraceRing& localRing() {
+    auto& leases = detail::ThreadLeases<detail::BacktraceRing>::Local();
+    if (auto ring = leases.Find(id_)) {
+      return *ring;
+    }
+    std::lock_guard guard(rings_mutex_);
+    for (auto& ring : rings_) {
+      bool in_use = false;
+      if (ring->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire)) {
+        leases.Add(id_, ring);
+        return *ring;
+      }
+    }
+    auto& ring = rings_.emplace_back(std::make_shared<detail::BacktraceRing>(capacity_, max_message_size_));
+    ring->next = rings_head_.load(std::memory_order_relaxed);
+    rings_head_.store(ring.get(), std::memory_order_release);
+    leases.Add(id_, ring);
+    return *ring;
+  }
+
+  void flush() override { target_->Flush(); }
+
+  //! \brief Write the records that have not been dumped to the crash file descriptor, in time stamp order,
+  //!        and flush the target, all without locking or allocating.
+  void flushLockFree() const override {
+    writeBacktrace(crash_fd_.load(std::memory_order_relaxed));
+    target_->flushLockFree();
+  }
+
+  void writeBacktrace(int fd) const {
+    const auto head = rings_head_.load(std::memory_order_acquire);
+    for (auto ring = head; ring; ring = ring->next) {
+      ring->crash_cursor = ring->FirstUndumped();
+    }
+    detail::BacktraceRing::Header header, oldest;
+    for (;;) {
+      // Merge the rings, each of which is in time order already.
+      detail::BacktraceRing* next_ring = nullptr;
+      for (auto ring = head; ring; ring = ring->next) {
+        while (ring->crash_cursor < ring->Written() && !ring->Read(ring->crash_cursor, header, nullptr)) {
+          ++ring->crash_cursor;  // Overwritten in the meantime.
+        }
+        if (ring->crash_cursor < ring->Written()
+            && (!next_ring || header.attributes.time_stamp < oldest.attributes.time_stamp))
+        {
+          next_ring = ring;
+          oldest = header;
+        }
+      }
+      if (!next_ring) {
+        return;
+      }
+      if (next_ring->Read(next_ring->crash_cursor++, header, crash_text_.get())) {
+        writeLine(fd, header);
+      }
+    }
+  }
+
+  //! \brief Write a record as a line like
+  //!        "2024-03-05 12:30:15.123456 [Error  ] [12345 name] logger: message (file.cpp:12)".
+  void writeLine(int fd, const detail::BacktraceRing::Header& header) const {
+    detail::SignalSafeLine line(crash_line_.get(), crash_line_.get() + crash_line_size_ + max_message_size_);
+    const auto& attributes = header.attributes;
+    if (auto& time_stamp = attributes.time_stamp) {
+      line.Number(time_stamp->GetYear(), 4) << '-';
+      line.Number(time_stamp->GetMonthInt(), 2) << '-';
+      line.Number(time_stamp->GetDay(), 2) << ' ';
+      line.Number(time_stamp->GetHour(), 2) << ':';
+      line.Number(time_stamp->GetMinute(), 2) << ':';
+      line.Number(time_stamp->GetSecond(), 2) << '.';
+      line.Number(time_stamp->GetMicrosecond(), 6) << ' ';
+    }
+    if (attributes.level) {
+      const auto name = SeverityName(*attributes.level);
+      line << '[' << name << std::string_view("       ").substr(0, 7 - std::min<std::size_t>(7, name.size()))
+           << "] ";
+    }
+    line << '[';
+    line.Number(attributes.thread_id);
+    if (!attributes.thread_name.empty()) {
+      line << ' ' << attributes.thread_name;
+    }
+    line << "] ";
+    const auto text =
+        std::string_view(crash_text_.get(), header.logger_name_size + std::size_t {header.message_size});
+    if (header.logger_name_size != 0) {
+      line << text.substr(0, header.logger_name_size) << ": ";
+    }
+    line << text.substr(header.logger_name_size);
+    if (auto call_site = attributes.call_site; call_site && call_site->file_path) {
+      line << " (" << call_site->FileName();
+      if (call_site->line_number) {
+        line << ':';
+        line.Number(*call_site->line_number);
+      }
+      line << ')';
+    }
+    line << '\n';
+    writeAll(fd, line.Data(), line.Size());
+  }
+
+  //! \brief Write all the data, retrying on partial writes and interrupts.
+  static void writeAll([[maybe_unused]] int fd,
+                       [[maybe_unused]] const char* data,
+                       [[maybe_unused]] std::size_t size) {
+#if LL_HAS_POSIX
+    while (size != 0) {
+      const auto written = ::write(fd, data, size);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      data += written;
+      size -= static_cast<std::size_t>(written);
+    }
+#endif
+  }
+
+  NO_DISCARD std::shared_ptr<Sink> clone() const override {
+    auto sink = std::make_shared<BacktraceSink>(target_->Clone(), capacity_, trigger_, max_message_size_);
+    sink->SetCrashFileDescriptor(crash_fd_.load(std::memory_order_relaxed));
+    return sink;
+  }
+
+  static std::uint64_t nextID() {
+    static std::atomic<std::uint64_t> id {0};
+    return id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  //! \brief Room in a crash line for everything but the message.
+  static constexpr std::size_t crash_line_size_ = 256 + detail::BacktraceRing::max_logger_name_size;
+
+  //! \brief The sink that the records are dumped to.
+  std::shared_ptr<Sink> target_;
+
+  const std::size_t capacity_;
+  const std::size_t max_message_size_;
+  SeveritySet trigger_;
+
+  //! \brief Identifies the sink to the threads' ring leases. Unlike the sink's address, this is never reused.
+  const std::uint64_t id_ = nextID();
+
+  //! \brief The settings that messages are formatted with.
+  const FormattingSettings settings_ {};
+
+  //! \brief Owns the rings. New rings are only added under the mutex.
+  std::mutex rings_mutex_;
+  std::vector<std::shared_ptr<detail::BacktraceRing>> rings_;
+
+  //! \brief The rings as a list, most recently added first, which can be walked without taking the mutex.
+  std::atomic<detail::BacktraceRing*> rings_head_ {nullptr};
+
+  //! \brief Serializes dumps.
+  std::mutex dump_mutex_;
+
+  std::atomic<int> crash_fd_ {2};
+
+  //! \brief Buffers for writing records when the process crashes, allocated in advance.
+  std::unique_ptr<char[]> crash_text_;
+  std::unique_ptr<char[]> crash_line_;
+};
+
+void Core::DumpBacktrace() const {
+  concurrency::EpochDomain::ReadSection section(synchronous_mode_);
+  for (auto& sink : currentSinks()) {
+    if (auto backtrace_sink = dynamic_cast<BacktraceSink*>(sink.get())) {
+      backtrace_sink->Dump();
+    }
+  }
+}
+
+// ==============================================================================
+//  Sharded file sink.
+// ==============================================================================
+
+namespace detail {
+
+//! \brief One of the files of a ShardedFileSink, which one thread at a time logs to.
+struct FileShard {
+  FileShard(const std::string& file_path, std::size_t buffer_capacity)
+      : backend(file_path, buffer_capacity) {}
+
+  //! \brief Whether a thread has the shard.
+  std::atomic<bool> in_use {true};
+
+  //! \brief The next shard in the sink's list of shards.
+  FileShard* next {};
+
+  //! \brief Held by the shard's thread while it logs, so it is only contended when the sink is flushed.
+  std::mutex mutex;
+
+  BinaryFileSink backend;
+};
+
+}  // namespace detail
+
+//! \brief A sink frontend that gives each thread that logs to it its own file, so threads never wait for each
+//!        other. MergeBinaryLogs (or the merge-log-shards application) merges the files into one log, in time
+//!        stamp order.
+//!
+//! A thread gets a file the first time it logs to the sink. Once the thread exits, the next thread that logs
+//! takes over its file, so there are only as many files as there were threads logging at the same time. The
+//! files are named `<base_path>.<N>`, counting from zero, and are written by BinaryFileSinks, so records are
+//! not formatted while logging. Each file is in time stamp order, as long as the loggers make time stamps.
+//!
+//! Each file has a mutex, which is taken by the thread that logs to it, so it is only contended when the sink
+//! is flushed.
+class ShardedFileSink : public Sink {
+public:
+  //! \brief Create a sharded sink. No files are created until threads log to it.
+  //!
+  //! \param base_path The path that the files' paths are made from, see GetShardPath.
+  //! \param buffer_capacity The capacity of each file's buffer, see BinaryFileSink.
+  explicit ShardedFileSink(std::string base_path, std::size_t buffer_capacity = 64 * 1024)
+      : Sink(std::make_unique<EmptySink>())
+      , base_path_(std::move(base_path))
+      , buffer_capacity_(buffer_capacity) {}
+
+  //! \brief Write out every file's buffer. Threads keep their files open until they exit.
+  ~ShardedFileSink() override { flush(); }
+
+  //! \brief Get the path of the file with the given index.
+  NO_DISCARD std::string GetShardPath(std::size_t index) const {
+    return base_path_ + "." + std::to_string(index);
+  }
+
+  //! \brief Get the paths of the files that were created so far.
+  NO_DISCARD std::vector<std::string> GetShardPaths() {
+    std::lock_guard guard(shards_mutex_);
+    std::vector<std::string> paths;
+    for (std::size_t index = 0; index < shards_.size(); ++index) {
+      paths.push_back(GetShardPath(index));
+    }
+    return paths;
+  }
+
+private:
+  void dispatch(const Record& record, const memory::BasicMemoryBuffer<char>*) override {
+    auto& shard = localShard();
+    std::lock_guard guard(shard.mutex);
+    shard.backend.Dispatch(no_message_, record);
+  }
+
+  void dispatchBatch(const std::vector<BatchEntry>& batch) override {
+    auto& shard = localShard();
+    std::lock_guard guard(shard.mutex);
+    for (auto& entry : batch) {
+      shard.backend.Dispatch(no_message_, *entry.record);
+    }
+  }
+
+  //! \brief Get the calling thread's shard, giving it one if it has none yet.
+  detail::FileShard& localShard() {
+    auto& leases = detail::ThreadLeases<detail::FileShard>::Local();
+    if (auto shard = leases.Find(id_)) {
+      return *shard;
+    }
+    std::lock_guard guard(shards_mutex_);
+    for (auto& shard : shards_) {
+      bool in_use = false;
+      if (shard->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire)) {
+        leases.Add(id_, shard);
+        return *shard;
+      }
+    }
+    auto& shard = shards_.emplace_back(std::make_shared<detail::FileShard>(GetShardPath(shards_.size()),
+                                                                           buffer_capacity_));
+    shard->next = shards_head_.load(std::memory_order_relaxed);
+    shards_head_.store(shard.get(), std::memory_order_release);
+    leases.Add(id_, shard);
+    return *shard;
+  }
+
+  void flush() override {
+    std::lock_guard guard(shards_mutex_);
+    for (auto& shard : shards_) {
+      std::lock_guard shard_guard(shard->mutex);
+      shard->backend.Flush();
+    }
+  }
+
+  //! \brief Write out every file's buffer, without locking, see Core::flushLockFree.
+  void flushLockFree() const override {
+    for (auto shard = shards_head_.load(std::memory_order_acquire); shard; shard = shard->next) {
+      static_cast<SinkBackend&>(shard->backend).flushLockFree();
+    }
+  }
+
+  NO_DISCARD std::shared_ptr<Sink> clone() const override {
+    return std::make_shared<ShardedFileSink>(base_path_, buffer_capacity_);
+  }
+
+  static std::uint64_t nextID() {
+    static std::atomic<std::uint64_t> id {0};
+    return id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const std::string base_path_;
+  const std::size_t buffer_capacity_;
+
+  //! \brief Identifies the sink to the threads' leases. Unlike the sink's address, this is never reused.
+  const std::uint64_t id_ = nextID();
+
+  //! \brief BinaryFileSinks encode the record, they do not use the formatted message.
+  const memory::MemoryBuffer<char> no_message_;
+
+  //! \brief Owns the shards. New shards are only added under the mutex.
+  std::mutex shards_mutex_;
+  std::vector<std::shared_ptr<detail::FileShard>> shards_;
+
+  //! \brief The shards as a list, which can be walked without taking the mutex.
+  std::atomic<detail::FileShard*> shards_head_ {nullptr};
+};
+
+//! \brief Merge files written by BinaryFileSinks, e.g. the files of a ShardedFileSink, passing their records
+//!        to `func(const Record&)` in time stamp order. Each file must be in time stamp order itself. Records
+//!        with the same time stamp are passed on in the order of the files.
+//!
+//! Only the next record of each file is kept in memory, so the files do not have to fit in memory.
+//!
+//! \return The number of records that were passed to the function.
+template<typename Func_t>
+std::size_t MergeBinaryLogs(const std::vector<std::string>& file_paths, Func_t&& func) {
+  std::vector<std::unique_ptr<BinaryLogReader>> readers;
+  std::vector<std::unique_ptr<Record>> next;
+  for (auto& path : file_paths) {
+    auto& reader = readers.emplace_back(std::make_unique<BinaryLogReader>(path));
+    next.push_back(reader->Next());
+  }
+  // A min-heap of the indices of the files that have records left, by the time stamp of their next record.
+  auto later = [&next](std::size_t lhs, std::size_t rhs) {
+    const auto& lhs_time = next[lhs]->Attributes().basic_attributes.time_stamp;
+    const auto& rhs_time = next[rhs]->Attributes().basic_attributes.time_stamp;
+    return rhs_time < lhs_time || (lhs_time == rhs_time && rhs < lhs);
+  };
+  std::vector<std::size_t> heap;
+  for (std::size_t index = 0; index < next.size(); ++index) {
+    if (next[index]) {
+      heap.push_back(index);
+    }
+  }
+  std::make_heap(heap.begin(), heap.end(), later);
+
+  std::size_t count = 0;
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    const auto index = heap.back();
+    func(static_cast<const Record&>(*next[index]));
+    ++count;
+    if ((next[index] = readers[index]->Next())) {
+      std::push_heap(heap.begin(), heap.end(), later);
+    }
+    else {
+      heap.pop_back();
+    }
+  }
+  return count;
+}
+
 // ==============================================================================
 //  Global logger.
 // ==============================================================================
@@ -4786,8 +12172,9 @@ class Global {
 public:
   Global() = delete;
 
-  //! \brief Get the global core.
-  static std::shared_ptr<Core> GetCore() {
+  //! \brief Get the global core. This returns a reference, so that getting the core does not change its
+  //!        reference count, which every thread would contend on.
+  static const std::shared_ptr<Core>& GetCore() {
     static std::once_flag flag;
     std::call_once(flag, [&]() { global_core_ = std::make_shared<Core>(); });
     return global_core_;
@@ -4802,7 +12189,7 @@ public:
 
   //! \brief Flush all sinks associated with the global core.
   static void Flush() {
-    auto&& core = GetCore();
+    auto& core = GetCore();
     // Note - cast is to get around "result is unused" warning.
     static_cast<void>(core->Flush());
   }
@@ -4824,30 +12211,95 @@ private:
 //  Logging macros.
 // ==============================================================================
 
+//! \brief Declare the static constexpr call site of a logging statement, with the given name and severity.
+#define LL_CALL_SITE(name, severity) \
+  static constexpr ::lightning::CallSite name(__FILE__, LL_CURRENT_FUNCTION, __LINE__, severity)
+
 //! \brief Log with severity to a specific logger. First does a very fast check whether the
 //!        message would be accepted given its severity level, since this is a very common case.
 //!        If it will be, creates a handler, constructing the record in-place inside the handler.
-#define LOG_SEV_TO(logger, severity)                                                   \
-  if ((logger).WillAccept(::lightning::Severity::severity))                            \
-    if (auto handler = (logger).LogWithLocation(                                       \
-            ::lightning::Severity::severity, __FILE__, LL_CURRENT_FUNCTION, __LINE__)) \
+//!
+//!        Statements below the minimum compiled severity (see LL_MIN_SEVERITY) are discarded at compile time.
+#define LOG_SEV_TO(logger, severity)                                                                \
+  if constexpr (::lightning::IsCompiledIn(::lightning::Severity::severity))                         \
+    if ((logger).WillAccept(::lightning::Severity::severity))                                       \
+      if (LL_CALL_SITE(lightning_call_site_, ::lightning::Severity::severity);                      \
+          auto handler = (logger).LogAt(lightning_call_site_))                                      \
   handler.GetRecord().Bundle()
 
 //! \brief Log with a severity attribute to the global logger.
 #define LOG_SEV(severity) LOG_SEV_TO(::lightning::Global::GetLogger(), severity)
 
+//! \brief Log with severity to a specific logger, attaching attributes to the record, e.g.
+//!        `LOG_SEV_WITH_TO(logger, Info, Attribute("request_id", id)) << "Handled request";`
+//!
+//!        The attributes are only created if the message is accepted.
+#define LOG_SEV_WITH_TO(logger, severity, ...)                                                      \
+  if constexpr (::lightning::IsCompiledIn(::lightning::Severity::severity))                         \
+    if ((logger).WillAccept(::lightning::Severity::severity))                                       \
+      if (LL_CALL_SITE(lightning_call_site_, ::lightning::Severity::severity);                      \
+          auto handler = (logger).LogAt(lightning_call_site_, __VA_ARGS__))                         \
+  handler.GetRecord().Bundle()
+
+//! \brief Log with a severity attribute and other attributes to the global logger.
+#define LOG_SEV_WITH(severity, ...) LOG_SEV_WITH_TO(::lightning::Global::GetLogger(), severity, __VA_ARGS__)
+
 //! \brief Log to a specific logger, without severity.
-#define LOG_TO(logger)                                                                                    \
-  if ((logger).WillAccept(::std::nullopt))                                                                \
-    if (auto handler = (logger).LogWithLocation(::std::nullopt, __FILE__, LL_CURRENT_FUNCTION, __LINE__)) \
+#define LOG_TO(logger)                                                                                          \
+  if ((logger).WillAccept(::std::nullopt))                                                                      \
+    if (LL_CALL_SITE(lightning_call_site_, ::std::nullopt); auto handler = (logger).LogAt(lightning_call_site_)) \
   handler.GetRecord().Bundle()
 
 //! \brief Log, without severity, to the global logger.
 #define LOG() LOG_TO(::lightning::Global::GetLogger())
 
+//! \brief Log with severity to a specific logger, if the sampling policy lets the message through.
+//!
+//!        The policy, e.g. `::lightning::sampling::EveryN(100)`, is constructed once, in a static that belongs to
+//!        the call site. It is only consulted for messages the logger would accept, and a record is only created
+//!        for messages that the policy lets through. If the policy reports suppressed messages, the count is
+//!        noted at the start of the message.
+#define LOG_SAMPLED_TO(logger, severity, ...)                                                        \
+  if constexpr (::lightning::IsCompiledIn(::lightning::Severity::severity))                          \
+    if ((logger).WillAccept(::lightning::Severity::severity))                                        \
+      if (static auto lightning_sampler_ = __VA_ARGS__; lightning_sampler_.ShouldLog())              \
+        if (LL_CALL_SITE(lightning_call_site_, ::lightning::Severity::severity);                     \
+            auto handler = (logger).LogAt(lightning_call_site_))                                     \
+  handler.GetRecord().Bundle() << ::lightning::sampling::SuppressedNote {lightning_sampler_.TakeSuppressed()}
+
+//! \brief Log with a severity to a specific logger, for the first message and then every N-th message.
+#define LOG_EVERY_N_TO(logger, severity, N) LOG_SAMPLED_TO(logger, severity, ::lightning::sampling::EveryN(N))
+
+//! \brief Log with a severity to a specific logger, only for the first N messages.
+#define LOG_FIRST_N_TO(logger, severity, N) LOG_SAMPLED_TO(logger, severity, ::lightning::sampling::FirstN(N))
+
+//! \brief Log with a severity to a specific logger, at most once per period (a std::chrono duration).
+#define LOG_EVERY_T_TO(logger, severity, period) \
+  LOG_SAMPLED_TO(logger, severity, ::lightning::sampling::EveryT(period))
+
+//! \brief Log with a severity to a specific logger, at most `rate` messages per second on average, in bursts of
+//!        up to `burst` messages.
+#define LOG_RATE_LIMITED_TO(logger, severity, rate, burst) \
+  LOG_SAMPLED_TO(logger, severity, ::lightning::sampling::RateLimited(rate, burst))
+
+//! \brief Sampled logging with a severity to the global logger.
+#define LOG_SAMPLED(severity, ...) LOG_SAMPLED_TO(::lightning::Global::GetLogger(), severity, __VA_ARGS__)
+#define LOG_EVERY_N(severity, N) LOG_EVERY_N_TO(::lightning::Global::GetLogger(), severity, N)
+#define LOG_FIRST_N(severity, N) LOG_FIRST_N_TO(::lightning::Global::GetLogger(), severity, N)
+#define LOG_EVERY_T(severity, period) LOG_EVERY_T_TO(::lightning::Global::GetLogger(), severity, period)
+#define LOG_RATE_LIMITED(severity, rate, burst) \
+  LOG_RATE_LIMITED_TO(::lightning::Global::GetLogger(), severity, rate, burst)
+
 //! \brief Get a logging handler for a specific logger.
-#define LOG_HANDLER_FOR(logger, severity) \
-  (logger).LogWithLocation(::lightning::Severity::severity, __FILE__, LL_CURRENT_FUNCTION, __LINE__)
+//!
+//!        This is an expression, so the call site can't be a static constexpr declaration. Instead, it is a static
+//!        inside a lambda that is unique to the statement, which is passed the enclosing function's name.
+#define LOG_HANDLER_FOR(logger, severity)                                                        \
+  (logger).LogAt([](const char* lightning_function_) -> const ::lightning::CallSite& {           \
+    static const ::lightning::CallSite lightning_call_site_(                                     \
+        __FILE__, lightning_function_, __LINE__, ::lightning::Severity::severity);               \
+    return lightning_call_site_;                                                                 \
+  }(LL_CURRENT_FUNCTION))
 
 //! \brief Function for use as a signal handler.
 //!
@@ -5040,6 +12492,27 @@ void formatTo(memory::BasicMemoryBuffer<char>& buffer,
                           std::make_index_sequence<sizeof...(args)> {});
 }
 
+//! \brief Format with a compile-time parsed format string. The literals were resolved when compiling, so each
+//!        one is a single copy into the buffer.
+template<typename Source_t, typename... Args_t, std::size_t... Indices>
+void compiledFormatTo(memory::BasicMemoryBuffer<char>& buffer,
+                      const FormattingSettings& settings,
+                      std::index_sequence<Indices...>,
+                      const Args_t&... args) {
+  using Format_t = CompiledFormat<Source_t>;
+  auto add_literal = [&buffer](std::string_view literal) {
+    if (!literal.empty()) {
+      buffer.Append(literal.data(), literal.data() + literal.size());
+    }
+  };
+  MessageInfo msg_info;
+  ((add_literal(Format_t::Literal(Indices)),
+    Segment<std::decay_t<typetraits::remove_cvref_t<Args_t>>>(args).AddToBuffer(
+        settings, msg_info, buffer, Format_t::Spec(Indices))),
+   ...);
+  add_literal(Format_t::Literal(sizeof...(Args_t)));
+}
+
 }  // namespace detail
 
 //! \brief Format data to a memory buffer. This is the main formatting function.
@@ -5059,12 +12532,41 @@ void FormatTo(memory::BasicMemoryBuffer<char>& buffer,
   }
 }
 
+//! \brief Format data to a memory buffer, using a format string that was parsed at compile time (see LL_FMT).
+//!
+//! Unlike the runtime version, the number of arguments must match the number of slots.
+template<typename Source_t, typename... Args_t>
+void FormatTo(memory::BasicMemoryBuffer<char>& buffer,
+              const FormattingSettings& settings,
+              CompiledFormat<Source_t>,
+              const Args_t&... args) {
+  static_assert(CompiledFormat<Source_t>::NumSlots() == sizeof...(Args_t),
+                "the number of arguments must match the number of slots in the format string");
+  detail::compiledFormatTo<Source_t>(buffer, settings, std::index_sequence_for<Args_t...> {}, args...);
+}
+
+//! \brief Format data to a string, using a format string that was parsed at compile time.
+template<typename Source_t, typename... Args_t>
+std::string Format(const FormattingSettings& settings, CompiledFormat<Source_t> fmt, const Args_t&... args) {
+  auto buffer = memory::BufferPool::Local().Acquire();
+  FormatTo(*buffer, settings, fmt, args...);
+  return buffer->ToString();
+}
+
+//! \brief Format data to a string with default formatting settings, using a format string that was parsed at
+//!        compile time.
+template<typename Source_t, typename... Args_t>
+std::string Format(CompiledFormat<Source_t> fmt, const Args_t&... args) {
+  FormattingSettings settings {};
+  return Format(settings, fmt, args...);
+}
+
 //! \brief Format data to a string.
 template<typename... Args_t>
 std::string Format(const FormattingSettings& settings, std::string_view fmt, const Args_t&... args) {
-  memory::StringMemoryBuffer buffer;
-  FormatTo(buffer, settings, fmt, args...);
-  return buffer.ToString();
+  auto buffer = memory::BufferPool::Local().Acquire();
+  FormatTo(*buffer, settings, fmt, args...);
+  return buffer->ToString();
 }
 
 //! \brief Format data to a string with default formatting settings.
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+namespace Testing {
+
+namespace {
+
+std::size_t CountLines(const std::string& str) {
+  return static_cast<std::size_t>(std::count(str.begin(), str.end(), '\n'));
+}
+
+}  // namespace
+
+TEST(AsyncSink, Basic) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = AsyncSink::From<OstreamSink>(stream);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  for (int i = 0; i < 5; ++i) {
+    LOG_SEV_TO(logger, Info) << "Message " << i;
+  }
+  logger.Flush();
+  EXPECT_EQ(stream->str(), "Message 0\nMessage 1\nMessage 2\nMessage 3\nMessage 4\n");
+}
+
+TEST(AsyncSink, NewSink) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = NewSink<OstreamSink, AsyncSink>(stream);
+  EXPECT_EQ(sink->GetQueueCapacity(), 8192);
+  EXPECT_EQ(sink->GetOverflowPolicy(), OverflowPolicy::Block);
+
+  auto cloned_sink = sink->Clone();
+  ASSERT_TRUE(dynamic_cast<AsyncSink*>(cloned_sink.get()));
+}
+
+TEST(AsyncSink, CapacityRoundedUp) {
+  AsyncSink sink(std::make_unique<EmptySink>(), 100);
+  EXPECT_EQ(sink.GetQueueCapacity(), 128);
+}
+
+TEST(AsyncSink, ViewedStringsAreCopied) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = AsyncSink::From<OstreamSink>(stream);
+  sink->SetFormatter(
+      formatting::MakeMsgFormatter("[{}] {}", formatting::LoggerNameAttributeFormatter {}, formatting::MSG));
+
+  {
+    Logger logger(sink);
+    logger.SetName("temporary");
+    // Hold the sink lock so the consumer cannot format the record before the strings are overwritten.
+    auto locked_sink = sink->GetLockedSink();
+    char buffer[] = "original";
+    std::string str = "also original";
+    LOG_SEV_TO(logger, Info) << buffer << ", " << std::string_view(str);
+    std::strcpy(buffer, "changed");
+    str = "also changed, and long enough to need a new allocation";
+  }
+  sink->Flush();
+  EXPECT_EQ(stream->str(), "[temporary] original, also original\n");
+}
+
+TEST(AsyncSink, DropNewest) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = std::make_shared<AsyncSink>(std::make_unique<OstreamSink>(stream), 4, OverflowPolicy::DropNewest);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  {
+    auto locked_sink = sink->GetLockedSink();
+    for (int i = 0; i < 10; ++i) {
+      LOG_SEV_TO(logger, Info) << i;
+    }
+  }
+  logger.Flush();
+  EXPECT_EQ(stream->str(), "0\n1\n2\n3\n");
+  EXPECT_EQ(sink->GetDroppedCount(), 6);
+}
+
+TEST(AsyncSink, DropOldest) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = std::make_shared<AsyncSink>(std::make_unique<OstreamSink>(stream), 4, OverflowPolicy::DropOldest);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  {
+    auto locked_sink = sink->GetLockedSink();
+    for (int i = 0; i < 10; ++i) {
+      LOG_SEV_TO(logger, Info) << i;
+    }
+  }
+  logger.Flush();
+  EXPECT_EQ(stream->str(), "6\n7\n8\n9\n");
+  EXPECT_EQ(sink->GetDroppedCount(), 6);
+}
+
+TEST(AsyncSink, BlockWhileHoldingLock) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = std::make_shared<AsyncSink>(std::make_unique<OstreamSink>(stream), 2, OverflowPolicy::Block);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  {
+    // The consumer cannot run, so a full queue has to be drained by the producer itself.
+    auto locked_sink = sink->GetLockedSink();
+    for (int i = 0; i < 5; ++i) {
+      LOG_SEV_TO(logger, Info) << i;
+    }
+  }
+  logger.Flush();
+  EXPECT_EQ(stream->str(), "0\n1\n2\n3\n4\n");
+  EXPECT_EQ(sink->GetDroppedCount(), 0);
+}
+
+TEST(AsyncSink, MultipleProducers) {
+  constexpr int num_threads = 4, num_messages = 2000;
+
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = std::make_shared<AsyncSink>(std::make_unique<OstreamSink>(stream), 64);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&logger, t] {
+      for (int i = 0; i < num_messages; ++i) {
+        LOG_SEV_TO(logger, Info) << "Thread " << t << " message " << i;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  logger.Flush();
+  EXPECT_EQ(CountLines(stream->str()), num_threads * num_messages);
+}
+
+TEST(AsyncSink, DrainOnDestruction) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = AsyncSink::From<OstreamSink>(stream);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  auto core = std::make_shared<Core>();
+  core->AddSink(sink);
+
+  for (int i = 0; i < 100; ++i) {
+    RecordDispatcher(core, BasicAttributes(Severity::Info)) << i;
+  }
+  core->ClearSinks();
+  sink.reset();
+  EXPECT_EQ(CountLines(stream->str()), 100);
+}
+
+}  // namespace Testing
@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+using namespace std::string_view_literals;
+
+namespace Testing {
+
+namespace {
+
+//! \brief Make a logger that writes records to the stream with a structured formatter. Time stamps, threads
+//!        and call sites are left out, so that the output is predictable.
+Logger MakeStructuredLogger(const std::shared_ptr<std::ostringstream>& stream,
+                            formatting::StructuredStyle style) {
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(
+      formatting::StructuredFormatter(style).IncludeThread(false).IncludeCallSite(false).Copy());
+  Logger logger(sink);
+  logger.SetDoTimeStamp(false);
+  return logger;
+}
+
+}  // namespace
+
+TEST(Attributes, Types) {
+  EXPECT_EQ(Attribute("a", 1).GetType(), Attribute::Type::Int);
+  EXPECT_EQ(Attribute("a", -1).GetInt(), -1);
+  EXPECT_EQ(Attribute("a", 1u).GetType(), Attribute::Type::UInt);
+  EXPECT_EQ(Attribute("a", std::uint64_t {1} << 63).GetUInt(), std::uint64_t {1} << 63);
+  EXPECT_EQ(Attribute("a", 1.5f).GetType(), Attribute::Type::Float);
+  EXPECT_EQ(Attribute("a", 1.5).GetFloat(), 1.5);
+  EXPECT_EQ(Attribute("a", true).GetType(), Attribute::Type::Bool);
+  EXPECT_TRUE(Attribute("a", true).GetBool());
+  EXPECT_EQ(Attribute("a", "text").GetType(), Attribute::Type::String);
+  EXPECT_EQ(Attribute("a", "text"sv).GetString(), "text");
+
+  std::string value = "tenant-1";
+  const auto interned = Attribute::Interned("tenant", value);
+  value = "changed";
+  EXPECT_EQ(interned.GetType(), Attribute::Type::InternedString);
+  EXPECT_TRUE(interned.IsString());
+  EXPECT_EQ(interned.GetString(), "tenant-1");
+  EXPECT_EQ(InternString("tenant-1").data(), interned.GetString().data());
+
+  static_assert(std::is_trivially_copyable_v<Attribute>);
+  EXPECT_LE(sizeof(Attribute), 32);
+}
+
+TEST(Attributes, List) {
+  AttributeList list;
+  EXPECT_TRUE(list.Empty());
+  EXPECT_TRUE(list.Set({"a", 1}));
+  EXPECT_TRUE(list.Set({"b", 2}));
+  // Setting an existing key replaces the attribute.
+  EXPECT_TRUE(list.Set({"a", 3}));
+  ASSERT_EQ(list.Size(), 2);
+  ASSERT_TRUE(list.Find("a"));
+  EXPECT_EQ(list.Find("a")->GetInt(), 3);
+  EXPECT_FALSE(list.Find("c"));
+
+  for (std::size_t i = list.Size(); i < AttributeList::capacity; ++i) {
+    EXPECT_TRUE(list.Set({InternString(std::to_string(i)), 0}));
+  }
+  EXPECT_FALSE(list.Set({"one too many", 0}));
+  EXPECT_EQ(list.Size(), AttributeList::capacity);
+
+  const auto copy = list;
+  EXPECT_EQ(copy.Size(), AttributeList::capacity);
+  EXPECT_EQ(copy.Find("a")->GetInt(), 3);
+}
+
+TEST(Attributes, LoggerAttributesAreMerged) {
+  Logger logger(UnlockedSink::From<EmptySink>());
+  logger.SetAttribute({"service", "api"}).SetAttribute({"region", "eu"});
+
+  auto handler = logger.Log(Severity::Info, Attribute("region", "us"), Attribute("request_id", 7));
+  const auto& attributes = handler.GetRecord().Attributes();
+
+  // Logger attributes are referred to, not copied.
+  EXPECT_EQ(attributes.basic_attributes.logger_attributes, &logger.GetAttributes());
+  EXPECT_EQ(attributes.attributes.Size(), 2);
+  EXPECT_EQ(attributes.FindAttribute("service")->GetString(), "api");
+  EXPECT_EQ(attributes.FindAttribute("region")->GetString(), "us");
+
+  std::vector<std::string_view> keys;
+  attributes.ForEachAttribute([&keys](const Attribute& attribute) { keys.push_back(attribute.GetKey()); });
+  EXPECT_EQ(keys, (std::vector {"service"sv, "region"sv, "request_id"sv}));
+}
+
+TEST(Attributes, JsonLines) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto logger = MakeStructuredLogger(stream, formatting::StructuredStyle::JsonLines);
+  logger.SetName("api");
+  logger.SetAttribute({"service", "billing"});
+
+  LOG_SEV_WITH_TO(logger,
+                  Warning,
+                  Attribute("request_id", 42u),
+                  Attribute("latency", 1.5),
+                  Attribute("cached", false),
+                  Attribute("user", "a \"quoted\"\tname\x01"))
+      << "Slow request";
+  EXPECT_EQ(stream->str(),
+            R"({"level":"Warning","logger":"api","msg":"Slow request","service":"billing","request_id":42,)"
+            R"("latency":1.5,"cached":false,"user":"a \"quoted\"\tname\u0001"})"
+            "\n");
+
+  stream->str("");
+  LOG_SEV_WITH_TO(logger, Info, Attribute("ratio", std::numeric_limits<double>::infinity())) << "x";
+  EXPECT_EQ(stream->str(),
+            R"({"level":"Info","logger":"api","msg":"x","service":"billing","ratio":null})"
+            "\n");
+}
+
+TEST(Attributes, Logfmt) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto logger = MakeStructuredLogger(stream, formatting::StructuredStyle::Logfmt);
+
+  LOG_SEV_WITH_TO(
+      logger, Error, Attribute("tenant", "acme"), Attribute("query", "a=b"), Attribute("empty", ""))
+      << "Request failed";
+  EXPECT_EQ(stream->str(), "level=Error msg=\"Request failed\" tenant=acme query=\"a=b\" empty=\"\"\n");
+}
+
+TEST(Attributes, StructuredBasicAttributes) {
+  static constexpr CallSite call_site("/src/main.cpp", "int main()", 12, Severity::Info);
+  Record record(BasicAttributes(Severity::Info, &call_site));
+  record.Attributes().basic_attributes.time_stamp = time::DateTime(2024, 3, 5, 12, 30, 15, 123456);
+  record.Bundle() << "Hello";
+
+  memory::MemoryBuffer<char> buffer;
+  formatting::StructuredFormatter(formatting::StructuredStyle::JsonLines)
+      .IncludeThread(false)
+      .Format(record, {}, buffer);
+  EXPECT_EQ(buffer.ToString(),
+            R"({"time":"2024-03-05T12:30:15.123456Z","level":"Info","file":"/src/main.cpp","line":12,)"
+            R"json("function":"int main()","msg":"Hello"})json"
+            "\n");
+
+  buffer.Clear();
+  formatting::StructuredFormatter(formatting::StructuredStyle::Logfmt, formatting::DateTimeLayout::Standard)
+      .IncludeThread(false)
+      .IncludeCallSite(false)
+      .Format(record, {}, buffer);
+  EXPECT_EQ(buffer.ToString(), "time=\"2024-03-05 12:30:15.123456\" level=Info msg=Hello\n");
+}
+
+TEST(Attributes, AsyncSinkCopiesStrings) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = AsyncSink::From<OstreamSink>(stream);
+  sink->SetFormatter(formatting::StructuredFormatter(formatting::StructuredStyle::Logfmt)
+                         .IncludeThread(false)
+                         .IncludeCallSite(false)
+                         .Copy());
+  {
+    Logger logger(sink);
+    logger.SetDoTimeStamp(false);
+    std::string service = "billing";
+    logger.SetAttribute({"service", service});
+    // Hold the sink lock so the consumer cannot format the record before the strings are overwritten.
+    auto locked_sink = sink->GetLockedSink();
+    std::string user = "alice";
+    LOG_SEV_WITH_TO(logger, Info, Attribute("user", user), Attribute::Interned("tenant", "acme")) << "Hi";
+    user = "bob, and long enough to need a new allocation";
+    service = "changed";
+  }
+  sink->Flush();
+  EXPECT_EQ(stream->str(), "level=Info msg=Hi service=billing user=alice tenant=acme\n");
+}
+
+}  // namespace Testing
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+namespace Testing {
+
+namespace {
+
+std::shared_ptr<BacktraceSink> MakeBacktraceSink(const std::shared_ptr<std::ostringstream>& stream,
+                                                 std::size_t capacity_per_thread = 4096) {
+  auto target = UnlockedSink::From<OstreamSink>(stream);
+  target->SetFormatter(formatting::MakeMsgFormatter("[{}] {}", formatting::SeverityAttributeFormatter {},
+                                                    formatting::MSG));
+  return std::make_shared<BacktraceSink>(target, capacity_per_thread);
+}
+
+}  // namespace
+
+TEST(BacktraceSink, HoldsRecordsUntilTriggered) {
+  auto stream = std::make_shared<std::ostringstream>();
+  Logger logger(MakeBacktraceSink(stream));
+
+  LOG_SEV_TO(logger, Debug) << "Connecting to " << "host";
+  LOG_SEV_TO(logger, Info) << "Retrying, attempt " << 2;
+  EXPECT_EQ(stream->str(), "");
+
+  LOG_SEV_TO(logger, Error) << "Connection failed";
+  EXPECT_EQ(stream->str(),
+            "[Debug  ] Connecting to host\n"
+            "[Info   ] Retrying, attempt 2\n"
+            "[Error  ] Connection failed\n");
+
+  // Records are only dumped once.
+  stream->str("");
+  LOG_SEV_TO(logger, Trace) << "After";
+  logger.GetCore()->DumpBacktrace();
+  EXPECT_EQ(stream->str(), "[Trace  ] After\n");
+  logger.GetCore()->DumpBacktrace();
+  EXPECT_EQ(stream->str(), "[Trace  ] After\n");
+}
+
+TEST(BacktraceSink, KeepsTheMostRecentRecords) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = MakeBacktraceSink(stream, 3);
+  sink->SetTrigger(SeveritySet({Severity::Fatal}));
+  Logger logger(sink);
+
+  for (int i = 0; i < 5; ++i) {
+    LOG_SEV_TO(logger, Debug) << i;
+  }
+  LOG_SEV_TO(logger, Error) << "Not a trigger";
+  EXPECT_EQ(stream->str(), "");
+  LOG_SEV_TO(logger, Fatal) << "Trigger";
+  EXPECT_EQ(stream->str(), "[Debug  ] 4\n[Error  ] Not a trigger\n[Fatal  ] Trigger\n");
+}
+
+TEST(BacktraceSink, MergesThreadsInTimeStampOrder) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = MakeBacktraceSink(stream);
+  sink->GetTarget().SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  auto core = std::make_shared<Core>();
+  core->AddSink(sink);
+
+  auto log_every_other = [&core](int first) {
+    for (int microsecond = first; microsecond < 20; microsecond += 2) {
+      BasicAttributes attributes(Severity::Debug);
+      attributes.time_stamp = time::DateTime(2024, 3, 5, 12, 30, 15, microsecond);
+      RecordDispatcher(core, attributes) << microsecond;
+    }
+  };
+  std::thread even(log_every_other, 0), odd(log_every_other, 1);
+  even.join();
+  odd.join();
+
+  core->DumpBacktrace();
+  std::string expected;
+  for (int microsecond = 0; microsecond < 20; ++microsecond) {
+    expected += std::to_string(microsecond) + "\n";
+  }
+  EXPECT_EQ(stream->str(), expected);
+}
+
+TEST(BacktraceSink, ReusesTheRingsOfExitedThreads) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = MakeBacktraceSink(stream, 2);
+  sink->GetTarget().SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  for (int i = 0; i < 3; ++i) {
+    std::thread([&logger, i] { LOG_SEV_TO(logger, Info) << "Thread " << i; }).join();
+  }
+  // The threads ran one after the other, so they all wrote to the same ring, which holds two records.
+  logger.GetCore()->DumpBacktrace();
+  EXPECT_EQ(stream->str(), "Thread 1\nThread 2\n");
+}
+
+TEST(BacktraceSink, Clone) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = MakeBacktraceSink(stream);
+  auto cloned_sink = sink->Clone();
+  ASSERT_TRUE(dynamic_cast<BacktraceSink*>(cloned_sink.get()));
+}
+
+#if LL_HAS_POSIX
+
+TEST(BacktraceSink, WritesRecordsWhenTheProcessCrashes) {
+  const auto path = TemporaryPath("backtrace-crash");
+  const auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_LE(0, fd);
+
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = MakeBacktraceSink(stream);
+  sink->SetCrashFileDescriptor(fd);
+  auto& core = Global::GetCore();
+  core->AddSink(sink);
+
+  Logger logger(core);
+  logger.SetDoTimeStamp(false).SetName("net");
+  SetThreadName("main");
+  LOG_SEV_TO(logger, Debug) << "Sent " << 42 << " bytes";
+  const auto line = __LINE__ - 1;
+  LOG_SEV_TO(logger, Warning) << "Slow reply";
+  LightningFlushAllHandler(SIGABRT);
+  core->ClearSinks();
+  SetThreadName("");
+  ::close(fd);
+
+  EXPECT_EQ(stream->str(), "");
+  const auto thread = "[" + std::to_string(GetThreadID()) + " main] net: ";
+  EXPECT_EQ(ReadFile(path),
+            formatting::Format("[Debug  ] {}Sent 42 bytes (UT_BacktraceSink.cpp:{})\n"
+                               "[Warning] {}Slow reply (UT_BacktraceSink.cpp:{})\n",
+                               thread, line, thread, line + 2));
+}
+
+#endif  // LL_HAS_POSIX
+
+}  // namespace Testing
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Benchmarking.h"
+
+using namespace lightning;
+using namespace lightning::benchmarking;
+using namespace std::string_literals;
+
+namespace Testing {
+
+TEST(Benchmarking, LatencyPercentiles) {
+  std::vector<double> samples;
+  for (int i = 1000; 0 < i; --i) {
+    samples.push_back(i);
+  }
+  auto stats = LatencyStats::FromSamples(samples);
+  EXPECT_EQ(stats.min, 1);
+  EXPECT_EQ(stats.p50, 500);
+  EXPECT_EQ(stats.p90, 900);
+  EXPECT_EQ(stats.p99, 990);
+  EXPECT_EQ(stats.p999, 999);
+  EXPECT_EQ(stats.max, 1000);
+  EXPECT_DOUBLE_EQ(stats.mean, 500.5);
+
+  std::vector<double> empty;
+  EXPECT_EQ(LatencyStats::FromSamples(empty).max, 0);
+}
+
+TEST(Benchmarking, StudentT) {
+  EXPECT_EQ(StudentT95(0), 0.);
+  EXPECT_DOUBLE_EQ(StudentT95(1), 12.706);
+  EXPECT_DOUBLE_EQ(StudentT95(4), 2.776);
+  EXPECT_DOUBLE_EQ(StudentT95(1000), 1.96);
+}
+
+TEST(Benchmarking, Run) {
+  Options options;
+  options.warmup_iterations = 10;
+  options.iterations = 100;
+  options.repetitions = 3;
+  options.latency_samples = 50;
+
+  std::atomic<std::size_t> calls {0};
+  auto result = benchmarking::Run("counting", 2, options, [&calls](std::size_t) { calls.fetch_add(1); });
+  EXPECT_EQ(calls.load(), 2 * (10 + 3 * 100 + 50));
+  EXPECT_EQ(result.name, "counting");
+  EXPECT_EQ(result.threads, 2);
+  ASSERT_EQ(result.rates.size(), 3);
+  EXPECT_LT(0, result.mean_rate);
+  EXPECT_LE(0, result.rate_ci95);
+  EXPECT_LE(result.latency.min, result.latency.p50);
+  EXPECT_LE(result.latency.p50, result.latency.p99);
+  EXPECT_LE(result.latency.p99, result.latency.max);
+  EXPECT_FALSE(result.counters);
+}
+
+TEST(Benchmarking, WriteJson) {
+  Result result;
+  result.name = "a \"quoted\" name";
+  result.threads = 4;
+  result.rates = {1, 2};
+  result.mean_rate = 1.5;
+
+  std::ostringstream out;
+  WriteJson(out, {result});
+  const auto json = out.str();
+  EXPECT_NE(json.find(R"("name": "a \"quoted\" name")"), std::string::npos);
+  EXPECT_NE(json.find(R"("threads": 4)"), std::string::npos);
+  EXPECT_NE(json.find(R"("rates": [1, 2])"), std::string::npos);
+  EXPECT_NE(json.find(R"("p99.9": 0)"), std::string::npos);
+  EXPECT_EQ(json.find("counters_per_call"), std::string::npos);
+}
+
+}  // namespace Testing
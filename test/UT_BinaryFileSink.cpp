@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+using namespace std::string_view_literals;
+
+namespace Testing {
+
+namespace {
+
+auto MakeFullFormatter() {
+  using namespace formatting;
+  return MakeMsgFormatter("[{}] [{}] [{}] [{}] [{}:{}] [{}] {}",
+                          SeverityAttributeFormatter {},
+                          DateTimeAttributeFormatter {},
+                          ThreadAttributeFormatter {},
+                          LoggerNameAttributeFormatter {},
+                          FileNameAttributeFormatter {true},
+                          FileLineAttributeFormatter {},
+                          FunctionNameAttributeFormatter {},
+                          MSG);
+}
+
+//! \brief Log the same messages to a text sink and a binary sink, and return the text and decoded binary log.
+template<typename Func_t>
+std::pair<std::string, std::string> LogAndDecode(const std::string& name, Func_t&& func, bool deferred) {
+  auto path = TemporaryPath(name, ".bin");
+  auto stream = std::make_shared<std::ostringstream>();
+  auto text_sink = UnlockedSink::From<OstreamSink>(stream);
+  text_sink->SetFormatter(MakeFullFormatter());
+
+  {
+    Logger logger(text_sink);
+    logger.GetCore()->AddSink(UnlockedSink::From<BinaryFileSink>(path));
+    logger.GetCore()->SetDeferredFormatting(deferred);
+    logger.SetName("binary-logger");
+    func(logger);
+  }
+
+  std::ostringstream decoded;
+  BinaryLogReader reader(path);
+  reader.DecodeTo(decoded, *MakeFullFormatter());
+  return {stream->str(), decoded.str()};
+}
+
+}  // namespace
+
+TEST(BinaryFileSink, RoundTrip) {
+  for (auto deferred : {false, true}) {
+    auto [text, decoded] = LogAndDecode(
+        "round-trip",
+        [](Logger& logger) {
+          std::string str = "a string that is too long for the small string optimization";
+          for (int i = 0; i < 3; ++i) {
+            LOG_SEV_TO(logger, Info) << "Int " << -42 << ", unsigned " << 42u << ", iteration " << i;
+          }
+          LOG_SEV_TO(logger, Warning) << "Float " << 1.5f << ", double " << 0.1 << ", bool " << true
+                                      << ", char " << 'c';
+          LOG_SEV_TO(logger, Error) << str << " " << std::string_view(str).substr(2, 6);
+          LOG_SEV_TO(logger, Debug) << "Point " << Point {1, 2} << " at "
+                                    << time::DateTime(2024, 3, 5, 12, 30, 15, 123456);
+          LOG_TO(logger) << "No severity";
+        },
+        deferred);
+    EXPECT_EQ(text, decoded) << "deferred = " << deferred;
+    EXPECT_EQ(std::count(decoded.begin(), decoded.end(), '\n'), 7);
+  }
+}
+
+TEST(BinaryFileSink, NoAttributes) {
+  auto path = TemporaryPath("no-attributes", ".bin");
+  auto core = std::make_shared<Core>();
+  core->AddSink(UnlockedSink::From<BinaryFileSink>(path));
+  RecordDispatcher(core, BasicAttributes(std::nullopt)) << "Just a message";
+  core.reset();
+
+  BinaryLogReader reader(path);
+  auto record = reader.Next();
+  ASSERT_TRUE(record);
+  const auto& basic = record->Attributes().basic_attributes;
+  EXPECT_FALSE(basic.level);
+  EXPECT_FALSE(basic.time_stamp);
+  EXPECT_FALSE(basic.call_site);
+  EXPECT_TRUE(basic.logger_name.empty());
+  EXPECT_EQ(basic.thread_id, GetThreadID());
+
+  memory::MemoryBuffer<char> buffer;
+  MakeMsgFormatter("{}", formatting::MSG)->Format(*record, {}, buffer);
+  EXPECT_EQ(std::string(buffer.Data(), buffer.Size()), "Just a message\n");
+  EXPECT_FALSE(reader.Next());
+}
+
+TEST(BinaryFileSink, ThreadNames) {
+  auto path = TemporaryPath("thread-names", ".bin");
+  auto core = std::make_shared<Core>();
+  core->AddSink(UnlockedSink::From<BinaryFileSink>(path));
+  ThreadID_t worker_id {};
+  std::thread([&] {
+    SetThreadName("binary-worker");
+    worker_id = GetThreadID();
+    RecordDispatcher(core, BasicAttributes(Severity::Info)) << "Named";
+  }).join();
+  RecordDispatcher(core, BasicAttributes(Severity::Info)) << "Unnamed";
+  core.reset();
+
+  BinaryLogReader reader(path);
+  auto named = reader.Next();
+  ASSERT_TRUE(named);
+  EXPECT_EQ(named->Attributes().basic_attributes.thread_id, worker_id);
+  EXPECT_EQ(named->Attributes().basic_attributes.thread_name, "binary-worker");
+  auto unnamed = reader.Next();
+  ASSERT_TRUE(unnamed);
+  EXPECT_EQ(unnamed->Attributes().basic_attributes.thread_id, GetThreadID());
+  EXPECT_TRUE(unnamed->Attributes().basic_attributes.thread_name.empty());
+  EXPECT_FALSE(reader.Next());
+}
+
+TEST(BinaryFileSink, StringsAreWrittenOnce) {
+  auto path = TemporaryPath("strings-written-once", ".bin");
+  auto sink = std::make_shared<UnlockedSink>(std::make_unique<BinaryFileSink>(path));
+  Logger logger(sink);
+  logger.SetName("once");
+  for (int i = 0; i < 10; ++i) {
+    LOG_SEV_TO(logger, Info) << "Message " << i;
+  }
+  // File name, function name, and logger name. The thread ID is a number, and this thread has no name.
+  auto& backend = dynamic_cast<BinaryFileSink&>(sink->GetBackend());
+  EXPECT_EQ(backend.GetStringCount(), 3);
+  EXPECT_EQ(backend.GetCallSiteCount(), 1);
+
+  // A second statement in the same file and function adds a call site, but no strings.
+  LOG_SEV_TO(logger, Warning) << "Another statement";
+  EXPECT_EQ(backend.GetStringCount(), 3);
+  EXPECT_EQ(backend.GetCallSiteCount(), 2);
+}
+
+TEST(BinaryFileSink, ReaderRejectsOtherFiles) {
+  auto path = TemporaryPath("not-binary", ".bin");
+  {
+    std::ofstream fout(path);
+    fout << "This is a text log\n";
+  }
+  EXPECT_THROW(BinaryLogReader {path}, LightningException);
+  EXPECT_THROW(BinaryLogReader {TemporaryPath("does-not-exist", ".bin")}, LightningException);
+}
+
+TEST(BinaryFileSink, AppendEncodedValidates) {
+  RefBundle bundle;
+  EXPECT_THROW(bundle.AppendEncoded("\x7f"), LightningException);
+  // A string entry whose size is larger than the remaining data.
+  EXPECT_THROW(bundle.AppendEncoded("\x08\x10\x00\x00\x00"
+                                      "abc"sv), LightningException);
+  EXPECT_FALSE(bundle.IsDeferredCapture());
+}
+
+TEST(BinaryFileSink, ReplayTo) {
+  auto path = TemporaryPath("replay", ".bin");
+  {
+    Logger logger(UnlockedSink::From<BinaryFileSink>(path));
+    for (int i = 0; i < 10; ++i) {
+      LOG_SEV_TO(logger, Info) << "Message " << i;
+    }
+    LOG_SEV_TO(logger, Error) << "An error";
+  }
+
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("[{}] {}", formatting::SeverityAttributeFormatter {}, formatting::MSG));
+  Core core;
+  core.AddSink(sink);
+  core.GetFilter().Accept({Severity::Error});
+
+  BinaryLogReader reader(path);
+  EXPECT_EQ(reader.ReplayTo(core, 4), 11);
+  EXPECT_EQ(stream->str(), "[Error  ] An error\n");
+  EXPECT_THROW(reader.ReplayTo(core, 0), LightningException);
+}
+
+TEST(DateTime, FromEpochMicroseconds) {
+  for (const auto& dt : {time::DateTime(1970, 1, 1),
+                         time::DateTime(2024, 2, 29, 23, 59, 59, 999999),
+                         time::DateTime(1969, 12, 31, 12, 0, 0, 1),
+                         time::DateTime(2100, 3, 1, 1, 2, 3, 4),
+                         time::DateTime(1600, 2, 29, 6, 30)}) {
+    EXPECT_EQ(time::DateTime::FromEpochMicroseconds(dt.EpochMicroseconds()), dt) << dt;
+  }
+  EXPECT_EQ(time::DateTime::FromEpochMicroseconds(0), time::DateTime(1970, 1, 1));
+}
+
+}  // namespace Testing
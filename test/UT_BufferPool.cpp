@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace lightning::memory;
+using namespace std::string_literals;
+
+namespace Testing {
+
+namespace {
+
+//! \brief A backend that keeps the messages it is given, taking over the buffers when it may.
+class KeepingSink : public SinkBackend {
+public:
+  std::vector<MemoryBuffer<char>> messages;
+  std::size_t num_copied = 0;
+
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override { return std::make_unique<KeepingSink>(); }
+
+private:
+  void dispatch(const BasicMemoryBuffer<char>& buffer, const Record&) override {
+    messages.emplace_back().Append(buffer);
+    ++num_copied;
+  }
+
+  void dispatchOwned(MemoryBuffer<char>& buffer, const Record&) override {
+    messages.push_back(std::move(buffer));
+  }
+};
+
+}  // namespace
+
+TEST(BufferPool, ReusesBuffers) {
+  auto& pool = BufferPool::Local();
+  const char* data = nullptr;
+  {
+    auto lease = pool.Acquire();
+    EXPECT_TRUE(lease->Empty());
+    AppendBuffer(*lease, std::string(3000, 'x'));
+    data = lease->Data();
+  }
+  const auto num_free = pool.GetNumFree();
+  EXPECT_LE(1u, num_free);
+  {
+    // The buffer comes back cleared, with the capacity it grew to.
+    auto lease = pool.Acquire();
+    EXPECT_EQ(pool.GetNumFree(), num_free - 1);
+    EXPECT_TRUE(lease->Empty());
+    EXPECT_EQ(lease->Data(), data);
+    EXPECT_LE(3000u, lease->Capacity());
+
+    // Leases can nest.
+    auto inner = pool.Acquire();
+    EXPECT_NE(inner->Data(), lease->Data());
+  }
+  EXPECT_LE(2u, pool.GetNumFree());
+}
+
+TEST(BufferPool, TrimsAboveTheHighWaterMark) {
+  auto& pool = BufferPool::Local();
+  const auto high_water_mark = pool.GetHighWaterMark();
+  pool.SetHighWaterMark(1024);
+  {
+    auto lease = pool.Acquire();
+    AppendBuffer(*lease, std::string(2000, 'x'));
+  }
+  {
+    auto lease = pool.Acquire();
+    EXPECT_EQ(lease->Capacity(), 256u);
+  }
+  pool.SetHighWaterMark(high_water_mark);
+}
+
+TEST(BufferPool, SinksKeepTheirCapacity) {
+  auto sink = UnlockedSink::From<TrivialDispatchSink>();
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+  LOG_SEV_TO(logger, Info) << std::string(4000, 'x');
+
+  auto lease = BufferPool::Local().Acquire();
+  EXPECT_LE(4000u, lease->Capacity());
+}
+
+TEST(BufferPool, BackendsMayTakeTheBuffer) {
+  for (auto sink : std::vector<std::shared_ptr<Sink>> {UnlockedSink::From<KeepingSink>(),
+                                                      SynchronousSink::From<KeepingSink>()}) {
+    sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+    Logger logger(sink);
+    LOG_SEV_TO(logger, Info) << "Short";
+    LOG_SEV_TO(logger, Info) << std::string(1000, 'x');
+
+    auto backend = sink->GetBackendAs<KeepingSink>();
+    ASSERT_EQ(backend->messages.size(), 2u);
+    EXPECT_EQ(backend->num_copied, 0u);
+    EXPECT_EQ(backend->messages[0].ToString(), "Short\n");
+    EXPECT_EQ(backend->messages[1].ToString(), std::string(1000, 'x') + "\n");
+
+    // The heap memory went with the message.
+    auto lease = BufferPool::Local().Acquire();
+    EXPECT_EQ(lease->Capacity(), 256u);
+  }
+}
+
+TEST(BufferPool, PreformattedMessagesAreNotTaken) {
+  auto core = std::make_shared<FormattingCore>(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  auto sink = UnlockedSink::From<KeepingSink>();
+  core->AddSink(sink);
+  Logger logger(core);
+  LOG_SEV_TO(logger, Info) << "Shared";
+
+  auto backend = sink->GetBackendAs<KeepingSink>();
+  ASSERT_EQ(backend->messages.size(), 1u);
+  EXPECT_EQ(backend->num_copied, 1u);
+  EXPECT_EQ(backend->messages[0].ToString(), "Shared\n");
+}
+
+TEST(MemoryBuffer, Reset) {
+  MemoryBuffer<char, 8> buffer;
+  AppendBuffer(buffer, "A longer string");
+  EXPECT_LT(8u, buffer.Capacity());
+  buffer.Reset();
+  EXPECT_TRUE(buffer.Empty());
+  EXPECT_EQ(buffer.Capacity(), 8u);
+  AppendBuffer(buffer, "Short");
+  EXPECT_EQ(buffer.ToString(), "Short");
+}
+
+}  // namespace Testing
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+namespace Testing {
+
+namespace {
+
+#if LL_HAS_ZLIB
+
+//! \brief Decompress a gzip file, which may hold several gzip members, one after the other.
+std::string Gunzip(const std::string& path) {
+  auto compressed = ReadFile(path);
+  z_stream stream {};
+  EXPECT_EQ(inflateInit2(&stream, 15 + 32), Z_OK);
+  std::string decompressed;
+  char buffer[4096];
+  stream.next_in = reinterpret_cast<Bytef*>(compressed.data());
+  stream.avail_in = static_cast<uInt>(compressed.size());
+  while (stream.avail_in != 0) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    const auto result = inflate(&stream, Z_NO_FLUSH);
+    decompressed.append(buffer, sizeof(buffer) - stream.avail_out);
+    if (result == Z_STREAM_END) {
+      inflateReset(&stream);
+    }
+    else if (result != Z_OK) {
+      ADD_FAILURE() << "the file is not valid gzip";
+      break;
+    }
+  }
+  inflateEnd(&stream);
+  return decompressed;
+}
+
+std::string NumberedLines(int first, int end) {
+  std::string lines;
+  for (int i = first; i < end; ++i) {
+    lines += "Line number " + std::to_string(i) + "\n";
+  }
+  return lines;
+}
+
+#endif  // LL_HAS_ZLIB
+
+}  // namespace
+
+TEST(CompressedFileSink, Availability) {
+  EXPECT_EQ(compression::IsAvailable(Compression::Gzip), static_cast<bool>(LL_HAS_ZLIB));
+  EXPECT_EQ(compression::IsAvailable(Compression::Lz4), static_cast<bool>(LL_HAS_LZ4));
+  EXPECT_EQ(compression::IsAvailable(Compression::Zstd), static_cast<bool>(LL_HAS_ZSTD));
+  EXPECT_EQ(compression::FileExtension(Compression::Zstd), ".zst");
+
+  for (auto compression : {Compression::Gzip, Compression::Lz4, Compression::Zstd}) {
+    if (!compression::IsAvailable(compression)) {
+      EXPECT_THROW(CompressedFileSink(TemporaryPath("compressed-unavailable"), compression), LightningException);
+    }
+  }
+}
+
+#if LL_HAS_ZLIB
+
+TEST(CompressedFileSink, Gzip) {
+  const auto path = TemporaryPath("compressed", ".log.gz");
+  {
+    // Small blocks, so the file is made of many gzip members.
+    auto sink = NewSink<CompressedFileSink>(path, Compression::Gzip, 1024);
+    sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+    Logger logger(sink);
+    for (int i = 0; i < 1000; ++i) {
+      LOG_SEV_TO(logger, Info) << "Line number " << i;
+    }
+    logger.Flush();
+
+    auto backend = sink->GetBackendAs<CompressedFileSink>();
+    ASSERT_TRUE(backend);
+    EXPECT_EQ(backend->GetBytesIn(), NumberedLines(0, 1000).size());
+    EXPECT_LT(backend->GetBytesOut(), backend->GetBytesIn());
+  }
+  EXPECT_EQ(Gunzip(path), NumberedLines(0, 1000));
+}
+
+TEST(CompressedFileSink, FlushesWhenTheFlushHandlerSaysSo) {
+  const auto path = TemporaryPath("compressed-flush", ".log.gz");
+  auto sink = NewSink<CompressedFileSink>(path, Compression::Gzip);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  sink->GetBackend().CreateFlushHandler<flush::FlushEveryN>(10);
+  Logger logger(sink);
+
+  for (int i = 0; i < 25; ++i) {
+    LOG_SEV_TO(logger, Info) << "Line number " << i;
+  }
+  // The last five lines are still in the block that is being filled.
+  EXPECT_EQ(Gunzip(path), NumberedLines(0, 20));
+}
+
+TEST(CompressedFileSink, WritesEverythingWhenDestroyed) {
+  const auto path = TemporaryPath("compressed-destroyed", ".log.gz");
+  {
+    auto sink = NewSink<CompressedFileSink>(path, Compression::Gzip, 64, 9, 1);
+    sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+    Logger logger(sink);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&logger, t] {
+        for (int i = 0; i < 250; ++i) {
+          LOG_SEV_TO(logger, Info) << "Line number " << t * 250 + i;
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  auto decompressed = Gunzip(path);
+  EXPECT_EQ(std::count(decompressed.begin(), decompressed.end(), '\n'), 1000);
+}
+
+#endif  // LL_HAS_ZLIB
+
+}  // namespace Testing
@@ -46,4 +46,336 @@ TEST(Core, FormattingCore) {
   EXPECT_EQ(stream2->str(), ">> Hello world!\n");
 }
 
-}  // namespace Testing
\ No newline at end of file
+TEST(Core, AcceptanceMaskTracksSinks) {
+  auto core = std::make_shared<Core>();
+  EXPECT_FALSE(core->WillAccept(Severity::Info));
+
+  auto sink = UnlockedSink::From<OstreamSink>(std::make_shared<std::ostringstream>());
+  core->AddSink(sink);
+  EXPECT_TRUE(core->WillAccept(Severity::Info));
+
+  core->ClearSinks();
+  EXPECT_FALSE(core->WillAccept(Severity::Info));
+}
+
+TEST(Core, AcceptanceMaskTracksFilters) {
+  auto sink1 = UnlockedSink::From<OstreamSink>(std::make_shared<std::ostringstream>());
+  auto sink2 = UnlockedSink::From<OstreamSink>(std::make_shared<std::ostringstream>());
+  auto core = std::make_shared<Core>();
+  core->AddSink(sink1).AddSink(sink2);
+  EXPECT_TRUE(core->WillAccept(Severity::Debug));
+  EXPECT_TRUE(core->WillAccept(std::nullopt));
+
+  // Modify the sinks' filters in place, after they have been added to the core.
+  sink1->GetFilter().Accept({Severity::Error});
+  sink2->SetFilter(Severity::Warning <= LoggingSeverity);
+  EXPECT_FALSE(core->WillAccept(Severity::Debug));
+  EXPECT_TRUE(core->WillAccept(Severity::Warning));
+  EXPECT_TRUE(core->WillAccept(Severity::Error));
+
+  sink2->GetFilter().AcceptNoSeverity(false);
+  EXPECT_TRUE(core->WillAccept(std::nullopt));
+  sink1->GetFilter().AcceptNoSeverity(false);
+  EXPECT_FALSE(core->WillAccept(std::nullopt));
+
+  // The core filter is and-ed with the union of the sink filters.
+  core->GetFilter().Accept({Severity::Error, Severity::Fatal});
+  EXPECT_FALSE(core->WillAccept(Severity::Warning));
+  EXPECT_TRUE(core->WillAccept(Severity::Error));
+
+  sink1->ClearFilters();
+  sink2->ClearFilters();
+  core->ClearFilters();
+  EXPECT_TRUE(core->WillAccept(Severity::Debug));
+  EXPECT_TRUE(core->WillAccept(std::nullopt));
+}
+
+TEST(Core, AcceptanceMaskRejectsRecords) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  LOG_SEV_TO(logger, Info) << "First";
+  sink->GetFilter().Accept({Severity::Error});
+  LOG_SEV_TO(logger, Info) << "Second";
+  LOG_SEV_TO(logger, Error) << "Third";
+  EXPECT_EQ(stream->str(), "First\nThird\n");
+}
+
+namespace {
+
+//! \brief Backend that records how its messages arrive.
+class BatchRecordingSink : public SinkBackend {
+public:
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    return std::make_unique<BatchRecordingSink>();
+  }
+
+  std::vector<std::size_t> batch_sizes;
+  std::string contents;
+  int num_pre_messages = 0, num_flushes = 0;
+
+private:
+  void dispatch(const memory::BasicMemoryBuffer<char>& buffer, const Record&) override {
+    contents += buffer.ToString();
+  }
+
+  void dispatchBatch(const std::vector<BatchEntry>& batch) override {
+    batch_sizes.push_back(batch.size());
+    SinkBackend::dispatchBatch(batch);
+  }
+
+  void preMessage() override { ++num_pre_messages; }
+
+  void flushLockFree() override { ++num_flushes; }
+};
+
+}  // namespace
+
+TEST(Core, DispatchBatch) {
+  auto core = std::make_shared<Core>();
+  auto all_sink = SynchronousSink::From<BatchRecordingSink>();
+  all_sink->SetFormatter(MakeMsgFormatter("[{}] {}", formatting::SeverityAttributeFormatter {}, formatting::MSG));
+  auto error_sink = UnlockedSink::From<BatchRecordingSink>();
+  error_sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  error_sink->GetFilter().Accept({Severity::Error});
+  error_sink->GetBackend().CreateFlushHandler<flush::FlushEveryN>(2);
+  core->AddSink(all_sink).AddSink(error_sink);
+  core->GetFilter().Accept({Severity::Info, Severity::Error});
+
+  std::vector<Record> records;
+  for (auto severity : {Severity::Info, Severity::Error, Severity::Debug, Severity::Error, Severity::Error}) {
+    records.emplace_back(BasicAttributes(severity));
+    records.back().Bundle() << "Message " << records.size();
+  }
+  std::vector<const Record*> batch;
+  for (auto& record : records) {
+    batch.push_back(&record);
+  }
+  core->DispatchBatch(batch);
+
+  auto& all = *all_sink->GetBackendAs<BatchRecordingSink>();
+  EXPECT_EQ(all.batch_sizes, std::vector<std::size_t>({4}));
+  EXPECT_EQ(all.num_pre_messages, 1);
+  EXPECT_EQ(all.contents, "[Info   ] Message 1\n[Error  ] Message 2\n[Error  ] Message 4\n[Error  ] Message 5\n");
+
+  auto& errors = *error_sink->GetBackendAs<BatchRecordingSink>();
+  EXPECT_EQ(errors.batch_sizes, std::vector<std::size_t>({3}));
+  EXPECT_EQ(errors.contents, "Message 2\nMessage 4\nMessage 5\n");
+
+  // The flush handler saw every record: the second one flushed the sink, and the next one will flush it again.
+  EXPECT_EQ(errors.num_flushes, 1);
+  core->DispatchBatch({&records[1]});
+  EXPECT_EQ(errors.num_flushes, 2);
+}
+
+TEST(Core, FormattingCoreDispatchBatch) {
+  auto core = std::make_shared<FormattingCore>(MakeMsgFormatter(">> {}", formatting::MSG));
+  auto stream = std::make_shared<std::ostringstream>();
+  core->AddSink(UnlockedSink::From<OstreamSink>(stream));
+
+  Record first{BasicAttributes(Severity::Info)}, second{BasicAttributes(Severity::Info)};
+  first.Bundle() << "First";
+  second.Bundle() << "Second";
+  core->DispatchBatch({&first, &second});
+  EXPECT_EQ(stream->str(), ">> First\n>> Second\n");
+}
+
+namespace {
+
+//! \brief Segment that counts how many times it has been formatted.
+struct CountingSegment : public BaseSegment {
+  explicit CountingSegment(int& count)
+      : count_(&count) {}
+
+  void CopyTo(SegmentStorage& storage) const override { storage.Create<CountingSegment>(*this); }
+
+private:
+  void addToBuffer(const FormattingSettings&,
+                   const formatting::MessageInfo&,
+                   memory::BasicMemoryBuffer<char>& buffer,
+                   const std::string_view&) const override {
+    ++*count_;
+    AppendBuffer(buffer, "counted");
+  }
+
+  int* count_;
+};
+
+}  // namespace
+
+TEST(Core, SinksShareFormattedMessage) {
+  auto core = std::make_shared<Core>();
+  std::shared_ptr<std::ostringstream> streams[3];
+  for (auto& stream : streams) {
+    stream = std::make_shared<std::ostringstream>();
+  }
+  auto plain = SynchronousSink::From<OstreamSink>(streams[0]);
+  plain->SetFormatter(MakeMsgFormatter("[{}] {}", formatting::SeverityAttributeFormatter {}, formatting::MSG));
+  auto other_plain = UnlockedSink::From<OstreamSink>(streams[1]);
+  other_plain->SetFormatter(MakeMsgFormatter("<{}>", formatting::MSG));
+  other_plain->GetBackend().GetFormattingSettings().message_terminator = "|";
+  auto colored = UnlockedSink::From<OstreamSink>(streams[2]);
+  colored->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  colored->GetBackend().GetFormattingSettings().has_virtual_terminal_processing = true;
+  core->AddSink(plain).AddSink(other_plain).AddSink(colored);
+  Logger logger(core);
+
+  // Two sinks share the plain message, the colored sink needs its own.
+  int count = 0;
+  LOG_SEV_TO(logger, Info) << "A " << CountingSegment {count} << " "
+                           << AnsiColor8Bit("red", formatting::AnsiForegroundColor::Red);
+  EXPECT_EQ(count, 2);
+  EXPECT_EQ(streams[0]->str(), "[Info   ] A counted red\n");
+  EXPECT_EQ(streams[1]->str(), "<A counted red>|");
+  EXPECT_EQ(streams[2]->str(), "A counted \x1b[31mred\x1b[0m\n");
+
+  // A message that depends on the header is formatted by each sink.
+  count = 0;
+  LOG_SEV_TO(logger, Info) << CountingSegment {count} << NewLineIndent << "next";
+  EXPECT_EQ(count, 3);
+  EXPECT_EQ(streams[0]->str(), "[Info   ] A counted red\n[Info   ] counted\n          next\n");
+}
+
+
+namespace {
+
+//! \brief Counts the records that are dispatched to it, and checks that it is still alive when they are.
+class CountingBackend : public SinkBackend {
+public:
+  explicit CountingBackend(std::shared_ptr<std::atomic<int>> count)
+      : count_(std::move(count)) {
+    settings_.needs_formatting = false;
+  }
+
+  ~CountingBackend() override { alive_ = false; }
+
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    return std::make_unique<CountingBackend>(count_);
+  }
+
+private:
+  void dispatch(const memory::BasicMemoryBuffer<char>&, const Record&) override {
+    EXPECT_TRUE(alive_);
+    count_->fetch_add(1);
+  }
+
+  std::shared_ptr<std::atomic<int>> count_;
+  bool alive_ = true;
+};
+
+}  // namespace
+
+TEST(Core, EpochDomainWaitsForReaders) {
+  auto& domain = concurrency::EpochDomain::Get();
+  std::atomic<bool> reading {false}, release {false}, synchronized {false};
+  std::thread reader([&] {
+    concurrency::EpochDomain::ReadSection section;
+    {
+      // Nested sections do not end the outer section.
+      concurrency::EpochDomain::ReadSection nested;
+    }
+    reading = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  while (!reading) {
+    std::this_thread::yield();
+  }
+  std::thread writer([&] {
+    domain.Synchronize();
+    synchronized = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(synchronized);
+  release = true;
+  reader.join();
+  writer.join();
+  EXPECT_TRUE(synchronized);
+
+  // Waiting from inside a read section could never finish.
+  concurrency::EpochDomain::ReadSection section;
+  EXPECT_TRUE(concurrency::EpochDomain::InReadSection());
+  EXPECT_THROW(domain.Synchronize(), LightningException);
+}
+
+TEST(Core, SetFilter) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  filter::AttributeFilter filter;
+  filter.Accept({Severity::Error});
+  logger.GetCore()->SetFilter(filter);
+  LOG_SEV_TO(logger, Info) << "Rejected";
+  LOG_SEV_TO(logger, Error) << "Accepted";
+  logger.GetCore()->ClearFilters();
+  LOG_SEV_TO(logger, Info) << "Accepted again";
+  EXPECT_EQ(stream->str(), "Accepted\nAccepted again\n");
+}
+
+TEST(Core, GetFilterPublishesACopy) {
+  auto core = std::make_shared<Core>();
+  core->AddSink(NewSink<TrivialDispatchSink, UnlockedSink>());
+  const auto& const_core = *core;
+
+  core->GetFilter().Accept({Severity::Error});
+  EXPECT_FALSE(core->WillAccept(Severity::Info));
+  EXPECT_TRUE(core->WillAccept(Severity::Error));
+  EXPECT_FALSE(const_core.GetFilter().WillAccept(Severity::Info));
+  {
+    auto editor = core->GetFilter();
+    editor.Accept({Severity::Info});
+    // Not published until the editor is done.
+    EXPECT_FALSE(core->WillAccept(Severity::Info));
+  }
+  EXPECT_TRUE(core->WillAccept(Severity::Info));
+  EXPECT_FALSE(core->WillAccept(Severity::Error));
+}
+
+TEST(Core, GetSinksIsASnapshot) {
+  auto core = std::make_shared<Core>();
+  core->AddSink(NewSink<TrivialDispatchSink, UnlockedSink>());
+  auto sinks = core->GetSinks();
+  core->ClearSinks();
+  ASSERT_EQ(sinks.size(), 1u);
+  EXPECT_TRUE(sinks[0]);
+  EXPECT_EQ(core->GetNumSinks(), 0u);
+}
+
+TEST(Core, ReconfigureWhileLogging) {
+  auto core = std::make_shared<Core>();
+  auto count = std::make_shared<std::atomic<int>>(0);
+  core->AddSink(UnlockedSink::From<CountingBackend>(count));
+  Logger logger(core);
+
+  std::atomic<bool> stop {false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      while (!stop) {
+        LOG_SEV_TO(logger, Info) << "Message";
+      }
+    });
+  }
+  // Sinks that are removed are destroyed while the other threads keep logging.
+  for (int i = 0; i < 200; ++i) {
+    core->ClearSinks();
+    core->AddSink(UnlockedSink::From<CountingBackend>(count));
+    core->AddSink(UnlockedSink::From<CountingBackend>(count));
+  }
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(core->GetNumSinks(), 2);
+
+  const auto before = count->load();
+  LOG_SEV_TO(logger, Info) << "Message";
+  EXPECT_EQ(count->load(), before + 2);
+}
+
+}  // namespace Testing
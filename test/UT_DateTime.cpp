@@ -32,6 +32,14 @@ TEST(DateTime, BasicDate) {
   }
 }
 
+TEST(DateTime, Constexpr) {
+  static constexpr DateTime leap_day(2024, 2, 29, 23, 59, 59, 999'999);
+  EXPECT_EQ(leap_day.GetDay(), 29);
+  EXPECT_EQ(leap_day.GetMicrosecond(), 999'999);
+  EXPECT_THROW(DateTime(2023, 2, 29), LightningException);
+  EXPECT_THROW(DateTime(2024, 2, 28, 24), LightningException);
+}
+
 TEST(DateTime, AddMicroseconds) {
   auto dt = DateTime::YMD_Time(2023'01'01, 0, 0, 0, 0);
 
@@ -72,6 +80,56 @@ TEST(DateTime, Streaming) {
   EXPECT_EQ(stream.str(), "2023-01-01 12:30:30.001000");
 }
 
+TEST(DateTimeAttributeFormatter, Layouts) {
+  auto format = [](const formatting::DateTimeAttributeFormatter& formatter, const DateTime& dt) {
+    RecordAttributes attributes;
+    attributes.basic_attributes.time_stamp = dt;
+    memory::MemoryBuffer<char> buffer;
+    formatter.AddToBuffer(attributes, {}, {}, buffer);
+    return std::string(buffer.Data(), buffer.Size());
+  };
+  using formatting::DateTimeAttributeFormatter;
+  using formatting::DateTimeLayout;
+
+  DateTime dt(2024, 3, 5, 12, 30, 15, 7'654);
+  EXPECT_EQ(format(DateTimeAttributeFormatter {}, dt), "2024-03-05 12:30:15.007654");
+  EXPECT_EQ(format(DateTimeAttributeFormatter {DateTimeLayout::Iso8601}, dt), "2024-03-05T12:30:15.007654Z");
+  EXPECT_EQ(format(DateTimeAttributeFormatter {DateTimeLayout::Milliseconds}, dt), "2024-03-05 12:30:15.007");
+  EXPECT_EQ(format(DateTimeAttributeFormatter {DateTimeLayout::EpochMicroseconds}, dt),
+            std::to_string(dt.EpochMicroseconds()));
+  EXPECT_EQ(format(DateTimeAttributeFormatter {"%d/%m/%Y %H%% %L"}, dt), "05/03/2024 12% 007");
+
+  EXPECT_THROW(DateTimeAttributeFormatter {"%Y-%q"}, LightningException);
+  EXPECT_THROW(DateTimeAttributeFormatter {"%Y%"}, LightningException);
+}
+
+TEST(DateTimeAttributeFormatter, CachesPerSecond) {
+  auto format = [](const formatting::DateTimeAttributeFormatter& formatter, const DateTime& dt) {
+    RecordAttributes attributes;
+    attributes.basic_attributes.time_stamp = dt;
+    memory::MemoryBuffer<char> buffer;
+    formatter.AddToBuffer(attributes, {}, {}, buffer);
+    return std::string(buffer.Data(), buffer.Size());
+  };
+  formatting::DateTimeAttributeFormatter standard, iso {formatting::DateTimeLayout::Iso8601};
+
+  // Interleave formatters and seconds, every result must match the uncached formatting.
+  for (int i = 0; i < 200; ++i) {
+    auto dt = AddMicroseconds(DateTime(2023, 12, 31, 23, 59, 59), static_cast<unsigned long long>(i) * 12'345);
+    char expected[26];
+    formatting::FormatDateTo(expected, expected + 26, dt);
+    EXPECT_EQ(format(standard, dt), std::string(expected, 26));
+    auto expected_iso = std::string(expected, 26) + "Z";
+    expected_iso[10] = 'T';
+    EXPECT_EQ(format(iso, dt), expected_iso);
+  }
+
+  // No time stamp, no text.
+  memory::MemoryBuffer<char> buffer;
+  standard.AddToBuffer(RecordAttributes {}, {}, {}, buffer);
+  EXPECT_TRUE(buffer.Empty());
+}
+
 //TEST(DateTime, Formatting) {
 //  auto dt = DateTime::YMD_Time(2023'05'06, 13, 01, 15, 532000);
 //
@@ -81,4 +139,64 @@ TEST(DateTime, Streaming) {
 //  EXPECT_EQ(Format(dt, "%I:%M:%S %p"), "01:01:15 PM");
 //}
 
+TEST(TimeSource, MatchesSystemClock) {
+  for (auto clock : {ClockSource::System, ClockSource::RealtimeCoarse, ClockSource::Tsc}) {
+    TimeSource source(clock);
+    EXPECT_EQ(source.GetClock(), TimeSource::IsAvailable(clock) ? clock : ClockSource::System);
+
+    for (int i = 0; i < 100; ++i) {
+      const auto before = DateTime::Now().EpochMicroseconds();
+      const auto now = source.Now().EpochMicroseconds();
+      const auto after = DateTime::Now().EpochMicroseconds();
+      // The coarse clock can lag by a tick, and the TSC by its calibration error.
+      EXPECT_LE(before - 20'000, now);
+      EXPECT_LE(now, after + 20'000);
+    }
+  }
+}
+
+TEST(TimeSource, ConvertsOncePerSecond) {
+  TimeSource source;
+  const auto start = source.GetUpdateCount();
+  for (int i = 0; i < 10'000; ++i) {
+    [[maybe_unused]] auto dt = source.Now();
+  }
+  // At most one update for the first time stamp, and one for crossing into the next second.
+  EXPECT_LE(source.GetUpdateCount() - start, 2);
+}
+
+TEST(TimeSource, SharedBetweenThreads) {
+  TimeSource source;
+  std::atomic<int> failures {0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      std::int64_t last = 0;
+      for (int i = 0; i < 20'000; ++i) {
+        const auto now = source.Now().EpochMicroseconds();
+        if (now < last) {
+          ++failures;
+        }
+        last = now;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(failures, 0);
+}
+
+TEST(TimeSource, GeneratorUsesSource) {
+  TimeSource source;
+  FastDateGenerator generator(source);
+  EXPECT_EQ(&generator.GetTimeSource(), &source);
+  EXPECT_EQ(&FastDateGenerator {}.GetTimeSource(), &TimeSource::Global());
+
+  const auto start = source.GetUpdateCount();
+  [[maybe_unused]] auto dt = generator.CurrentTime();
+  EXPECT_LE(start, source.GetUpdateCount());
+  EXPECT_LT(0u, source.GetUpdateCount());
+}
+
 } // namespace Testing
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+namespace Testing {
+
+namespace {
+
+struct Ostreamable {
+  int value;
+};
+
+std::ostream& operator<<(std::ostream& stream, const Ostreamable& obj) {
+  return stream << "Ostreamable(" << obj.value << ")";
+}
+
+//! \brief Log the same message through a core with and without deferred formatting.
+template<typename Func_t>
+std::pair<std::string, std::string> LogBothWays(Func_t&& func, bool colors = false) {
+  std::string outputs[2];
+  for (auto deferred : {false, true}) {
+    auto stream = std::make_shared<std::ostringstream>();
+    auto sink = UnlockedSink::From<OstreamSink>(stream);
+    sink->SetFormatter(MakeMsgFormatter("[{}] {}", formatting::SeverityAttributeFormatter {}, formatting::MSG));
+    sink->GetBackend().GetFormattingSettings().has_virtual_terminal_processing = colors;
+    Logger logger(sink);
+    logger.GetCore()->SetDeferredFormatting(deferred);
+    func(logger);
+    outputs[deferred] = stream->str();
+  }
+  return {outputs[0], outputs[1]};
+}
+
+}  // namespace
+
+TEST(DeferredFormatting, SimpleTypes) {
+  auto [immediate, deferred] = LogBothWays([](Logger& logger) {
+    std::string str = "a string that is too long for the small string optimization";
+    std::string_view view = "a string view";
+    char buffer[] = "a char buffer";
+    LOG_SEV_TO(logger, Info) << "Int " << -42 << ", unsigned " << 42u << ", long long "
+                             << std::numeric_limits<long long>::min() << ", unsigned long long "
+                             << std::numeric_limits<unsigned long long>::max();
+    LOG_SEV_TO(logger, Warning) << "Float " << 1.5f << ", double " << 0.1 << ", bool " << true << ", char "
+                                << 'c' << ", short " << static_cast<short>(-3);
+    LOG_SEV_TO(logger, Error) << str << " " << view << " " << buffer;
+    LOG_SEV_TO(logger, Info) << time::DateTime(2024, 3, 5, 12, 30, 15, 123456);
+  });
+  EXPECT_EQ(immediate, deferred);
+  EXPECT_EQ(deferred,
+            "[Info   ] Int -42, unsigned 42, long long -9223372036854775808, unsigned long long "
+            "18446744073709551615\n"
+            "[Warning] Float 1.5, double 0.1, bool true, char c, short -3\n"
+            "[Error  ] a string that is too long for the small string optimization a string view a char buffer\n"
+            "[Info   ] 2024-03-05 12:30:15.123456\n");
+}
+
+TEST(DeferredFormatting, MixedWithSegments) {
+  auto [immediate, deferred] = LogBothWays(
+      [](Logger& logger) {
+        LOG_SEV_TO(logger, Info) << "Point " << Point {1, 2} << " is "
+                                 << AnsiColor8Bit("colored", formatting::AnsiForegroundColor::Red) << " and "
+                                 << Ostreamable {7} << "." << NewLineIndent << "Next line " << 8;
+      },
+      true);
+  EXPECT_EQ(immediate, deferred);
+}
+
+TEST(DeferredFormatting, SetOnBundle) {
+  auto core = std::make_shared<Core>();
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  core->AddSink(sink);
+
+  {
+    RecordDispatcher dispatcher(core, BasicAttributes(Severity::Info));
+    EXPECT_FALSE(dispatcher.GetRecord().Bundle().IsDeferredCapture());
+  }
+  core->SetDeferredFormatting(true);
+  {
+    RecordDispatcher dispatcher(core, BasicAttributes(Severity::Info));
+    EXPECT_TRUE(dispatcher.GetRecord().Bundle().IsDeferredCapture());
+    dispatcher << "Value: " << 3.25;
+  }
+  EXPECT_EQ(stream->str(), "\nValue: 3.25\n");
+}
+
+TEST(DeferredFormatting, AsyncSink) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = AsyncSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+  logger.GetCore()->SetDeferredFormatting(true);
+
+  {
+    auto locked_sink = sink->GetLockedSink();
+    char buffer[] = "original";
+    LOG_SEV_TO(logger, Info) << buffer << " " << 1 << " " << AnsiColor8Bit(2, formatting::AnsiForegroundColor::Red);
+    std::strcpy(buffer, "changed");
+  }
+  logger.Flush();
+  EXPECT_EQ(stream->str(), "original 1 2\n");
+}
+
+}  // namespace Testing
@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+#if LL_HAS_POSIX
+
+namespace Testing {
+
+TEST(FastFileSink, BuffersUntilFlush) {
+  auto path = TemporaryPath("buffers-until-flush");
+  auto sink = UnlockedSink::From<FastFileSink>(path);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  for (int i = 0; i < 3; ++i) {
+    LOG_SEV_TO(logger, Info) << "Message " << i;
+  }
+  auto backend = dynamic_cast<FastFileSink*>(&sink->GetBackend());
+  ASSERT_TRUE(backend);
+  EXPECT_EQ(backend->GetWriteCount(), 0);
+  EXPECT_EQ(backend->GetBufferedSize(), 30);
+  EXPECT_EQ(ReadFile(path), "");
+
+  logger.Flush();
+  EXPECT_EQ(backend->GetWriteCount(), 1);
+  EXPECT_EQ(backend->GetBufferedSize(), 0);
+  EXPECT_EQ(ReadFile(path), "Message 0\nMessage 1\nMessage 2\n");
+}
+
+TEST(FastFileSink, WritesWhenFull) {
+  auto path = TemporaryPath("writes-when-full");
+  {
+    auto sink = std::make_shared<UnlockedSink>(std::make_unique<FastFileSink>(path, 25));
+    sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+    Logger logger(sink);
+    auto backend = dynamic_cast<FastFileSink*>(&sink->GetBackend());
+    ASSERT_TRUE(backend);
+
+    LOG_SEV_TO(logger, Info) << "Message 0";  // 10 bytes
+    LOG_SEV_TO(logger, Info) << "Message 1";  // 20 bytes
+    EXPECT_EQ(backend->GetWriteCount(), 0);
+    // Does not fit, written together with the buffered messages.
+    LOG_SEV_TO(logger, Info) << "Message 2";
+    EXPECT_EQ(backend->GetWriteCount(), 1);
+    EXPECT_EQ(backend->GetBufferedSize(), 0);
+    EXPECT_EQ(ReadFile(path), "Message 0\nMessage 1\nMessage 2\n");
+
+    // Larger than the whole buffer.
+    LOG_SEV_TO(logger, Info) << "A message that is larger than the buffer";
+    EXPECT_EQ(backend->GetWriteCount(), 2);
+    LOG_SEV_TO(logger, Info) << "Last";
+  }
+  // Flushed on destruction.
+  EXPECT_EQ(ReadFile(path), "Message 0\nMessage 1\nMessage 2\nA message that is larger than the buffer\nLast\n");
+}
+
+TEST(FastFileSink, MaxAge) {
+  auto path = TemporaryPath("max-age");
+  auto sink = std::make_shared<UnlockedSink>(
+      std::make_unique<FastFileSink>(path, 1024, std::chrono::milliseconds(20), SyncPolicy::OnFlush));
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+  auto backend = dynamic_cast<FastFileSink*>(&sink->GetBackend());
+  ASSERT_TRUE(backend);
+
+  LOG_SEV_TO(logger, Info) << "First";
+  EXPECT_EQ(backend->GetWriteCount(), 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  LOG_SEV_TO(logger, Info) << "Second";
+  EXPECT_EQ(backend->GetWriteCount(), 1);
+  EXPECT_EQ(ReadFile(path), "First\nSecond\n");
+}
+
+TEST(FastFileSink, FlushHandlerAndAppend) {
+  auto path = TemporaryPath("flush-handler");
+  {
+    std::ofstream fout(path);
+    fout << "Existing\n";
+  }
+  auto sink = UnlockedSink::From<FastFileSink>(path);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  sink->GetBackend().CreateFlushHandler<flush::FlushEveryN>(2);
+  Logger logger(sink);
+  auto backend = dynamic_cast<FastFileSink*>(&sink->GetBackend());
+  ASSERT_TRUE(backend);
+
+  for (int i = 0; i < 5; ++i) {
+    LOG_SEV_TO(logger, Info) << i;
+  }
+  EXPECT_EQ(backend->GetWriteCount(), 2);
+  EXPECT_EQ(ReadFile(path), "Existing\n0\n1\n2\n3\n");
+
+  auto cloned = sink->Clone();
+  ASSERT_TRUE(dynamic_cast<FastFileSink*>(&cloned->GetBackend()));
+}
+
+TEST(FastFileSink, BadPath) {
+  EXPECT_THROW(FastFileSink("/this/path/does/not/exist/log.txt"), std::runtime_error);
+}
+
+TEST(FastFileSink, DispatchBatch) {
+  auto path = TemporaryPath("dispatch-batch");
+  auto sink = std::make_shared<SynchronousSink>(std::make_unique<FastFileSink>(path, 32));
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  auto core = std::make_shared<Core>();
+  core->AddSink(sink);
+  auto backend = sink->GetBackendAs<FastFileSink>();
+  ASSERT_TRUE(backend);
+
+  std::vector<Record> records(10);
+  std::vector<const Record*> batch;
+  for (std::size_t i = 0; i < records.size(); ++i) {
+    records[i].Bundle() << "Message " << i;
+    batch.push_back(&records[i]);
+  }
+  // A small batch fits in the buffer.
+  core->DispatchBatch({batch.begin(), batch.begin() + 2});
+  EXPECT_EQ(backend->GetWriteCount(), 0);
+  EXPECT_EQ(backend->GetBufferedSize(), 20);
+
+  // The rest does not, and is written together with the buffered messages in a single writev.
+  core->DispatchBatch({batch.begin() + 2, batch.end()});
+  EXPECT_EQ(backend->GetWriteCount(), 1);
+  EXPECT_EQ(backend->GetBufferedSize(), 0);
+  EXPECT_EQ(ReadFile(path),
+            "Message 0\nMessage 1\nMessage 2\nMessage 3\nMessage 4\n"
+            "Message 5\nMessage 6\nMessage 7\nMessage 8\nMessage 9\n");
+}
+
+}  // namespace Testing
+
+#endif  // LL_HAS_POSIX
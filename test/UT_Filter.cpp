@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+using namespace lightning::filter;
+using namespace std::string_view_literals;
+
+namespace Testing {
+
+namespace {
+
+RecordAttributes MakeAttributes(std::optional<Severity> severity,
+                                std::string_view logger_name = {},
+                                const CallSite* call_site = nullptr) {
+  RecordAttributes attributes(BasicAttributes(severity, call_site));
+  attributes.basic_attributes.logger_name = logger_name;
+  return attributes;
+}
+
+std::shared_ptr<Sink> MakeSink(const std::shared_ptr<std::ostringstream>& stream) {
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  return sink;
+}
+
+//! \brief A test defined the way user code can define tests, by overriding only Accepts.
+class LoggerNameLengthIs : public AttributeTest {
+  friend class ImplBase;
+
+protected:
+  class Impl : public AttributeTest::Impl {
+  public:
+    explicit Impl(std::size_t length)
+        : length(length) {}
+    NO_DISCARD bool Accepts(const RecordAttributes& attributes) const override {
+      return attributes.basic_attributes.logger_name.size() == length;
+    }
+    std::size_t length;
+  };
+
+public:
+  explicit LoggerNameLengthIs(std::size_t length)
+      : AttributeTest(std::make_shared<Impl>(length)) {}
+};
+
+}  // namespace
+
+TEST(Filter, UserDefinedTest) {
+  AttributeFilter filter;
+  filter.Require(LoggerNameLengthIs(3) && HasSeverity(Severity::Info <= LoggingSeverity));
+  EXPECT_TRUE(filter.WillAccept(MakeAttributes(Severity::Info, "abc")));
+  EXPECT_FALSE(filter.WillAccept(MakeAttributes(Severity::Info, "abcd")));
+  EXPECT_FALSE(filter.WillAccept(MakeAttributes(Severity::Debug, "abc")));
+  // The severity part is still folded into the acceptance mask.
+  EXPECT_FALSE(filter.WillAccept(Severity::Debug));
+  EXPECT_TRUE(filter.WillAccept(Severity::Error));
+}
+
+TEST(Filter, Program) {
+  Program program;
+  // (severity is Error or higher) || (logger name is "net" && !(logger name starts with "net."))
+  const auto error_or_fatal =
+      static_cast<std::uint32_t>(Severity::Error) | static_cast<std::uint32_t>(Severity::Fatal);
+  program.Emit(Program::Op::Severity, error_or_fatal)
+      .Emit(Program::Op::LoggerName, "net"sv)
+      .Emit(Program::Op::LoggerNamePrefix, "net."sv)
+      .Emit(Program::Op::Not)
+      .Emit(Program::Op::And)
+      .Emit(Program::Op::Or)
+      .Finish();
+  EXPECT_EQ(program.GetCode().size(), 6);
+  EXPECT_EQ(program.GetStrings().size(), 2);
+
+  EXPECT_TRUE(program.Run(MakeAttributes(Severity::Error)));
+  EXPECT_TRUE(program.Run(MakeAttributes(Severity::Info, "net")));
+  EXPECT_FALSE(program.Run(MakeAttributes(Severity::Info, "disk")));
+  EXPECT_FALSE(program.Run(MakeAttributes(std::nullopt)));
+
+  EXPECT_TRUE(program.AlwaysAccepts(Severity::Fatal));
+  EXPECT_FALSE(program.AlwaysAccepts(Severity::Info));
+  EXPECT_TRUE(program.MayAccept(Severity::Info));
+}
+
+TEST(Filter, ProgramErrors) {
+  Program unbalanced;
+  EXPECT_THROW(unbalanced.Emit(Program::Op::And), LightningException);
+  unbalanced.Emit(Program::Op::LoggerName, "a"sv).Emit(Program::Op::LoggerName, "b"sv);
+  EXPECT_THROW(unbalanced.Finish(), LightningException);
+
+  Program deep;
+  for (std::size_t i = 0; i < Program::max_depth; ++i) {
+    deep.Emit(Program::Op::LoggerName, "a"sv);
+  }
+  EXPECT_THROW(deep.Emit(Program::Op::LoggerName, "a"sv), LightningException);
+}
+
+TEST(Filter, SeverityAnalysis) {
+  AttributeFilter both;
+  both.Require(HasSeverity(Severity::Error <= LoggingSeverity) && LoggerNameIs("net"));
+  EXPECT_FALSE(both.WillAccept(Severity::Info));
+  EXPECT_TRUE(both.WillAccept(Severity::Error));
+  EXPECT_FALSE(both.WillAccept(std::nullopt));
+
+  AttributeFilter either;
+  either.Require(HasSeverity(Severity::Error <= LoggingSeverity, true) || LoggerNameIs("net"));
+  EXPECT_TRUE(either.WillAccept(Severity::Info));
+  ASSERT_TRUE(either.GetProgram());
+  EXPECT_TRUE(either.GetProgram()->AlwaysAccepts(std::nullopt));
+
+  // Requirements are and-ed together.
+  either.Require(!HasSeverity(Severity::Debug <= LoggingSeverity));
+  EXPECT_FALSE(either.WillAccept(Severity::Info));
+  EXPECT_TRUE(either.WillAccept(Severity::Trace));
+  EXPECT_FALSE(either.WillAccept(MakeAttributes(Severity::Trace, "disk")));
+  EXPECT_TRUE(either.WillAccept(MakeAttributes(Severity::Trace, "net")));
+}
+
+TEST(Filter, TreeAndProgramAgree) {
+  static constexpr CallSite call_site("/src/net/socket.cpp", "void net::Socket::Send()", 10);
+  const auto test = (LoggerNameStartsWith("net") || FilePathStartsWith("/src/disk/"))
+                    && !FunctionNameStartsWith("void net::Socket::Close");
+  AttributeFilter filter;
+  filter.Require(test);
+  for (const auto& attributes : {MakeAttributes(Severity::Info, "net.tcp"),
+                                 MakeAttributes(Severity::Info, "disk", &call_site),
+                                 MakeAttributes(Severity::Info, "network", &call_site),
+                                 MakeAttributes(Severity::Info)})
+  {
+    EXPECT_EQ(test.Accepts(attributes), filter.WillAccept(attributes));
+  }
+  EXPECT_TRUE(filter.WillAccept(MakeAttributes(Severity::Info, "net.tcp", &call_site)));
+  EXPECT_FALSE(filter.WillAccept(MakeAttributes(Severity::Info, "disk", &call_site)));
+}
+
+TEST(Filter, Attributes) {
+  const AttributeList logger_attributes = [] {
+    AttributeList list;
+    list.Set({"tenant", "acme"});
+    return list;
+  }();
+  auto attributes = MakeAttributes(Severity::Info);
+  attributes.attributes.Set({"request_id", 42});
+
+  AttributeFilter filter;
+  filter.Require(HasAttribute("request_id") && AttributeIs("tenant", "acme"));
+  EXPECT_FALSE(filter.WillAccept(attributes));
+  attributes.basic_attributes.logger_attributes = &logger_attributes;
+  EXPECT_TRUE(filter.WillAccept(attributes));
+
+  // The record's attributes take precedence over the logger's.
+  attributes.attributes.Set({"tenant", "other"});
+  EXPECT_FALSE(filter.WillAccept(attributes));
+  attributes.attributes.Set({"tenant", 1});
+  EXPECT_FALSE(filter.WillAccept(attributes));
+}
+
+TEST(Filter, SinksByLoggerName) {
+  auto net_stream = std::make_shared<std::ostringstream>();
+  auto net_sink = MakeSink(net_stream);
+  net_sink->GetFilter().Require(LoggerNameIs("net"));
+  auto other_stream = std::make_shared<std::ostringstream>();
+  auto other_sink = MakeSink(other_stream);
+  other_sink->GetFilter().Require(!LoggerNameIs("net"));
+
+  auto core = std::make_shared<Core>();
+  core->AddSink(net_sink).AddSink(other_sink);
+  Logger net(core), disk(core);
+  net.SetName("net");
+  disk.SetName("disk");
+
+  LOG_SEV_TO(net, Info) << "net message";
+  LOG_SEV_TO(disk, Info) << "disk message";
+  EXPECT_EQ(net_stream->str(), "net message\n");
+  EXPECT_EQ(other_stream->str(), "disk message\n");
+}
+
+TEST(Filter, AcceptanceMaskRejectsEarly) {
+  auto sink = MakeSink(std::make_shared<std::ostringstream>());
+  sink->GetFilter().Require(HasSeverity(Severity::Warning <= LoggingSeverity) && LoggerNameStartsWith("net"));
+  Logger logger(sink);
+  EXPECT_FALSE(logger.WillAccept(Severity::Info));
+  EXPECT_TRUE(logger.WillAccept(Severity::Warning));
+
+  int evaluated = 0;
+  LOG_SEV_TO(logger, Info) << ++evaluated;
+  EXPECT_EQ(evaluated, 0);
+}
+
+TEST(Filter, EachFilterRunsOncePerRecord) {
+  int runs = 0;
+  AttributeFilter filter;
+  filter.Require(Predicate([&runs](const RecordAttributes&) {
+    ++runs;
+    return true;
+  }));
+
+  auto streams = std::vector {std::make_shared<std::ostringstream>(), std::make_shared<std::ostringstream>()};
+  auto core = std::make_shared<Core>();
+  for (auto& stream : streams) {
+    auto sink = MakeSink(stream);
+    // Copies of a filter share its program.
+    sink->GetFilter() = filter;
+    core->AddSink(sink);
+  }
+  Logger logger(core);
+
+  LOG_SEV_TO(logger, Info) << "Hello";
+  EXPECT_EQ(runs, 1);
+  EXPECT_EQ(streams[0]->str(), "Hello\n");
+  EXPECT_EQ(streams[1]->str(), "Hello\n");
+
+  // A filter that changes between opening and dispatching the record is run again.
+  {
+    auto handler = LOG_HANDLER_FOR(logger, Info);
+    handler << "World";
+    core->GetSinks()[1]->GetFilter().Accept({Severity::Error});
+  }
+  EXPECT_EQ(runs, 3);
+  EXPECT_EQ(streams[0]->str(), "Hello\nWorld\n");
+  EXPECT_EQ(streams[1]->str(), "Hello\n");
+}
+
+}  // namespace Testing
@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+namespace Testing {
+
+namespace {
+
+//! \brief A backend that only counts how often it was flushed.
+class FlushCountingSink : public SinkBackend {
+public:
+  NO_DISCARD std::size_t GetFlushCount() const { return flush_count_; }
+
+  NO_DISCARD std::unique_ptr<SinkBackend> Clone() const override {
+    return std::make_unique<FlushCountingSink>();
+  }
+
+private:
+  void dispatch(const memory::BasicMemoryBuffer<char>&, const Record&) override {}
+
+  void flush() override { ++flush_count_; }
+
+  std::atomic<std::size_t> flush_count_ {};
+};
+
+Record MakeRecord(Severity severity) {
+  Record record;
+  record.Attributes().basic_attributes.level = severity;
+  return record;
+}
+
+}  // namespace
+
+TEST(FlushHandler, FlushEveryN) {
+  flush::FlushEveryN handler(3);
+  const auto record = MakeRecord(Severity::Info);
+  std::string flushes;
+  for (int i = 0; i < 7; ++i) {
+    flushes += handler.DoFlush(record) ? '1' : '0';
+  }
+  EXPECT_EQ(flushes, "0010010");
+}
+
+TEST(FlushHandler, FlushEveryN_Threads) {
+  flush::FlushEveryN handler(10);
+  const auto record = MakeRecord(Severity::Info);
+  std::atomic<int> flushes {0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 1000; ++i) {
+        flushes += handler.DoFlush(record);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(flushes, 400);
+}
+
+TEST(FlushHandler, FlushAfterBytes) {
+  flush::FlushAfterBytes handler(100);
+  const auto record = MakeRecord(Severity::Info);
+  EXPECT_FALSE(handler.DoFlush(record, 60));
+  EXPECT_TRUE(handler.DoFlush(record, 40));
+  // The count started again after the flush.
+  EXPECT_FALSE(handler.DoFlush(record, 99));
+  EXPECT_TRUE(handler.DoFlush(record, 500));
+  // Without the message size, nothing is counted.
+  EXPECT_FALSE(handler.DoFlush(record));
+
+  EXPECT_THROW(flush::FlushAfterBytes(0), LightningException);
+}
+
+TEST(FlushHandler, FlushAfterBytes_Sink) {
+  auto sink = UnlockedSink::From<FlushCountingSink>();
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  sink->GetBackend().CreateFlushHandler<flush::FlushAfterBytes>(25);
+  Logger logger(sink);
+  auto backend = sink->GetBackendAs<FlushCountingSink>();
+
+  LOG_SEV_TO(logger, Info) << "Message 0";  // 10 bytes
+  LOG_SEV_TO(logger, Info) << "Message 1";  // 20 bytes
+  EXPECT_EQ(backend->GetFlushCount(), 0u);
+  LOG_SEV_TO(logger, Info) << "Message 2";  // 30 bytes
+  EXPECT_EQ(backend->GetFlushCount(), 1u);
+}
+
+TEST(FlushHandler, FlushAfterInterval) {
+  flush::FlushAfterInterval handler(std::chrono::milliseconds(20));
+  const auto record = MakeRecord(Severity::Info);
+  EXPECT_FALSE(handler.DoFlush(record));
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_TRUE(handler.DoFlush(record));
+  EXPECT_FALSE(handler.DoFlush(record));
+
+  // A clone starts its own interval.
+  auto cloned = handler.Clone();
+  EXPECT_FALSE(cloned.DoFlush(record));
+}
+
+TEST(FlushHandler, FlushOnSeverity) {
+  flush::FlushOnSeverity handler(SeveritySet({Severity::Error, Severity::Fatal}));
+  EXPECT_FALSE(handler.DoFlush(MakeRecord(Severity::Info)));
+  EXPECT_TRUE(handler.DoFlush(MakeRecord(Severity::Error)));
+  EXPECT_TRUE(handler.DoFlush(MakeRecord(Severity::Fatal), 10));
+  EXPECT_FALSE(handler.DoFlush(Record {}));
+}
+
+TEST(FlushHandler, Combinations) {
+  auto handler = flush::FlushAfterBytes(100) || flush::FlushOnSeverity(SeveritySet({Severity::Error}));
+  EXPECT_FALSE(handler.DoFlush(MakeRecord(Severity::Info), 50));
+  EXPECT_TRUE(handler.DoFlush(MakeRecord(Severity::Error), 10));
+  // The byte count is passed through the disjunction.
+  EXPECT_TRUE(handler.DoFlush(MakeRecord(Severity::Info), 40));
+}
+
+TEST(BackgroundFlusher, FlushesRegisteredSinks) {
+  auto sink = UnlockedSink::From<FlushCountingSink>();
+  auto backend = sink->GetBackendAs<FlushCountingSink>();
+  flush::BackgroundFlusher flusher;
+  flusher.Register(sink, std::chrono::milliseconds(5));
+  EXPECT_EQ(flusher.GetNumSinks(), 1u);
+
+  const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (backend->GetFlushCount() < 3 && std::chrono::steady_clock::now() < give_up) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_LE(3u, backend->GetFlushCount());
+
+  EXPECT_TRUE(flusher.Unregister(sink));
+  EXPECT_FALSE(flusher.Unregister(sink));
+  EXPECT_EQ(flusher.GetNumSinks(), 0u);
+}
+
+TEST(BackgroundFlusher, FlushesOnceMoreWhenStopped) {
+  auto sink = UnlockedSink::From<FlushCountingSink>();
+  auto backend = sink->GetBackendAs<FlushCountingSink>();
+  {
+    flush::BackgroundFlusher flusher;
+    flusher.Register(sink, std::chrono::hours(1));
+  }
+  EXPECT_EQ(backend->GetFlushCount(), 1u);
+}
+
+TEST(BackgroundFlusher, ForgetsDestroyedSinks) {
+  flush::BackgroundFlusher flusher;
+  {
+    auto sink = UnlockedSink::From<FlushCountingSink>();
+    flusher.Register(sink, std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(flusher.GetNumSinks(), 0u);
+  EXPECT_THROW(flusher.Register(nullptr, std::chrono::milliseconds(1)), LightningException);
+  EXPECT_THROW(flusher.Register(UnlockedSink::From<FlushCountingSink>(), std::chrono::milliseconds(0)),
+               LightningException);
+}
+
+}  // namespace Testing
@@ -54,6 +54,54 @@ TEST(Formatting, Integers) {
   EXPECT_EQ(formatting::Format("Print: {:L}X", 1'345'562), "Print: 1,345,562X");
 }
 
+TEST(Formatting, Floats) {
+  EXPECT_EQ(formatting::Format("{}", 3.14159), "3.14159");
+  EXPECT_EQ(formatting::Format("{:.3f}", 3.14159), "3.142");
+  EXPECT_EQ(formatting::Format("{:.0f}", 2.5), "2");
+  EXPECT_EQ(formatting::Format("{:f}", 0.5), "0.500000");
+  EXPECT_EQ(formatting::Format("{:e}", 1234.5), "1.234500e+03");
+  EXPECT_EQ(formatting::Format("{:.2E}", 0.000123), "1.23E-04");
+  EXPECT_EQ(formatting::Format("{:g}", 1e20), "1e+20");
+  EXPECT_EQ(formatting::Format("{:.3}", 1.0 / 3), "0.333");
+  EXPECT_EQ(formatting::Format("{:F}", std::numeric_limits<double>::infinity()), "INF");
+  EXPECT_EQ(formatting::Format("{:.2f}", 1.5f), "1.50");
+  // Fixed notation of a large number does not fit in the stack buffer.
+  EXPECT_EQ(formatting::Format("{:.2f}", 1e300).size(), 304u);
+}
+
+TEST(Formatting, FormatFloat_Alignment) {
+  {
+    memory::MemoryBuffer<char> buffer;
+    EXPECT_NO_THROW(FormatFloat(":8.2f", 3.14159, buffer));
+    EXPECT_EQ(buffer.ToString(), "3.14    ");
+  }
+  {
+    memory::MemoryBuffer<char> buffer;
+    EXPECT_NO_THROW(FormatFloat(":>8.2f", -3.14159, buffer));
+    EXPECT_EQ(buffer.ToString(), "   -3.14");
+  }
+  {
+    memory::MemoryBuffer<char> buffer;
+    EXPECT_NO_THROW(FormatFloat(":*^9.1f", 2.25, buffer));
+    EXPECT_EQ(buffer.ToString(), "***2.2***");
+  }
+  {
+    // The number is wider than the width.
+    memory::MemoryBuffer<char> buffer;
+    EXPECT_NO_THROW(FormatFloat(":>2", 1234.5, buffer));
+    EXPECT_EQ(buffer.ToString(), "1234.5");
+  }
+}
+
+TEST(Formatting, FormatFloat_Errors) {
+  memory::MemoryBuffer<char> buffer;
+  EXPECT_ANY_THROW(FormatFloat(":x", 1.5, buffer));
+  EXPECT_ANY_THROW(FormatFloat(":L", 1.5, buffer));
+  EXPECT_ANY_THROW(FormatFloat(":.f", 1.5, buffer));
+  // Integers have no precision.
+  EXPECT_ANY_THROW(FormatInteger(":.2", 12, buffer));
+}
+
 TEST(Formatting, Colors) {
   EXPECT_EQ(formatting::Format("When in {@RED}Rome{@RESET}, do as the {@GREEN}Greeks{@RESET} do."),
             "When in \033[31mRome\033[0m, do as the \033[32mGreeks\033[0m do.");
@@ -64,6 +112,37 @@ TEST(Formatting, Colors) {
 
 }
 
+TEST(Formatting, CompiledFormat) {
+  auto fmt = LL_FMT("A {} and {:>5}{@RED}!{@RESET} {{");
+  using Fmt_t = decltype(fmt);
+  static_assert(Fmt_t::NumSlots() == 2);
+  static_assert(Fmt_t::Literal(0) == "A ");
+  static_assert(Fmt_t::Literal(1) == " and ");
+  static_assert(Fmt_t::Literal(2) == "\033[31m!\033[0m {");
+  static_assert(Fmt_t::Spec(0).empty());
+  static_assert(Fmt_t::Spec(1) == ":>5");
+
+  EXPECT_EQ(formatting::Format(LL_FMT("No spaces!")), "No spaces!");
+  EXPECT_EQ(formatting::Format(LL_FMT("One {{space} {}"), 1), "One {space} 1");
+  EXPECT_EQ(formatting::Format(LL_FMT("{} + {} = {}"), 1, 2, 3), "1 + 2 = 3");
+  EXPECT_EQ(formatting::Format(LL_FMT("Richard {} York {} battle {:?} {:_^6}"), "of", std::string("gave"), "in",
+                               std::string_view("vain")),
+            "Richard of York gave battle \"in\" _vain_");
+  EXPECT_EQ(formatting::Format(LL_FMT("Print: {:L}X"), 1'345'562), "Print: 1,345,562X");
+  EXPECT_EQ(formatting::Format(LL_FMT("{}{}"), 1.5, 'c'), "1.5c");
+}
+
+TEST(Formatting, CompiledFormat_Colors) {
+  EXPECT_EQ(formatting::Format(LL_FMT("When in {@RED}Rome{@RESET}, do as the {@GREEN}Greeks{@RESET} do.")),
+            "When in \033[31mRome\033[0m, do as the \033[32mGreeks\033[0m do.");
+  EXPECT_EQ(formatting::Format(LL_FMT("When in {@REDR}Rome{@RRESET}, do as the {@BGREEN}Greeks{@RESET} do.")),
+            "When in {@REDR}Rome{@RRESET}, do as the \033[92mGreeks\033[0m do.");
+
+  // The compiled and runtime versions agree.
+  EXPECT_EQ(formatting::Format(LL_FMT("{@BLUE}{}{@DEFAULT} is {:x}, {@YELLOW"), "Value", 255),
+            formatting::Format("{@BLUE}{}{@DEFAULT} is {:x}, {@YELLOW", "Value", 255));
+}
+
 TEST(Formatting, FormatIntegerWithCommas) {
   {
     memory::MemoryBuffer<char> buffer;
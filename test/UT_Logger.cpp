@@ -124,6 +124,29 @@ TEST(Logger, LogHandler) {
   EXPECT_EQ(stream->str(), "ABC\n");
 }
 
+TEST(Logger, RecordsBorrowTheCore) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+  const auto use_count = logger.GetCore().use_count();
+  {
+    auto handle = LOG_HANDLER_FOR(logger, Info);
+    ASSERT_TRUE(handle);
+    EXPECT_EQ(logger.GetCore().use_count(), use_count);
+
+    // Moving a record moves where it is destined, so only one of the records dispatches.
+    Record moved = std::move(handle.GetRecord());
+    EXPECT_TRUE(moved);
+    EXPECT_FALSE(handle.GetRecord());
+    moved.Bundle() << "Moved";
+    moved.Dispatch();
+    EXPECT_FALSE(moved);
+  }
+  EXPECT_EQ(stream->str(), "Moved\n");
+  EXPECT_EQ(&Global::GetCore(), &Global::GetCore());
+}
+
 TEST(Logger, LogStringView) {
   auto stream = std::make_shared<std::ostringstream>();
   auto sink = UnlockedSink::From<OstreamSink>(stream);
@@ -136,4 +159,65 @@ TEST(Logger, LogStringView) {
   EXPECT_EQ(stream->str(), "Hello, world!\n");
 }
 
+TEST(Logger, CallSite) {
+  static constexpr CallSite call_site("/path/to/source.cpp", "void f()", 12, Severity::Warning);
+  static_assert(call_site.file_name_index == 9);
+  EXPECT_STREQ(call_site.FileName(), "source.cpp");
+  EXPECT_FALSE(CallSite().FileName());
+
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{} {} {}",
+                                                  formatting::FileNameAttributeFormatter{true},
+                                                  formatting::FileLineAttributeFormatter{},
+                                                  formatting::MSG));
+  Logger logger(sink);
+
+  // Each statement has one call site, which every record it logs points to.
+  for (int i = 0; i < 2; ++i) {
+    LOG_SEV_TO(logger, Info) << "A";
+    LOG_SEV_TO(logger, Info) << "B";
+  }
+  auto line = __LINE__ - 3;
+  EXPECT_EQ(stream->str(),
+            formatting::Format("UT_Logger.cpp {} A\nUT_Logger.cpp {} B\nUT_Logger.cpp {} A\nUT_Logger.cpp {} B\n",
+                               line, line + 1, line, line + 1));
+
+  auto handler = logger.LogAt(call_site);
+  ASSERT_TRUE(handler);
+  EXPECT_EQ(handler.GetRecord().Attributes().basic_attributes.call_site, &call_site);
+  EXPECT_EQ(handler.GetRecord().Attributes().basic_attributes.level, Severity::Warning);
+}
+
+#if defined(__GNUC__)
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+
+TEST(Logger, DeprecatedLocation) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}:{} {}",
+                                                  formatting::FileNameAttributeFormatter{true},
+                                                  formatting::FileLineAttributeFormatter{},
+                                                  formatting::MSG));
+  Logger logger(sink);
+
+  logger.LogWithLocation(Severity::Info, "/src/file.cpp", "void f()", 7) << "Located";
+  EXPECT_EQ(stream->str(), "file.cpp:7 Located\n");
+
+  // Call sites are looked up by the pointers to the names, which is what the same literals give.
+  const char *file = "/src/file.cpp", *function = "void f()";
+  BasicAttributes first(Severity::Info, file, function, 7);
+  BasicAttributes second(Severity::Error, file, function, 7);
+  ASSERT_TRUE(first.call_site);
+  EXPECT_EQ(first.call_site, second.call_site);
+  EXPECT_STREQ(first.call_site->function_name, "void f()");
+  EXPECT_EQ(first.call_site->line_number, 7u);
+}
+
+#if defined(__GNUC__)
+#  pragma GCC diagnostic pop
+#endif
+
 } // namespace Testing
\ No newline at end of file
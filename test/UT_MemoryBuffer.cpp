@@ -50,4 +50,13 @@ TEST(MemoryBuffer, StringMemoryBuffer) {
   buffer.PushBack('D');
   EXPECT_EQ(buffer.Size(), 3);
 }
+
+TEST(MemoryBuffer, BufferStreambuf) {
+  MemoryBuffer<char, 10> buffer;
+  AppendBuffer(buffer, "x = ");
+  BufferStreambuf streambuf(buffer);
+  std::ostream stream(&streambuf);
+  stream << std::hex << 255 << ", " << std::string(20, 'y') << '!';
+  EXPECT_EQ(buffer.ToString(), "x = ff, yyyyyyyyyyyyyyyyyyyy!");
+}
 }
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+// The stand alone test is built with LL_ENABLE_METRICS=1, the complete test suite without it, so both the
+// collecting and the compiled out versions are checked.
+
+namespace Testing {
+
+TEST(Metrics, ShardedCounters) {
+  metrics::ShardedCounters<2> counters;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&counters] {
+      for (int i = 0; i < 10000; ++i) {
+        counters.Add(0);
+        counters.Add(1, 2);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(counters.Get(0), 40000);
+  EXPECT_EQ(counters.Get(1), 80000);
+  counters.Reset();
+  EXPECT_EQ(counters.Get(0), 0);
+  EXPECT_EQ(counters.Get(1), 0);
+}
+
+TEST(Metrics, SeveritySlots) {
+  EXPECT_EQ(metrics::SeveritySlot(Severity::Trace), 0);
+  EXPECT_EQ(metrics::SeveritySlot(Severity::Fatal), 6);
+  EXPECT_EQ(metrics::SeveritySlot(std::nullopt), 7);
+}
+
+TEST(Metrics, CoreAndSink) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  sink->GetFilter().Accept({Severity::Warning, Severity::Error});
+  Logger logger(sink);
+
+  for (int i = 0; i < 3; ++i) {
+    LOG_SEV_TO(logger, Info) << "Rejected " << i;
+  }
+  LOG_SEV_TO(logger, Warning) << "Accepted";
+  LOG_SEV_TO(logger, Warning) << "Accepted";
+  LOG_SEV_TO(logger, Error) << "Accepted";
+  logger.Flush();
+
+  auto stats = logger.GetCore()->GetStats();
+  ASSERT_EQ(stats.sinks.size(), 1);
+  auto& sink_stats = stats.sinks[0];
+  if (metrics::enabled) {
+    EXPECT_EQ(stats.GetRejected(Severity::Info), 3);
+    EXPECT_EQ(stats.GetAccepted(Severity::Warning), 2);
+    EXPECT_EQ(stats.GetAccepted(Severity::Error), 1);
+    EXPECT_EQ(stats.TotalAccepted(), 3);
+    EXPECT_EQ(stats.TotalRejected(), 3);
+
+    EXPECT_EQ(sink_stats.records, 3);
+    EXPECT_EQ(sink_stats.bytes_formatted, stream->str().size());
+    EXPECT_EQ(sink_stats.backend.dispatch_count, 3);
+    EXPECT_LE(1, sink_stats.backend.flush_count);
+  }
+  else {
+    EXPECT_EQ(stats.TotalAccepted(), 0);
+    EXPECT_EQ(stats.TotalRejected(), 0);
+    EXPECT_EQ(sink_stats.records, 0);
+    EXPECT_EQ(sink_stats.bytes_formatted, 0);
+    EXPECT_EQ(sink_stats.backend.dispatch_count, 0);
+  }
+  EXPECT_EQ(sink_stats.queue_capacity, 0);
+}
+
+TEST(Metrics, SynchronousSinkLockWait) {
+  auto sink = NewSink<EmptySink, SynchronousSink>();
+  Logger logger(sink);
+
+  std::thread logging_thread;
+  {
+    auto locked_sink = sink->GetLockedSink();
+    logging_thread = std::thread([&logger] { LOG_SEV_TO(logger, Info) << "Waits for the lock"; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  logging_thread.join();
+
+  auto stats = sink->GetStats();
+  if (metrics::enabled) {
+    EXPECT_EQ(stats.records, 1);
+    EXPECT_LE(10'000'000u, stats.lock_wait_ns);
+  }
+  else {
+    EXPECT_EQ(stats.lock_wait_ns, 0);
+  }
+}
+
+TEST(Metrics, AsyncSinkQueue) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = std::make_shared<AsyncSink>(std::make_unique<OstreamSink>(stream), 4, OverflowPolicy::DropNewest);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  {
+    auto locked_sink = sink->GetLockedSink();
+    for (int i = 0; i < 10; ++i) {
+      LOG_SEV_TO(logger, Info) << i;
+    }
+    auto stats = locked_sink->GetStats();
+    EXPECT_EQ(stats.queue_depth, 4);
+    EXPECT_EQ(stats.queue_capacity, 4);
+    EXPECT_EQ(stats.dropped, 6);
+  }
+  logger.Flush();
+
+  auto stats = sink->GetStats();
+  EXPECT_EQ(stats.queue_depth, 0);
+  EXPECT_EQ(stats.records, metrics::enabled ? 4 : 0);
+}
+
+}  // namespace Testing
@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+// The stand alone test is built with LL_MIN_SEVERITY=Info, the complete test suite without a minimum severity.
+
+namespace Testing {
+
+namespace {
+
+int Evaluate(int& count) {
+  return ++count;
+}
+
+}  // namespace
+
+TEST(MinSeverity, IsCompiledIn) {
+  static_assert(IsCompiledIn(Severity::Fatal));
+  static_assert(IsCompiledIn(min_compiled_severity));
+  for (auto severity : ALL_SEVERITIES) {
+    EXPECT_EQ(IsCompiledIn(severity),
+              static_cast<SeverityInt_t>(min_compiled_severity) <= static_cast<SeverityInt_t>(severity));
+  }
+#ifdef LL_MIN_SEVERITY
+  EXPECT_EQ(min_compiled_severity, Severity::Info);
+  EXPECT_FALSE(IsCompiledIn(Severity::Debug));
+  EXPECT_TRUE(IsCompiledIn(Severity::Major));
+#else
+  EXPECT_EQ(min_compiled_severity, Severity::Trace);
+#endif
+}
+
+TEST(MinSeverity, StatementsBelowTheMinimumAreDiscarded) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  int count = 0;
+  LOG_SEV_TO(logger, Trace) << "Trace " << Evaluate(count);
+  LOG_SEV_TO(logger, Debug) << "Debug " << Evaluate(count);
+  LOG_SEV_TO(logger, Info) << "Info " << Evaluate(count);
+  LOG_SEV_TO(logger, Error) << "Error " << Evaluate(count);
+
+  if (IsCompiledIn(Severity::Debug)) {
+    EXPECT_EQ(count, 4);
+    EXPECT_EQ(stream->str(), "Trace 1\nDebug 2\nInfo 3\nError 4\n");
+  }
+  else {
+    EXPECT_EQ(count, 2);
+    EXPECT_EQ(stream->str(), "Info 1\nError 2\n");
+  }
+}
+
+TEST(MinSeverity, WorksAsAStatement) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+
+  for (int i = 0; i < 3; ++i)
+    LOG_SEV_TO(logger, Debug) << i;
+  LOG_SEV_TO(logger, Warning) << "done";
+  EXPECT_EQ(stream->str(), IsCompiledIn(Severity::Debug) ? "0\n1\n2\ndone\n" : "done\n");
+}
+
+}  // namespace Testing
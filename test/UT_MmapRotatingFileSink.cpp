@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+#if LL_HAS_POSIX
+
+namespace Testing {
+
+namespace {
+
+std::vector<std::filesystem::path> ListFiles(const std::filesystem::path& directory) {
+  std::vector<std::filesystem::path> files;
+  for (auto& entry : std::filesystem::directory_iterator(directory)) {
+    files.push_back(entry.path());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+void DispatchAt(Sink& sink, const time::DateTime& time_stamp, const std::string& message) {
+  Record record(BasicAttributes(Severity::Info));
+  record.Attributes().basic_attributes.time_stamp = time_stamp;
+  record.Bundle() << message;
+  sink.Dispatch(record);
+}
+
+}  // namespace
+
+TEST(MmapRotatingFileSink, Basic) {
+  auto directory = TemporaryDirectory("mmap-basic");
+  {
+    auto sink = UnlockedSink::From<MmapRotatingFileSink>((directory / "log").string(), 4096);
+    sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+    DispatchAt(*sink, time::DateTime(2024, 3, 5, 12, 30, 15), "First");
+    DispatchAt(*sink, time::DateTime(2024, 3, 5, 12, 30, 16), "Second");
+    sink->Flush();
+
+    auto backend = dynamic_cast<MmapRotatingFileSink*>(&sink->GetBackend());
+    ASSERT_TRUE(backend);
+    EXPECT_EQ(backend->GetFileCount(), 1);
+    EXPECT_EQ(backend->GetCurrentFilePath(), (directory / "log_20240305-123015.log").string());
+    // While the file is open, it has its full size.
+    EXPECT_EQ(std::filesystem::file_size(backend->GetCurrentFilePath()), 4096);
+  }
+  auto files = ListFiles(directory);
+  ASSERT_EQ(files.size(), 1);
+  EXPECT_EQ(ReadFile(files[0]), "First\nSecond\n");
+}
+
+TEST(MmapRotatingFileSink, RotateOnSize) {
+  auto directory = TemporaryDirectory("mmap-size");
+  {
+    auto sink = UnlockedSink::From<MmapRotatingFileSink>((directory / "log").string(), 16);
+    sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+    const time::DateTime time_stamp(2024, 3, 5, 12, 30, 15);
+    DispatchAt(*sink, time_stamp, "Message 0");  // 10 bytes
+    DispatchAt(*sink, time_stamp, "Message 1");  // Does not fit.
+    DispatchAt(*sink, time_stamp, "A message that is larger than a whole file");
+
+    auto backend = dynamic_cast<MmapRotatingFileSink*>(&sink->GetBackend());
+    ASSERT_TRUE(backend);
+    EXPECT_EQ(backend->GetFileCount(), 3);
+  }
+  auto files = ListFiles(directory);
+  ASSERT_EQ(files.size(), 3);
+  EXPECT_EQ(files[0].filename(), "log_20240305-123015.1.log");
+  EXPECT_EQ(files[1].filename(), "log_20240305-123015.2.log");
+  EXPECT_EQ(files[2].filename(), "log_20240305-123015.log");
+  EXPECT_EQ(ReadFile(files[2]), "Message 0\n");
+  EXPECT_EQ(ReadFile(files[0]), "Message 1\n");
+  EXPECT_EQ(ReadFile(files[1]), "A message that is larger than a whole file\n");
+}
+
+TEST(MmapRotatingFileSink, RotateOnTime) {
+  auto directory = TemporaryDirectory("mmap-time");
+  {
+    auto sink = UnlockedSink::From<MmapRotatingFileSink>(
+        (directory / "log").string(), 4096, std::chrono::hours(1));
+    sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+    DispatchAt(*sink, time::DateTime(2024, 3, 5, 12, 30, 15), "A");
+    DispatchAt(*sink, time::DateTime(2024, 3, 5, 12, 59, 59), "B");
+    DispatchAt(*sink, time::DateTime(2024, 3, 5, 13, 0, 0), "C");
+    DispatchAt(*sink, time::DateTime(2024, 3, 6, 1, 0, 0), "D");
+  }
+  auto files = ListFiles(directory);
+  ASSERT_EQ(files.size(), 3);
+  EXPECT_EQ(files[0].filename(), "log_20240305-123015.log");
+  EXPECT_EQ(files[1].filename(), "log_20240305-130000.log");
+  EXPECT_EQ(files[2].filename(), "log_20240306-010000.log");
+  EXPECT_EQ(ReadFile(files[0]), "A\nB\n");
+  EXPECT_EQ(ReadFile(files[1]), "C\n");
+  EXPECT_EQ(ReadFile(files[2]), "D\n");
+}
+
+TEST(MmapRotatingFileSink, Clone) {
+  auto directory = TemporaryDirectory("mmap-clone");
+  {
+    auto sink = UnlockedSink::From<MmapRotatingFileSink>((directory / "log").string(), 4096);
+    sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+    auto cloned = sink->Clone();
+    ASSERT_TRUE(dynamic_cast<MmapRotatingFileSink*>(&cloned->GetBackend()));
+
+    // The clone writes next to the original, without the two getting in each other's way.
+    DispatchAt(*sink, time::DateTime(2024, 3, 5, 12, 30, 15), "Original");
+    DispatchAt(*cloned, time::DateTime(2024, 3, 5, 12, 30, 16), "Clone");
+    DispatchAt(*sink, time::DateTime(2024, 3, 5, 12, 30, 17), "Original again");
+  }
+  auto files = ListFiles(directory);
+  ASSERT_EQ(files.size(), 2);
+  EXPECT_EQ(files[0].filename(), "log_20240305-123015.log");
+  EXPECT_EQ(files[1].filename(), "log_20240305-123016.log");
+  EXPECT_EQ(ReadFile(files[0]), "Original\nOriginal again\n");
+  EXPECT_EQ(ReadFile(files[1]), "Clone\n");
+}
+
+TEST(DateTime, EpochMicroseconds) {
+  EXPECT_EQ(time::DaysFromCivil(1970, 1, 1), 0);
+  EXPECT_EQ(time::DaysFromCivil(2000, 3, 1), 11017);
+  EXPECT_EQ(time::DateTime(1970, 1, 2, 0, 0, 1, 5).EpochMicroseconds(), 86'401'000'005);
+  EXPECT_EQ(time::DateTime(2024, 3, 5, 12, 30, 15).EpochMicroseconds(), 1'709'641'815'000'000);
+}
+
+}  // namespace Testing
+
+#endif  // LL_HAS_POSIX
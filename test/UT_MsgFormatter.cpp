@@ -39,6 +39,29 @@ TEST(MsgFormatter, Basic) {
   }
 }
 
+TEST(MsgFormatter, CompiledFormat) {
+  auto formatter = formatting::MsgFormatter(LL_FMT("{@BLUE}[{}]{@RESET} [{}] {{{}}"),
+                                            formatting::SeverityAttributeFormatter{},
+                                            formatting::DateTimeAttributeFormatter{},
+                                            formatting::MSG);
+
+  Record record;
+  record.Attributes().basic_attributes.level = Severity::Info;
+  record.Attributes().basic_attributes.time_stamp = time::DateTime(2023, 12, 31, 12, 49, 30, 100'000);
+  record.Bundle() << "Hello world!";
+
+  FormattingSettings sink_settings;
+  sink_settings.has_virtual_terminal_processing = false;
+  memory::MemoryBuffer<char> buffer;
+  formatter.Format(record, sink_settings, buffer);
+  EXPECT_EQ(buffer.ToString(), "\x1B[34m[Info   ]\x1B[0m [2023-12-31 12:49:30.100000] {Hello world!}\n");
+
+  auto copy = formatting::MakeMsgFormatter(LL_FMT("{}: {}"), formatting::SeverityAttributeFormatter{}, formatting::MSG);
+  buffer.Clear();
+  copy->Format(record, sink_settings, buffer);
+  EXPECT_EQ(buffer.ToString(), "Info   : Hello world!\n");
+}
+
 TEST(MsgFormatter, Default) {
   auto formatter = formatting::MakeStandardFormatter();
 
@@ -58,4 +58,44 @@ TEST(RecordFormatter, Basic) {
   }
 }
 
-}
\ No newline at end of file
+TEST(RecordFormatter, Thread) {
+  EXPECT_NE(GetThreadID(), 0u);
+  ThreadID_t other_id {};
+  std::thread([&other_id] { other_id = GetThreadID(); }).join();
+  EXPECT_NE(other_id, GetThreadID());
+
+  Record record(BasicAttributes(Severity::Info, nullptr, 1234));
+  auto format = [&record](const formatting::ThreadAttributeFormatter& formatter) {
+    memory::MemoryBuffer<char> buffer;
+    formatter.AddToBuffer(record.Attributes(), {}, {}, buffer);
+    return buffer.ToString();
+  };
+  EXPECT_EQ(format(formatting::ThreadAttributeFormatter {}), "1234");
+  EXPECT_EQ(format(formatting::ThreadAttributeFormatter {true, 6}), "1234  ");
+
+  record.Attributes().basic_attributes.thread_name = "worker";
+  EXPECT_EQ(format(formatting::ThreadAttributeFormatter {}), "worker");
+  EXPECT_EQ(format(formatting::ThreadAttributeFormatter {true, 8}), "worker  ");
+  EXPECT_EQ(format(formatting::ThreadAttributeFormatter {true, 3}), "worker");
+  EXPECT_EQ(format(formatting::ThreadAttributeFormatter {false}), "1234");
+}
+
+TEST(RecordFormatter, ThreadName) {
+  std::thread([] {
+    EXPECT_TRUE(GetThreadName().empty());
+    EXPECT_TRUE(BasicAttributes {}.thread_name.empty());
+
+    SetThreadName(std::string("io-") + "worker");
+    EXPECT_EQ(GetThreadName(), "io-worker");
+    BasicAttributes attributes;
+    EXPECT_EQ(attributes.thread_name, "io-worker");
+    EXPECT_EQ(attributes.thread_id, GetThreadID());
+
+    SetThreadName("");
+    EXPECT_TRUE(GetThreadName().empty());
+  }).join();
+  // Names are per thread.
+  EXPECT_TRUE(GetThreadName().empty());
+}
+
+}  // namespace Testing
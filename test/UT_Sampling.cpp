@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+using namespace std::chrono_literals;
+
+namespace Testing {
+
+namespace {
+
+Logger MakeLogger(const std::shared_ptr<std::ostringstream>& stream) {
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  return Logger(sink);
+}
+
+}  // namespace
+
+TEST(Sampling, EveryN) {
+  sampling::EveryN policy(3);
+  std::string decisions;
+  for (int i = 0; i < 7; ++i) {
+    decisions += policy.ShouldLog() ? 'Y' : 'n';
+  }
+  EXPECT_EQ(decisions, "YnnYnnY");
+  EXPECT_EQ(policy.TakeSuppressed(), 0);
+
+  sampling::EveryN reporting(3, true);
+  EXPECT_TRUE(reporting.ShouldLog());
+  EXPECT_EQ(reporting.TakeSuppressed(), 0);
+  EXPECT_FALSE(reporting.ShouldLog());
+  EXPECT_FALSE(reporting.ShouldLog());
+  EXPECT_TRUE(reporting.ShouldLog());
+  EXPECT_EQ(reporting.TakeSuppressed(), 2);
+
+  EXPECT_ANY_THROW(sampling::EveryN(0));
+}
+
+TEST(Sampling, FirstN) {
+  sampling::FirstN policy(2);
+  EXPECT_TRUE(policy.ShouldLog());
+  EXPECT_TRUE(policy.ShouldLog());
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_FALSE(policy.ShouldLog());
+  }
+}
+
+TEST(Sampling, EveryT) {
+  sampling::EveryT policy(10ms, true);
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(policy.ShouldLog(start));
+  EXPECT_FALSE(policy.ShouldLog(start + 1ms));
+  EXPECT_FALSE(policy.ShouldLog(start + 9ms));
+  EXPECT_TRUE(policy.ShouldLog(start + 10ms));
+  EXPECT_EQ(policy.TakeSuppressed(), 2);
+  EXPECT_EQ(policy.TakeSuppressed(), 0);
+  EXPECT_FALSE(policy.ShouldLog(start + 19ms));
+  EXPECT_TRUE(policy.ShouldLog(start + 25ms));
+  EXPECT_EQ(policy.TakeSuppressed(), 1);
+}
+
+TEST(Sampling, RateLimited) {
+  // Ten messages per second, in bursts of up to three.
+  sampling::RateLimited policy(10, 3, true);
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(policy.ShouldLog(start));
+  EXPECT_TRUE(policy.ShouldLog(start));
+  EXPECT_TRUE(policy.ShouldLog(start));
+  EXPECT_FALSE(policy.ShouldLog(start));
+  EXPECT_FALSE(policy.ShouldLog(start + 50ms));
+  // One token comes back every 100ms.
+  EXPECT_TRUE(policy.ShouldLog(start + 100ms));
+  EXPECT_FALSE(policy.ShouldLog(start + 150ms));
+  EXPECT_EQ(policy.TakeSuppressed(), 3);
+  // After a long pause, the bucket is full again, but holds no more than the burst size.
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(policy.ShouldLog(start + 10s));
+  }
+  EXPECT_FALSE(policy.ShouldLog(start + 10s));
+
+  EXPECT_ANY_THROW(sampling::RateLimited(0));
+  EXPECT_ANY_THROW(sampling::RateLimited(1, 0));
+}
+
+TEST(Sampling, ConcurrentEveryN) {
+  sampling::EveryN policy(10);
+  std::atomic<int> emitted {0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 2500; ++i) {
+        if (policy.ShouldLog()) {
+          emitted.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(emitted.load(), 1000);
+}
+
+TEST(Sampling, Macros) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto logger = MakeLogger(stream);
+
+  int evaluated = 0;
+  auto count = [&evaluated] { return ++evaluated; };
+  for (int i = 0; i < 5; ++i) {
+    LOG_EVERY_N_TO(logger, Info, 2) << "every " << i;
+    LOG_FIRST_N_TO(logger, Info, 2) << "first " << count();
+  }
+  // The streamed expressions of suppressed messages are not evaluated.
+  EXPECT_EQ(evaluated, 2);
+  EXPECT_EQ(stream->str(), "every 0\nfirst 1\nfirst 2\nevery 2\nevery 4\n");
+}
+
+TEST(Sampling, CallSitesHaveTheirOwnState) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto logger = MakeLogger(stream);
+
+  for (int i = 0; i < 2; ++i) {
+    LOG_FIRST_N_TO(logger, Info, 1) << "A" << i;
+    LOG_FIRST_N_TO(logger, Info, 1) << "B" << i;
+  }
+  EXPECT_EQ(stream->str(), "A0\nB0\n");
+}
+
+TEST(Sampling, RejectedMessagesDoNotCount) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto logger = MakeLogger(stream);
+  logger.GetCore()->GetFilter().Accept({Severity::Warning});
+
+  for (int i = 0; i < 3; ++i) {
+    LOG_FIRST_N_TO(logger, Info, 1) << "rejected " << i;
+  }
+  logger.GetCore()->GetFilter().Accept({Severity::Info});
+  for (int i = 0; i < 3; ++i) {
+    LOG_FIRST_N_TO(logger, Info, 1) << "accepted " << i;
+  }
+  EXPECT_EQ(stream->str(), "accepted 0\n");
+}
+
+TEST(Sampling, ReportSuppressed) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto logger = MakeLogger(stream);
+
+  for (int i = 0; i < 7; ++i) {
+    LOG_SAMPLED_TO(logger, Warning, sampling::EveryN(3, true)) << "message " << i;
+  }
+  EXPECT_EQ(stream->str(),
+            "message 0\n"
+            "[suppressed 2 messages] message 3\n"
+            "[suppressed 2 messages] message 6\n");
+}
+
+}  // namespace Testing
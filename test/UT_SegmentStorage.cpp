@@ -25,7 +25,22 @@ TEST(SegmentStorage, StackVsHeap) {
     container.Create<AnsiColor8Bit<int>>(55, formatting::AnsiForegroundColor::Green);
 
     EXPECT_FALSE(container.IsUsingBuffer());
+    EXPECT_FALSE(container.IsUsingArena());
   }
 }
 
+TEST(SegmentStorage, Arena) {
+  memory::ArenaScope scope;
+  scope.Open();
+  SegmentStorage container;
+  container.Create<AnsiColor8Bit<int>>(55, formatting::AnsiForegroundColor::Green);
+  EXPECT_FALSE(container.IsUsingBuffer());
+  EXPECT_TRUE(container.IsUsingArena());
+  EXPECT_TRUE(memory::ThreadArena::Local().Owns(container.Get()));
+
+  SegmentStorage moved(std::move(container));
+  EXPECT_TRUE(moved.IsUsingArena());
+  EXPECT_FALSE(container.IsUsingArena());
+}
+
 } // namespace Testing
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+using namespace lightning;
+using namespace std::string_literals;
+
+namespace Testing {
+
+namespace {
+
+//! \brief Merge a sink's files, returning the messages, one per line.
+std::string MergeMessages(const std::vector<std::string>& paths) {
+  auto formatter = formatting::MakeMsgFormatter("{}", formatting::MSG);
+  std::string merged;
+  memory::MemoryBuffer<char> buffer;
+  MergeBinaryLogs(paths, [&](const Record& record) {
+    buffer.Clear();
+    formatter->Format(record, {}, buffer);
+    merged += buffer.ToString();
+  });
+  return merged;
+}
+
+}  // namespace
+
+TEST(ShardedFileSink, GivesEachThreadItsOwnFile) {
+  const auto directory = TemporaryDirectory("sharded");
+  auto sink = std::make_shared<ShardedFileSink>((directory / "app.bin").string());
+  auto core = std::make_shared<Core>();
+  core->AddSink(sink);
+
+  // Every thread logs every fourth microsecond. The threads wait for each other before exiting, so no thread
+  // can take over the file of another.
+  constexpr int num_threads = 4;
+  std::atomic<int> done {0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&core, &done, t] {
+      for (int microsecond = t; microsecond < 400; microsecond += num_threads) {
+        BasicAttributes attributes(Severity::Info);
+        attributes.time_stamp = time::DateTime(2024, 3, 5, 12, 30, 15, microsecond);
+        RecordDispatcher(core, attributes) << "Message " << microsecond;
+      }
+      ++done;
+      while (done < num_threads) {
+        std::this_thread::yield();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  core->Flush();
+
+  const auto paths = sink->GetShardPaths();
+  ASSERT_EQ(paths.size(), 4u);
+  EXPECT_EQ(paths[0], (directory / "app.bin.0").string());
+  std::string expected;
+  for (int microsecond = 0; microsecond < 400; ++microsecond) {
+    expected += "Message " + std::to_string(microsecond) + "\n";
+  }
+  EXPECT_EQ(MergeMessages(paths), expected);
+}
+
+TEST(ShardedFileSink, ReusesTheFilesOfExitedThreads) {
+  const auto directory = TemporaryDirectory("sharded-reuse");
+  std::vector<std::string> paths;
+  {
+    auto sink = std::make_shared<ShardedFileSink>((directory / "app.bin").string());
+    Logger logger(sink);
+    for (int i = 0; i < 3; ++i) {
+      std::thread([&logger, i] { LOG_SEV_TO(logger, Info) << "Thread " << i; }).join();
+    }
+    paths = sink->GetShardPaths();
+  }
+  ASSERT_EQ(paths.size(), 1u);
+  EXPECT_EQ(MergeMessages(paths), "Thread 0\nThread 1\nThread 2\n");
+}
+
+TEST(ShardedFileSink, Clone) {
+  auto sink = std::make_shared<ShardedFileSink>(TemporaryPath("sharded-clone", ".bin"));
+  auto cloned_sink = sink->Clone();
+  ASSERT_TRUE(dynamic_cast<ShardedFileSink*>(cloned_sink.get()));
+}
+
+TEST(MergeBinaryLogs, KeepsTheOrderOfFilesForEqualTimeStamps) {
+  const auto directory = TemporaryDirectory("merge-binary-logs");
+  const auto first = (directory / "first.bin").string(), second = (directory / "second.bin").string();
+  {
+    auto log = [](const std::string& path, std::initializer_list<std::pair<int, std::string>> messages) {
+      Logger logger(NewSink<BinaryFileSink>(path));
+      for (auto& [microsecond, message] : messages) {
+        BasicAttributes attributes(Severity::Info);
+        attributes.time_stamp = time::DateTime(2024, 3, 5, 12, 30, 15, microsecond);
+        RecordDispatcher(logger.GetCore(), attributes) << message;
+      }
+    };
+    log(first, {{1, "a"}, {2, "b"}, {5, "c"}});
+    log(second, {{2, "x"}, {3, "y"}});
+  }
+  EXPECT_EQ(MergeMessages({second, first}), "a\nx\nb\ny\nc\n");
+  EXPECT_EQ(MergeMessages({first, second}), "a\nb\nx\ny\nc\n");
+  EXPECT_EQ(MergeMessages({}), "");
+}
+
+}  // namespace Testing
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+#include "setup/TestUtilities.h"
+
+#if LL_HAS_POSIX
+#  include <sys/wait.h>
+#endif
+
+using namespace lightning;
+using namespace std::string_literals;
+
+namespace Testing {
+
+#if LL_HAS_POSIX
+
+namespace {
+
+//! \brief Removes a test's shared memory segment before and after the test.
+class SegmentName {
+public:
+  explicit SegmentName(const std::string& name)
+      : name_("/lightning-test-" + name + "-" + std::to_string(::getpid())) {
+    ipc::Segment::Remove(name_);
+  }
+
+  ~SegmentName() { ipc::Segment::Remove(name_); }
+
+  NO_DISCARD const std::string& Get() const { return name_; }
+
+private:
+  std::string name_;
+};
+
+std::shared_ptr<SynchronousSink> MakeSink(const std::string& name,
+                                          std::uint32_t ring_count,
+                                          std::uint64_t capacity) {
+  auto sink = NewSink<SharedMemorySink>(name, ring_count, capacity);
+  sink->SetFormatter(formatting::MakeMsgFormatter("{}", formatting::MSG));
+  return sink;
+}
+
+void LogAt(Logger& logger, int microsecond, const std::string& message) {
+  BasicAttributes attributes(Severity::Info);
+  attributes.time_stamp = time::DateTime(2024, 3, 5, 12, 30, 15, microsecond);
+  RecordDispatcher(logger.GetCore(), attributes) << message;
+}
+
+std::string Collect(SharedMemoryCollector& collector) {
+  std::string collected;
+  collector.Poll([&collected](std::int64_t, std::string_view text) { collected += text; });
+  return collected;
+}
+
+}  // namespace
+
+TEST(SharedMemorySink, CollectsRecords) {
+  SegmentName name("collects");
+  SharedMemoryCollector collector(name.Get(), 2, 1024);
+  Logger logger(MakeSink(name.Get(), 2, 1024));
+
+  LOG_SEV_TO(logger, Info) << "First";
+  LOG_SEV_TO(logger, Info) << "Second";
+  EXPECT_EQ(Collect(collector), "First\nSecond\n");
+  EXPECT_EQ(Collect(collector), "");
+
+  // Wrap around the end of the ring a few times.
+  for (int round = 0; round < 20; ++round) {
+    std::string expected;
+    for (int i = 0; i < 5; ++i) {
+      const auto line = "Round " + std::to_string(round) + ", message " + std::to_string(i);
+      LOG_SEV_TO(logger, Info) << line;
+      expected += line + "\n";
+    }
+    EXPECT_EQ(Collect(collector), expected);
+  }
+
+  auto stats = collector.GetRingStats();
+  ASSERT_EQ(stats.size(), 2u);
+  EXPECT_EQ(stats[0].owner_pid, ::getpid());
+  EXPECT_EQ(stats[0].generation, 1u);
+  EXPECT_EQ(stats[0].dropped, 0u);
+  EXPECT_EQ(stats[0].collected, 102u);
+  EXPECT_EQ(stats[1].owner_pid, 0);
+}
+
+TEST(SharedMemorySink, MergesRingsByTimeStamp) {
+  SegmentName name("merges");
+  Logger first(MakeSink(name.Get(), 2, 4096)), second(MakeSink(name.Get(), 2, 4096));
+  for (int microsecond = 0; microsecond < 10; microsecond += 2) {
+    LogAt(first, microsecond, std::to_string(microsecond));
+    LogAt(second, microsecond + 1, std::to_string(microsecond + 1));
+  }
+
+  // The collector may be started after the producers.
+  SharedMemoryCollector collector(name.Get(), 2, 4096);
+  EXPECT_EQ(Collect(collector), "0\n1\n2\n3\n4\n5\n6\n7\n8\n9\n");
+}
+
+TEST(SharedMemorySink, DropsRecordsWhenTheRingIsFull) {
+  SegmentName name("drops");
+  auto sink = MakeSink(name.Get(), 1, 256);
+  Logger logger(sink);
+  SharedMemoryCollector collector(name.Get(), 1, 256);
+
+  // Each entry takes 16 bytes of header and 8 bytes of text, so the ring holds 10 of them.
+  for (int i = 0; i < 15; ++i) {
+    LOG_SEV_TO(logger, Info) << "Line " << i % 10;
+  }
+  EXPECT_EQ(sink->GetBackendAs<SharedMemorySink>()->GetDroppedCount(), 5u);
+  EXPECT_EQ(collector.GetRingStats()[0].dropped, 5u);
+  EXPECT_EQ(Collect(collector),
+            "Line 0\nLine 1\nLine 2\nLine 3\nLine 4\nLine 5\nLine 6\nLine 7\nLine 8\nLine 9\n");
+
+  // Once the collector caught up, there is room again.
+  LOG_SEV_TO(logger, Info) << "Later";
+  EXPECT_EQ(Collect(collector), "Later\n");
+}
+
+TEST(SharedMemorySink, TakesOverTheRingOfAProcessThatDied) {
+  SegmentName name("restarts");
+  SharedMemoryCollector collector(name.Get(), 1, 1024);
+
+  const auto child = ::fork();
+  ASSERT_LE(0, child);
+  if (child == 0) {
+    // Exit without destroying the sink, as if the process had crashed, so the ring is still marked as taken.
+    auto sink = new SharedMemorySink(name.Get(), 1, 1024);
+    const std::string_view message = "Before the restart\n";
+    memory::MemoryBuffer<char> buffer;
+    buffer.Append(message.data(), message.data() + message.size());
+    sink->Dispatch(buffer, Record {});
+    ::_exit(0);
+  }
+  int status = 0;
+  ASSERT_EQ(::waitpid(child, &status, 0), child);
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(collector.GetRingStats()[0].owner_pid, child);
+
+  {
+    Logger logger(MakeSink(name.Get(), 1, 1024));
+    LOG_SEV_TO(logger, Info) << "After the restart";
+    EXPECT_EQ(collector.GetRingStats()[0].owner_pid, ::getpid());
+    EXPECT_EQ(collector.GetRingStats()[0].generation, 2u);
+    EXPECT_EQ(Collect(collector), "Before the restart\nAfter the restart\n");
+
+    // Every ring is taken by a living process.
+    EXPECT_THROW(SharedMemorySink(name.Get(), 1, 1024), LightningException);
+  }
+  EXPECT_EQ(collector.GetRingStats()[0].owner_pid, 0);
+}
+
+TEST(SharedMemorySink, RejectsADifferentLayout) {
+  SegmentName name("layout");
+  SharedMemoryCollector collector(name.Get(), 2, 1024);
+  EXPECT_THROW(SharedMemorySink(name.Get(), 4, 1024), LightningException);
+  EXPECT_THROW(SharedMemorySink(name.Get(), 2, 2048), LightningException);
+}
+
+#endif  // LL_HAS_POSIX
+
+}  // namespace Testing
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+
+#include <random>
+
+using namespace lightning;
+
+namespace Testing {
+
+namespace {
+
+//! \brief Run a test with each supported instruction set, restoring the original one afterwards.
+template<typename Func_t>
+void ForEachIsa(Func_t&& func) {
+  const auto original = simd::GetIsa();
+  for (auto isa : {simd::Isa::Scalar, simd::Isa::SSE2, simd::Isa::AVX2, simd::Isa::NEON}) {
+    if (simd::IsSupported(isa)) {
+      simd::SetIsa(isa);
+      func(isa);
+    }
+  }
+  simd::SetIsa(original);
+}
+
+//! \brief Make a string of random characters, drawn mostly from the characters the kernels look for.
+std::string RandomString(std::mt19937& generator, std::size_t size, int special_percent) {
+  static constexpr char special[] = {'"', '\\', '\n', '\r', '\t', '\x1b', 'm'};
+  std::uniform_int_distribution<int> percent(0, 99), plain('a', 'l'), choose(0, sizeof(special) - 1);
+  std::string str(size, ' ');
+  for (auto& c : str) {
+    c = percent(generator) < special_percent ? special[choose(generator)] : static_cast<char>(plain(generator));
+  }
+  return str;
+}
+
+//! \brief The original, byte by byte, implementation.
+unsigned ReferenceCount(const std::string& str) {
+  unsigned count = 0;
+  bool in_escape = false;
+  for (auto c : str) {
+    if (c == '\x1b') {
+      in_escape = true;
+    }
+    if (!in_escape) {
+      ++count;
+    }
+    if (c == 'm') {
+      in_escape = false;
+    }
+  }
+  return count;
+}
+
+}  // namespace
+
+TEST(Simd, BestIsaIsSupported) {
+  EXPECT_TRUE(simd::IsSupported(simd::BestIsa()));
+  EXPECT_TRUE(simd::IsSupported(simd::Isa::Scalar));
+  EXPECT_EQ(simd::GetIsa(), simd::BestIsa());
+}
+
+TEST(Simd, KernelsMatchScalar) {
+  std::mt19937 generator(42);
+  ForEachIsa([&](simd::Isa isa) {
+    for (std::size_t size = 0; size < 150; ++size) {
+      for (auto special_percent : {0, 2, 30}) {
+        const auto str = RandomString(generator, size, special_percent);
+        // Check every offset, so loads are at every alignment.
+        for (std::size_t offset = 0; offset < std::min<std::size_t>(size, 33); offset += 3) {
+          const auto begin = str.data() + offset, end = str.data() + str.size();
+          for (auto c : {'\n', '\x1b', 'm'}) {
+            EXPECT_EQ(simd::FindByte(begin, end, c), simd::detail::findByteScalar(begin, end, c))
+                << "isa " << static_cast<int>(isa) << ", size " << size;
+            EXPECT_EQ(simd::FindLastByte(begin, end, c), simd::detail::findLastByteScalar(begin, end, c))
+                << "isa " << static_cast<int>(isa) << ", size " << size;
+          }
+          EXPECT_EQ(simd::FindDebugEscape(begin, end), simd::detail::findDebugEscapeScalar(begin, end))
+              << "isa " << static_cast<int>(isa) << ", size " << size;
+          EXPECT_EQ(simd::FindJsonEscape(begin, end), simd::detail::findJsonEscapeScalar(begin, end))
+              << "isa " << static_cast<int>(isa) << ", size " << size;
+        }
+      }
+    }
+  });
+}
+
+TEST(Simd, CountNonAnsiSequenceCharacters) {
+  std::mt19937 generator(7);
+  ForEachIsa([&](simd::Isa) {
+    for (std::size_t size : std::initializer_list<std::size_t> {0, 1, 15, 16, 17, 31, 32, 33, 100, 1000}) {
+      const auto str = RandomString(generator, size, 5);
+      EXPECT_EQ(formatting::CountNonAnsiSequenceCharacters(str.data(), str.data() + str.size()),
+                ReferenceCount(str));
+    }
+    const std::string colored = formatting::SetAnsiColorFmt(formatting::AnsiForegroundColor::Red)
+                                + "a long enough message, to use the vector kernels" + formatting::AnsiReset();
+    EXPECT_EQ(formatting::CountNonAnsiSequenceCharacters(colored.data(), colored.data() + colored.size()), 48);
+  });
+}
+
+TEST(Simd, DebugStringEscaping) {
+  ForEachIsa([&](simd::Isa) {
+    memory::MemoryBuffer<char> buffer;
+    formatting::detail::formatDebugString(
+        "A \"quoted\" string\twith\\escapes\r\nthat is long enough for the vector kernels", buffer);
+    EXPECT_EQ(std::string(buffer.Data(), buffer.Size()),
+              R"("A \"quoted\" string\twith\\escapes\r\nthat is long enough for the vector kernels")");
+
+    buffer.Clear();
+    formatting::detail::formatDebugString("", buffer);
+    EXPECT_EQ(std::string(buffer.Data(), buffer.Size()), R"("")");
+  });
+}
+
+TEST(Simd, JsonEscaping) {
+  ForEachIsa([&](simd::Isa) {
+    memory::MemoryBuffer<char> buffer;
+    formatting::detail::appendJsonEscaped(
+        "A \"quoted\" string\twith\\escapes\r\n, \x1b[31mcolors\x1b[0m, and a long enough tail", buffer);
+    EXPECT_EQ(std::string(buffer.Data(), buffer.Size()),
+              R"(A \"quoted\" string\twith\\escapes\r\n, \u001b[31mcolors\u001b[0m, and a long enough tail)");
+  });
+}
+
+TEST(Simd, MessageIndentation) {
+  ForEachIsa([&](simd::Isa) {
+    const std::string header = "first line\n[\x1b[31mInfo\x1b[0m] [a fairly long header, past sixteen] ";
+    formatting::MessageInfo msg_info {};
+    msg_info.total_length = static_cast<unsigned>(header.size());
+    EXPECT_EQ(formatting::CalculateMessageIndentation(header.data() + header.size(), msg_info),
+              ReferenceCount(header.substr(header.find('\n') + 1)));
+
+    const std::string no_newline = "[Info] [a header without any newlines in it] ";
+    msg_info.total_length = static_cast<unsigned>(no_newline.size());
+    EXPECT_EQ(formatting::CalculateMessageIndentation(no_newline.data() + no_newline.size(), msg_info),
+              no_newline.size());
+  });
+}
+
+}  // namespace Testing
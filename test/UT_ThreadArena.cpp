@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+// Other files.
+#include "Lightning/Lightning.h"
+
+using namespace lightning;
+using namespace lightning::memory;
+using namespace std::string_literals;
+
+namespace Testing {
+
+TEST(ThreadArena, OnlyServesInsideScope) {
+  auto& arena = ThreadArena::Local();
+  EXPECT_FALSE(arena.IsActive());
+  EXPECT_EQ(arena.Allocate(16, 8), nullptr);
+  {
+    ArenaScope scope;
+    EXPECT_FALSE(scope.IsOpen());
+    scope.Open();
+    EXPECT_TRUE(arena.IsActive());
+
+    auto ptr = arena.Allocate(16, 8);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_TRUE(arena.Owns(ptr));
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % 8, 0);
+    // Too large for a block.
+    EXPECT_EQ(arena.Allocate(arena.GetBlockSize() + 1, 1), nullptr);
+  }
+  EXPECT_FALSE(arena.IsActive());
+}
+
+TEST(ThreadArena, ScopesReleaseInBulk) {
+  auto& arena = ThreadArena::Local();
+  void *outer_ptr, *inner_ptr;
+  {
+    ArenaScope outer;
+    outer.Open();
+    outer_ptr = arena.Allocate(64, 8);
+    {
+      ArenaScope inner;
+      inner.Open();
+      inner_ptr = arena.Allocate(64, 8);
+      EXPECT_NE(outer_ptr, inner_ptr);
+    }
+    // The inner scope's memory is reused.
+    EXPECT_EQ(arena.Allocate(64, 8), inner_ptr);
+  }
+  ArenaScope scope;
+  scope.Open();
+  EXPECT_EQ(arena.Allocate(64, 8), outer_ptr);
+}
+
+TEST(ThreadArena, Suspend) {
+  auto& arena = ThreadArena::Local();
+  ArenaScope scope;
+  scope.Open();
+  {
+    ArenaSuspend suspend;
+    EXPECT_FALSE(arena.IsActive());
+    EXPECT_EQ(arena.Allocate(16, 8), nullptr);
+  }
+  EXPECT_TRUE(arena.IsActive());
+}
+
+TEST(ThreadArena, NewBlocks) {
+  auto& arena = ThreadArena::Local();
+  arena.SetBlockSize(256);
+  EXPECT_EQ(arena.GetBlockCount(), 0);
+  {
+    ArenaScope scope;
+    scope.Open();
+    for (int i = 0; i < 10; ++i) {
+      EXPECT_NE(arena.Allocate(100, 8), nullptr);
+    }
+    EXPECT_EQ(arena.GetBlockCount(), 5);
+    EXPECT_THROW(arena.SetBlockSize(1024), std::runtime_error);
+  }
+  arena.SetBlockSize(16 * 1024);
+  EXPECT_EQ(arena.GetBlockCount(), 0);
+}
+
+TEST(ThreadArena, Allocator) {
+  auto& arena = ThreadArena::Local();
+  arena.ResetCounters();
+  {
+    HybridVector<int, 2, ArenaAllocator<int>> vec;
+    for (int i = 0; i < 10; ++i) {
+      vec.PushBack(std::move(i));
+    }
+    EXPECT_EQ(arena.GetArenaBytes(), 0);
+    EXPECT_LT(0, arena.GetHeapBytes());
+  }
+  arena.ResetCounters();
+  {
+    ArenaScope scope;
+    scope.Open();
+    HybridVector<int, 2, ArenaAllocator<int>> vec;
+    for (int i = 0; i < 10; ++i) {
+      vec.PushBack(std::move(i));
+    }
+    for (std::size_t i = 0; i < 10; ++i) {
+      EXPECT_EQ(vec[i], static_cast<int>(i));
+    }
+    EXPECT_LT(0, arena.GetArenaBytes());
+    EXPECT_EQ(arena.GetHeapBytes(), 0);
+  }
+}
+
+TEST(ThreadArena, Logging) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = UnlockedSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+  logger.GetCore()->SetArenaAllocation(true);
+  EXPECT_TRUE(logger.GetCore()->UsesArenaAllocation());
+
+  auto& arena = ThreadArena::Local();
+  arena.ResetCounters();
+  for (int i = 0; i < 3; ++i) {
+    LOG_SEV_TO(logger, Info) << "A string segment: "s << AnsiColor8Bit(i, formatting::AnsiForegroundColor::Red)
+                             << " 1 " << 2 << " 3 " << 4 << " 5 " << 6 << " 7 " << 8 << " 9 " << 10;
+  }
+  EXPECT_FALSE(arena.IsActive());
+  EXPECT_LT(0, arena.GetArenaBytes());
+  EXPECT_EQ(arena.GetHeapBytes(), 0);
+  EXPECT_EQ(stream->str(),
+            "A string segment: 0 1 2 3 4 5 6 7 8 9 10\n"
+            "A string segment: 1 1 2 3 4 5 6 7 8 9 10\n"
+            "A string segment: 2 1 2 3 4 5 6 7 8 9 10\n");
+}
+
+TEST(ThreadArena, AsyncSinkCopiesToHeap) {
+  auto stream = std::make_shared<std::ostringstream>();
+  auto sink = AsyncSink::From<OstreamSink>(stream);
+  sink->SetFormatter(MakeMsgFormatter("{}", formatting::MSG));
+  Logger logger(sink);
+  logger.GetCore()->SetArenaAllocation(true);
+
+  {
+    auto locked_sink = sink->GetLockedSink();
+    for (int i = 0; i < 3; ++i) {
+      LOG_SEV_TO(logger, Info) << "A string that is long enough to need an allocation "s << i;
+    }
+    // Reuse the arena memory before the records are formatted.
+    ArenaScope scope;
+    scope.Open();
+    auto& arena = ThreadArena::Local();
+    std::memset(arena.Allocate(1024, 8), 'x', 1024);
+  }
+  logger.Flush();
+  EXPECT_EQ(stream->str(),
+            "A string that is long enough to need an allocation 0\n"
+            "A string that is long enough to need an allocation 1\n"
+            "A string that is long enough to need an allocation 2\n");
+}
+
+}  // namespace Testing
@@ -0,0 +1,43 @@
+#pragma once
+
+// Helpers that several test files share.
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "Lightning/Lightning.h"
+
+namespace Testing {
+
+//! \brief Get a path in the temporary directory for a test's file, removing any file left by an earlier run.
+inline std::string TemporaryPath(const std::string& name, const std::string& extension = ".log") {
+  auto path = std::filesystem::temp_directory_path() / ("lightning-" + name + extension);
+  std::filesystem::remove(path);
+  return path.string();
+}
+
+//! \brief Create an empty directory for a test's log files.
+inline std::filesystem::path TemporaryDirectory(const std::string& name) {
+  auto path = std::filesystem::temp_directory_path() / ("lightning-" + name);
+  std::filesystem::remove_all(path);
+  std::filesystem::create_directories(path);
+  return path;
+}
+
+//! \brief Read a whole file into a string.
+inline std::string ReadFile(const std::filesystem::path& path) {
+  std::ifstream fin(path);
+  return {std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>()};
+}
+
+//! \brief A user type that is logged through format_logstream.
+struct Point {
+  int x, y;
+};
+
+inline void format_logstream(const Point& point, lightning::RefBundle& bundle) {
+  bundle << "(" << point.x << ", " << point.y << ")";
+}
+
+}  // namespace Testing